@@ -0,0 +1,269 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _BASEITEMLIST_H_
+#define _BASEITEMLIST_H_
+
+#include "baseio.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ITEMLIST_SSE2
+#include <emmintrin.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// Item container with a struct-of-arrays layout.
+/// Used by the db layer for inventory, cart and storages.
+/// Each field of struct item has its own array, so scanning for occupied
+/// slots only touches the nameid array and can be done 8 slots at a time.
+/// The arrays are padded to a multiple of 8 slots, the padding is always 0.
+/// The occupied slots are kept at the front ([0,count[) after assign/compact,
+/// slot[] keeps the index each of them has in the item array, so the
+/// tables can key the rows by it and scatter puts the items back in place.
+template<size_t SZ>
+class CItemList
+{
+public:
+	///////////////////////////////////////////////////////////////////////////
+	enum
+	{
+		SIZE = SZ,					///< number of usable slots
+		CAPACITY = (SZ + 7) & ~7	///< number of slots incl. padding
+	};
+
+	///////////////////////////////////////////////////////////////////////////
+	ushort nameid[CAPACITY];
+	short  amount[CAPACITY];
+	ushort equip[CAPACITY];
+	char   identify[CAPACITY];
+	char   refine[CAPACITY];
+	char   attribute[CAPACITY];
+	ushort card[4][CAPACITY];
+	ushort slot[CAPACITY];		///< index in the item array
+
+	/// number of slots in use
+	size_t count;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// constructor.
+	CItemList()
+	{
+		this->clear();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// empties all slots
+	void clear()
+	{
+		memset(this->nameid,    0, sizeof(this->nameid));
+		memset(this->amount,    0, sizeof(this->amount));
+		memset(this->equip,     0, sizeof(this->equip));
+		memset(this->identify,  0, sizeof(this->identify));
+		memset(this->refine,    0, sizeof(this->refine));
+		memset(this->attribute, 0, sizeof(this->attribute));
+		memset(this->card,      0, sizeof(this->card));
+		memset(this->slot,      0, sizeof(this->slot));
+		this->count = 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// returns a bitmask of the used slots [i,i+8[ (nameid!=0).
+	/// i must be a multiple of 8
+	uint32 occupied8(size_t i) const
+	{
+#if defined(ITEMLIST_SSE2)
+		const __m128i v = _mm_loadu_si128((const __m128i*)(this->nameid+i));
+		const __m128i m = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+		// one bit per slot, set for the empty ones
+		return ~(uint32)_mm_movemask_epi8(_mm_packs_epi16(m, m)) & 0xFF;
+#else
+		uint32 mask = 0;
+		size_t k;
+		for(k=0; k<8; ++k)
+			if( this->nameid[i+k] != 0 )
+				mask |= 1u<<k;
+		return mask;
+#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// counts the used slots
+	size_t occupied() const
+	{
+		size_t i, num=0;
+		for(i=0; i<CAPACITY; i+=8)
+		{
+			uint32 mask = this->occupied8(i);
+			for( ; mask; mask &= mask-1)
+				++num;
+		}
+		return num;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// moves all occupied slots to the front, keeping the order,
+	/// and zeros the rest.
+	void compact()
+	{
+		size_t i, pos=0;
+		for(i=0; i<CAPACITY; i+=8)
+		{
+			uint32 mask = this->occupied8(i);
+			if( mask == 0xFF && pos == i )
+			{	// whole block in place
+				pos += 8;
+				continue;
+			}
+			for( ; mask; mask &= mask-1)
+			{
+				const size_t k = i + this->lowbit(mask);
+				if( k != pos )
+					this->move(pos, k);
+				++pos;
+			}
+		}
+		this->zero(pos);
+		this->count = pos;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// reads an array of SZ items, only the occupied ones are taken.
+	void assign(const struct item* items)
+	{
+		size_t i, pos=0;
+		// gather the ids first so the occupancy scan can run on them
+		for(i=0; i<SZ; ++i)
+			this->nameid[i] = items[i].nameid;
+		for( ; i<CAPACITY; ++i)
+			this->nameid[i] = 0;
+
+		for(i=0; i<CAPACITY; i+=8)
+		{
+			uint32 mask = this->occupied8(i);
+			for( ; mask; mask &= mask-1)
+			{
+				const size_t k = i + this->lowbit(mask);
+				const struct item& it = items[k];
+				this->slot[pos]			= (ushort)k;
+				this->nameid[pos]		= it.nameid;
+				this->amount[pos]		= it.amount;
+				this->equip[pos]		= it.equip;
+				this->identify[pos]		= it.identify;
+				this->refine[pos]		= it.refine;
+				this->attribute[pos]	= it.attribute;
+				this->card[0][pos]		= it.card[0];
+				this->card[1][pos]		= it.card[1];
+				this->card[2][pos]		= it.card[2];
+				this->card[3][pos]		= it.card[3];
+				++pos;
+			}
+		}
+		this->zero(pos);
+		this->count = pos;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// writes all SZ slots to an array of items.
+	/// the items go back to their slots, the others are zero filled.
+	/// the slots have to be unique and below SZ, see fix_slots
+	void scatter(struct item* items) const
+	{
+		size_t i;
+		memset(items, 0, SZ*sizeof(struct item));
+		for(i=0; i<this->count && i<SZ; ++i)
+		{
+			struct item& it = items[this->slot[i]];
+			it.nameid		= this->nameid[i];
+			it.amount		= this->amount[i];
+			it.equip		= this->equip[i];
+			it.identify		= this->identify[i];
+			it.refine		= this->refine[i];
+			it.attribute	= this->attribute[i];
+			it.card[0]		= this->card[0][i];
+			it.card[1]		= this->card[1][i];
+			it.card[2]		= this->card[2][i];
+			it.card[3]		= this->card[3][i];
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// moves items with a slot out of range or already taken to free slots.
+	/// for lists read from tables with old or damaged slot numbers
+	void fix_slots()
+	{
+		bool used[SZ];
+		size_t i, next=0;
+		memset(used, 0, sizeof(used));
+		for(i=0; i<this->count; ++i)
+		{
+			if( this->slot[i] < SZ && !used[this->slot[i]] )
+				used[this->slot[i]] = true;
+			else
+				this->slot[i] = (ushort)SZ;
+		}
+		for(i=0; i<this->count; ++i)
+		{
+			if( this->slot[i] >= SZ )
+			{
+				while( used[next] )
+					++next;
+				used[next] = true;
+				this->slot[i] = (ushort)next;
+			}
+		}
+	}
+
+private:
+	///////////////////////////////////////////////////////////////////////////
+	/// index of the lowest set bit
+	static size_t lowbit(uint32 mask)
+	{
+		size_t k=0;
+		while( !(mask & 1) )
+		{
+			mask >>= 1;
+			++k;
+		}
+		return k;
+	}
+
+	/// moves slot src to slot dst and clears src
+	void move(size_t dst, size_t src)
+	{
+		this->nameid[dst]		= this->nameid[src];	this->nameid[src] = 0;
+		this->amount[dst]		= this->amount[src];	this->amount[src] = 0;
+		this->equip[dst]		= this->equip[src];		this->equip[src] = 0;
+		this->identify[dst]		= this->identify[src];	this->identify[src] = 0;
+		this->refine[dst]		= this->refine[src];	this->refine[src] = 0;
+		this->attribute[dst]	= this->attribute[src];	this->attribute[src] = 0;
+		this->card[0][dst]		= this->card[0][src];	this->card[0][src] = 0;
+		this->card[1][dst]		= this->card[1][src];	this->card[1][src] = 0;
+		this->card[2][dst]		= this->card[2][src];	this->card[2][src] = 0;
+		this->card[3][dst]		= this->card[3][src];	this->card[3][src] = 0;
+		this->slot[dst]			= this->slot[src];		this->slot[src] = 0;
+	}
+
+	/// zeros the slots [pos,CAPACITY[
+	void zero(size_t pos)
+	{
+		if( pos < CAPACITY )
+		{
+			const size_t n = CAPACITY-pos;
+			memset(this->nameid+pos,    0, n*sizeof(this->nameid[0]));
+			memset(this->amount+pos,    0, n*sizeof(this->amount[0]));
+			memset(this->equip+pos,     0, n*sizeof(this->equip[0]));
+			memset(this->identify+pos,  0, n*sizeof(this->identify[0]));
+			memset(this->refine+pos,    0, n*sizeof(this->refine[0]));
+			memset(this->attribute+pos, 0, n*sizeof(this->attribute[0]));
+			memset(this->card[0]+pos,   0, n*sizeof(this->card[0][0]));
+			memset(this->card[1]+pos,   0, n*sizeof(this->card[1][0]));
+			memset(this->card[2]+pos,   0, n*sizeof(this->card[2][0]));
+			memset(this->card[3]+pos,   0, n*sizeof(this->card[3][0]));
+			memset(this->slot+pos,      0, n*sizeof(this->slot[0]));
+		}
+	}
+};
+
+
+#endif//_BASEITEMLIST_H_
@@ -0,0 +1,2863 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "basekv.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// file layer.
+// on windows the view is a heap copy of the file that is kept up to date
+// by the writes, elsewhere it is a read-only shared mapping.
+#ifdef WIN32
+#define kv_open_file(p,f)	_open(p, f|_O_BINARY, _S_IREAD|_S_IWRITE)
+#define kv_close_file		_close
+#define kv_sync_file		_commit
+#define kv_truncate_file(f,l)	_chsize_s(f, (__int64)(l))
+#else
+#define kv_open_file(p,f)	::open(p, f, 0644)
+#define kv_close_file		::close
+#define kv_sync_file		::fsync
+#define kv_truncate_file(f,l)	::ftruncate(f, (off_t)(l))
+#endif
+
+/// write a buffer at an offset,
+/// the offsets are 64bit so the files can grow beyond 4GB
+static bool kv_write(int fd, uint64 pos, const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+#ifdef WIN32
+	if( _lseeki64(fd, (__int64)pos, SEEK_SET) < 0 )
+		return false;
+	while( len )
+	{
+		const int n = _write(fd, p, (unsigned int)len);
+		if( n <= 0 )
+			return false;
+		p += n; len -= n;
+	}
+#else
+	while( len )
+	{
+		const ssize_t n = ::pwrite(fd, p, len, (off_t)pos);
+		if( n <= 0 )
+			return false;
+		p += n; len -= n; pos += n;
+	}
+#endif
+	return true;
+}
+
+/// size of a file
+static uint64 kv_file_size(int fd)
+{
+#ifdef WIN32
+	const __int64 len = _lseeki64(fd, 0, SEEK_END);
+	return (len>0) ? (uint64)len : 0;
+#else
+	struct stat st;
+	return ( 0==fstat(fd, &st) ) ? (uint64)st.st_size : 0;
+#endif
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// record layout
+
+/// record header, the data follows padded to 8 bytes
+struct kv_head
+{
+	uint32	magic;
+	uchar	op;
+	uchar	ns;
+	ushort	pad;
+	uint32	key;
+	uint32	len;
+	uint32	crc;	///< crc32 of the header with crc=0 and the data
+	uint32	pad2;
+};
+#define KV_MAGIC	0x5652564B	// "KVRV"
+#define KV_PUT		1
+#define KV_DEL		2
+#define KV_EMPTY	(~((uint64)0))
+#define KV_DELETED	(~((uint64)0)-1)
+
+/// size of a record on disk
+static inline size_t kv_size(size_t len)
+{
+	return sizeof(kv_head) + ((len+7)&~((size_t)7));
+}
+
+/// crc32 (ieee 802.3)
+static uint32 kv_crc(uint32 crc, const void* data, size_t len)
+{
+	static uint32 table[256];
+	static bool init = false;
+	if( !init )
+	{
+		uint32 i, k, c;
+		for(i=0; i<256; ++i)
+		{
+			for(c=i, k=0; k<8; ++k)
+				c = (c&1) ? 0xEDB88320u ^ (c>>1) : (c>>1);
+			table[i] = c;
+		}
+		init = true;
+	}
+	const uchar* p = (const uchar*)data;
+	crc = ~crc;
+	while( len-- )
+		crc = table[(crc ^ *p++) & 0xFF] ^ (crc>>8);
+	return ~crc;
+}
+
+/// hash of an index key
+static inline size_t kv_hash(uint64 k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (size_t)k;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// record encoding.
+// the records are written field by field, a record starts with the number
+// of fields, numbers are varints (the signed ones zigzag coded), strings
+// and byte arrays are written with their length and arrays of numbers or
+// structs with their number of elements. fields missing in an older
+// record keep their defaults, the reads clip what does not fit.
+
+/// record buffer
+class CKVWriter
+{
+	char*	buf;
+	size_t	len;
+	size_t	cap;
+
+	CKVWriter(const CKVWriter&);
+	const CKVWriter& operator=(const CKVWriter&);
+public:
+	CKVWriter() : buf(NULL), len(0), cap(0)
+	{}
+	~CKVWriter()
+	{
+		if(buf) delete[] buf;
+	}
+	const char* data() const	{ return this->buf; }
+	size_t size() const			{ return this->len; }
+
+	void bytes(const void* p, size_t n)
+	{
+		if( this->len + n > this->cap )
+		{
+			size_t c = this->cap ? this->cap : 1024;
+			while( c < this->len + n )
+				c *= 2;
+			char* b = new char[c];
+			if( this->buf )
+			{
+				memcpy(b, this->buf, this->len);
+				delete[] this->buf;
+			}
+			this->buf = b;
+			this->cap = c;
+		}
+		memcpy(this->buf+this->len, p, n);
+		this->len += n;
+	}
+	void varint(uint64 v)
+	{
+		uchar tmp[10];
+		size_t n = 0;
+		for( ; v >= 0x80; v >>= 7)
+			tmp[n++] = (uchar)(v | 0x80);
+		tmp[n++] = (uchar)v;
+		this->bytes(tmp, n);
+	}
+	template<typename T>
+	void number(T v)
+	{
+		if( (T)(-1) < (T)0 )
+		{	// zigzag
+			const int64 i = (int64)v;
+			this->varint( ((uint64)i << 1) ^ (uint64)(i >> 63) );
+		}
+		else
+			this->varint( (uint64)v );
+	}
+	void string(const char* str, size_t max)
+	{
+		size_t n = 0;
+		while( n < max && str[n] )
+			++n;
+		this->varint(n);
+		this->bytes(str, n);
+	}
+};
+
+/// record reader, reads past the end return zeros and clear ok
+class CKVReader
+{
+	const uchar*	ptr;
+	const uchar*	end;
+public:
+	bool			ok;
+
+	CKVReader(const char* data, size_t len)
+		: ptr((const uchar*)data), end((const uchar*)data+len), ok(true)
+	{}
+	bool empty() const	{ return this->ptr >= this->end; }
+
+	uint64 varint()
+	{
+		uint64 v = 0;
+		size_t shift;
+		for(shift=0; shift<64; shift+=7)
+		{
+			if( this->ptr >= this->end )
+			{
+				this->ok = false;
+				return 0;
+			}
+			const uchar c = *this->ptr++;
+			v |= (uint64)(c & 0x7F) << shift;
+			if( !(c & 0x80) )
+				return v;
+		}
+		this->ok = false;
+		return v;
+	}
+	template<typename T>
+	T number()
+	{
+		const uint64 v = this->varint();
+		if( (T)(-1) < (T)0 )
+			return (T)(int64)((v >> 1) ^ (0-(v & 1)));
+		return (T)v;
+	}
+	/// reads a string into a buffer of max bytes, always terminated
+	void string(char* str, size_t max)
+	{
+		const size_t n = this->length();
+		const size_t k = (n<max) ? n : max-1;
+		memcpy(str, this->ptr, k);
+		str[k] = 0;
+		this->ptr += n;
+	}
+	/// reads bytes into a buffer of max bytes, the rest is zeroed
+	void bytes(void* p, size_t max)
+	{
+		const size_t n = this->length();
+		const size_t k = (n<max) ? n : max;
+		memcpy(p, this->ptr, k);
+		memset((char*)p+k, 0, max-k);
+		this->ptr += n;
+	}
+private:
+	size_t length()
+	{
+		const uint64 n = this->varint();
+		if( n > (uint64)(this->end-this->ptr) )
+		{
+			this->ok = false;
+			this->ptr = this->end;
+			return 0;
+		}
+		return (size_t)n;
+	}
+};
+
+/// default constructed object of a struct,
+/// the field descriptors take the offsets from it
+template<typename S>
+struct CKVProbe
+{
+	static const char* base()
+	{
+		return reinterpret_cast<const char*>(&object());
+	}
+	static S& object()
+	{
+		static S s;
+		return s;
+	}
+};
+
+template<typename S> class CKVFieldMap;
+
+/// field codec, selected from the field type.
+/// arg is the field map of the elements for arrays of structs
+template<typename T>
+struct CKVCodec
+{
+	static void encode(CKVWriter& w, const void* field, const void*)
+	{
+		w.number(*static_cast<const T*>(field));
+	}
+	static void decode(CKVReader& r, void* field, const void*)
+	{
+		*static_cast<T*>(field) = r.template number<T>();
+	}
+};
+template<size_t N>
+struct CKVCodec<char[N]>
+{
+	static void encode(CKVWriter& w, const void* field, const void*)
+	{
+		w.string(static_cast<const char*>(field), N);
+	}
+	static void decode(CKVReader& r, void* field, const void*)
+	{
+		r.string(static_cast<char*>(field), N);
+	}
+};
+template<typename T, size_t N>
+struct CKVCodec<T[N]>
+{
+	static void encode(CKVWriter& w, const void* field, const void*)
+	{
+		const T* a = static_cast<const T*>(field);
+		size_t i;
+		w.varint(N);
+		for(i=0; i<N; ++i)
+			w.number(a[i]);
+	}
+	static void decode(CKVReader& r, void* field, const void*)
+	{
+		T* a = static_cast<T*>(field);
+		const size_t n = (size_t)r.varint();
+		size_t i;
+		for(i=0; i<n && r.ok; ++i)
+		{
+			const T v = r.template number<T>();
+			if( i<N ) a[i] = v;
+		}
+		for( ; i<N; ++i)
+			a[i] = 0;
+	}
+};
+template<>
+struct CKVCodec<basics::ipaddress>
+{
+	static void encode(CKVWriter& w, const void* field, const void*)
+	{
+		w.number( (uint32)*static_cast<const basics::ipaddress*>(field) );
+	}
+	static void decode(CKVReader& r, void* field, const void*)
+	{
+		*static_cast<basics::ipaddress*>(field) = basics::ipaddress( r.number<uint32>() );
+	}
+};
+/// arrays of structs, each element is a record of its own
+template<typename T, size_t N>
+struct CKVListCodec
+{
+	static void encode(CKVWriter& w, const void* field, const void* arg)
+	{
+		const CKVFieldMap<T>& map = *static_cast<const CKVFieldMap<T>*>(arg);
+		const T* a = static_cast<const T*>(field);
+		size_t n = N, i;
+		while( n && map.empty(a[n-1]) )
+			--n;
+		w.varint(n);
+		for(i=0; i<n; ++i)
+			map.encode(w, a[i]);
+	}
+	static void decode(CKVReader& r, void* field, const void* arg)
+	{
+		const CKVFieldMap<T>& map = *static_cast<const CKVFieldMap<T>*>(arg);
+		T* a = static_cast<T*>(field);
+		const size_t n = (size_t)r.varint();
+		size_t i;
+		for(i=0; i<n && r.ok; ++i)
+		{
+			T tmp;
+			map.decode(r, (i<N) ? a[i] : tmp);
+		}
+		for( ; i<N; ++i)
+			a[i] = CKVProbe<T>::object();
+	}
+};
+/// raw bytes, trailing zeros are not written
+struct CKVBytesCodec
+{
+	template<typename T>
+	static void encode(CKVWriter& w, const void* field, const void*)
+	{
+		const char* p = static_cast<const char*>(field);
+		size_t n = sizeof(T);
+		while( n && !p[n-1] )
+			--n;
+		w.varint(n);
+		w.bytes(p, n);
+	}
+	template<typename T>
+	static void decode(CKVReader& r, void* field, const void*)
+	{
+		r.bytes(field, sizeof(T));
+	}
+};
+
+/// field descriptor.
+/// binds a field of S to its codec, the codec is selected from the type of
+/// the field or given explicitly. arrays of structs take a function
+/// returning the field map of the element, fields of a member struct are
+/// bound with two member pointers.
+template<typename S>
+struct CKVField
+{
+	typedef void (*encoder)(CKVWriter& w, const void* field, const void* arg);
+	typedef void (*decoder)(CKVReader& r, void* field, const void* arg);
+
+	size_t		offset;
+	size_t		size;
+	encoder		encode;
+	decoder		decode;
+	const void*	arg;
+
+	template<typename T, typename B>
+	CKVField(T B::*member)
+		: offset( reinterpret_cast<const char*>(&(CKVProbe<S>::object().*member)) - CKVProbe<S>::base() )
+		, size(sizeof(T))
+		, encode(&CKVCodec<T>::encode)
+		, decode(&CKVCodec<T>::decode)
+		, arg(NULL)
+	{}
+	template<typename T, typename B, typename C>
+	CKVField(T B::*member, const C&)
+		: offset( reinterpret_cast<const char*>(&(CKVProbe<S>::object().*member)) - CKVProbe<S>::base() )
+		, size(sizeof(T))
+		, encode(&C::template encode<T>)
+		, decode(&C::template decode<T>)
+		, arg(NULL)
+	{}
+	template<typename T, size_t N, typename B>
+	CKVField(T (B::*member)[N], const CKVFieldMap<T>& (*fields)(const T*))
+		: offset( reinterpret_cast<const char*>(&(CKVProbe<S>::object().*member)) - CKVProbe<S>::base() )
+		, size(sizeof(T)*N)
+		, encode(&CKVListCodec<T,N>::encode)
+		, decode(&CKVListCodec<T,N>::decode)
+		, arg(&fields(NULL))
+	{}
+	template<typename M, typename B, typename T, typename BM>
+	CKVField(M B::*outer, T BM::*inner)
+		: offset( reinterpret_cast<const char*>(&((CKVProbe<S>::object().*outer).*inner)) - CKVProbe<S>::base() )
+		, size(sizeof(T))
+		, encode(&CKVCodec<T>::encode)
+		, decode(&CKVCodec<T>::decode)
+		, arg(NULL)
+	{}
+};
+
+/// field map, writes and reads a record of S.
+/// new fields go to the end, so older records can still be read
+template<typename S>
+class CKVFieldMap
+{
+	const CKVField<S>*	fields;
+	size_t				cnt;
+public:
+	template<size_t N>
+	CKVFieldMap(const CKVField<S> (&f)[N]) : fields(f), cnt(N)
+	{}
+
+	void encode(CKVWriter& w, const S& s) const
+	{
+		const char* base = reinterpret_cast<const char*>(&s);
+		size_t i;
+		w.varint(this->cnt);
+		for(i=0; i<this->cnt; ++i)
+			this->fields[i].encode(w, base+this->fields[i].offset, this->fields[i].arg);
+	}
+	/// reads the first max fields of a record, the others keep their values
+	void decode(CKVReader& r, S& s, size_t max=~((size_t)0)) const
+	{
+		char* base = reinterpret_cast<char*>(&s);
+		const size_t n = (size_t)r.varint();
+		size_t i;
+		if( n > this->cnt )
+		{	// written by a newer version
+			r.ok = false;
+			return;
+		}
+		for(i=0; i<n && r.ok; ++i)
+		{
+			if( i >= max )
+				return;
+			this->fields[i].decode(r, base+this->fields[i].offset, this->fields[i].arg);
+		}
+		for( ; i<this->cnt && i<max; ++i)
+		{	// not in the record, take the default
+			const char* def = CKVProbe<S>::base()+this->fields[i].offset;
+			memcpy(base+this->fields[i].offset, def, this->fields[i].size);
+		}
+	}
+	/// true when all fields have their default value
+	bool empty(const S& s) const
+	{
+		const char* base = reinterpret_cast<const char*>(&s);
+		size_t i;
+		for(i=0; i<this->cnt; ++i)
+		{
+			const size_t o = this->fields[i].offset;
+			if( 0!=memcmp(base+o, CKVProbe<S>::base()+o, this->fields[i].size) )
+				return false;
+		}
+		return true;
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// store
+basics::CParam<uint32> CKVStore::kv_sync("kv_sync", 64);
+basics::CParam<uint32> CKVStore::kv_compact_min("kv_compact_min", 16*1024*1024);
+basics::CParam<uint32> CKVStore::kv_compact_step("kv_compact_step", 16);
+
+CKVStore::CKVStore()
+	: fd(-1), base(NULL), base_len(0), file_len(0),
+	  index(NULL), index_cap(0), index_used(0), index_dead(0),
+	  live_bytes(0), dead_bytes(0), unsynced(0),
+	  cmp_fd(-1), cmp_slot(0), cmp_len(0),
+	  memory(false), mem_cap(0)
+{
+	this->path[0] = 0;
+	memset(this->ns_count, 0, sizeof(this->ns_count));
+}
+
+CKVStore::~CKVStore()
+{
+	this->close();
+}
+
+bool CKVStore::open(const char* p)
+{
+	this->close();
+	if( !p || !*p )
+	{
+		safestrcpy(this->path, sizeof(this->path), "(memory)");
+		this->memory = true;
+		return this->rehash(1024);
+	}
+	safestrcpy(this->path, sizeof(this->path), p);
+
+	// an unfinished compaction is useless, the log itself is complete
+	char tmp[sizeof(this->path)+16];
+	snprintf(tmp, sizeof(tmp), "%s.compact", this->path);
+	::remove(tmp);
+
+	this->fd = kv_open_file(this->path, O_RDWR|O_CREAT);
+	if( this->fd < 0 )
+	{
+		ShowError("kv: cannot open '%s'\n", this->path);
+		return false;
+	}
+	this->file_len = kv_file_size(this->fd);
+	return this->rehash(1024) && this->scan();
+}
+
+void CKVStore::close()
+{
+	if( this->cmp_fd >= 0 )
+	{	// not finished, it will be started again later
+		char tmp[sizeof(this->path)+16];
+		kv_close_file(this->cmp_fd);
+		this->cmp_fd = -1;
+		snprintf(tmp, sizeof(tmp), "%s.compact", this->path);
+		::remove(tmp);
+	}
+	if( this->memory )
+	{
+		if( this->base ) delete[] this->base;
+		this->base = NULL;
+		this->base_len = this->mem_cap = 0;
+		this->memory = false;
+	}
+	if( this->fd >= 0 )
+	{
+		this->sync();
+		this->unmap();
+		kv_close_file(this->fd);
+		this->fd = -1;
+	}
+	if( this->index )
+	{
+		delete[] this->index;
+		this->index = NULL;
+	}
+	this->index_cap = this->index_used = this->index_dead = 0;
+	this->file_len = this->live_bytes = this->dead_bytes = 0;
+	memset(this->ns_count, 0, sizeof(this->ns_count));
+}
+
+bool CKVStore::map(size_t len)
+{
+	if( len <= this->base_len || this->memory )
+		return len <= this->base_len;
+#ifdef WIN32
+	// first use, load the file, the writes keep it current
+	char* img = new char[(size_t)this->file_len+1];
+	size_t got = 0;
+	_lseeki64(this->fd, 0, SEEK_SET);
+	while( got < this->file_len )
+	{
+		const int n = _read(this->fd, img+got, (unsigned int)(this->file_len-got));
+		if( n <= 0 )
+			break;
+		got += n;
+	}
+	if( this->base ) delete[] this->base;
+	this->base = img;
+	this->base_len = got;
+	return got >= len;
+#else
+	this->unmap();
+	if( this->file_len != (size_t)this->file_len )
+	{	// beyond the address space
+		ShowError("kv: '%s' is too large to be mapped\n", this->path);
+		return false;
+	}
+	void* p = mmap(NULL, (size_t)this->file_len, PROT_READ, MAP_SHARED, this->fd, 0);
+	if( p == MAP_FAILED )
+	{
+		ShowError("kv: cannot map '%s'\n", this->path);
+		return false;
+	}
+	this->base = (char*)p;
+	this->base_len = (size_t)this->file_len;
+	return true;
+#endif
+}
+
+void CKVStore::unmap()
+{
+	if( this->base )
+	{
+#ifdef WIN32
+		delete[] this->base;
+#else
+		munmap(this->base, this->base_len);
+#endif
+		this->base = NULL;
+		this->base_len = 0;
+	}
+}
+
+bool CKVStore::append(int to, uint64& end, uchar op, uchar ns, uint32 key, const void* data, size_t len)
+{
+	static const char zero[8] = {0,0,0,0,0,0,0,0};
+	kv_head head;
+	head.magic = KV_MAGIC;
+	head.op    = op;
+	head.ns    = ns;
+	head.pad   = 0;
+	head.key   = key;
+	head.len   = len;
+	head.crc   = 0;
+	head.pad2  = 0;
+	head.crc   = kv_crc(kv_crc(0, &head, sizeof(head)), data, len);
+
+	const size_t total = kv_size(len);
+	if( this->memory )
+	{
+		const size_t pos = (size_t)end;
+		if( pos + total > this->mem_cap )
+		{
+			size_t cap = this->mem_cap ? this->mem_cap : 65536;
+			while( cap < pos + total )
+				cap *= 2;
+			char* buf = new char[cap];
+			if( this->base )
+			{
+				memcpy(buf, this->base, pos);
+				delete[] this->base;
+			}
+			this->base = buf;
+			this->mem_cap = cap;
+		}
+		memcpy(this->base+pos, &head, sizeof(head));
+		memcpy(this->base+pos+sizeof(head), data, len);
+		memset(this->base+pos+sizeof(head)+len, 0, total-sizeof(head)-len);
+		end += total;
+		this->base_len = (size_t)end;
+		return true;
+	}
+	if( !kv_write(to, end, &head, sizeof(head)) ||
+		!kv_write(to, end+sizeof(head), data, len) ||
+		!kv_write(to, end+sizeof(head)+len, zero, total-sizeof(head)-len) )
+	{
+		ShowError("kv: write to '%s' failed\n", this->path);
+		kv_truncate_file(to, end);
+		return false;
+	}
+#ifdef WIN32
+	if( to == this->fd && this->base )
+	{	// keep the view current
+		const size_t pos = (size_t)end;
+		char* img = new char[pos+total];
+		memcpy(img, this->base, this->base_len);
+		memcpy(img+pos, &head, sizeof(head));
+		memcpy(img+pos+sizeof(head), data, len);
+		memset(img+pos+sizeof(head)+len, 0, total-sizeof(head)-len);
+		delete[] this->base;
+		this->base = img;
+		this->base_len = pos+total;
+	}
+#endif
+	end += total;
+	return true;
+}
+
+bool CKVStore::scan()
+{
+	uint64 pos = 0;
+	if( this->file_len && !this->map((size_t)this->file_len) )
+		return false;
+
+	while( pos + sizeof(kv_head) <= this->file_len )
+	{
+		kv_head head;
+		memcpy(&head, this->base+pos, sizeof(head));
+		const size_t total = kv_size(head.len);
+		if( head.magic != KV_MAGIC || head.ns >= KV_MAX || pos + total > this->file_len )
+			break;
+		const uint32 crc = head.crc;
+		head.crc = 0;
+		if( crc != kv_crc(kv_crc(0, &head, sizeof(head)), this->base+pos+sizeof(head), head.len) )
+			break;
+
+		const uint64 k = ((uint64)head.ns<<32) | head.key;
+		entry* e = this->find(k);
+		if( e )
+		{	// older version
+			this->dead_bytes += kv_size(e->len);
+			this->live_bytes -= kv_size(e->len);
+		}
+		if( head.op == KV_PUT )
+		{
+			if( !e )
+			{
+				e = this->insert(k);
+				++this->ns_count[head.ns];
+			}
+			e->pos = pos;
+			e->len = head.len;
+			this->live_bytes += total;
+		}
+		else
+		{
+			if( e )
+			{
+				this->erase(e);
+				--this->ns_count[head.ns];
+			}
+			this->dead_bytes += total;
+		}
+		pos += total;
+	}
+	if( pos < this->file_len )
+	{	// torn write at the end
+		ShowWarning("kv: '%s' has a damaged tail at %lu, dropping %lu bytes\n",
+			this->path, (ulong)pos, (ulong)(this->file_len-pos));
+		this->unmap();
+		kv_truncate_file(this->fd, pos);
+		this->file_len = pos;
+	}
+	ShowInfo("kv: '%s' loaded, %lu records, %lu bytes\n", this->path, (ulong)this->index_used, (ulong)this->file_len);
+	return true;
+}
+
+CKVStore::entry* CKVStore::find(uint64 k) const
+{
+	if( !this->index_cap )
+		return NULL;
+	const size_t mask = this->index_cap-1;
+	size_t i = kv_hash(k) & mask;
+	for(;;)
+	{
+		entry& e = this->index[i];
+		if( e.key == k )
+			return &e;
+		if( e.key == KV_EMPTY )
+			return NULL;
+		i = (i+1) & mask;
+	}
+}
+
+CKVStore::entry* CKVStore::insert(uint64 k)
+{
+	if( (this->index_used+this->index_dead+1)*4 > this->index_cap*3 )
+	{	// grow when mostly live, otherwise just clear the deleted slots
+		const size_t cap = ( (this->index_used+1)*2 > this->index_cap ) ? this->index_cap*2 : this->index_cap;
+		this->rehash(cap);
+	}
+	const size_t mask = this->index_cap-1;
+	size_t i = kv_hash(k) & mask;
+	while( this->index[i].key != KV_EMPTY && this->index[i].key != KV_DELETED )
+		i = (i+1) & mask;
+	if( this->index[i].key == KV_DELETED )
+		--this->index_dead;
+	this->index[i].key = k;
+	++this->index_used;
+	return &this->index[i];
+}
+
+void CKVStore::erase(entry* e)
+{
+	e->key = KV_DELETED;
+	--this->index_used;
+	++this->index_dead;
+}
+
+bool CKVStore::rehash(size_t cap)
+{
+	entry* old = this->index;
+	const size_t oldcap = this->index_cap;
+	size_t i;
+
+	this->index = new entry[cap];
+	this->index_cap = cap;
+	this->index_used = this->index_dead = 0;
+	for(i=0; i<cap; ++i)
+		this->index[i].key = KV_EMPTY;
+	if( old )
+	{
+		for(i=0; i<oldcap; ++i)
+		{
+			if( old[i].key != KV_EMPTY && old[i].key != KV_DELETED )
+			{
+				entry* e = this->insert(old[i].key);
+				e->pos = old[i].pos;
+				e->len = old[i].len;
+			}
+		}
+		delete[] old;
+	}
+	// slot order changed, a running compaction copies everything again
+	this->cmp_slot = 0;
+	return true;
+}
+
+const char* CKVStore::get(uchar ns, uint32 key, size_t& len)
+{
+	const entry* e = this->find(((uint64)ns<<32) | key);
+	if( !e || !this->map((size_t)(e->pos + kv_size(e->len))) )
+		return NULL;
+	len = e->len;
+	return this->base + e->pos + sizeof(kv_head);
+}
+
+bool CKVStore::exists(uchar ns, uint32 key) const
+{
+	return NULL != this->find(((uint64)ns<<32) | key);
+}
+
+bool CKVStore::put(uchar ns, uint32 key, const void* data, size_t len)
+{
+	if( !this->is_open() || ns >= KV_MAX )
+		return false;
+	const uint64 pos = this->file_len;
+	if( !this->append(this->fd, this->file_len, KV_PUT, ns, key, data, len) )
+		return false;
+	if( this->cmp_fd >= 0 && !this->append(this->cmp_fd, this->cmp_len, KV_PUT, ns, key, data, len) )
+		this->compact_abort();
+
+	const uint64 k = ((uint64)ns<<32) | key;
+	entry* e = this->find(k);
+	if( e )
+	{
+		this->dead_bytes += kv_size(e->len);
+		this->live_bytes -= kv_size(e->len);
+	}
+	else
+	{
+		e = this->insert(k);
+		++this->ns_count[ns];
+	}
+	e->pos = pos;
+	e->len = len;
+	this->live_bytes += kv_size(len);
+
+	if( kv_sync && ++this->unsynced >= kv_sync )
+		this->sync();
+	this->compact();
+	return true;
+}
+
+bool CKVStore::remove(uchar ns, uint32 key)
+{
+	const uint64 k = ((uint64)ns<<32) | key;
+	entry* e = this->find(k);
+	if( !e )
+		return false;
+	if( !this->append(this->fd, this->file_len, KV_DEL, ns, key, NULL, 0) )
+		return false;
+	if( this->cmp_fd >= 0 && !this->append(this->cmp_fd, this->cmp_len, KV_DEL, ns, key, NULL, 0) )
+		this->compact_abort();
+
+	this->dead_bytes += kv_size(e->len) + kv_size(0);
+	this->live_bytes -= kv_size(e->len);
+	this->erase(e);
+	--this->ns_count[ns];
+
+	if( kv_sync && ++this->unsynced >= kv_sync )
+		this->sync();
+	this->compact();
+	return true;
+}
+
+bool CKVStore::next(uchar ns, size_t& cursor, uint32& key) const
+{
+	for( ; cursor < this->index_cap; ++cursor)
+	{
+		const uint64 k = this->index[cursor].key;
+		if( k != KV_EMPTY && k != KV_DELETED && (k>>32) == ns )
+		{
+			key = (uint32)k;
+			++cursor;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CKVStore::at(uchar ns, size_t i, uint32& key) const
+{
+	size_t cursor = 0;
+	while( this->next(ns, cursor, key) )
+	{
+		if( 0 == i-- )
+			return true;
+	}
+	return false;
+}
+
+uint32 CKVStore::next_id(uchar ns, uint32 first)
+{
+	uint32 id = first;
+	size_t len;
+	const char* last = this->get(KV_META, ns, len);
+	if( last && len == sizeof(uint32) )
+	{
+		uint32 prev;
+		memcpy(&prev, last, sizeof(prev));
+		if( prev >= id )
+			id = prev+1;
+	}
+	while( this->exists(ns, id) )
+		++id;
+	this->put(KV_META, ns, &id, sizeof(id));
+	return id;
+}
+
+bool CKVStore::sync()
+{
+	this->unsynced = 0;
+	if( this->memory )
+		return true;
+	if( this->cmp_fd >= 0 )
+		kv_sync_file(this->cmp_fd);
+	return this->fd >= 0 && 0 == kv_sync_file(this->fd);
+}
+
+bool CKVStore::snapshot(const char* target)
+{
+	if( !this->is_open() || (this->file_len && !this->map((size_t)this->file_len)) )
+		return false;
+	const int to = kv_open_file(target, O_RDWR|O_CREAT|O_TRUNC);
+	if( to < 0 )
+	{
+		ShowError("kv: cannot create snapshot '%s'\n", target);
+		return false;
+	}
+	const bool ok = kv_write(to, 0, this->base, this->file_len) && 0 == kv_sync_file(to);
+	kv_close_file(to);
+	if( ok )
+		ShowInfo("kv: snapshot of '%s' written to '%s'\n", this->path, target);
+	return ok;
+}
+
+void CKVStore::compact()
+{
+	if( this->memory )
+	{
+		if( this->file_len >= 65536 && this->dead_bytes > this->live_bytes )
+			this->compact_memory();
+		return;
+	}
+	if( this->cmp_fd < 0 )
+	{
+		if( this->file_len >= kv_compact_min && this->dead_bytes > this->live_bytes )
+			this->compact_start();
+		return;
+	}
+
+	size_t n = kv_compact_step;
+	for( ; n && this->cmp_slot < this->index_cap; ++this->cmp_slot)
+	{
+		const entry& e = this->index[this->cmp_slot];
+		if( e.key == KV_EMPTY || e.key == KV_DELETED )
+			continue;
+		if( !this->map((size_t)(e.pos + kv_size(e.len))) ||
+			!this->append(this->cmp_fd, this->cmp_len, KV_PUT, (uchar)(e.key>>32), (uint32)e.key, this->base+e.pos+sizeof(kv_head), e.len) )
+		{
+			this->compact_abort();
+			return;
+		}
+		--n;
+	}
+	if( this->cmp_slot >= this->index_cap )
+		this->compact_finish();
+}
+
+bool CKVStore::compact_start()
+{
+	char tmp[sizeof(this->path)+16];
+	snprintf(tmp, sizeof(tmp), "%s.compact", this->path);
+	this->cmp_fd = kv_open_file(tmp, O_RDWR|O_CREAT|O_TRUNC);
+	if( this->cmp_fd < 0 )
+	{
+		ShowError("kv: cannot create '%s'\n", tmp);
+		return false;
+	}
+	this->cmp_slot = 0;
+	this->cmp_len = 0;
+	ShowInfo("kv: compacting '%s' (%lu live, %lu dead bytes)\n", this->path, (ulong)this->live_bytes, (ulong)this->dead_bytes);
+	return true;
+}
+
+void CKVStore::compact_abort()
+{	// give up, the next write starts over
+	ShowError("kv: compaction of '%s' failed\n", this->path);
+	char tmp[sizeof(this->path)+16];
+	kv_close_file(this->cmp_fd);
+	this->cmp_fd = -1;
+	snprintf(tmp, sizeof(tmp), "%s.compact", this->path);
+	::remove(tmp);
+}
+
+bool CKVStore::compact_finish()
+{
+	char tmp[sizeof(this->path)+16];
+	char name[sizeof(this->path)];
+	snprintf(tmp, sizeof(tmp), "%s.compact", this->path);
+	safestrcpy(name, sizeof(name), this->path);
+
+	kv_sync_file(this->cmp_fd);
+	kv_close_file(this->cmp_fd);
+	this->cmp_fd = -1;
+
+	// swap the files and load the compacted one
+	this->sync();
+	this->unmap();
+	kv_close_file(this->fd);
+	this->fd = -1;
+#ifdef WIN32
+	::remove(name);
+#endif
+	if( 0 != ::rename(tmp, name) )
+		ShowError("kv: cannot replace '%s' with its compacted version\n", name);
+	return this->open(name);
+}
+
+
+void CKVStore::compact_memory()
+{	// copy the live records to a fresh buffer
+	const size_t cap = this->live_bytes ? (size_t)this->live_bytes*2 : 65536;
+	char* buf = new char[cap];
+	size_t i, end = 0;
+	for(i=0; i<this->index_cap; ++i)
+	{
+		entry& e = this->index[i];
+		if( e.key == KV_EMPTY || e.key == KV_DELETED )
+			continue;
+		const size_t total = kv_size(e.len);
+		memcpy(buf+end, this->base+e.pos, total);
+		e.pos = end;
+		end += total;
+	}
+	delete[] this->base;
+	this->base = buf;
+	this->base_len = this->file_len = end;
+	this->mem_cap = cap;
+	this->dead_bytes = 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// name index
+void CKVNameIndex::clear()
+{
+	if( this->table )
+		delete[] this->table;
+	this->table = NULL;
+	this->cap = this->used = 0;
+}
+
+uint32 CKVNameIndex::hash(const char* name) const
+{	// fnv-1a
+	uint32 h = 2166136261u;
+	for( ; *name; ++name)
+	{
+		const uchar c = (uchar)*name;
+		h = (h ^ ((this->nocase && c>='A' && c<='Z') ? c+('a'-'A') : c)) * 16777619u;
+	}
+	return h;
+}
+
+bool CKVNameIndex::equal(const char* a, const char* b) const
+{
+	if( !this->nocase )
+		return 0==strcmp(a, b);
+	for( ; *a && *b; ++a, ++b)
+	{
+		const uchar x = (uchar)*a, y = (uchar)*b;
+		if( x != y && ((x|0x20) != (y|0x20) || (x|0x20) < 'a' || (x|0x20) > 'z') )
+			return false;
+	}
+	return *a == *b;
+}
+
+bool CKVNameIndex::grow()
+{
+	entry* old = this->table;
+	const size_t oldcap = this->cap;
+	size_t i;
+	this->cap = oldcap ? oldcap*2 : 256;
+	this->table = new entry[this->cap];
+	this->used = 0;
+	for(i=0; i<this->cap; ++i)
+		this->table[i].key = 0;
+	if( old )
+	{
+		for(i=0; i<oldcap; ++i)
+		{
+			if( old[i].key )
+				this->insert(old[i].name, old[i].key);
+		}
+		delete[] old;
+	}
+	return true;
+}
+
+uint32 CKVNameIndex::find(const char* name) const
+{
+	if( !this->cap || !name )
+		return 0;
+	const uint32 h = this->hash(name);
+	size_t i = h & (this->cap-1);
+	for( ; this->table[i].key; i = (i+1) & (this->cap-1))
+	{
+		if( this->table[i].hash == h && this->equal(this->table[i].name, name) )
+			return this->table[i].key;
+	}
+	return 0;
+}
+
+bool CKVNameIndex::insert(const char* name, uint32 key)
+{
+	if( !name || !key || this->find(name) )
+		return false;
+	if( (this->used+1)*2 > this->cap )
+		this->grow();
+	const uint32 h = this->hash(name);
+	size_t i = h & (this->cap-1);
+	while( this->table[i].key )
+		i = (i+1) & (this->cap-1);
+	this->table[i].hash = h;
+	this->table[i].key  = key;
+	safestrcpy(this->table[i].name, sizeof(this->table[i].name), name);
+	++this->used;
+	return true;
+}
+
+bool CKVNameIndex::remove(const char* name)
+{
+	if( !this->cap || !name )
+		return false;
+	const uint32 h = this->hash(name);
+	const size_t mask = this->cap-1;
+	size_t i = h & mask;
+	for( ; this->table[i].key; i = (i+1) & mask)
+	{
+		if( this->table[i].hash == h && this->equal(this->table[i].name, name) )
+		{	// backward shift, no deleted markers needed
+			size_t k = i;
+			this->table[i].key = 0;
+			--this->used;
+			for(k = (i+1) & mask; this->table[k].key; k = (k+1) & mask)
+			{
+				const size_t home = this->table[k].hash & mask;
+				// move k to i when its home is not in ]i,k]
+				if( (i<k) ? (home<=i || home>k) : (home<=i && home>k) )
+				{
+					this->table[i] = this->table[k];
+					this->table[k].key = 0;
+					i = k;
+				}
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// owner index
+void CKVOwnerIndex::clear()
+{
+	if( this->table )
+	{
+		size_t i;
+		for(i=0; i<this->cap; ++i)
+		{
+			if( this->table[i].keys )
+				delete[] this->table[i].keys;
+		}
+		delete[] this->table;
+	}
+	this->table = NULL;
+	this->cap = this->used = 0;
+}
+
+CKVOwnerIndex::entry* CKVOwnerIndex::lookup(uint32 owner) const
+{	// the slot of the owner or the free slot it would go to
+	const size_t mask = this->cap-1;
+	size_t i = kv_hash(owner) & mask;
+	while( this->table[i].owner && this->table[i].owner != owner )
+		i = (i+1) & mask;
+	return &this->table[i];
+}
+
+bool CKVOwnerIndex::grow()
+{
+	entry* old = this->table;
+	const size_t oldcap = this->cap;
+	size_t i;
+	this->cap = oldcap ? oldcap*2 : 256;
+	this->table = new entry[this->cap];
+	for(i=0; i<this->cap; ++i)
+	{
+		this->table[i].owner = 0;
+		this->table[i].cnt = this->table[i].cap = 0;
+		this->table[i].keys = NULL;
+	}
+	if( old )
+	{
+		for(i=0; i<oldcap; ++i)
+		{
+			if( old[i].owner )
+				*this->lookup(old[i].owner) = old[i];
+		}
+		delete[] old;
+	}
+	return true;
+}
+
+const uint32* CKVOwnerIndex::find(uint32 owner, size_t& cnt) const
+{
+	cnt = 0;
+	if( !this->cap || !owner )
+		return NULL;
+	const entry* e = this->lookup(owner);
+	if( !e->owner || !e->cnt )
+		return NULL;
+	cnt = e->cnt;
+	return e->keys;
+}
+
+bool CKVOwnerIndex::insert(uint32 owner, uint32 key)
+{
+	if( !owner )
+		return false;
+	if( (this->used+1)*2 > this->cap )
+		this->grow();
+	entry* e = this->lookup(owner);
+	if( !e->owner )
+	{	// owners stay in the table when their last key goes,
+		// they usually get new ones
+		e->owner = owner;
+		++this->used;
+	}
+	if( e->cnt >= e->cap )
+	{
+		const uint32 cap = e->cap ? e->cap*2 : 4;
+		uint32* keys = new uint32[cap];
+		if( e->keys )
+		{
+			memcpy(keys, e->keys, e->cnt*sizeof(uint32));
+			delete[] e->keys;
+		}
+		e->keys = keys;
+		e->cap = cap;
+	}
+	// keys usually come in ascending order
+	uint32 i = e->cnt;
+	while( i>0 && e->keys[i-1] > key )
+	{
+		e->keys[i] = e->keys[i-1];
+		--i;
+	}
+	if( i>0 && e->keys[i-1] == key )
+	{	// already there, undo the shift
+		memmove(e->keys+i, e->keys+i+1, (e->cnt-i)*sizeof(uint32));
+		return false;
+	}
+	e->keys[i] = key;
+	++e->cnt;
+	return true;
+}
+
+bool CKVOwnerIndex::remove(uint32 owner, uint32 key)
+{
+	if( !this->cap || !owner )
+		return false;
+	entry* e = this->lookup(owner);
+	uint32 i;
+	for(i=0; i<e->cnt; ++i)
+	{
+		if( e->keys[i] == key )
+		{
+			memmove(e->keys+i, e->keys+i+1, (e->cnt-i-1)*sizeof(uint32));
+			--e->cnt;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// common part
+basics::CParam< basics::string<> > CKVParameter::kv_path("kv_path", "save/");
+basics::CParam< basics::string<> > CKVParameter::db_engine("db_engine", "sql");
+
+bool CKVParameter::selected(const char* configfile)
+{
+#if defined(WITH_MYSQL)
+	if(configfile) basics::CParamBase::loadFile(configfile);
+	const basics::string<>& engine = db_engine;
+	return engine == "kv";
+#else
+	return true;
+#endif
+}
+
+CKVParameter::CKVParameter(const char* configfile, const char* name, bool memory)
+{
+	if(configfile) basics::CParamBase::loadFile(configfile);
+	if( memory )
+	{
+		this->store.open(NULL);
+		return;
+	}
+	const basics::string<>& dir = kv_path;
+	char file[256];
+	snprintf(file, sizeof(file), "%s%s.kv", dir.c_str(), name);
+	this->store.open(file);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// record fields.
+// the same fields as the sql tables keep, the key fields go first so the
+// lookups can read them without decoding the whole record.
+// the element maps are templates so they only name the fields
+
+template<typename E>
+static const CKVFieldMap<E>& kv_item_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::nameid),
+		CKVField<E>(&E::amount),
+		CKVField<E>(&E::equip),
+		CKVField<E>(&E::identify),
+		CKVField<E>(&E::refine),
+		CKVField<E>(&E::attribute),
+		CKVField<E>(&E::card),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_point_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::mapname),
+		CKVField<E>(&E::x),
+		CKVField<E>(&E::y),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_reg_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::str),
+		CKVField<E>(&E::value),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_skill_fields(const E*)
+{	// char skills, the flag marks the temporary ones
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::id),
+		CKVField<E>(&E::lv),
+		CKVField<E>(&E::flag),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_skill_lv_fields(const E*)
+{	// guild and homunculus skills
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::id),
+		CKVField<E>(&E::lv),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_friend_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::friend_id),
+		CKVField<E>(&E::friend_name),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_guild_member_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::account_id),
+		CKVField<E>(&E::char_id),
+		CKVField<E>(&E::hair),
+		CKVField<E>(&E::hair_color),
+		CKVField<E>(&E::gender),
+		CKVField<E>(&E::class_),
+		CKVField<E>(&E::lv),
+		CKVField<E>(&E::exp),
+		CKVField<E>(&E::exp_payper),
+		CKVField<E>(&E::online),
+		CKVField<E>(&E::position),
+		CKVField<E>(&E::rsv1),
+		CKVField<E>(&E::rsv2),
+		CKVField<E>(&E::name),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_guild_position_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::name),
+		CKVField<E>(&E::mode),
+		CKVField<E>(&E::exp_mode),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_guild_alliance_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::opposition),
+		CKVField<E>(&E::guild_id),
+		CKVField<E>(&E::name),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_guild_explusion_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::name),
+		CKVField<E>(&E::mes),
+		CKVField<E>(&E::acc),
+		CKVField<E>(&E::account_id),
+		CKVField<E>(&E::char_id),
+		CKVField<E>(&E::rsv1),
+		CKVField<E>(&E::rsv2),
+		CKVField<E>(&E::rsv3),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+template<typename E>
+static const CKVFieldMap<E>& kv_party_member_fields(const E*)
+{
+	static const CKVField<E> list[] =
+	{
+		CKVField<E>(&E::account_id),
+		CKVField<E>(&E::name),
+		CKVField<E>(&E::mapname),
+		CKVField<E>(&E::leader),
+		CKVField<E>(&E::online),
+		CKVField<E>(&E::lv),
+	};
+	static const CKVFieldMap<E> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CLoginAccount>& kv_fields(const CLoginAccount*)
+{
+	static const CKVField<CLoginAccount> list[] =
+	{
+		CKVField<CLoginAccount>(&CLoginAccount::account_id),
+		CKVField<CLoginAccount>(&CLoginAccount::userid),
+		CKVField<CLoginAccount>(&CLoginAccount::passwd),
+		CKVField<CLoginAccount>(&CLoginAccount::sex),
+		CKVField<CLoginAccount>(&CLoginAccount::gm_level),
+		CKVField<CLoginAccount>(&CLoginAccount::online),
+		CKVField<CLoginAccount>(&CLoginAccount::email),
+		CKVField<CLoginAccount>(&CLoginAccount::login_id1),
+		CKVField<CLoginAccount>(&CLoginAccount::login_id2),
+		CKVField<CLoginAccount>(&CLoginAccount::client_ip),
+		CKVField<CLoginAccount>(&CLoginAccount::last_ip),
+		CKVField<CLoginAccount>(&CLoginAccount::last_login),
+		CKVField<CLoginAccount>(&CLoginAccount::login_count),
+		CKVField<CLoginAccount>(&CLoginAccount::ban_until),
+		CKVField<CLoginAccount>(&CLoginAccount::valid_until),
+		CKVField<CLoginAccount>(&CLoginAccount::account_reg2_num),
+		CKVField<CLoginAccount>(&CLoginAccount::account_reg2, kv_reg_fields),
+	};
+	static const CKVFieldMap<CLoginAccount> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CCharCharAccount>& kv_fields(const CCharCharAccount*)
+{	// the charlist is built from the chars
+	static const CKVField<CCharCharAccount> list[] =
+	{
+		CKVField<CCharCharAccount>(&CCharCharAccount::account_id),
+		CKVField<CCharCharAccount>(&CCharCharAccount::sex),
+		CKVField<CCharCharAccount>(&CCharCharAccount::gm_level),
+		CKVField<CCharCharAccount>(&CCharCharAccount::email),
+		CKVField<CCharCharAccount>(&CCharCharAccount::login_id1),
+		CKVField<CCharCharAccount>(&CCharCharAccount::login_id2),
+		CKVField<CCharCharAccount>(&CCharCharAccount::client_ip),
+		CKVField<CCharCharAccount>(&CCharCharAccount::ban_until),
+		CKVField<CCharCharAccount>(&CCharCharAccount::valid_until),
+		CKVField<CCharCharAccount>(&CCharCharAccount::account_reg2_num),
+		CKVField<CCharCharAccount>(&CCharCharAccount::account_reg2, kv_reg_fields),
+	};
+	static const CKVFieldMap<CCharCharAccount> map(list);
+	return map;
+}
+
+/// number of leading char fields needed by the account lookups
+#define KV_CHAR_KEYFIELDS	3
+
+static const CKVFieldMap<CCharCharacter>& kv_fields(const CCharCharacter*)
+{	// char_id, account_id and slot have to stay first
+	static const CKVField<CCharCharacter> list[] =
+	{
+		CKVField<CCharCharacter>(&CCharCharacter::char_id),
+		CKVField<CCharCharacter>(&CCharCharacter::account_id),
+		CKVField<CCharCharacter>(&CCharCharacter::slot),
+		CKVField<CCharCharacter>(&CCharCharacter::name),
+		CKVField<CCharCharacter>(&CCharCharacter::class_),
+		CKVField<CCharCharacter>(&CCharCharacter::base_level),
+		CKVField<CCharCharacter>(&CCharCharacter::job_level),
+		CKVField<CCharCharacter>(&CCharCharacter::base_exp),
+		CKVField<CCharCharacter>(&CCharCharacter::job_exp),
+		CKVField<CCharCharacter>(&CCharCharacter::zeny),
+		CKVField<CCharCharacter>(&CCharCharacter::str),
+		CKVField<CCharCharacter>(&CCharCharacter::agi),
+		CKVField<CCharCharacter>(&CCharCharacter::vit),
+		CKVField<CCharCharacter>(&CCharCharacter::int_),
+		CKVField<CCharCharacter>(&CCharCharacter::dex),
+		CKVField<CCharCharacter>(&CCharCharacter::luk),
+		CKVField<CCharCharacter>(&CCharCharacter::max_hp),
+		CKVField<CCharCharacter>(&CCharCharacter::hp),
+		CKVField<CCharCharacter>(&CCharCharacter::max_sp),
+		CKVField<CCharCharacter>(&CCharCharacter::sp),
+		CKVField<CCharCharacter>(&CCharCharacter::status_point),
+		CKVField<CCharCharacter>(&CCharCharacter::skill_point),
+		CKVField<CCharCharacter>(&CCharCharacter::option),
+		CKVField<CCharCharacter>(&CCharCharacter::karma),
+		CKVField<CCharCharacter>(&CCharCharacter::chaos),
+		CKVField<CCharCharacter>(&CCharCharacter::manner),
+		CKVField<CCharCharacter>(&CCharCharacter::party_id),
+		CKVField<CCharCharacter>(&CCharCharacter::guild_id),
+		CKVField<CCharCharacter>(&CCharCharacter::pet_id),
+		CKVField<CCharCharacter>(&CCharCharacter::hair),
+		CKVField<CCharCharacter>(&CCharCharacter::hair_color),
+		CKVField<CCharCharacter>(&CCharCharacter::clothes_color),
+		CKVField<CCharCharacter>(&CCharCharacter::weapon),
+		CKVField<CCharCharacter>(&CCharCharacter::shield),
+		CKVField<CCharCharacter>(&CCharCharacter::head_top),
+		CKVField<CCharCharacter>(&CCharCharacter::head_mid),
+		CKVField<CCharCharacter>(&CCharCharacter::head_bottom),
+		CKVField<CCharCharacter>(&CCharCharacter::last_point, &point::mapname),
+		CKVField<CCharCharacter>(&CCharCharacter::last_point, &point::x),
+		CKVField<CCharCharacter>(&CCharCharacter::last_point, &point::y),
+		CKVField<CCharCharacter>(&CCharCharacter::save_point, &point::mapname),
+		CKVField<CCharCharacter>(&CCharCharacter::save_point, &point::x),
+		CKVField<CCharCharacter>(&CCharCharacter::save_point, &point::y),
+		CKVField<CCharCharacter>(&CCharCharacter::partner_id),
+		CKVField<CCharCharacter>(&CCharCharacter::father_id),
+		CKVField<CCharCharacter>(&CCharCharacter::mother_id),
+		CKVField<CCharCharacter>(&CCharCharacter::child_id),
+		CKVField<CCharCharacter>(&CCharCharacter::fame_points),
+		CKVField<CCharCharacter>(&CCharCharacter::memo_point, kv_point_fields),
+		CKVField<CCharCharacter>(&CCharCharacter::inventory, kv_item_fields),
+		CKVField<CCharCharacter>(&CCharCharacter::cart, kv_item_fields),
+		CKVField<CCharCharacter>(&CCharCharacter::skill, kv_skill_fields),
+		CKVField<CCharCharacter>(&CCharCharacter::global_reg_num),
+		CKVField<CCharCharacter>(&CCharCharacter::global_reg, kv_reg_fields),
+		CKVField<CCharCharacter>(&CCharCharacter::friendlist, kv_friend_fields),
+	};
+	static const CKVFieldMap<CCharCharacter> map(list);
+	return map;
+}
+
+/// mail as stored
+struct kv_mail
+{
+	uint32		message_id;
+	uint32		to_char_id;
+	uint32		from_char_id;
+	uint32		read_flag;
+	uint32		sendtime;
+	uint32		zeny;
+	struct item	item;
+	char		from_name[24];
+	char		header[32];
+	char		message[80];
+};
+
+static const CKVFieldMap<kv_mail>& kv_fields(const kv_mail*)
+{
+	static const CKVField<kv_mail> list[] =
+	{
+		CKVField<kv_mail>(&kv_mail::message_id),
+		CKVField<kv_mail>(&kv_mail::to_char_id),
+		CKVField<kv_mail>(&kv_mail::from_char_id),
+		CKVField<kv_mail>(&kv_mail::read_flag),
+		CKVField<kv_mail>(&kv_mail::sendtime),
+		CKVField<kv_mail>(&kv_mail::zeny),
+		CKVField<kv_mail>(&kv_mail::item, &item::nameid),
+		CKVField<kv_mail>(&kv_mail::item, &item::amount),
+		CKVField<kv_mail>(&kv_mail::item, &item::equip),
+		CKVField<kv_mail>(&kv_mail::item, &item::identify),
+		CKVField<kv_mail>(&kv_mail::item, &item::refine),
+		CKVField<kv_mail>(&kv_mail::item, &item::attribute),
+		CKVField<kv_mail>(&kv_mail::item, &item::card),
+		CKVField<kv_mail>(&kv_mail::from_name),
+		CKVField<kv_mail>(&kv_mail::header),
+		CKVField<kv_mail>(&kv_mail::message),
+	};
+	static const CKVFieldMap<kv_mail> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CGuild>& kv_fields(const CGuild*)
+{	// the save flags only matter for sql
+	static const CKVField<CGuild> list[] =
+	{
+		CKVField<CGuild>(&CGuild::guild_id),
+		CKVField<CGuild>(&CGuild::name),
+		CKVField<CGuild>(&CGuild::master),
+		CKVField<CGuild>(&CGuild::guild_lv),
+		CKVField<CGuild>(&CGuild::connect_member),
+		CKVField<CGuild>(&CGuild::max_member),
+		CKVField<CGuild>(&CGuild::average_lv),
+		CKVField<CGuild>(&CGuild::exp),
+		CKVField<CGuild>(&CGuild::next_exp),
+		CKVField<CGuild>(&CGuild::skill_point),
+		CKVField<CGuild>(&CGuild::mes1),
+		CKVField<CGuild>(&CGuild::mes2),
+		CKVField<CGuild>(&CGuild::emblem_id),
+		CKVField<CGuild>(&CGuild::emblem_len),
+		CKVField<CGuild>(&CGuild::emblem_data, CKVBytesCodec()),
+		CKVField<CGuild>(&CGuild::member, kv_guild_member_fields),
+		CKVField<CGuild>(&CGuild::position, kv_guild_position_fields),
+		CKVField<CGuild>(&CGuild::alliance, kv_guild_alliance_fields),
+		CKVField<CGuild>(&CGuild::explusion, kv_guild_explusion_fields),
+		CKVField<CGuild>(&CGuild::skill, kv_skill_lv_fields),
+	};
+	static const CKVFieldMap<CGuild> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CCastle>& kv_fields(const CCastle*)
+{
+	static const CKVField<CCastle> list[] =
+	{
+		CKVField<CCastle>(&CCastle::castle_id),
+		CKVField<CCastle>(&CCastle::guild_id),
+		CKVField<CCastle>(&CCastle::economy),
+		CKVField<CCastle>(&CCastle::defense),
+		CKVField<CCastle>(&CCastle::triggerE),
+		CKVField<CCastle>(&CCastle::triggerD),
+		CKVField<CCastle>(&CCastle::nextTime),
+		CKVField<CCastle>(&CCastle::payTime),
+		CKVField<CCastle>(&CCastle::createTime),
+		CKVField<CCastle>(&CCastle::visibleC),
+	};
+	static const CKVFieldMap<CCastle> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CParty>& kv_fields(const CParty*)
+{
+	static const CKVField<CParty> list[] =
+	{
+		CKVField<CParty>(&CParty::party_id),
+		CKVField<CParty>(&CParty::name),
+		CKVField<CParty>(&CParty::expshare),
+		CKVField<CParty>(&CParty::itemshare),
+		CKVField<CParty>(&CParty::itemc),
+		CKVField<CParty>(&CParty::member, kv_party_member_fields),
+	};
+	static const CKVFieldMap<CParty> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CPCStorage>& kv_fields(const CPCStorage*)
+{
+	static const CKVField<CPCStorage> list[] =
+	{
+		CKVField<CPCStorage>(&CPCStorage::account_id),
+		CKVField<CPCStorage>(&CPCStorage::storage_amount),
+		CKVField<CPCStorage>(&CPCStorage::storage, kv_item_fields),
+	};
+	static const CKVFieldMap<CPCStorage> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CGuildStorage>& kv_fields(const CGuildStorage*)
+{
+	static const CKVField<CGuildStorage> list[] =
+	{
+		CKVField<CGuildStorage>(&CGuildStorage::guild_id),
+		CKVField<CGuildStorage>(&CGuildStorage::storage_amount),
+		CKVField<CGuildStorage>(&CGuildStorage::storage, kv_item_fields),
+	};
+	static const CKVFieldMap<CGuildStorage> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CPet>& kv_fields(const CPet*)
+{
+	static const CKVField<CPet> list[] =
+	{
+		CKVField<CPet>(&CPet::pet_id),
+		CKVField<CPet>(&CPet::account_id),
+		CKVField<CPet>(&CPet::char_id),
+		CKVField<CPet>(&CPet::class_),
+		CKVField<CPet>(&CPet::level),
+		CKVField<CPet>(&CPet::egg_id),
+		CKVField<CPet>(&CPet::equip_id),
+		CKVField<CPet>(&CPet::intimate),
+		CKVField<CPet>(&CPet::hungry),
+		CKVField<CPet>(&CPet::name),
+		CKVField<CPet>(&CPet::rename_flag),
+		CKVField<CPet>(&CPet::incuvate),
+	};
+	static const CKVFieldMap<CPet> map(list);
+	return map;
+}
+
+static const CKVFieldMap<CHomunculus>& kv_fields(const CHomunculus*)
+{
+	static const CKVField<CHomunculus> list[] =
+	{
+		CKVField<CHomunculus>(&CHomunculus::homun_id),
+		CKVField<CHomunculus>(&CHomunculus::account_id),
+		CKVField<CHomunculus>(&CHomunculus::char_id),
+		CKVField<CHomunculus>(&CHomunculus::base_exp),
+		CKVField<CHomunculus>(&CHomunculus::name),
+		CKVField<CHomunculus>(&CHomunculus::hp),
+		CKVField<CHomunculus>(&CHomunculus::max_hp),
+		CKVField<CHomunculus>(&CHomunculus::sp),
+		CKVField<CHomunculus>(&CHomunculus::max_sp),
+		CKVField<CHomunculus>(&CHomunculus::class_),
+		CKVField<CHomunculus>(&CHomunculus::status_point),
+		CKVField<CHomunculus>(&CHomunculus::skill_point),
+		CKVField<CHomunculus>(&CHomunculus::str),
+		CKVField<CHomunculus>(&CHomunculus::agi),
+		CKVField<CHomunculus>(&CHomunculus::vit),
+		CKVField<CHomunculus>(&CHomunculus::int_),
+		CKVField<CHomunculus>(&CHomunculus::dex),
+		CKVField<CHomunculus>(&CHomunculus::luk),
+		CKVField<CHomunculus>(&CHomunculus::option),
+		CKVField<CHomunculus>(&CHomunculus::equip),
+		CKVField<CHomunculus>(&CHomunculus::intimate),
+		CKVField<CHomunculus>(&CHomunculus::hungry),
+		CKVField<CHomunculus>(&CHomunculus::base_level),
+		CKVField<CHomunculus>(&CHomunculus::rename_flag),
+		CKVField<CHomunculus>(&CHomunculus::incubate),
+		CKVField<CHomunculus>(&CHomunculus::skill, kv_skill_lv_fields),
+	};
+	static const CKVFieldMap<CHomunculus> map(list);
+	return map;
+}
+
+/// read a record, with max only the first max fields
+template<typename S>
+static bool kv_get(CKVStore& store, uchar ns, uint32 key, S& s, size_t max=~((size_t)0))
+{
+	size_t len;
+	const char* data = store.get(ns, key, len);
+	if( !data )
+		return false;
+	CKVReader r(data, len);
+	kv_fields((const S*)NULL).decode(r, s, max);
+	if( !r.ok )
+		ShowError("kv: record %u of namespace %u cannot be read\n", key, ns);
+	return r.ok;
+}
+
+/// write a record
+template<typename S>
+static bool kv_put(CKVStore& store, uchar ns, uint32 key, const S& s)
+{
+	CKVWriter w;
+	kv_fields((const S*)NULL).encode(w, s);
+	return store.put(ns, key, w.data(), w.size());
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// accounts
+static basics::CParam<uint32> kv_start_account_num("start_account_num", 10000000);
+static basics::CParam<uint32> kv_start_char_num("start_char_num", 20000000);
+
+bool CAccountDB_kv::init(const char* configfile)
+{
+	size_t cursor = 0;
+	uint32 key;
+	CLoginAccount account;
+
+	this->names.case_sensitive(this->case_sensitive);
+	while( this->store.next(KV_ACCOUNT, cursor, key) )
+	{
+		if( kv_get(this->store, KV_ACCOUNT, key, account) )
+			this->names.insert(account.userid, key);
+	}
+	if( 0==this->store.count(KV_ACCOUNT) )
+	{	// same server accounts as the sql database
+		this->insertAccount("s1", "p1", 'S', "", account);
+		this->insertAccount("s2", "p2", 'S', "", account);
+		this->insertAccount("s3", "p3", 'S', "", account);
+		ShowInfo("created default server accounts\n"CL_SPACE"it is recommended to modify the passwords\n");
+	}
+	return true;
+}
+
+size_t CAccountDB_kv::size() const
+{
+	return this->store.count(KV_ACCOUNT);
+}
+
+CLoginAccount& CAccountDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CLoginAccount account;
+	uint32 key;
+	if( !this->store.at(KV_ACCOUNT, i, key) || !kv_get(this->store, KV_ACCOUNT, key, account) )
+		account.account_id = 0;
+	return account;
+}
+
+bool CAccountDB_kv::existAccount(const char* userid)
+{
+	return 0 != this->names.find(userid);
+}
+
+bool CAccountDB_kv::searchAccount(const char* userid, CLoginAccount& account)
+{
+	const uint32 accid = this->names.find(userid);
+	return accid && this->searchAccount(accid, account);
+}
+
+bool CAccountDB_kv::searchAccount(uint32 accid, CLoginAccount& account)
+{
+	return kv_get(this->store, KV_ACCOUNT, accid, account);
+}
+
+bool CAccountDB_kv::insertAccount(const char* userid, const char* passwd, unsigned char sex, const char* email, CLoginAccount& account)
+{
+	if( this->existAccount(userid) )
+		return false;
+	CLoginAccount a;
+	a.account_id = this->store.next_id(KV_ACCOUNT, kv_start_account_num);
+	safestrcpy(a.userid, sizeof(a.userid), userid);
+	safestrcpy(a.passwd, sizeof(a.passwd), passwd);
+	safestrcpy(a.email, sizeof(a.email), email);
+	a.sex = (sex=='S') ? 2 : (sex=='M');
+	if( !kv_put(this->store, KV_ACCOUNT, a.account_id, a) )
+		return false;
+	this->names.insert(a.userid, a.account_id);
+	account = a;
+	return true;
+}
+
+bool CAccountDB_kv::removeAccount(uint32 accid)
+{
+	CLoginAccount account;
+	if( !kv_get(this->store, KV_ACCOUNT, accid, account) )
+		return false;
+	this->names.remove(account.userid);
+	return this->store.remove(KV_ACCOUNT, accid);
+}
+
+bool CAccountDB_kv::saveAccount(const CLoginAccount& account)
+{
+	CLoginAccount old;
+	if( !kv_get(this->store, KV_ACCOUNT, account.account_id, old) )
+		return false;
+	if( 0!=strcmp(old.userid, account.userid) )
+	{
+		this->names.remove(old.userid);
+		this->names.insert(account.userid, account.account_id);
+	}
+	return kv_put(this->store, KV_ACCOUNT, account.account_id, account);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// chars
+bool CCharDB_kv::init(const char* configfile)
+{
+	size_t cursor = 0;
+	uint32 key;
+	CCharCharacter p;
+	while( this->store.next(KV_CHAR, cursor, key) )
+	{	// the name follows the key fields
+		if( kv_get(this->store, KV_CHAR, key, p, KV_CHAR_KEYFIELDS+1) )
+		{
+			this->names.insert(p.name, key);
+			this->account_chars.insert(p.account_id, key);
+		}
+	}
+	kv_mail m;
+	cursor = 0;
+	while( this->store.next(KV_MAIL, cursor, key) )
+	{	// message_id and to_char_id
+		if( kv_get(this->store, KV_MAIL, key, m, 2) )
+			this->char_mails.insert(m.to_char_id, key);
+	}
+	return true;
+}
+
+size_t CCharDB_kv::size() const
+{
+	return this->store.count(KV_CHAR);
+}
+
+CCharCharacter& CCharDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CCharCharacter p;
+	uint32 key;
+	if( !this->store.at(KV_CHAR, i, key) || !kv_get(this->store, KV_CHAR, key, p) )
+		p.char_id = 0;
+	return p;
+}
+
+bool CCharDB_kv::existChar(const char* name)
+{
+	return 0 != this->names.find(name);
+}
+
+bool CCharDB_kv::existChar(uint32 char_id)
+{
+	return this->store.exists(KV_CHAR, char_id);
+}
+
+bool CCharDB_kv::searchChar(const char* name, CCharCharacter& p)
+{
+	const uint32 char_id = this->names.find(name);
+	return char_id && this->searchChar(char_id, p);
+}
+
+bool CCharDB_kv::searchChar(uint32 char_id, CCharCharacter& p)
+{
+	return kv_get(this->store, KV_CHAR, char_id, p);
+}
+
+bool CCharDB_kv::insertChar(CCharAccount &account,
+					const char *n,
+					unsigned char str,
+					unsigned char agi,
+					unsigned char vit,
+					unsigned char int_,
+					unsigned char dex,
+					unsigned char luk,
+					unsigned char slot,
+					unsigned char hair_style,
+					unsigned char hair_color,
+					CCharCharacter &p)
+{
+	p = CCharCharacter(n);
+	if( this->existChar(p.name) )
+	{
+		ShowError("char creation failed, charname '%s' already in use\n", p.name);
+		return false;
+	}
+
+	// check char slot
+	size_t i, cnt;
+	const uint32* keys = this->account_chars.find(account.account_id, cnt);
+	for(i=0; i<cnt; ++i)
+	{
+		CCharCharacter c;
+		if( kv_get(this->store, KV_CHAR, keys[i], c, KV_CHAR_KEYFIELDS) && c.slot==slot )
+		{
+			ShowError("char creation failed, (aid: %d, slot: %d), slot already in use\n", account.account_id, slot);
+			return false;
+		}
+	}
+
+	p.char_id = this->store.next_id(KV_CHAR, kv_start_char_num);
+	p.account_id = account.account_id;
+	p.slot = slot;
+	p.class_ = 0;
+	p.base_level = 1;
+	p.job_level = 1;
+	p.base_exp = 0;
+	p.job_exp = 0;
+	p.zeny = start_zeny;
+	p.str = str;
+	p.agi = agi;
+	p.vit = vit;
+	p.int_ = int_;
+	p.dex = dex;
+	p.luk = luk;
+	p.max_hp = 40 * (100 + vit) / 100;
+	p.max_sp = 11 * (100 + int_) / 100;
+	p.hp = p.max_hp;
+	p.sp = p.max_sp;
+	p.status_point = 0;
+	p.skill_point = 0;
+	p.option = 0;
+	p.karma = 0;
+	p.chaos = 0;
+	p.manner = 0;
+	p.party_id = 0;
+	p.guild_id = 0;
+	p.hair = hair_style;
+	p.hair_color = hair_color;
+	p.clothes_color = 0;
+	p.inventory[0].nameid = start_weapon; // Knife
+	p.inventory[0].amount = 1;
+	p.inventory[0].equip = 0x02;
+	p.inventory[0].identify = 1;
+	p.inventory[1].nameid = start_armor; // Cotton Shirt
+	p.inventory[1].amount = 1;
+	p.inventory[1].equip = 0x10;
+	p.inventory[1].identify = 1;
+	p.weapon = 1;
+	p.shield = 0;
+	p.head_top = 0;
+	p.head_mid = 0;
+	p.head_bottom = 0;
+	p.last_point = start_point;
+	p.save_point = start_point;
+
+	if( !kv_put(this->store, KV_CHAR, p.char_id, p) )
+		return false;
+	this->names.insert(p.name, p.char_id);
+	this->account_chars.insert(p.account_id, p.char_id);
+	return true;
+}
+
+bool CCharDB_kv::removeChar(uint32 charid)
+{
+	CCharCharacter p;
+	if( !kv_get(this->store, KV_CHAR, charid, p) )
+		return false;
+	this->names.remove(p.name);
+	this->account_chars.remove(p.account_id, charid);
+
+	// the mails go with the char, from the back so the list stays valid
+	size_t cnt;
+	const uint32* keys = this->char_mails.find(charid, cnt);
+	while( keys && cnt-- )
+	{
+		const uint32 key = keys[cnt];
+		this->store.remove(KV_MAIL, key);
+		this->char_mails.remove(charid, key);
+	}
+	return this->store.remove(KV_CHAR, charid);
+}
+
+bool CCharDB_kv::saveChar(const CCharCharacter& p)
+{
+	CCharCharacter old;
+	if( !kv_get(this->store, KV_CHAR, p.char_id, old, KV_CHAR_KEYFIELDS+1) )
+		this->account_chars.insert(p.account_id, p.char_id);
+	else
+	{
+		if( 0!=strcmp(old.name, p.name) )
+		{
+			this->names.remove(old.name);
+			this->names.insert(p.name, p.char_id);
+		}
+		if( old.account_id != p.account_id )
+		{
+			this->account_chars.remove(old.account_id, p.char_id);
+			this->account_chars.insert(p.account_id, p.char_id);
+		}
+	}
+	return kv_put(this->store, KV_CHAR, p.char_id, p);
+}
+
+bool CCharDB_kv::searchAccount(uint32 accid, CCharCharAccount& account)
+{
+	if( !accid || !kv_get(this->store, KV_CHARACCOUNT, accid, account) )
+		return false;
+
+	// associated chars
+	size_t i, cnt;
+	const uint32* keys = this->account_chars.find(accid, cnt);
+	for(i=0; i<9; ++i)
+		account.charlist[i] = 0;
+	for(i=0; i<cnt; ++i)
+	{
+		CCharCharacter c;
+		if( kv_get(this->store, KV_CHAR, keys[i], c, KV_CHAR_KEYFIELDS) && c.slot<9 )
+		{
+			if( account.charlist[c.slot] != 0 )
+				ShowError("CharDB: doubled used slot %i for account_id %i\n", c.slot, accid);
+			account.charlist[c.slot] = c.char_id;
+		}
+	}
+	return true;
+}
+
+bool CCharDB_kv::saveAccount(CCharAccount& account)
+{	// the char server keeps its own copy of the login data here,
+	// it only passes the CCharCharAccount it got from searchAccount
+	return kv_put(this->store, KV_CHARACCOUNT, account.account_id, static_cast<CCharCharAccount&>(account));
+}
+
+bool CCharDB_kv::removeAccount(uint32 accid)
+{
+	return this->store.remove(KV_CHARACCOUNT, accid);
+}
+
+size_t CCharDB_kv::getMailCount(uint32 cid, uint32 &all, uint32 &unread)
+{
+	size_t i, cnt;
+	const uint32* keys = this->char_mails.find(cid, cnt);
+	all = unread = 0;
+	for(i=0; i<cnt; ++i)
+	{	// up to the read flag
+		kv_mail m;
+		if( kv_get(this->store, KV_MAIL, keys[i], m, 4) )
+		{
+			++all;
+			if( !m.read_flag )
+				++unread;
+		}
+	}
+	return all;
+}
+
+size_t CCharDB_kv::listMail(uint32 cid, unsigned char box, unsigned char *buffer)
+{
+	unsigned char *buf = buffer;
+	size_t i, cnt, count = 0;
+	const uint32* keys = this->char_mails.find(cid, cnt);
+	for(i=0; i<cnt; ++i)
+	{
+		kv_mail m;
+		if( kv_get(this->store, KV_MAIL, keys[i], m) )
+		{
+			CMailHead mailhead(m.message_id, m.read_flag, m.from_name, m.sendtime, m.header);
+			mailhead._tobuffer(buf); // automatic buffer increment
+			++count;
+		}
+	}
+	return count;
+}
+
+bool CCharDB_kv::readMail(uint32 cid, uint32 mid, CMail& mail)
+{
+	kv_mail m;
+	// default clearing
+	mail.read    = 0;
+	mail.name[0] = 0;
+	mail.head[0] = 0;
+	mail.body[0] = 0;
+	if( !kv_get(this->store, KV_MAIL, mid, m) || m.to_char_id != cid )
+		return false;
+
+	mail = CMail(mid, m.read_flag, m.from_name, m.header, m.sendtime, m.zeny, m.item, m.message);
+	if( 0==m.read_flag )
+	{	// attachments are handed out once
+		m.read_flag = 1;
+		m.zeny = 0;
+		memset(&m.item, 0, sizeof(m.item));
+		kv_put(this->store, KV_MAIL, mid, m);
+	}
+	return true;
+}
+
+bool CCharDB_kv::deleteMail(uint32 cid, uint32 mid)
+{
+	kv_mail m;
+	if( !kv_get(this->store, KV_MAIL, mid, m, 2) || m.to_char_id != cid || !this->store.remove(KV_MAIL, mid) )
+		return false;
+	this->char_mails.remove(cid, mid);
+	return true;
+}
+
+bool CCharDB_kv::sendMail(uint32 senderid, const char* sendername, const char* targetname, const char *head, const char *body, uint32 zeny, const struct item& item, uint32& msgid, uint32& tid)
+{
+	kv_mail m;
+	memset(&m, 0, sizeof(m));
+	m.from_char_id = senderid;
+	m.sendtime = (uint32)time(NULL);
+	m.zeny = zeny;
+	m.item = item;
+	m.item.equip = 0;
+	safestrcpy(m.from_name, sizeof(m.from_name), sendername);
+	safestrcpy(m.header, sizeof(m.header), head);
+	safestrcpy(m.message, sizeof(m.message), body);
+
+	if( 0==strcmp(targetname,"*") )
+	{	// send to all, the puts can reorder the index so collect the chars first
+		const size_t cnt = this->store.count(KV_CHAR);
+		uint32* ids = new uint32[cnt+1];
+		size_t i, n = 0, cursor = 0;
+		uint32 key;
+		bool ret = false;
+		while( n<cnt && this->store.next(KV_CHAR, cursor, key) )
+		{
+			if( key != senderid )
+				ids[n++] = key;
+		}
+		for(i=0; i<n; ++i)
+		{
+			m.to_char_id = ids[i];
+			m.message_id = this->store.next_id(KV_MAIL);
+			if( kv_put(this->store, KV_MAIL, m.message_id, m) )
+			{
+				this->char_mails.insert(m.to_char_id, m.message_id);
+				ret = true;
+			}
+		}
+		delete[] ids;
+		msgid = m.message_id;
+		tid = 0;
+		return ret;
+	}
+
+	m.to_char_id = this->names.find(targetname);
+	if( !m.to_char_id )
+		return false;
+	m.message_id = this->store.next_id(KV_MAIL);
+	msgid = m.message_id;
+	tid = m.to_char_id;
+	if( !kv_put(this->store, KV_MAIL, m.message_id, m) )
+		return false;
+	this->char_mails.insert(m.to_char_id, m.message_id);
+	return true;
+}
+
+void CCharDB_kv::loadfamelist()
+{
+	const static fame_t fametype[] = {FAME_PK, FAME_SMITH, FAME_CHEM, FAME_TEAK};
+	const static char* famevar[] = {"PC_PK_FAME", "PC_SMITH_FAME", "PC_CHEM_FAME", "PC_TEAK_FAME"};
+
+	// best values first
+	uint32 ids[4][MAX_FAMELIST+1], values[4][MAX_FAMELIST+1];
+	size_t cnt[4] = {0,0,0,0};
+	size_t i, k, cursor = 0;
+	uint32 key;
+
+	CCharCharacter* c = new CCharCharacter;
+	while( this->store.next(KV_CHAR, cursor, key) )
+	{
+		if( !kv_get(this->store, KV_CHAR, key, *c) )
+			continue;
+		for(i=0; i<4; ++i)
+		{	// same class restrictions as the sql database
+			if( (i==1 && c->class_!=10 && c->class_!=4011 && c->class_!=4033) ||
+				(i==2 && c->class_!=18 && c->class_!=4019 && c->class_!=4041) ||
+				(i==3 && c->class_!=4046) )
+				continue;
+			for(k=0; k<c->global_reg_num && k<GLOBAL_REG_NUM; ++k)
+			{
+				if( 0==strcmp(c->global_reg[k].str, famevar[i]) )
+					break;
+			}
+			if( k>=c->global_reg_num || k>=GLOBAL_REG_NUM || c->global_reg[k].value <= 0 )
+				continue;
+
+			const uint32 v = c->global_reg[k].value;
+			size_t pos = cnt[i];
+			while( pos>0 && values[i][pos-1] < v )
+				--pos;
+			if( pos > MAX_FAMELIST )
+				continue;
+			if( cnt[i] < MAX_FAMELIST+1 )
+				++cnt[i];
+			for(k=cnt[i]-1; k>pos; --k)
+			{
+				ids[i][k] = ids[i][k-1];
+				values[i][k] = values[i][k-1];
+			}
+			ids[i][pos] = c->char_id;
+			values[i][pos] = v;
+		}
+	}
+	delete c;
+
+	for(i=0; i<4; ++i)
+	{
+		CFameList &fl = this->famelists[fametype[i]];
+		fl.clear();
+		for(k=0; k<cnt[i]; ++k)
+		{
+			CCharCharacter p;
+			kv_get(this->store, KV_CHAR, ids[i][k], p, KV_CHAR_KEYFIELDS+1);
+			fl.cEntry[k] = CFameList::fameentry(ids[i][k], p.name, values[i][k]);
+		}
+		fl.cCount = k;
+		for( ; k<MAX_FAMELIST+1; ++k)
+			fl.cEntry[k] = CFameList::fameentry(0, "", 0);
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// guilds
+bool CGuildDB_kv::init(const char* configfile)
+{
+	size_t i, cursor = 0;
+	uint32 key;
+	CGuild g;
+	while( this->store.next(KV_GUILD, cursor, key) )
+	{
+		if( kv_get(this->store, KV_GUILD, key, g) )
+			this->names.insert(g.name, key);
+	}
+	// check if all castles exist
+	for(i=0; i<MAX_GUILDCASTLE; ++i)
+	{
+		if( !this->store.exists(KV_CASTLE, i) )
+			this->saveCastle( CCastle(i) ); // constructor takes care of all settings
+	}
+	return true;
+}
+
+size_t CGuildDB_kv::size() const
+{
+	return this->store.count(KV_GUILD);
+}
+
+CGuild& CGuildDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CGuild g;
+	uint32 key;
+	if( !this->store.at(KV_GUILD, i, key) || !kv_get(this->store, KV_GUILD, key, g) )
+		g.guild_id = 0;
+	return g;
+}
+
+size_t CGuildDB_kv::castlesize() const
+{
+	return this->store.count(KV_CASTLE);
+}
+
+CCastle& CGuildDB_kv::castle(size_t i)
+{	// not threadsafe
+	static CCastle c;
+	uint32 key;
+	if( !this->store.at(KV_CASTLE, i, key) || !kv_get(this->store, KV_CASTLE, key, c) )
+		c.castle_id = 0;
+	return c;
+}
+
+bool CGuildDB_kv::searchGuild(const char* name, CGuild& g)
+{
+	const uint32 guild_id = this->names.find(name);
+	return guild_id && this->searchGuild(guild_id, g);
+}
+
+bool CGuildDB_kv::searchGuild(uint32 guild_id, CGuild& g)
+{
+	return kv_get(this->store, KV_GUILD, guild_id, g);
+}
+
+bool CGuildDB_kv::insertGuild(const struct guild_member &m, const char *name, CGuild &g)
+{
+	size_t i;
+	if( this->names.find(name) )
+		return false;
+
+	// construct initial guild
+	g = CGuild(name);
+	g.member[0] = m;
+	safestrcpy(g.master, sizeof(g.master), m.name);
+	g.position[0].mode=0x11;
+	safestrcpy(g.position[0].name, sizeof(g.position[0].name),"GuildMaster");
+	safestrcpy(g.position[MAX_GUILDPOSITION-1].name, sizeof(g.position[0].name),"Newbie");
+	for(i=1; i<MAX_GUILDPOSITION-1; ++i)
+		snprintf(g.position[i].name,sizeof(g.position[0].name),"Position %ld",(unsigned long)(i+1));
+
+	g.max_member=(16>MAX_GUILD)?MAX_GUILD:16;
+	g.average_lv=g.member[0].lv;
+	for(i=0;i<MAX_GUILDSKILL;++i)
+	{
+		g.skill[i].id = i+GD_SKILLBASE;
+		g.skill[i].lv = 0;
+	}
+
+	g.guild_id = this->store.next_id(KV_GUILD);
+	if( !this->saveGuild(g) )
+		return false;
+	this->names.insert(g.name, g.guild_id);
+	return true;
+}
+
+bool CGuildDB_kv::removeGuild(uint32 guild_id)
+{
+	CGuild g;
+	if( !kv_get(this->store, KV_GUILD, guild_id, g) )
+		return false;
+	this->names.remove(g.name);
+	this->store.remove(KV_GUILD, guild_id);
+
+	// drop the alliances with it,
+	// the puts can reorder the index so collect the guilds first
+	const size_t cnt = this->store.count(KV_GUILD);
+	uint32* ids = new uint32[cnt+1];
+	size_t i, k, n = 0, cursor = 0;
+	uint32 key;
+	while( n<cnt && this->store.next(KV_GUILD, cursor, key) )
+		ids[n++] = key;
+	for(k=0; k<n; ++k)
+	{
+		if( !kv_get(this->store, KV_GUILD, ids[k], g) )
+			continue;
+		bool changed = false;
+		for(i=0; i<MAX_GUILDALLIANCE; ++i)
+		{
+			if( g.alliance[i].guild_id == guild_id )
+			{
+				memset(&g.alliance[i], 0, sizeof(g.alliance[i]));
+				changed = true;
+			}
+		}
+		if( changed )
+			kv_put(this->store, KV_GUILD, ids[k], g);
+	}
+	delete[] ids;
+	return true;
+}
+
+bool CGuildDB_kv::saveGuild(const CGuild& g)
+{	// always the full guild, the save flags only matter for sql
+	const_cast<CGuild&>(g).save_flags = 0;
+	return kv_put(this->store, KV_GUILD, g.guild_id, g);
+}
+
+bool CGuildDB_kv::searchCastle(ushort castle_id, CCastle& castle)
+{
+	return kv_get(this->store, KV_CASTLE, castle_id, castle);
+}
+
+bool CGuildDB_kv::saveCastle(const CCastle& castle)
+{
+	return kv_put(this->store, KV_CASTLE, castle.castle_id, castle);
+}
+
+bool CGuildDB_kv::removeCastle(ushort castle_id)
+{
+	return this->store.remove(KV_CASTLE, castle_id);
+}
+
+bool CGuildDB_kv::getCastles(basics::vector<CCastle>& castlevector)
+{
+	size_t cursor = 0;
+	uint32 key;
+	CCastle tmp;
+	castlevector.clear();
+	while( this->store.next(KV_CASTLE, cursor, key) )
+	{
+		if( kv_get(this->store, KV_CASTLE, key, tmp) )
+			castlevector.push(tmp);
+	}
+	return true;
+}
+
+uint32 CGuildDB_kv::has_conflict(uint32 guild_id, uint32 account_id, uint32 char_id)
+{	// only the guild members are known here, not the guild_id of the chars
+	size_t i, cursor = 0;
+	uint32 key, ret = 0;
+	CGuild* g = new CGuild;
+	while( !ret && this->store.next(KV_GUILD, cursor, key) )
+	{
+		if( key==guild_id || !kv_get(this->store, KV_GUILD, key, *g) )
+			continue;
+		for(i=0; i<MAX_GUILD; ++i)
+		{
+			if( g->member[i].char_id == char_id && g->member[i].account_id == account_id )
+			{
+				ret = key;
+				break;
+			}
+		}
+	}
+	delete g;
+	return ret;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// parties
+bool CPartyDB_kv::init(const char* configfile)
+{
+	size_t cursor = 0;
+	uint32 key;
+	CParty p;
+	while( this->store.next(KV_PARTY, cursor, key) )
+	{
+		if( kv_get(this->store, KV_PARTY, key, p) )
+			this->names.insert(p.name, key);
+	}
+	return true;
+}
+
+size_t CPartyDB_kv::size() const
+{
+	return this->store.count(KV_PARTY);
+}
+
+CParty& CPartyDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CParty p;
+	uint32 key;
+	if( !this->store.at(KV_PARTY, i, key) || !kv_get(this->store, KV_PARTY, key, p) )
+		p.party_id = 0;
+	return p;
+}
+
+bool CPartyDB_kv::searchParty(const char* name, CParty& p)
+{
+	const uint32 pid = this->names.find(name);
+	return pid && this->searchParty(pid, p);
+}
+
+bool CPartyDB_kv::searchParty(uint32 pid, CParty& p)
+{
+	return kv_get(this->store, KV_PARTY, pid, p);
+}
+
+bool CPartyDB_kv::insertParty(uint32 accid, const char* nick, const char* mapname, ushort lv, const char* name, CParty& p)
+{
+	if( this->names.find(name) )
+		return false;
+	p = CParty();
+	safestrcpy(p.name,sizeof(p.name),name);
+	p.expshare = 0;
+	p.itemshare= 0;
+	p.itemc    = 0;
+	p.member[0].account_id = accid;
+	safestrcpy( p.member[0].name, sizeof(p.member[0].name), nick );
+	safestrcpy( p.member[0].mapname, sizeof(p.member[0].mapname), mapname );
+	p.member[0].leader = 1;
+	p.member[0].online = 1;
+	p.member[0].lv = lv;
+	p.party_id = this->store.next_id(KV_PARTY);
+	if( !kv_put(this->store, KV_PARTY, p.party_id, p) )
+		return false;
+	this->names.insert(p.name, p.party_id);
+	return true;
+}
+
+bool CPartyDB_kv::removeParty(uint32 pid)
+{
+	CParty p;
+	if( !kv_get(this->store, KV_PARTY, pid, p) )
+		return false;
+	this->names.remove(p.name);
+	return this->store.remove(KV_PARTY, pid);
+}
+
+bool CPartyDB_kv::saveParty(const CParty& p)
+{
+	return kv_put(this->store, KV_PARTY, p.party_id, p);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// storages
+size_t CPCStorageDB_kv::size() const
+{
+	return this->store.count(KV_PCSTORAGE);
+}
+
+CPCStorage& CPCStorageDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CPCStorage stor;
+	uint32 key;
+	if( !this->store.at(KV_PCSTORAGE, i, key) || !kv_get(this->store, KV_PCSTORAGE, key, stor) )
+		stor.account_id = 0;
+	return stor;
+}
+
+bool CPCStorageDB_kv::searchStorage(uint32 accid, CPCStorage& stor)
+{
+	if( !kv_get(this->store, KV_PCSTORAGE, accid, stor) )
+	{	// empty storage, same as no rows in sql
+		memset(&stor, 0, sizeof(stor));
+		stor.account_id = accid;
+	}
+	return true;
+}
+
+bool CPCStorageDB_kv::removeStorage(uint32 accid)
+{
+	this->store.remove(KV_PCSTORAGE, accid);
+	return true;
+}
+
+bool CPCStorageDB_kv::saveStorage(const CPCStorage& stor)
+{
+	return kv_put(this->store, KV_PCSTORAGE, stor.account_id, stor);
+}
+
+size_t CGuildStorageDB_kv::size() const
+{
+	return this->store.count(KV_GUILDSTORAGE);
+}
+
+CGuildStorage& CGuildStorageDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CGuildStorage stor;
+	uint32 key;
+	if( !this->store.at(KV_GUILDSTORAGE, i, key) || !kv_get(this->store, KV_GUILDSTORAGE, key, stor) )
+		stor.guild_id = 0;
+	return stor;
+}
+
+bool CGuildStorageDB_kv::searchStorage(uint32 gid, CGuildStorage& stor)
+{
+	if( !kv_get(this->store, KV_GUILDSTORAGE, gid, stor) )
+	{
+		memset(&stor, 0, sizeof(stor));
+		stor.guild_id = gid;
+	}
+	return true;
+}
+
+bool CGuildStorageDB_kv::removeStorage(uint32 gid)
+{
+	this->store.remove(KV_GUILDSTORAGE, gid);
+	return true;
+}
+
+bool CGuildStorageDB_kv::saveStorage(const CGuildStorage& stor)
+{
+	return kv_put(this->store, KV_GUILDSTORAGE, stor.guild_id, stor);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// pets
+size_t CPetDB_kv::size() const
+{
+	return this->store.count(KV_PET);
+}
+
+CPet& CPetDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CPet pet;
+	uint32 key;
+	if( !this->store.at(KV_PET, i, key) || !kv_get(this->store, KV_PET, key, pet) )
+		pet.pet_id = 0;
+	return pet;
+}
+
+bool CPetDB_kv::searchPet(uint32 pid, CPet& pet)
+{
+	return kv_get(this->store, KV_PET, pid, pet);
+}
+
+bool CPetDB_kv::insertPet(uint32 accid, uint32 cid, short pet_class, short pet_lv, short pet_egg_id, ushort pet_equip, short intimate, short hungry, char renameflag, char incuvat, char *pet_name, CPet& pd)
+{
+	pd.pet_id = this->store.next_id(KV_PET);
+	pd.account_id = accid;
+	pd.char_id = cid;
+	pd.class_ = pet_class;
+	pd.level = pet_lv;
+	pd.egg_id = pet_egg_id;
+	pd.equip_id = pet_equip;
+	pd.intimate = intimate;
+	pd.hungry = hungry;
+	safestrcpy(pd.name, sizeof(pd.name), pet_name);
+	pd.rename_flag = renameflag;
+	pd.incuvate = incuvat;
+	return kv_put(this->store, KV_PET, pd.pet_id, pd);
+}
+
+bool CPetDB_kv::removePet(uint32 pid)
+{
+	return this->store.remove(KV_PET, pid);
+}
+
+bool CPetDB_kv::savePet(const CPet& pet)
+{
+	return kv_put(this->store, KV_PET, pet.pet_id, pet);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// homunculi
+size_t CHomunculusDB_kv::size() const
+{
+	return this->store.count(KV_HOMUNCULUS);
+}
+
+CHomunculus& CHomunculusDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CHomunculus hom;
+	uint32 key;
+	if( !this->store.at(KV_HOMUNCULUS, i, key) || !kv_get(this->store, KV_HOMUNCULUS, key, hom) )
+		hom.homun_id = 0;
+	return hom;
+}
+
+bool CHomunculusDB_kv::searchHomunculus(uint32 hid, CHomunculus& hom)
+{
+	return kv_get(this->store, KV_HOMUNCULUS, hid, hom);
+}
+
+bool CHomunculusDB_kv::insertHomunculus(CHomunculus& hom)
+{
+	hom.homun_id = this->store.next_id(KV_HOMUNCULUS);
+	return kv_put(this->store, KV_HOMUNCULUS, hom.homun_id, hom);
+}
+
+bool CHomunculusDB_kv::removeHomunculus(uint32 hid)
+{
+	return this->store.remove(KV_HOMUNCULUS, hid);
+}
+
+bool CHomunculusDB_kv::saveHomunculus(const CHomunculus& hom)
+{
+	return kv_put(this->store, KV_HOMUNCULUS, hom.homun_id, hom);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// variables
+bool CVarDB_kv::init(const char* configfile)
+{
+	size_t cursor = 0;
+	uint32 key;
+	while( this->store.next(KV_VAR, cursor, key) )
+	{
+		size_t len;
+		const char* data = this->store.get(KV_VAR, key, len);
+		if( data && len && memchr(data, 0, len) )
+			this->names.insert(data, key);
+	}
+	return true;
+}
+
+bool CVarDB_kv::decode(uint32 key, CVar& var)
+{
+	size_t len;
+	const char* data = this->store.get(KV_VAR, key, len);
+	if( !data || len<2 || data[len-1] )
+		return false;
+	const char* value = (const char*)memchr(data, 0, len);
+	var = CVar(data, value+1);
+	return true;
+}
+
+bool CVarDB_kv::write(uint32 key, const char* name, const char* value)
+{
+	const size_t nlen = strlen(name)+1;
+	const size_t vlen = strlen(value)+1;
+	char* buf = new char[nlen+vlen];
+	memcpy(buf, name, nlen);
+	memcpy(buf+nlen, value, vlen);
+	const bool ret = this->store.put(KV_VAR, key, buf, nlen+vlen);
+	delete[] buf;
+	return ret;
+}
+
+size_t CVarDB_kv::size() const
+{
+	return this->store.count(KV_VAR);
+}
+
+CVar& CVarDB_kv::operator[](size_t i)
+{	// not threadsafe
+	static CVar var;
+	uint32 key;
+	if( !this->store.at(KV_VAR, i, key) || !this->decode(key, var) )
+		var = CVar("","");
+	return var;
+}
+
+bool CVarDB_kv::searchVar(const char* name, CVar& var)
+{
+	const uint32 key = this->names.find(name);
+	return key && this->decode(key, var);
+}
+
+bool CVarDB_kv::insertVar(const char* name, const char* value)
+{
+	if( this->names.find(name) )
+		return false;
+	const uint32 key = this->store.next_id(KV_VAR);
+	if( !this->write(key, name, value) )
+		return false;
+	this->names.insert(name, key);
+	return true;
+}
+
+bool CVarDB_kv::removeVar(const char* name)
+{
+	const uint32 key = this->names.find(name);
+	if( !key )
+		return false;
+	this->names.remove(name);
+	return this->store.remove(KV_VAR, key);
+}
+
+bool CVarDB_kv::saveVar(const CVar& var)
+{
+	const uint32 key = this->names.find(var.name());
+	if( !key )
+		return this->insertVar(var.name(), var.value());
+	return this->write(key, var.name(), var.value());
+}
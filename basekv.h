@@ -0,0 +1,478 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _BASEKV_H_
+#define _BASEKV_H_
+
+#include "baseio.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// record namespaces of the embedded store.
+enum kv_ns
+{
+	KV_META = 0,		///< id counters
+	KV_ACCOUNT,
+	KV_CHAR,
+	KV_CHARACCOUNT,		///< account data as seen by the char server
+	KV_MAIL,
+	KV_GUILD,
+	KV_CASTLE,
+	KV_PARTY,
+	KV_PCSTORAGE,
+	KV_GUILDSTORAGE,
+	KV_PET,
+	KV_HOMUNCULUS,
+	KV_VAR,
+	KV_MAX
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// embedded log-structured store.
+/// all records live in one append-only file, a record is a header with
+/// namespace, key, length and crc32 followed by the data. a put appends
+/// the new version, a remove appends a tombstone; an in-memory hash index
+/// points to the latest version of each key. reads go through a read-only
+/// memory map of the file, so get() does not copy.
+///
+/// compaction runs in steps: once the dead bytes outweigh the live ones
+/// every write copies a few live records to a new file, writes made in the
+/// meantime go to both files. when all records are copied the new file
+/// replaces the old one.
+/// a snapshot is a copy of the file up to its current end, which is a
+/// consistent state since nothing before the end ever changes.
+///
+/// opened without a path the store keeps the log in a heap buffer only
+/// and compacts it in place, the databases run on it without any file
+/// (the kvmem engine of dbbench). the plain in-memory tables are in basemem.h.
+///
+/// the store only knows bytes, the databases encode their records field
+/// by field (see the field maps in basekv.cpp), so a record does not
+/// depend on the layout of the structs it is read into.
+class CKVStore
+{
+	///////////////////////////////////////////////////////////////////////////
+	/// index entry
+	struct entry
+	{
+		uint64	key;	///< namespace<<32 | key, KV_EMPTY or KV_DELETED when unused
+		uint64	pos;	///< file offset of the record
+		uint32	len;	///< data length
+	};
+
+	int			fd;			///< file handle
+	char*		base;		///< view of the file
+	size_t		base_len;	///< mapped length
+	uint64		file_len;	///< current end of the file
+	char		path[256];
+
+	entry*		index;
+	size_t		index_cap;	///< number of slots, power of 2
+	size_t		index_used;	///< slots with a live key
+	size_t		index_dead;	///< slots with a deleted marker
+	size_t		ns_count[KV_MAX];
+
+	uint64		live_bytes;	///< bytes of records that are the latest version
+	uint64		dead_bytes;	///< bytes of overwritten records and tombstones
+	size_t		unsynced;	///< writes since the last sync
+
+	int			cmp_fd;		///< file being compacted into, -1 when idle
+	size_t		cmp_slot;	///< next index slot to copy
+	uint64		cmp_len;	///< end of the compaction file
+
+	bool		memory;		///< no file, the log is a heap buffer
+	size_t		mem_cap;	///< allocated size of the heap buffer
+
+	CKVStore(const CKVStore&);
+	const CKVStore& operator=(const CKVStore&);
+public:
+	///////////////////////////////////////////////////////////////////////////
+	/// sync after this number of writes, 0 leaves it to the system
+	static basics::CParam<uint32> kv_sync;
+	/// start compacting when the file is at least this large
+	static basics::CParam<uint32> kv_compact_min;
+	/// number of records copied by each compaction step
+	static basics::CParam<uint32> kv_compact_step;
+
+	///////////////////////////////////////////////////////////////////////////
+	CKVStore();
+	~CKVStore();
+
+	/// open or create the file and build the index,
+	/// an empty path opens a store that lives in memory only
+	bool open(const char* path);
+	/// sync and close
+	void close();
+	bool is_open() const	{ return this->fd>=0 || this->memory; }
+
+	/// data of a key or NULL, valid until the next write
+	const char* get(uchar ns, uint32 key, size_t& len);
+	bool exists(uchar ns, uint32 key) const;
+
+	/// write a new version of a key
+	bool put(uchar ns, uint32 key, const void* data, size_t len);
+	/// remove a key
+	bool remove(uchar ns, uint32 key);
+
+	/// number of keys in a namespace
+	size_t count(uchar ns) const	{ return (ns<KV_MAX)?this->ns_count[ns]:0; }
+	/// iterate the keys of a namespace, start with cursor=0
+	bool next(uchar ns, size_t& cursor, uint32& key) const;
+	/// the i-th key of a namespace in index order
+	bool at(uchar ns, size_t i, uint32& key) const;
+	/// allocate a new key for a namespace, keys start with first
+	uint32 next_id(uchar ns, uint32 first=1);
+
+	/// flush the file to disk
+	bool sync();
+	/// write a consistent copy of the store to path
+	bool snapshot(const char* path);
+	/// run a compaction step when one is due
+	void compact();
+
+private:
+	bool map(size_t len);
+	void unmap();
+	bool append(int to, uint64& end, uchar op, uchar ns, uint32 key, const void* data, size_t len);
+	bool scan();
+	entry* find(uint64 k) const;
+	entry* insert(uint64 k);
+	void erase(entry* e);
+	bool rehash(size_t cap);
+	bool compact_start();
+	void compact_abort();
+	bool compact_finish();
+	void compact_memory();
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// name to key index for the lookups by name.
+class CKVNameIndex
+{
+	struct entry
+	{
+		uint32	hash;
+		uint32	key;	///< 0 when unused
+		char	name[64];
+	};
+	entry*	table;
+	size_t	cap;
+	size_t	used;
+	bool	nocase;
+
+	CKVNameIndex(const CKVNameIndex&);
+	const CKVNameIndex& operator=(const CKVNameIndex&);
+public:
+	CKVNameIndex() : table(NULL), cap(0), used(0), nocase(false)
+	{}
+	~CKVNameIndex()
+	{
+		if(table) delete[] table;
+	}
+	void case_sensitive(bool on)	{ this->nocase = !on; }
+	void clear();
+	/// key of a name or 0
+	uint32 find(const char* name) const;
+	bool insert(const char* name, uint32 key);
+	bool remove(const char* name);
+private:
+	uint32 hash(const char* name) const;
+	bool equal(const char* a, const char* b) const;
+	bool grow();
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// owner to keys index for the lookups by owner,
+/// ie. the mails of a char or the chars of an account.
+/// the keys of an owner are kept in ascending order.
+class CKVOwnerIndex
+{
+	struct entry
+	{
+		uint32	owner;	///< 0 when unused
+		uint32	cnt;
+		uint32	cap;
+		uint32*	keys;
+	};
+	entry*	table;
+	size_t	cap;
+	size_t	used;
+
+	CKVOwnerIndex(const CKVOwnerIndex&);
+	const CKVOwnerIndex& operator=(const CKVOwnerIndex&);
+public:
+	CKVOwnerIndex() : table(NULL), cap(0), used(0)
+	{}
+	~CKVOwnerIndex()
+	{
+		this->clear();
+	}
+	void clear();
+	/// keys of an owner or NULL, valid until the next insert or remove
+	const uint32* find(uint32 owner, size_t& cnt) const;
+	bool insert(uint32 owner, uint32 key);
+	bool remove(uint32 owner, uint32 key);
+private:
+	entry* lookup(uint32 owner) const;
+	bool grow();
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// common part of the embedded databases.
+/// each database keeps its own file "<kv_path><name>.kv", so the login
+/// and char server never share a file. with memory set nothing is written.
+class CKVParameter
+{
+protected:
+	static basics::CParam< basics::string<> > kv_path;
+	static basics::CParam< basics::string<> > db_engine;
+
+	CKVStore store;
+
+	CKVParameter(const char* configfile, const char* name, bool memory=false);
+	~CKVParameter()
+	{}
+public:
+	/// write a snapshot of the database next to its file
+	bool snapshot(const char* path)	{ return this->store.snapshot(path); }
+
+	/// true when the config selects the embedded store ("db_engine: kv").
+	/// the getDB factories use it to choose between the _sql and _kv classes,
+	/// without mysql support the embedded store is always used.
+	static bool selected(const char* configfile=NULL);
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CAccountDB_kv : public CAccountDBInterface, public CKVParameter
+{
+	CKVNameIndex names;
+public:
+	CAccountDB_kv(const char* configfile=NULL, bool memory=false) : CKVParameter(configfile, "account", memory)
+	{
+		this->init(configfile);
+	}
+	virtual ~CAccountDB_kv()
+	{}
+protected:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CLoginAccount& operator[](size_t i);
+
+	virtual bool existAccount(const char* userid);
+	virtual bool searchAccount(const char* userid, CLoginAccount&account);
+	virtual bool searchAccount(uint32 accid, CLoginAccount&account);
+	virtual bool insertAccount(const char* userid, const char* passwd, unsigned char sex, const char* email, CLoginAccount&account);
+	virtual bool removeAccount(uint32 accid);
+	virtual bool saveAccount(const CLoginAccount& account);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CCharDB_kv : public CCharDBInterface, public CKVParameter
+{
+	CKVNameIndex names;
+	CKVOwnerIndex account_chars;	///< chars of an account
+	CKVOwnerIndex char_mails;		///< mails of a char
+public:
+	CCharDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "char", memory)
+	{
+		this->init(dbcfgfile);
+	}
+	virtual ~CCharDB_kv()
+	{}
+protected:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CCharCharacter& operator[](size_t i);
+
+	virtual bool existChar(const char* name);
+	virtual bool existChar(uint32 char_id);
+	virtual bool searchChar(const char* name, CCharCharacter&data);
+	virtual bool searchChar(uint32 char_id, CCharCharacter&data);
+	virtual bool insertChar(CCharAccount &account, const char *name, unsigned char str, unsigned char agi, unsigned char vit, unsigned char int_, unsigned char dex, unsigned char luk, unsigned char slot, unsigned char hair_style, unsigned char hair_color, CCharCharacter&data);
+	virtual bool removeChar(uint32 charid);
+	virtual bool saveChar(const CCharCharacter& data);
+
+	virtual bool searchAccount(uint32 accid, CCharCharAccount& account);
+	virtual bool saveAccount(CCharAccount& account);
+	virtual bool removeAccount(uint32 accid);
+
+	virtual size_t getMailCount(uint32 cid, uint32 &all, uint32 &unread);
+	virtual size_t listMail(uint32 cid, unsigned char box, unsigned char *buffer);
+	virtual bool readMail(uint32 cid, uint32 mid, CMail& mail);
+	virtual bool deleteMail(uint32 cid, uint32 mid);
+	virtual bool sendMail(uint32 senderid, const char* sendername, const char* targetname, const char *head, const char *body, uint32 zeny, const struct item& item, uint32& msgid, uint32& tid);
+
+	virtual void loadfamelist();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CGuildDB_kv : public CGuildDBInterface, public CKVParameter
+{
+	CKVNameIndex names;
+public:
+	CGuildDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "guild", memory)
+	{
+		this->init(dbcfgfile);
+	}
+	virtual ~CGuildDB_kv()
+	{}
+private:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CGuild& operator[](size_t i);
+
+	virtual size_t castlesize() const;
+	virtual CCastle &castle(size_t i);
+
+	virtual bool searchGuild(const char* name, CGuild& guild);
+	virtual bool searchGuild(uint32 guildid, CGuild& guild);
+	virtual bool insertGuild(const struct guild_member &member, const char *name, CGuild &g);
+	virtual bool removeGuild(uint32 guild_id);
+	virtual bool saveGuild(const CGuild& g);
+
+	virtual bool searchCastle(ushort castleid, CCastle& castle);
+	virtual bool saveCastle(const CCastle& castle);
+	virtual bool removeCastle(ushort castle_id);
+
+	virtual bool getCastles(basics::vector<CCastle>& castlevector);
+	virtual uint32 has_conflict(uint32 guild_id, uint32 account_id, uint32 char_id);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPartyDB_kv : public CPartyDBInterface, public CKVParameter
+{
+	CKVNameIndex names;
+public:
+	CPartyDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "party", memory)
+	{
+		this->init(dbcfgfile);
+	}
+	virtual ~CPartyDB_kv()
+	{}
+private:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CParty& operator[](size_t i);
+
+	virtual bool searchParty(const char* name, CParty& p);
+	virtual bool searchParty(uint32 pid, CParty& p);
+	virtual bool insertParty(uint32 accid, const char* nick, const char* mapname, ushort lv, const char* name, CParty& p);
+	virtual bool removeParty(uint32 pid);
+	virtual bool saveParty(const CParty& p);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPCStorageDB_kv : public CPCStorageDBInterface, public CKVParameter
+{
+public:
+	CPCStorageDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "storage", memory)
+	{}
+	virtual ~CPCStorageDB_kv()
+	{}
+
+	virtual size_t size() const;
+	virtual CPCStorage& operator[](size_t i);
+
+	virtual bool searchStorage(uint32 accid, CPCStorage& stor);
+	virtual bool removeStorage(uint32 accid);
+	virtual bool saveStorage(const CPCStorage& stor);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CGuildStorageDB_kv : public CGuildStorageDBInterface, public CKVParameter
+{
+public:
+	CGuildStorageDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "guild_storage", memory)
+	{}
+	virtual ~CGuildStorageDB_kv()
+	{}
+
+	virtual size_t size() const;
+	virtual CGuildStorage& operator[](size_t i);
+
+	virtual bool searchStorage(uint32 gid, CGuildStorage& stor);
+	virtual bool removeStorage(uint32 gid);
+	virtual bool saveStorage(const CGuildStorage& stor);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPetDB_kv : public CPetDBInterface, public CKVParameter
+{
+public:
+	CPetDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "pet", memory)
+	{}
+	virtual ~CPetDB_kv()
+	{}
+
+	virtual size_t size() const;
+	virtual CPet& operator[](size_t i);
+
+	virtual bool searchPet(uint32 pid, CPet& pet);
+	virtual bool insertPet(uint32 accid, uint32 cid, short pet_class, short pet_lv, short pet_egg_id, ushort pet_equip, short intimate, short hungry, char renameflag, char incuvat, char *pet_name, CPet& pet);
+	virtual bool removePet(uint32 pid);
+	virtual bool savePet(const CPet& pet);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CHomunculusDB_kv : public CHomunculusDBInterface, public CKVParameter
+{
+public:
+	CHomunculusDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "homunculus", memory)
+	{}
+	virtual ~CHomunculusDB_kv()
+	{}
+
+	virtual size_t size() const;
+	virtual CHomunculus& operator[](size_t i);
+
+	virtual bool searchHomunculus(uint32 hid, CHomunculus& hom);
+	virtual bool insertHomunculus(CHomunculus& hom);
+	virtual bool removeHomunculus(uint32 hid);
+	virtual bool saveHomunculus(const CHomunculus& hom);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// variables are stored as "name\0value\0"
+class CVarDB_kv : public CVarDBInterface, public CKVParameter
+{
+	CKVNameIndex names;
+public:
+	CVarDB_kv(const char *dbcfgfile, bool memory=false) : CKVParameter(dbcfgfile, "variable", memory)
+	{
+		this->init(dbcfgfile);
+	}
+	virtual ~CVarDB_kv()
+	{}
+private:
+	bool init(const char* configfile);
+	bool decode(uint32 key, CVar& var);
+	bool write(uint32 key, const char* name, const char* value);
+public:
+	virtual size_t size() const;
+	virtual CVar& operator[](size_t i);
+
+	virtual bool searchVar(const char* name, CVar& var);
+	virtual bool insertVar(const char* name, const char* value);
+	virtual bool removeVar(const char* name);
+	virtual bool saveVar(const CVar& var);
+};
+
+
+#endif//_BASEKV_H_
@@ -0,0 +1,862 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "basemem.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// accounts
+static basics::CParam<uint32> mem_start_account_num("start_account_num", 10000000);
+static basics::CParam<uint32> mem_start_char_num("start_char_num", 20000000);
+
+bool CAccountDB_mem::init(const char* configfile)
+{
+	CLoginAccount account;
+	if(configfile) basics::CParamBase::loadFile(configfile);
+	this->next_id = mem_start_account_num;
+	this->names.case_sensitive(this->case_sensitive);
+	// same server accounts as the sql database
+	this->insertAccount("s1", "p1", 'S', "", account);
+	this->insertAccount("s2", "p2", 'S', "", account);
+	this->insertAccount("s3", "p3", 'S', "", account);
+	return true;
+}
+
+size_t CAccountDB_mem::size() const
+{
+	return this->accounts.size();
+}
+
+CLoginAccount& CAccountDB_mem::operator[](size_t i)
+{
+	return this->accounts[i];
+}
+
+bool CAccountDB_mem::existAccount(const char* userid)
+{
+	return 0 != this->names.find(userid);
+}
+
+bool CAccountDB_mem::searchAccount(const char* userid, CLoginAccount& account)
+{
+	const uint32 accid = this->names.find(userid);
+	return accid && this->accounts.get(accid, account);
+}
+
+bool CAccountDB_mem::searchAccount(uint32 accid, CLoginAccount& account)
+{
+	return this->accounts.get(accid, account);
+}
+
+bool CAccountDB_mem::insertAccount(const char* userid, const char* passwd, unsigned char sex, const char* email, CLoginAccount& account)
+{
+	if( this->existAccount(userid) )
+		return false;
+	CLoginAccount a;
+	a.account_id = this->next_id++;
+	safestrcpy(a.userid, sizeof(a.userid), userid);
+	safestrcpy(a.passwd, sizeof(a.passwd), passwd);
+	safestrcpy(a.email, sizeof(a.email), email);
+	a.sex = (sex=='S') ? 2 : (sex=='M');
+	this->accounts.put(a.account_id, a);
+	this->names.insert(a.userid, a.account_id);
+	account = a;
+	return true;
+}
+
+bool CAccountDB_mem::removeAccount(uint32 accid)
+{
+	const CLoginAccount* a = this->accounts.find(accid);
+	if( !a )
+		return false;
+	this->names.remove(a->userid);
+	return this->accounts.remove(accid);
+}
+
+bool CAccountDB_mem::saveAccount(const CLoginAccount& account)
+{
+	const CLoginAccount* old = this->accounts.find(account.account_id);
+	if( !old )
+		return false;
+	if( 0!=strcmp(old->userid, account.userid) )
+	{
+		this->names.remove(old->userid);
+		this->names.insert(account.userid, account.account_id);
+	}
+	this->accounts.put(account.account_id, account);
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// chars
+bool CCharDB_mem::init(const char* configfile)
+{
+	if(configfile) basics::CParamBase::loadFile(configfile);
+	this->next_char = mem_start_char_num;
+	this->next_mail = 1;
+	return true;
+}
+
+size_t CCharDB_mem::size() const
+{
+	return this->chars.size();
+}
+
+CCharCharacter& CCharDB_mem::operator[](size_t i)
+{
+	return this->chars[i];
+}
+
+bool CCharDB_mem::existChar(const char* name)
+{
+	return 0 != this->names.find(name);
+}
+
+bool CCharDB_mem::existChar(uint32 char_id)
+{
+	return this->chars.exists(char_id);
+}
+
+bool CCharDB_mem::searchChar(const char* name, CCharCharacter& p)
+{
+	const uint32 char_id = this->names.find(name);
+	return char_id && this->chars.get(char_id, p);
+}
+
+bool CCharDB_mem::searchChar(uint32 char_id, CCharCharacter& p)
+{
+	return this->chars.get(char_id, p);
+}
+
+bool CCharDB_mem::insertChar(CCharAccount &account,
+					const char *n,
+					unsigned char str,
+					unsigned char agi,
+					unsigned char vit,
+					unsigned char int_,
+					unsigned char dex,
+					unsigned char luk,
+					unsigned char slot,
+					unsigned char hair_style,
+					unsigned char hair_color,
+					CCharCharacter &p)
+{
+	p = CCharCharacter(n);
+	if( this->existChar(p.name) )
+	{
+		ShowError("char creation failed, charname '%s' already in use\n", p.name);
+		return false;
+	}
+
+	// check char slot
+	size_t i, cnt;
+	const uint32* keys = this->account_chars.find(account.account_id, cnt);
+	for(i=0; i<cnt; ++i)
+	{
+		const CCharCharacter* c = this->chars.find(keys[i]);
+		if( c && c->slot==slot )
+		{
+			ShowError("char creation failed, (aid: %d, slot: %d), slot already in use\n", account.account_id, slot);
+			return false;
+		}
+	}
+
+	p.char_id = this->next_char++;
+	p.account_id = account.account_id;
+	p.slot = slot;
+	p.class_ = 0;
+	p.base_level = 1;
+	p.job_level = 1;
+	p.base_exp = 0;
+	p.job_exp = 0;
+	p.zeny = start_zeny;
+	p.str = str;
+	p.agi = agi;
+	p.vit = vit;
+	p.int_ = int_;
+	p.dex = dex;
+	p.luk = luk;
+	p.max_hp = 40 * (100 + vit) / 100;
+	p.max_sp = 11 * (100 + int_) / 100;
+	p.hp = p.max_hp;
+	p.sp = p.max_sp;
+	p.status_point = 0;
+	p.skill_point = 0;
+	p.option = 0;
+	p.karma = 0;
+	p.chaos = 0;
+	p.manner = 0;
+	p.party_id = 0;
+	p.guild_id = 0;
+	p.hair = hair_style;
+	p.hair_color = hair_color;
+	p.clothes_color = 0;
+	p.inventory[0].nameid = start_weapon; // Knife
+	p.inventory[0].amount = 1;
+	p.inventory[0].equip = 0x02;
+	p.inventory[0].identify = 1;
+	p.inventory[1].nameid = start_armor; // Cotton Shirt
+	p.inventory[1].amount = 1;
+	p.inventory[1].equip = 0x10;
+	p.inventory[1].identify = 1;
+	p.weapon = 1;
+	p.shield = 0;
+	p.head_top = 0;
+	p.head_mid = 0;
+	p.head_bottom = 0;
+	p.last_point = start_point;
+	p.save_point = start_point;
+
+	this->chars.put(p.char_id, p);
+	this->names.insert(p.name, p.char_id);
+	this->account_chars.insert(p.account_id, p.char_id);
+	return true;
+}
+
+bool CCharDB_mem::removeChar(uint32 charid)
+{
+	const CCharCharacter* p = this->chars.find(charid);
+	if( !p )
+		return false;
+	this->names.remove(p->name);
+	this->account_chars.remove(p->account_id, charid);
+
+	// the mails go with the char, from the back so the list stays valid
+	size_t cnt;
+	const uint32* keys = this->char_mails.find(charid, cnt);
+	while( keys && cnt-- )
+	{
+		const uint32 key = keys[cnt];
+		this->mails.remove(key);
+		this->char_mails.remove(charid, key);
+	}
+	return this->chars.remove(charid);
+}
+
+bool CCharDB_mem::saveChar(const CCharCharacter& p)
+{
+	const CCharCharacter* old = this->chars.find(p.char_id);
+	if( !old )
+		this->account_chars.insert(p.account_id, p.char_id);
+	else
+	{
+		if( 0!=strcmp(old->name, p.name) )
+		{
+			this->names.remove(old->name);
+			this->names.insert(p.name, p.char_id);
+		}
+		if( old->account_id != p.account_id )
+		{
+			this->account_chars.remove(old->account_id, p.char_id);
+			this->account_chars.insert(p.account_id, p.char_id);
+		}
+	}
+	this->chars.put(p.char_id, p);
+	return true;
+}
+
+bool CCharDB_mem::searchAccount(uint32 accid, CCharCharAccount& account)
+{
+	if( !accid || !this->accounts.get(accid, account) )
+		return false;
+
+	// associated chars
+	size_t i, cnt;
+	const uint32* keys = this->account_chars.find(accid, cnt);
+	for(i=0; i<9; ++i)
+		account.charlist[i] = 0;
+	for(i=0; i<cnt; ++i)
+	{
+		const CCharCharacter* c = this->chars.find(keys[i]);
+		if( c && c->slot<9 )
+		{
+			if( account.charlist[c->slot] != 0 )
+				ShowError("CharDB: doubled used slot %i for account_id %i\n", c->slot, accid);
+			account.charlist[c->slot] = c->char_id;
+		}
+	}
+	return true;
+}
+
+bool CCharDB_mem::saveAccount(CCharAccount& account)
+{	// same as the embedded store, only the CCharCharAccount part is kept
+	this->accounts.put(account.account_id, static_cast<CCharCharAccount&>(account));
+	return true;
+}
+
+bool CCharDB_mem::removeAccount(uint32 accid)
+{
+	return this->accounts.remove(accid);
+}
+
+size_t CCharDB_mem::getMailCount(uint32 cid, uint32 &all, uint32 &unread)
+{
+	size_t i, cnt;
+	const uint32* keys = this->char_mails.find(cid, cnt);
+	all = unread = 0;
+	for(i=0; i<cnt; ++i)
+	{
+		const mailrec* m = this->mails.find(keys[i]);
+		if( m )
+		{
+			++all;
+			if( !m->read_flag )
+				++unread;
+		}
+	}
+	return all;
+}
+
+size_t CCharDB_mem::listMail(uint32 cid, unsigned char box, unsigned char *buffer)
+{
+	unsigned char *buf = buffer;
+	size_t i, cnt, count = 0;
+	const uint32* keys = this->char_mails.find(cid, cnt);
+	for(i=0; i<cnt; ++i)
+	{
+		const mailrec* m = this->mails.find(keys[i]);
+		if( m )
+		{
+			CMailHead mailhead(m->message_id, m->read_flag, m->from_name, m->sendtime, m->header);
+			mailhead._tobuffer(buf); // automatic buffer increment
+			++count;
+		}
+	}
+	return count;
+}
+
+bool CCharDB_mem::readMail(uint32 cid, uint32 mid, CMail& mail)
+{
+	// default clearing
+	mail.read    = 0;
+	mail.name[0] = 0;
+	mail.head[0] = 0;
+	mail.body[0] = 0;
+	mailrec* m = this->mails.find(mid);
+	if( !m || m->to_char_id != cid )
+		return false;
+
+	mail = CMail(mid, m->read_flag, m->from_name, m->header, m->sendtime, m->zeny, m->item, m->message);
+	if( 0==m->read_flag )
+	{	// attachments are handed out once
+		m->read_flag = 1;
+		m->zeny = 0;
+		memset(&m->item, 0, sizeof(m->item));
+	}
+	return true;
+}
+
+bool CCharDB_mem::deleteMail(uint32 cid, uint32 mid)
+{
+	const mailrec* m = this->mails.find(mid);
+	if( !m || m->to_char_id != cid )
+		return false;
+	this->mails.remove(mid);
+	this->char_mails.remove(cid, mid);
+	return true;
+}
+
+bool CCharDB_mem::sendMail(uint32 senderid, const char* sendername, const char* targetname, const char *head, const char *body, uint32 zeny, const struct item& item, uint32& msgid, uint32& tid)
+{
+	mailrec m;
+	memset(&m, 0, sizeof(m));
+	m.sendtime = (uint32)time(NULL);
+	m.zeny = zeny;
+	m.item = item;
+	m.item.equip = 0;
+	safestrcpy(m.from_name, sizeof(m.from_name), sendername);
+	safestrcpy(m.header, sizeof(m.header), head);
+	safestrcpy(m.message, sizeof(m.message), body);
+
+	if( 0==strcmp(targetname,"*") )
+	{	// send to all
+		size_t i;
+		bool ret = false;
+		for(i=0; i<this->chars.size(); ++i)
+		{
+			const uint32 key = this->chars.key(i);
+			if( key == senderid )
+				continue;
+			m.to_char_id = key;
+			m.message_id = this->next_mail++;
+			this->mails.put(m.message_id, m);
+			this->char_mails.insert(m.to_char_id, m.message_id);
+			ret = true;
+		}
+		msgid = m.message_id;
+		tid = 0;
+		return ret;
+	}
+
+	m.to_char_id = this->names.find(targetname);
+	if( !m.to_char_id )
+		return false;
+	m.message_id = this->next_mail++;
+	msgid = m.message_id;
+	tid = m.to_char_id;
+	this->mails.put(m.message_id, m);
+	this->char_mails.insert(m.to_char_id, m.message_id);
+	return true;
+}
+
+void CCharDB_mem::loadfamelist()
+{
+	const static fame_t fametype[] = {FAME_PK, FAME_SMITH, FAME_CHEM, FAME_TEAK};
+	const static char* famevar[] = {"PC_PK_FAME", "PC_SMITH_FAME", "PC_CHEM_FAME", "PC_TEAK_FAME"};
+
+	// best values first
+	uint32 ids[4][MAX_FAMELIST+1], values[4][MAX_FAMELIST+1];
+	size_t cnt[4] = {0,0,0,0};
+	size_t n, i, k;
+
+	for(n=0; n<this->chars.size(); ++n)
+	{
+		const CCharCharacter& c = this->chars[n];
+		for(i=0; i<4; ++i)
+		{	// same class restrictions as the sql database
+			if( (i==1 && c.class_!=10 && c.class_!=4011 && c.class_!=4033) ||
+				(i==2 && c.class_!=18 && c.class_!=4019 && c.class_!=4041) ||
+				(i==3 && c.class_!=4046) )
+				continue;
+			for(k=0; k<c.global_reg_num && k<GLOBAL_REG_NUM; ++k)
+			{
+				if( 0==strcmp(c.global_reg[k].str, famevar[i]) )
+					break;
+			}
+			if( k>=c.global_reg_num || k>=GLOBAL_REG_NUM || c.global_reg[k].value <= 0 )
+				continue;
+
+			const uint32 v = c.global_reg[k].value;
+			size_t pos = cnt[i];
+			while( pos>0 && values[i][pos-1] < v )
+				--pos;
+			if( pos > MAX_FAMELIST )
+				continue;
+			if( cnt[i] < MAX_FAMELIST+1 )
+				++cnt[i];
+			for(k=cnt[i]-1; k>pos; --k)
+			{
+				ids[i][k] = ids[i][k-1];
+				values[i][k] = values[i][k-1];
+			}
+			ids[i][pos] = c.char_id;
+			values[i][pos] = v;
+		}
+	}
+
+	for(i=0; i<4; ++i)
+	{
+		CFameList &fl = this->famelists[fametype[i]];
+		fl.clear();
+		for(k=0; k<cnt[i]; ++k)
+		{
+			const CCharCharacter* p = this->chars.find(ids[i][k]);
+			fl.cEntry[k] = CFameList::fameentry(ids[i][k], p?p->name:"", values[i][k]);
+		}
+		fl.cCount = k;
+		for( ; k<MAX_FAMELIST+1; ++k)
+			fl.cEntry[k] = CFameList::fameentry(0, "", 0);
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// guilds
+bool CGuildDB_mem::init(const char* configfile)
+{
+	size_t i;
+	if(configfile) basics::CParamBase::loadFile(configfile);
+	this->next_id = 1;
+	for(i=0; i<MAX_GUILDCASTLE; ++i)
+		this->saveCastle( CCastle(i) ); // constructor takes care of all settings
+	return true;
+}
+
+size_t CGuildDB_mem::size() const
+{
+	return this->guilds.size();
+}
+
+CGuild& CGuildDB_mem::operator[](size_t i)
+{
+	return this->guilds[i];
+}
+
+size_t CGuildDB_mem::castlesize() const
+{
+	return this->castles.size();
+}
+
+CCastle& CGuildDB_mem::castle(size_t i)
+{
+	return this->castles[i];
+}
+
+bool CGuildDB_mem::searchGuild(const char* name, CGuild& g)
+{
+	const uint32 guild_id = this->names.find(name);
+	return guild_id && this->guilds.get(guild_id, g);
+}
+
+bool CGuildDB_mem::searchGuild(uint32 guild_id, CGuild& g)
+{
+	return this->guilds.get(guild_id, g);
+}
+
+bool CGuildDB_mem::insertGuild(const struct guild_member &m, const char *name, CGuild &g)
+{
+	size_t i;
+	if( this->names.find(name) )
+		return false;
+
+	// construct initial guild
+	g = CGuild(name);
+	g.member[0] = m;
+	safestrcpy(g.master, sizeof(g.master), m.name);
+	g.position[0].mode=0x11;
+	safestrcpy(g.position[0].name, sizeof(g.position[0].name),"GuildMaster");
+	safestrcpy(g.position[MAX_GUILDPOSITION-1].name, sizeof(g.position[0].name),"Newbie");
+	for(i=1; i<MAX_GUILDPOSITION-1; ++i)
+		snprintf(g.position[i].name,sizeof(g.position[0].name),"Position %ld",(unsigned long)(i+1));
+
+	g.max_member=(16>MAX_GUILD)?MAX_GUILD:16;
+	g.average_lv=g.member[0].lv;
+	for(i=0;i<MAX_GUILDSKILL;++i)
+	{
+		g.skill[i].id = i+GD_SKILLBASE;
+		g.skill[i].lv = 0;
+	}
+
+	g.guild_id = this->next_id++;
+	this->saveGuild(g);
+	this->names.insert(g.name, g.guild_id);
+	return true;
+}
+
+bool CGuildDB_mem::removeGuild(uint32 guild_id)
+{
+	const CGuild* g = this->guilds.find(guild_id);
+	if( !g )
+		return false;
+	this->names.remove(g->name);
+	this->guilds.remove(guild_id);
+
+	// drop the alliances with it
+	size_t i, k;
+	for(k=0; k<this->guilds.size(); ++k)
+	{
+		CGuild& a = this->guilds[k];
+		for(i=0; i<MAX_GUILDALLIANCE; ++i)
+		{
+			if( a.alliance[i].guild_id == guild_id )
+				memset(&a.alliance[i], 0, sizeof(a.alliance[i]));
+		}
+	}
+	return true;
+}
+
+bool CGuildDB_mem::saveGuild(const CGuild& g)
+{	// always the full guild, the save flags only matter for sql
+	this->guilds.put(g.guild_id, g).save_flags = 0;
+	return true;
+}
+
+bool CGuildDB_mem::searchCastle(ushort castle_id, CCastle& castle)
+{
+	return this->castles.get(castle_id, castle);
+}
+
+bool CGuildDB_mem::saveCastle(const CCastle& castle)
+{
+	this->castles.put(castle.castle_id, castle);
+	return true;
+}
+
+bool CGuildDB_mem::removeCastle(ushort castle_id)
+{
+	return this->castles.remove(castle_id);
+}
+
+bool CGuildDB_mem::getCastles(basics::vector<CCastle>& castlevector)
+{
+	size_t i;
+	castlevector.clear();
+	for(i=0; i<this->castles.size(); ++i)
+		castlevector.push(this->castles[i]);
+	return true;
+}
+
+uint32 CGuildDB_mem::has_conflict(uint32 guild_id, uint32 account_id, uint32 char_id)
+{	// only the guild members are known here, not the guild_id of the chars
+	size_t i, k;
+	for(k=0; k<this->guilds.size(); ++k)
+	{
+		const CGuild& g = this->guilds[k];
+		if( g.guild_id==guild_id )
+			continue;
+		for(i=0; i<MAX_GUILD; ++i)
+		{
+			if( g.member[i].char_id == char_id && g.member[i].account_id == account_id )
+				return g.guild_id;
+		}
+	}
+	return 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// parties
+size_t CPartyDB_mem::size() const
+{
+	return this->parties.size();
+}
+
+CParty& CPartyDB_mem::operator[](size_t i)
+{
+	return this->parties[i];
+}
+
+bool CPartyDB_mem::searchParty(const char* name, CParty& p)
+{
+	const uint32 pid = this->names.find(name);
+	return pid && this->parties.get(pid, p);
+}
+
+bool CPartyDB_mem::searchParty(uint32 pid, CParty& p)
+{
+	return this->parties.get(pid, p);
+}
+
+bool CPartyDB_mem::insertParty(uint32 accid, const char* nick, const char* mapname, ushort lv, const char* name, CParty& p)
+{
+	if( this->names.find(name) )
+		return false;
+	p = CParty();
+	safestrcpy(p.name,sizeof(p.name),name);
+	p.expshare = 0;
+	p.itemshare= 0;
+	p.itemc    = 0;
+	p.member[0].account_id = accid;
+	safestrcpy( p.member[0].name, sizeof(p.member[0].name), nick );
+	safestrcpy( p.member[0].mapname, sizeof(p.member[0].mapname), mapname );
+	p.member[0].leader = 1;
+	p.member[0].online = 1;
+	p.member[0].lv = lv;
+	p.party_id = this->next_id++;
+	this->parties.put(p.party_id, p);
+	this->names.insert(p.name, p.party_id);
+	return true;
+}
+
+bool CPartyDB_mem::removeParty(uint32 pid)
+{
+	const CParty* p = this->parties.find(pid);
+	if( !p )
+		return false;
+	this->names.remove(p->name);
+	return this->parties.remove(pid);
+}
+
+bool CPartyDB_mem::saveParty(const CParty& p)
+{
+	this->parties.put(p.party_id, p);
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// storages
+size_t CPCStorageDB_mem::size() const
+{
+	return this->storages.size();
+}
+
+CPCStorage& CPCStorageDB_mem::operator[](size_t i)
+{
+	return this->storages[i];
+}
+
+bool CPCStorageDB_mem::searchStorage(uint32 accid, CPCStorage& stor)
+{
+	if( !this->storages.get(accid, stor) )
+	{	// empty storage, same as no rows in sql
+		memset(&stor, 0, sizeof(stor));
+		stor.account_id = accid;
+	}
+	return true;
+}
+
+bool CPCStorageDB_mem::removeStorage(uint32 accid)
+{
+	this->storages.remove(accid);
+	return true;
+}
+
+bool CPCStorageDB_mem::saveStorage(const CPCStorage& stor)
+{
+	this->storages.put(stor.account_id, stor);
+	return true;
+}
+
+size_t CGuildStorageDB_mem::size() const
+{
+	return this->storages.size();
+}
+
+CGuildStorage& CGuildStorageDB_mem::operator[](size_t i)
+{
+	return this->storages[i];
+}
+
+bool CGuildStorageDB_mem::searchStorage(uint32 gid, CGuildStorage& stor)
+{
+	if( !this->storages.get(gid, stor) )
+	{
+		memset(&stor, 0, sizeof(stor));
+		stor.guild_id = gid;
+	}
+	return true;
+}
+
+bool CGuildStorageDB_mem::removeStorage(uint32 gid)
+{
+	this->storages.remove(gid);
+	return true;
+}
+
+bool CGuildStorageDB_mem::saveStorage(const CGuildStorage& stor)
+{
+	this->storages.put(stor.guild_id, stor);
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// pets
+size_t CPetDB_mem::size() const
+{
+	return this->pets.size();
+}
+
+CPet& CPetDB_mem::operator[](size_t i)
+{
+	return this->pets[i];
+}
+
+bool CPetDB_mem::searchPet(uint32 pid, CPet& pet)
+{
+	return this->pets.get(pid, pet);
+}
+
+bool CPetDB_mem::insertPet(uint32 accid, uint32 cid, short pet_class, short pet_lv, short pet_egg_id, ushort pet_equip, short intimate, short hungry, char renameflag, char incuvat, char *pet_name, CPet& pd)
+{
+	pd.pet_id = this->next_id++;
+	pd.account_id = accid;
+	pd.char_id = cid;
+	pd.class_ = pet_class;
+	pd.level = pet_lv;
+	pd.egg_id = pet_egg_id;
+	pd.equip_id = pet_equip;
+	pd.intimate = intimate;
+	pd.hungry = hungry;
+	safestrcpy(pd.name, sizeof(pd.name), pet_name);
+	pd.rename_flag = renameflag;
+	pd.incuvate = incuvat;
+	this->pets.put(pd.pet_id, pd);
+	return true;
+}
+
+bool CPetDB_mem::removePet(uint32 pid)
+{
+	return this->pets.remove(pid);
+}
+
+bool CPetDB_mem::savePet(const CPet& pet)
+{
+	this->pets.put(pet.pet_id, pet);
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// homunculi
+size_t CHomunculusDB_mem::size() const
+{
+	return this->homunculi.size();
+}
+
+CHomunculus& CHomunculusDB_mem::operator[](size_t i)
+{
+	return this->homunculi[i];
+}
+
+bool CHomunculusDB_mem::searchHomunculus(uint32 hid, CHomunculus& hom)
+{
+	return this->homunculi.get(hid, hom);
+}
+
+bool CHomunculusDB_mem::insertHomunculus(CHomunculus& hom)
+{
+	hom.homun_id = this->next_id++;
+	this->homunculi.put(hom.homun_id, hom);
+	return true;
+}
+
+bool CHomunculusDB_mem::removeHomunculus(uint32 hid)
+{
+	return this->homunculi.remove(hid);
+}
+
+bool CHomunculusDB_mem::saveHomunculus(const CHomunculus& hom)
+{
+	this->homunculi.put(hom.homun_id, hom);
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// variables
+size_t CVarDB_mem::size() const
+{
+	return this->vars.size();
+}
+
+CVar& CVarDB_mem::operator[](size_t i)
+{
+	return this->vars[i];
+}
+
+bool CVarDB_mem::searchVar(const char* name, CVar& var)
+{
+	const uint32 key = this->names.find(name);
+	return key && this->vars.get(key, var);
+}
+
+bool CVarDB_mem::insertVar(const char* name, const char* value)
+{
+	if( this->names.find(name) )
+		return false;
+	const uint32 key = this->next_id++;
+	this->vars.put(key, CVar(name, value));
+	this->names.insert(name, key);
+	return true;
+}
+
+bool CVarDB_mem::removeVar(const char* name)
+{
+	const uint32 key = this->names.find(name);
+	if( !key )
+		return false;
+	this->names.remove(name);
+	return this->vars.remove(key);
+}
+
+bool CVarDB_mem::saveVar(const CVar& var)
+{
+	const uint32 key = this->names.find(var.name());
+	if( !key )
+		return this->insertVar(var.name(), var.value());
+	this->vars.put(key, var);
+	return true;
+}
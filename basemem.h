@@ -0,0 +1,420 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _BASEMEM_H_
+#define _BASEMEM_H_
+
+#include "basekv.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// id to record table.
+/// the records are kept by value in a dense array, a hash of the ids
+/// points into it. removing moves the last record into the gap, so
+/// references and pointers are only valid until the next insert or remove.
+template<typename T>
+class CMemTable
+{
+	struct slot
+	{
+		uint32	key;
+		uint32	pos;	///< index in the record array, EMPTY when unused
+	};
+	enum { EMPTY = 0xFFFFFFFF };
+
+	T*		data;
+	uint32*	keys;		///< id of each record
+	size_t	cnt;
+	size_t	cap;
+	slot*	hash;
+	size_t	hash_cap;	///< power of 2
+
+	CMemTable(const CMemTable&);
+	const CMemTable& operator=(const CMemTable&);
+public:
+	CMemTable() : data(NULL), keys(NULL), cnt(0), cap(0), hash(NULL), hash_cap(0)
+	{}
+	~CMemTable()
+	{
+		if(data) delete[] data;
+		if(keys) delete[] keys;
+		if(hash) delete[] hash;
+	}
+
+	size_t size() const				{ return this->cnt; }
+	/// the i-th record in no particular order
+	T& operator[](size_t i)			{ return this->data[i]; }
+	uint32 key(size_t i) const		{ return this->keys[i]; }
+
+	/// record of an id or NULL
+	T* find(uint32 k)
+	{
+		const slot* s = this->lookup(k);
+		return ( s && s->pos != EMPTY ) ? &this->data[s->pos] : NULL;
+	}
+	bool exists(uint32 k) const
+	{
+		const slot* s = this->lookup(k);
+		return s && s->pos != EMPTY;
+	}
+	/// copy a record out
+	bool get(uint32 k, T& t)
+	{
+		const T* p = this->find(k);
+		if( p )
+			t = *p;
+		return NULL != p;
+	}
+	/// insert or replace a record
+	T& put(uint32 k, const T& t)
+	{
+		slot* s = this->lookup(k);
+		if( !s || s->pos == EMPTY )
+		{
+			if( this->cnt >= this->cap )
+				this->grow();
+			if( (this->cnt+1)*2 > this->hash_cap )
+				this->rehash(this->hash_cap ? this->hash_cap*2 : 256);
+			s = this->lookup(k);
+			s->key = k;
+			s->pos = this->cnt;
+			this->keys[this->cnt++] = k;
+		}
+		return this->data[s->pos] = t;
+	}
+	bool remove(uint32 k)
+	{
+		slot* s = this->lookup(k);
+		if( !s || s->pos == EMPTY )
+			return false;
+		const size_t pos = s->pos;
+		this->erase(s);
+		if( pos != --this->cnt )
+		{	// move the last record into the gap
+			this->data[pos] = this->data[this->cnt];
+			this->keys[pos] = this->keys[this->cnt];
+			this->lookup(this->keys[pos])->pos = pos;
+		}
+		return true;
+	}
+
+private:
+	/// slot of an id or the free slot it would go to, NULL when empty
+	slot* lookup(uint32 k) const
+	{
+		if( !this->hash_cap )
+			return NULL;
+		const size_t mask = this->hash_cap-1;
+		size_t i = (k*2654435761u) & mask;
+		while( this->hash[i].pos != EMPTY && this->hash[i].key != k )
+			i = (i+1) & mask;
+		return &this->hash[i];
+	}
+	/// backward shift, no deleted markers needed
+	void erase(slot* s)
+	{
+		const size_t mask = this->hash_cap-1;
+		size_t i = s - this->hash, k;
+		this->hash[i].pos = EMPTY;
+		for(k = (i+1) & mask; this->hash[k].pos != EMPTY; k = (k+1) & mask)
+		{
+			const size_t home = (this->hash[k].key*2654435761u) & mask;
+			// move k to i when its home is not in ]i,k]
+			if( (i<k) ? (home<=i || home>k) : (home<=i && home>k) )
+			{
+				this->hash[i] = this->hash[k];
+				this->hash[k].pos = EMPTY;
+				i = k;
+			}
+		}
+	}
+	void grow()
+	{
+		const size_t c = this->cap ? this->cap*2 : 64;
+		T* d = new T[c];
+		uint32* k = new uint32[c];
+		size_t i;
+		for(i=0; i<this->cnt; ++i)
+		{
+			d[i] = this->data[i];
+			k[i] = this->keys[i];
+		}
+		if(this->data) delete[] this->data;
+		if(this->keys) delete[] this->keys;
+		this->data = d;
+		this->keys = k;
+		this->cap = c;
+	}
+	void rehash(size_t c)
+	{
+		size_t i;
+		if(this->hash) delete[] this->hash;
+		this->hash = new slot[c];
+		this->hash_cap = c;
+		for(i=0; i<c; ++i)
+			this->hash[i].pos = EMPTY;
+		for(i=0; i<this->cnt; ++i)
+		{
+			slot* s = this->lookup(this->keys[i]);
+			s->key = this->keys[i];
+			s->pos = i;
+		}
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// in-memory reference backend.
+/// the records are plain copies in tables, nothing is encoded or written
+/// and nothing survives a restart. used as baseline by dbbench and for
+/// testing the servers without any database setup.
+class CAccountDB_mem : public CAccountDBInterface
+{
+	CMemTable<CLoginAccount>	accounts;
+	CKVNameIndex				names;
+	uint32						next_id;
+public:
+	CAccountDB_mem(const char* configfile=NULL)
+	{
+		this->init(configfile);
+	}
+	virtual ~CAccountDB_mem()
+	{}
+protected:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CLoginAccount& operator[](size_t i);
+
+	virtual bool existAccount(const char* userid);
+	virtual bool searchAccount(const char* userid, CLoginAccount&account);
+	virtual bool searchAccount(uint32 accid, CLoginAccount&account);
+	virtual bool insertAccount(const char* userid, const char* passwd, unsigned char sex, const char* email, CLoginAccount&account);
+	virtual bool removeAccount(uint32 accid);
+	virtual bool saveAccount(const CLoginAccount& account);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CCharDB_mem : public CCharDBInterface
+{
+	/// mail as kept
+	struct mailrec
+	{
+		uint32		message_id;
+		uint32		to_char_id;
+		uint32		read_flag;
+		uint32		sendtime;
+		uint32		zeny;
+		struct item	item;
+		char		from_name[24];
+		char		header[32];
+		char		message[80];
+	};
+	CMemTable<CCharCharacter>	chars;
+	CMemTable<CCharCharAccount>	accounts;
+	CMemTable<mailrec>			mails;
+	CKVNameIndex				names;
+	CKVOwnerIndex				account_chars;	///< chars of an account
+	CKVOwnerIndex				char_mails;		///< mails of a char
+	uint32						next_char;
+	uint32						next_mail;
+public:
+	CCharDB_mem(const char* configfile=NULL)
+	{
+		this->init(configfile);
+	}
+	virtual ~CCharDB_mem()
+	{}
+protected:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CCharCharacter& operator[](size_t i);
+
+	virtual bool existChar(const char* name);
+	virtual bool existChar(uint32 char_id);
+	virtual bool searchChar(const char* name, CCharCharacter&data);
+	virtual bool searchChar(uint32 char_id, CCharCharacter&data);
+	virtual bool insertChar(CCharAccount &account, const char *name, unsigned char str, unsigned char agi, unsigned char vit, unsigned char int_, unsigned char dex, unsigned char luk, unsigned char slot, unsigned char hair_style, unsigned char hair_color, CCharCharacter&data);
+	virtual bool removeChar(uint32 charid);
+	virtual bool saveChar(const CCharCharacter& data);
+
+	virtual bool searchAccount(uint32 accid, CCharCharAccount& account);
+	virtual bool saveAccount(CCharAccount& account);
+	virtual bool removeAccount(uint32 accid);
+
+	virtual size_t getMailCount(uint32 cid, uint32 &all, uint32 &unread);
+	virtual size_t listMail(uint32 cid, unsigned char box, unsigned char *buffer);
+	virtual bool readMail(uint32 cid, uint32 mid, CMail& mail);
+	virtual bool deleteMail(uint32 cid, uint32 mid);
+	virtual bool sendMail(uint32 senderid, const char* sendername, const char* targetname, const char *head, const char *body, uint32 zeny, const struct item& item, uint32& msgid, uint32& tid);
+
+	virtual void loadfamelist();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CGuildDB_mem : public CGuildDBInterface
+{
+	CMemTable<CGuild>	guilds;
+	CMemTable<CCastle>	castles;
+	CKVNameIndex		names;
+	uint32				next_id;
+public:
+	CGuildDB_mem(const char* configfile=NULL)
+	{
+		this->init(configfile);
+	}
+	virtual ~CGuildDB_mem()
+	{}
+private:
+	bool init(const char* configfile);
+public:
+	virtual size_t size() const;
+	virtual CGuild& operator[](size_t i);
+
+	virtual size_t castlesize() const;
+	virtual CCastle &castle(size_t i);
+
+	virtual bool searchGuild(const char* name, CGuild& guild);
+	virtual bool searchGuild(uint32 guildid, CGuild& guild);
+	virtual bool insertGuild(const struct guild_member &member, const char *name, CGuild &g);
+	virtual bool removeGuild(uint32 guild_id);
+	virtual bool saveGuild(const CGuild& g);
+
+	virtual bool searchCastle(ushort castleid, CCastle& castle);
+	virtual bool saveCastle(const CCastle& castle);
+	virtual bool removeCastle(ushort castle_id);
+
+	virtual bool getCastles(basics::vector<CCastle>& castlevector);
+	virtual uint32 has_conflict(uint32 guild_id, uint32 account_id, uint32 char_id);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPartyDB_mem : public CPartyDBInterface
+{
+	CMemTable<CParty>	parties;
+	CKVNameIndex		names;
+	uint32				next_id;
+public:
+	CPartyDB_mem(const char* configfile=NULL) : next_id(1)
+	{}
+	virtual ~CPartyDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CParty& operator[](size_t i);
+
+	virtual bool searchParty(const char* name, CParty& p);
+	virtual bool searchParty(uint32 pid, CParty& p);
+	virtual bool insertParty(uint32 accid, const char* nick, const char* mapname, ushort lv, const char* name, CParty& p);
+	virtual bool removeParty(uint32 pid);
+	virtual bool saveParty(const CParty& p);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPCStorageDB_mem : public CPCStorageDBInterface
+{
+	CMemTable<CPCStorage>	storages;
+public:
+	CPCStorageDB_mem(const char* configfile=NULL)
+	{}
+	virtual ~CPCStorageDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CPCStorage& operator[](size_t i);
+
+	virtual bool searchStorage(uint32 accid, CPCStorage& stor);
+	virtual bool removeStorage(uint32 accid);
+	virtual bool saveStorage(const CPCStorage& stor);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CGuildStorageDB_mem : public CGuildStorageDBInterface
+{
+	CMemTable<CGuildStorage>	storages;
+public:
+	CGuildStorageDB_mem(const char* configfile=NULL)
+	{}
+	virtual ~CGuildStorageDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CGuildStorage& operator[](size_t i);
+
+	virtual bool searchStorage(uint32 gid, CGuildStorage& stor);
+	virtual bool removeStorage(uint32 gid);
+	virtual bool saveStorage(const CGuildStorage& stor);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CPetDB_mem : public CPetDBInterface
+{
+	CMemTable<CPet>	pets;
+	uint32			next_id;
+public:
+	CPetDB_mem(const char* configfile=NULL) : next_id(1)
+	{}
+	virtual ~CPetDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CPet& operator[](size_t i);
+
+	virtual bool searchPet(uint32 pid, CPet& pet);
+	virtual bool insertPet(uint32 accid, uint32 cid, short pet_class, short pet_lv, short pet_egg_id, ushort pet_equip, short intimate, short hungry, char renameflag, char incuvat, char *pet_name, CPet& pet);
+	virtual bool removePet(uint32 pid);
+	virtual bool savePet(const CPet& pet);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CHomunculusDB_mem : public CHomunculusDBInterface
+{
+	CMemTable<CHomunculus>	homunculi;
+	uint32					next_id;
+public:
+	CHomunculusDB_mem(const char* configfile=NULL) : next_id(1)
+	{}
+	virtual ~CHomunculusDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CHomunculus& operator[](size_t i);
+
+	virtual bool searchHomunculus(uint32 hid, CHomunculus& hom);
+	virtual bool insertHomunculus(CHomunculus& hom);
+	virtual bool removeHomunculus(uint32 hid);
+	virtual bool saveHomunculus(const CHomunculus& hom);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//
+class CVarDB_mem : public CVarDBInterface
+{
+	CMemTable<CVar>	vars;
+	CKVNameIndex	names;
+	uint32			next_id;
+public:
+	CVarDB_mem(const char* configfile=NULL) : next_id(1)
+	{}
+	virtual ~CVarDB_mem()
+	{}
+
+	virtual size_t size() const;
+	virtual CVar& operator[](size_t i);
+
+	virtual bool searchVar(const char* name, CVar& var);
+	virtual bool insertVar(const char* name, const char* value);
+	virtual bool removeVar(const char* name);
+	virtual bool saveVar(const CVar& var);
+};
+
+
+#endif//_BASEMEM_H_
@@ -6,6 +6,15 @@
 
 #include "basesq.h"
 
+#ifdef WIN32
+#include <io.h>
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
 
 #if defined(WITH_MYSQL)
 
@@ -183,75 +192,2050 @@ basics::CParam< basics::string<> > CSQLParameter::mysqldb_ip("sql_ip",       "12
 basics::CParam< basics::string<> > CSQLParameter::mysqldb_cp("sql_codepage", "DEFAULT", &ParamCallback_Database_string);
 basics::CParam< ushort   >         CSQLParameter::mysqldb_port("sql_port",   3306,        &ParamCallback_Database_ushort);
 
+basics::CMySQL CSQLParameter::sqlshard[CSQLParameter::SQL_MAX_SHARDS];
+size_t CSQLParameter::sqlshard_cnt=0;
+basics::CParam< basics::string<> > CSQLParameter::mysqldb_shards("sql_shards", "", &ParamCallback_Shards);
+
+basics::CMySQL CSQLParameter::sqlreplica[CSQLParameter::SQL_MAX_REPLICAS];
+size_t CSQLParameter::sqlreplica_cnt=0;
+size_t CSQLParameter::instances=0;
+basics::CParam< basics::string<> > CSQLParameter::mysqldb_replicas("sql_replicas", "", &ParamCallback_Replicas);
+basics::CParam<uint32> CSQLParameter::mysqldb_replica_lag("sql_replica_lag", 5);
+
+
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_login_log("tbl_login_log", "login_log", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_char_log("tbl_char_log", "char_log", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_map_log("tbl_map_log", "map_log", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_login_status("tbl_login_status", "login_status", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_char_status("tbl_char_status", "char_status", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_map_status("tbl_map_status", "map_status", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_account("tbl_account", "account", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_char("tbl_char", "character", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_memo("tbl_memo", "memo", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_inventory("tbl_inventory", "inventory", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_cart("tbl_cart", "cart", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_skill("tbl_skill", "skill", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_friends("tbl_friends", "friends", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_mail("tbl_mail", "mail", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_login_reg("tbl_login_reg", "login_reg", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_login_reg2("tbl_login_reg2", "login_reg2", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_char_reg("tbl_char_reg", "char_reg", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild("tbl_guild","guild", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_skill("tbl_guild_skill","guild_skill", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_member("tbl_guild_member","guild_member", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_position("tbl_guild_position","guild_position", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_alliance("tbl_guild_alliance","guild_alliance", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_expulsion("tbl_guild_expulsion","guild_expulsion", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_castle("tbl_castle","castle", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_castle_guardian("tbl_castle_guardian", "castle_guardian", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_party ("tbl_party", "party", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_storage("tbl_storage", "storage", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_guild_storage("tbl_guild_storage", "guild_storage", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_pet("tbl_pet", "pet", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_homunculus("tbl_homunculus", "homunculus", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_homunskill("tbl_homunskill", "homunskill", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_variable("tbl_variable", "variable", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_heartbeat("tbl_heartbeat", "heartbeat", ParamCallback_Tables);
+
+basics::CParam< basics::string<> > CSQLParameter::tbl_reg_key("tbl_reg_key", "reg_key", ParamCallback_Tables);
+basics::CParam< basics::string<> > CSQLParameter::tbl_registry("tbl_registry", "registry", ParamCallback_Tables);
+basics::CParam<uint32> CSQLParameter::sql_reg_cache("sql_reg_cache", 4096);
+
+
+basics::CParam< basics::string<> > CSQLParameter::sql_journal("sql_journal", "", &ParamCallback_Journal);
+basics::CParam<uint32> CSQLParameter::sql_journal_sync("sql_journal_sync", 16);
+basics::CParam<uint32> CSQLParameter::sql_journal_size("sql_journal_size", 4*1024*1024);
+basics::CParam<uint32> CSQLParameter::sql_journal_retry("sql_journal_retry", 5);
+
+basics::CParam<uint32> CSQLParameter::sql_count_interval("sql_count_interval", 300);
+basics::CParam<bool> CSQLParameter::sql_count_approx("sql_count_approx", false);
+basics::CParam<bool> CSQLParameter::sql_binary_fetch("sql_binary_fetch", true);
+
+basics::CParam< basics::string<> > CSQLParameter::sql_partition("sql_partition", "");	// day, week or month
+basics::CParam<uint32> CSQLParameter::sql_partition_ahead("sql_partition_ahead", 2);
+basics::CParam<uint32> CSQLParameter::sql_log_retention("sql_log_retention", 90);
+basics::CParam<uint32> CSQLParameter::sql_mail_retention("sql_mail_retention", 0);
+
+basics::CParam<bool> CSQLParameter::wipe_sql("wipe_sql", false);
+basics::CParam< basics::string<> > CSQLParameter::sql_engine("sql_engine", "InnoDB"); // or "MyISAM"
+
+basics::CParam<bool> CSQLParameter::log_login("log_login", true);
+basics::CParam<bool> CSQLParameter::log_char("log_char", true);
+basics::CParam<bool> CSQLParameter::log_map("log_map", true);
+
+
+///////////////////////////////////////////////////////////////////////////////
+// row counters
+static struct
+{
+	const void*	tbl;	///< table parameter
+	size_t		rows;	///< row count
+	time_t		next;	///< time of the next reconciliation, 0 when invalid
+} table_count[64];
+static size_t table_count_cnt = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// time partitions
+int CSQLParameter::partition_period()
+{
+	const basics::string<>& p = sql_partition;
+	if( p == "day" )	return 1;
+	if( p == "week" )	return 7;
+	if( p == "month" )	return 31;
+	return 0;
+}
+
+time_t CSQLParameter::partition_start(time_t t)
+{
+	struct tm tm = *localtime(&t);
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	if( partition_period() == 7 )
+		tm.tm_mday -= (tm.tm_wday+6)%7;	// monday
+	else if( partition_period() == 31 )
+		tm.tm_mday = 1;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+time_t CSQLParameter::partition_next(time_t t)
+{
+	struct tm tm = *localtime(&t);
+	if( partition_period() == 31 )
+		tm.tm_mon += 1;
+	else
+		tm.tm_mday += partition_period();
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/// partition name for the period starting at t
+static void partition_name(char* buf, size_t sz, time_t t)
+{
+	strftime(buf, sz, "p%Y%m%d", localtime(&t));
+}
+
+void CSQLParameter::partition_clause(basics::string<>& query, const char* expr)
+{
+	if( !partition_period() )
+		return;
+	time_t t = partition_start(time(NULL));
+	char name[32];
+	size_t i;
+	query << " PARTITION BY RANGE (" << expr << ") (";
+	for(i=0; i<=sql_partition_ahead; ++i)
+	{
+		const time_t next = partition_next(t);
+		partition_name(name, sizeof(name), t);
+		query << "PARTITION `" << name << "` VALUES LESS THAN (" << (ulong)next << "),";
+		t = next;
+	}
+	query << "PARTITION `pmax` VALUES LESS THAN MAXVALUE)";
+}
+
+bool CSQLParameter::partition_table(basics::CMySQLConnection& dbcon1, const basics::CParam< basics::string<> >& tbl, const char* expr, uint32 retention)
+{
+	enum { MAX_PARTS = 1024 };
+	static char names[MAX_PARTS][64];
+	static time_t bounds[MAX_PARTS];
+	basics::string<> query;
+	size_t i, cnt = 0;
+	bool has_max = false, exists = false;
+	bool ret = true;
+	char name[32];
+	const basics::string<>& tbl_name = tbl;
+
+	query << "SELECT `PARTITION_NAME`,`PARTITION_DESCRIPTION` "
+			 "FROM `information_schema`.`PARTITIONS` "
+			 "WHERE `TABLE_SCHEMA`=DATABASE() AND `TABLE_NAME`='" << dbcon1.escaped(tbl) << "' "
+			 "ORDER BY `PARTITION_ORDINAL_POSITION`";
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		exists = true;
+		if( !dbcon1[0] || !dbcon1[0][0] )
+			continue;	// not partitioned
+		if( 0==strcmp(dbcon1[1], "MAXVALUE") )
+			has_max = true;
+		else if( cnt < MAX_PARTS )
+		{
+			safestrcpy(names[cnt], sizeof(names[cnt]), dbcon1[0]);
+			bounds[cnt] = (time_t)strtoul(dbcon1[1], NULL, 10);
+			++cnt;
+		}
+	}
+	if( !exists )
+		return true;	// table not in use
+
+	if( !cnt && !has_max )
+	{	// convert the table
+		if( &tbl == &tbl_mail )
+		{	// same keys as a new partitioned mail table
+			basics::string<> fks[8];
+			size_t fk = 0;
+			query.clear();
+			query << "SELECT `CONSTRAINT_NAME` "
+					 "FROM `information_schema`.`REFERENTIAL_CONSTRAINTS` "
+					 "WHERE `CONSTRAINT_SCHEMA`=DATABASE() AND `TABLE_NAME`='" << dbcon1.escaped(tbl) << "'";
+			for( dbcon1.ResultQuery(query); dbcon1 && fk<8; ++dbcon1)
+				fks[fk++] << dbcon1[0];
+			for(i=0; i<fk; ++i)
+			{
+				query.clear();
+				query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` DROP FOREIGN KEY `" << dbcon1.escaped(fks[i]) << "`";
+				dbcon1.PureQuery(query);
+			}
+			query.clear();
+			query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` "
+					 "DROP PRIMARY KEY, ADD PRIMARY KEY (`message_id`,`sendtime`)";
+			dbcon1.PureQuery(query);
+		}
+		query.clear();
+		query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "`";
+		partition_clause(query, expr);
+		if( !dbcon1.PureQuery(query) )
+		{
+			ShowError("cannot partition table '%s'\n", tbl_name.c_str());
+			return false;
+		}
+		ShowInfo("table '%s' is now partitioned by time\n", tbl_name.c_str());
+		return true;
+	}
+
+	// partitions for the coming periods
+	time_t last = cnt ? bounds[cnt-1] : partition_start(time(NULL));
+	time_t until = partition_start(time(NULL));
+	for(i=0; i<=sql_partition_ahead; ++i)
+		until = partition_next(until);
+	while( last < until )
+	{
+		const time_t next = partition_next(last);
+		partition_name(name, sizeof(name), last);
+		query.clear();
+		if( has_max )
+		{	// pmax is empty while the maintenance runs, splitting it is cheap
+			query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` "
+					 "REORGANIZE PARTITION `pmax` INTO ("
+					 "PARTITION `" << name << "` VALUES LESS THAN (" << (ulong)next << "),"
+					 "PARTITION `pmax` VALUES LESS THAN MAXVALUE)";
+		}
+		else
+		{
+			query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` "
+					 "ADD PARTITION (PARTITION `" << name << "` VALUES LESS THAN (" << (ulong)next << "))";
+		}
+		if( !dbcon1.PureQuery(query) )
+		{
+			ret = false;
+			break;
+		}
+		last = next;
+	}
+
+	// drop expired partitions, the newest one is always kept
+	if( retention && cnt > 1 )
+	{
+		const time_t cutoff = time(NULL) - (time_t)retention*86400;
+		size_t dropped = 0;
+		query.clear();
+		query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` DROP PARTITION ";
+		for(i=0; i+1<cnt && bounds[i] <= cutoff; ++i)
+		{
+			query << (dropped?",":"") << "`" << names[i] << "`";
+			++dropped;
+		}
+		if( dropped )
+		{
+			if( dbcon1.PureQuery(query) )
+			{
+				ShowInfo("dropped %lu expired partitions of '%s'\n", (ulong)dropped, tbl_name.c_str());
+				invalidate_rows(tbl);
+			}
+			else
+				ret = false;
+		}
+	}
+	return ret;
+}
+
+static bool partition_timer_on = false;	///< maintenance registered at the timer
+
+void CSQLParameter::partition_timer(void*)
+{
+	maintain_partitions();
+}
+
+bool CSQLParameter::maintain_partitions()
+{
+	if( !partition_period() )
+		return true;
+	if( !partition_timer_on )
+		partition_timer_on = CSQLTimer::add("partition maintenance", &CSQLParameter::partition_timer, NULL, SQL_PARTITION_CHECK);
+	basics::CMySQLConnection dbcon1(sqlbase);
+	bool ret = true;
+	ret &= partition_table(dbcon1, tbl_login_log, "UNIX_TIMESTAMP(`time`)", sql_log_retention);
+	ret &= partition_table(dbcon1, tbl_char_log, "UNIX_TIMESTAMP(`time`)", sql_log_retention);
+	ret &= partition_table(dbcon1, tbl_map_log, "UNIX_TIMESTAMP(`time`)", sql_log_retention);
+	ret &= partition_table(dbcon1, tbl_mail, "`sendtime`", sql_mail_retention);
+	return ret;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// registry
+#define REG_NAME_LEN 34
+
+/// interned names, the id is the index
+static char (*reg_names)[REG_NAME_LEN] = NULL;
+static size_t reg_names_cap = 0;
+/// name hash to id, 0 is free
+static uint32* reg_hash = NULL;
+static size_t reg_hash_cap = 0;
+static size_t reg_hash_cnt = 0;
+static bool reg_loaded = false;
+
+/// cached state of an owner, values sorted by key
+struct reg_value
+{
+	uint32	key;
+	int		value;
+};
+static struct reg_owner
+{
+	uint64		id;		///< scope<<32 | owner, 0 when free
+	reg_value*	val;
+	size_t		cnt;
+} *reg_cache = NULL;
+static size_t reg_cache_cap = 0;
+/// the queued char saves reach the registry from the timer thread
+static CSQLMutex reg_mutex;
+
+/// case insensitive like the collation of the old tables
+static uint32 reg_hashname(const char* name)
+{
+	uint32 h = 2166136261u;
+	for( ; *name; ++name)
+		h = (h ^ (uchar)tolower((uchar)*name)) * 16777619u;
+	return h;
+}
+
+static void reg_hash_insert(uint32 id)
+{
+	if( (reg_hash_cnt+1)*2 > reg_hash_cap )
+	{
+		uint32* old = reg_hash;
+		const size_t oldcap = reg_hash_cap;
+		size_t i;
+		reg_hash_cap = oldcap ? oldcap*2 : 1024;
+		reg_hash = new uint32[reg_hash_cap];
+		memset(reg_hash, 0, reg_hash_cap*sizeof(uint32));
+		reg_hash_cnt = 0;
+		if( old )
+		{
+			for(i=0; i<oldcap; ++i)
+				if( old[i] ) reg_hash_insert(old[i]);
+			delete[] old;
+		}
+	}
+	size_t i = reg_hashname(reg_names[id]) & (reg_hash_cap-1);
+	while( reg_hash[i] )
+		i = (i+1) & (reg_hash_cap-1);
+	reg_hash[i] = id;
+	++reg_hash_cnt;
+}
+
+static void reg_intern(uint32 id, const char* name)
+{
+	if( id >= reg_names_cap )
+	{
+		size_t cap = reg_names_cap ? reg_names_cap : 1024;
+		while( cap <= id )
+			cap *= 2;
+		char (*tmp)[REG_NAME_LEN] = new char[cap][REG_NAME_LEN];
+		memset(tmp, 0, cap*REG_NAME_LEN);
+		if( reg_names )
+		{
+			memcpy(tmp, reg_names, reg_names_cap*REG_NAME_LEN);
+			delete[] reg_names;
+		}
+		reg_names = tmp;
+		reg_names_cap = cap;
+	}
+	if( !reg_names[id][0] )
+	{
+		safestrcpy(reg_names[id], REG_NAME_LEN, name);
+		reg_hash_insert(id);
+	}
+}
+
+static uint32 reg_find(const char* name)
+{
+	if( !reg_hash_cap )
+		return 0;
+	size_t i = reg_hashname(name) & (reg_hash_cap-1);
+	for( ; reg_hash[i]; i = (i+1) & (reg_hash_cap-1))
+	{
+		if( 0==strcasecmp(reg_names[reg_hash[i]], name) )
+			return reg_hash[i];
+	}
+	return 0;
+}
+
+/// read the whole dictionary
+static void reg_load_keys(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl)
+{
+	basics::string<> query;
+	query << "SELECT `key_id`,`name` FROM `" << dbcon1.escaped(tbl) << "`";
+	if( dbcon1.ResultQuery(query) )
+	{
+		for( ; dbcon1; ++dbcon1)
+			reg_intern(atol(dbcon1[0]), dbcon1[1]);
+		reg_loaded = true;
+	}
+}
+
+uint32 CSQLParameter::reg_key(const char* name)
+{
+	if( !name || !*name )
+		return 0;
+	CSQLLock lock(reg_mutex);
+	uint32 id = reg_find(name);
+	if( id )
+		return id;
+
+	basics::CMySQLConnection dbcon1(sqlbase);
+	basics::string<> query;
+	if( !reg_loaded )
+	{
+		reg_load_keys(dbcon1, tbl_reg_key);
+		if( (id = reg_find(name)) != 0 )
+			return id;
+	}
+	query << "INSERT IGNORE INTO `" << dbcon1.escaped(tbl_reg_key) << "` (`name`) "
+			 "VALUES ('" << dbcon1.escaped(name) << "')";
+	dbcon1.PureQuery(query);
+	query.clear();
+	query << "SELECT `key_id`,`name` FROM `" << dbcon1.escaped(tbl_reg_key) << "` "
+			 "WHERE `name`='" << dbcon1.escaped(name) << "'";
+	if( dbcon1.ResultQuery(query) && dbcon1 )
+	{
+		id = atol(dbcon1[0]);
+		reg_intern(id, dbcon1[1]);
+	}
+	return id;
+}
+
+const char* CSQLParameter::reg_name(uint32 id)
+{
+	CSQLLock lock(reg_mutex);
+	if( id >= reg_names_cap || !reg_names[id][0] )
+	{	// interned by another server
+		basics::CMySQLConnection dbcon1(sqlbase);
+		reg_load_keys(dbcon1, tbl_reg_key);
+	}
+	return ( id < reg_names_cap && reg_names[id][0] ) ? reg_names[id] : NULL;
+}
+
+/// cache slot of an owner
+static reg_owner& reg_slot(uint64 id, size_t size)
+{
+	if( !reg_cache )
+	{
+		size_t cap = 64;
+		while( cap < size )
+			cap *= 2;
+		reg_cache = new reg_owner[cap];
+		memset(reg_cache, 0, cap*sizeof(reg_owner));
+		reg_cache_cap = cap;
+	}
+	uint64 h = id * 0x9E3779B97F4A7C15ULL;
+	return reg_cache[(size_t)(h>>40) & (reg_cache_cap-1)];
+}
+
+/// remember the state of an owner, replaces whatever was in the slot
+static void reg_store(reg_owner& o, uint64 id, const reg_value* val, size_t cnt)
+{
+	if( o.val && (o.id != id || o.cnt < cnt) )
+	{
+		delete[] o.val;
+		o.val = NULL;
+	}
+	if( !o.val && cnt )
+		o.val = new reg_value[cnt];
+	if( cnt )
+		memcpy(o.val, val, cnt*sizeof(reg_value));
+	o.id = id;
+	o.cnt = cnt;
+}
+
+static int reg_cmp(const void* a, const void* b)
+{
+	const uint32 x = ((const reg_value*)a)->key, y = ((const reg_value*)b)->key;
+	return (x<y) ? -1 : (x>y);
+}
+
+size_t CSQLParameter::reg_load(basics::CMySQL& base, reg_scope scope, uint32 owner, struct global_reg* regs, size_t max)
+{
+	CSQLLock lock(reg_mutex);
+	basics::CMySQLConnection dbcon1(base);
+	basics::string<> query;
+	reg_value* val = new reg_value[max+1];
+	size_t i = 0, k;
+
+	query << "SELECT `key_id`,`ival` "
+			 "FROM `" << dbcon1.escaped(tbl_registry) << "` "
+			 "WHERE `scope`='" << (int)scope << "' AND `owner`='" << owner << "'";
+	if( dbcon1.ResultQuery(query) )
+	{
+		for( ; dbcon1 && i<max; ++dbcon1, ++i)
+		{
+			val[i].key = atol(dbcon1[0]);
+			val[i].value = CSQLValue(dbcon1[1]);
+		}
+	}
+	// names after the result is done, reg_name may need the connection
+	for(k=0; k<i; ++k)
+	{
+		const char* name = reg_name(val[k].key);
+		safestrcpy(regs[k].str, sizeof(regs[k].str), name ? name : "");
+		regs[k].value = val[k].value;
+	}
+	for(k=i; k<max; ++k)
+	{
+		regs[k].str[0] = 0;
+		regs[k].value = 0;
+	}
+	qsort(val, i, sizeof(reg_value), reg_cmp);
+	const uint64 id = ((uint64)scope<<32) | owner;
+	reg_store(reg_slot(id, sql_reg_cache), id, val, i);
+	delete[] val;
+	return i;
+}
+
+bool CSQLParameter::reg_prime(basics::CMySQL& base, reg_scope scope, const basics::string<>& query, size_t max)
+{
+	basics::CMySQLConnection dbcon1(base);
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+
+	reg_value* val = new reg_value[max+1];
+	uint32 owner = 0;
+	size_t cnt = 0;
+	for(;;)
+	{
+		// owner 0 ends the rows
+		const uint32 o = dbcon1 ? (uint32)atol(dbcon1[0]) : 0;
+		if( o != owner && owner )
+		{	// the rows of one owner are complete
+			const uint64 id = ((uint64)scope<<32) | owner;
+			qsort(val, cnt, sizeof(reg_value), reg_cmp);
+			CSQLLock lock(reg_mutex);
+			reg_owner& slot = reg_slot(id, sql_reg_cache);
+			if( slot.id != id )
+				reg_store(slot, id, val, cnt);
+		}
+		if( !o )
+			break;
+		if( o != owner )
+		{
+			owner = o;
+			cnt = 0;
+		}
+		if( cnt < max )
+		{
+			val[cnt].key = atol(dbcon1[1]);
+			val[cnt].value = CSQLValue(dbcon1[2]);
+			++cnt;
+		}
+		++dbcon1;
+	}
+	delete[] val;
+	return true;
+}
+
+void CSQLParameter::reg_save(CSQLBatch& batch, reg_scope scope, uint32 owner, const struct global_reg* regs, size_t num)
+{
+	CSQLLock lock(reg_mutex);
+	basics::CMySQLConnection dbcon1(sqlbase);
+	basics::string<> query, keys;
+	const uint64 id = ((uint64)scope<<32) | owner;
+	reg_value* val = new reg_value[num+1];
+	size_t i, k, cnt = 0, ups = 0, dels = 0;
+
+	for(i=0; i<num; ++i)
+	{
+		if( regs[i].str[0] && regs[i].value != 0 )
+		{
+			const uint32 key = reg_key(regs[i].str);
+			if( !key )
+				continue;
+			for(k=0; k<cnt && val[k].key != key; ++k) ;
+			val[k].key = key;	// a doubled name keeps the last value
+			val[k].value = regs[i].value;
+			if( k == cnt ) ++cnt;
+		}
+	}
+	qsort(val, cnt, sizeof(reg_value), reg_cmp);
+
+	query << "INSERT INTO `" << dbcon1.escaped(tbl_registry) << "` "
+			 "(`scope`,`owner`,`key_id`,`ival`) VALUES ";
+	reg_owner& o = reg_slot(id, sql_reg_cache);
+	if( o.id == id )
+	{	// merge with the known state
+		const reg_value* old = o.val;
+		const size_t ocnt = o.cnt;
+		for(i=0, k=0; i<cnt || k<ocnt; )
+		{
+			if( k>=ocnt || (i<cnt && val[i].key < old[k].key) )
+			{	// new
+				query << (ups++?",":"") << "('" << (int)scope << "','" << owner << "','" << val[i].key << "','" << val[i].value << "')";
+				++i;
+			}
+			else if( i>=cnt || old[k].key < val[i].key )
+			{	// gone
+				keys << (dels++?",":"") << "'" << old[k].key << "'";
+				++k;
+			}
+			else
+			{	// changed or same
+				if( val[i].value != old[k].value )
+					query << (ups++?",":"") << "('" << (int)scope << "','" << owner << "','" << val[i].key << "','" << val[i].value << "')";
+				++i, ++k;
+			}
+		}
+		query << " ON DUPLICATE KEY UPDATE `ival`=VALUES(`ival`)";
+		if( ups ) batch.add(sqlbase, query);
+		if( dels )
+		{
+			query.clear();
+			query << "DELETE "
+					 "FROM `" << dbcon1.escaped(tbl_registry) << "` "
+					 "WHERE `scope`='" << (int)scope << "' AND `owner`='" << owner << "' "
+					 "AND `key_id` IN (" << keys << ")";
+			batch.add(sqlbase, query);
+		}
+	}
+	else
+	{	// unknown state, write everything
+		for(i=0; i<cnt; ++i)
+		{
+			query << (i?",":"") << "('" << (int)scope << "','" << owner << "','" << val[i].key << "','" << val[i].value << "')";
+			keys << (i?",":"") << "'" << val[i].key << "'";
+		}
+		query << " ON DUPLICATE KEY UPDATE `ival`=VALUES(`ival`)";
+		if( cnt ) batch.add(sqlbase, query);
+		query.clear();
+		query << "DELETE "
+				 "FROM `" << dbcon1.escaped(tbl_registry) << "` "
+				 "WHERE `scope`='" << (int)scope << "' AND `owner`='" << owner << "'";
+		if( cnt ) query << " AND `key_id` NOT IN (" << keys << ")";
+		batch.add(sqlbase, query);
+	}
+	reg_store(o, id, val, cnt);
+	delete[] val;
+}
+
+bool CSQLParameter::reg_remove(reg_scope scope, uint32 owner)
+{
+	CSQLBatch batch;
+	reg_remove(batch, scope, owner);
+	return batch.commit();
+}
+
+void CSQLParameter::reg_remove(CSQLBatch& batch, reg_scope scope, uint32 owner)
+{
+	reg_forget(scope, owner);
+
+	basics::CMySQLConnection dbcon1(sqlbase);
+	basics::string<> query;
+	query << "DELETE "
+			 "FROM `" << dbcon1.escaped(tbl_registry) << "` "
+			 "WHERE `scope`='" << (int)scope << "' AND `owner`='" << owner << "'";
+	batch.add(sqlbase, query);
+}
+
+void CSQLParameter::reg_forget(reg_scope scope, uint32 owner)
+{
+	const uint64 id = ((uint64)scope<<32) | owner;
+	CSQLLock lock(reg_mutex);
+	reg_owner& o = reg_slot(id, sql_reg_cache);
+	if( o.id == id )
+		o.id = 0;
+}
+
+void CSQLParameter::reg_reset()
+{
+	CSQLLock lock(reg_mutex);
+	size_t i;
+	for(i=0; i<reg_cache_cap; ++i)
+	{
+		if( reg_cache[i].val )
+			delete[] reg_cache[i].val;
+	}
+	if( reg_cache ) delete[] reg_cache;
+	if( reg_hash ) delete[] reg_hash;
+	if( reg_names ) delete[] reg_names;
+	reg_cache = NULL;
+	reg_hash = NULL;
+	reg_names = NULL;
+	reg_cache_cap = reg_hash_cap = reg_hash_cnt = reg_names_cap = 0;
+	reg_loaded = false;
+}
+
+
+bool CSQLParameter::ParamCallback_Database_string(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+{
+	sqlbase.init(mysqldb_id, mysqldb_pw,mysqldb_db,mysqldb_ip,mysqldb_port, mysqldb_cp);
+	if( sqlshard_cnt ) init_shards(mysqldb_shards);
+	if( sqlreplica_cnt ) init_replicas(mysqldb_replicas);
+	return true;
+}
+bool CSQLParameter::ParamCallback_Database_ushort(const basics::string<>& name, ushort& newval, const ushort& oldval)
+{
+	sqlbase.init(mysqldb_id, mysqldb_pw,mysqldb_db,mysqldb_ip,mysqldb_port, mysqldb_cp);
+	return true;
+}
+bool CSQLParameter::ParamCallback_Shards(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+{
+	init_shards(newval);
+	return true;
+}
+bool CSQLParameter::ParamCallback_Replicas(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+{
+	init_replicas(newval);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// (re)connect the shards from a "ip:port,ip:port" list.
+/// an empty list switches sharding off
+void CSQLParameter::init_shards(const basics::string<>& list)
+{
+	char buffer[1024];
+	char *ip, *next, *port;
+	size_t i;
+
+	safestrcpy(buffer, sizeof(buffer), list.c_str());
+	for(i=0, ip=buffer; ip && *ip && i<SQL_MAX_SHARDS; ip=next)
+	{
+		next = strchr(ip, ',');
+		if(next) *next++ = 0;
+		while(*ip==' ') ++ip;
+		if(!*ip) continue;
+		port = strchr(ip, ':');
+		if(port) *port++ = 0;
+
+		sqlshard[i].init(mysqldb_id, mysqldb_pw, mysqldb_db, basics::string<>(ip), port?(ushort)atoi(port):(ushort)mysqldb_port, mysqldb_cp);
+		ShowInfo("sql shard %u: %s:%u\n", (uint)i, ip, port?atoi(port):(int)(ushort)mysqldb_port);
+		++i;
+	}
+	if( ip && *ip )
+		ShowWarning("sql shards: only %u shards supported, ignoring '%s'\n", (uint)SQL_MAX_SHARDS, ip);
+	sqlshard_cnt = i;
+
+	for(i=0; i<sqlshard_cnt; ++i)
+		rebuild_shard(sqlshard[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// add the pos column and the (owner,pos) key to an item table of an old
+/// install. the existing rows are numbered per owner in table order,
+/// load_items moves them to free slots if there are too many
+static void migrate_item_table(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl, const char* owner_col)
+{
+	basics::string<> query;
+	query << "SHOW COLUMNS FROM `" << dbcon1.escaped(tbl) << "` LIKE 'pos'";
+	if( !dbcon1.ResultQuery(query) || dbcon1 )
+		return;
+	query.clear();
+
+	ShowInfo("sql: adding the slot column to table '%s'\n", tbl.c_str());
+	query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` "
+			 "ADD COLUMN `pos` SMALLINT UNSIGNED NOT NULL default '0' AFTER `" << owner_col << "`";
+	if( !dbcon1.PureQuery(query) )
+	{
+		ShowError("sql: could not add the slot column to table '%s'\n", tbl.c_str());
+		return;
+	}
+	query.clear();
+
+	// the variables live in the session, so both statements use dbcon1
+	query << "SET @pos:=-1, @owner:=0";
+	dbcon1.PureQuery(query);
+	query.clear();
+	query << "UPDATE `" << dbcon1.escaped(tbl) << "` "
+			 "SET `pos`=(@pos:=IF(@owner=`" << owner_col << "`,@pos+1,0))+((@owner:=`" << owner_col << "`)*0) "
+			 "ORDER BY `" << owner_col << "`";
+	dbcon1.PureQuery(query);
+	query.clear();
+
+	query << "ALTER TABLE `" << dbcon1.escaped(tbl) << "` "
+			 "ADD PRIMARY KEY (`" << owner_col << "`,`pos`)";
+	if( !dbcon1.PureQuery(query) )
+		ShowError("sql: could not add the slot key to table '%s'\n", tbl.c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// create the char-scoped tables on a shard.
+/// the definitions are copied from the primary, without the foreign keys
+/// since the referenced tables only exist on the primary
+void CSQLParameter::rebuild_shard(basics::CMySQL& shard)
+{
+	const basics::CParam< basics::string<> >* tables[] = { &tbl_memo, &tbl_inventory, &tbl_cart, &tbl_skill };
+	basics::CMySQLConnection dbcon1(CSQLParameter::sqlbase);
+	basics::CMySQLConnection dbcon2(shard);
+	basics::string<> query;
+	size_t i;
+
+	for(i=0; i<sizeof(tables)/sizeof(tables[0]); ++i)
+	{
+		if( CSQLParameter::wipe_sql )
+		{
+			query << "DROP TABLE IF EXISTS `" << dbcon2.escaped(*tables[i]) << "`";
+			dbcon2.PureQuery(query);
+			query.clear();
+		}
+
+		query << "SHOW CREATE TABLE `" << dbcon1.escaped(*tables[i]) << "`";
+		if( dbcon1.ResultQuery(query) && dbcon1 && 0==strncmp(dbcon1[1], "CREATE TABLE ", 13) )
+		{	// copy the definition line by line and skip the constraints
+			const char* src = dbcon1[1]+13;
+			const char* eol;
+			const char* fk;
+			char* buf = new char[strlen(src)+1];
+			size_t pos=0;
+			for( ; *src; src=eol)
+			{
+				eol = strchr(src, '\n');
+				eol = (eol)? eol+1 : src+strlen(src);
+				fk = strstr(src, "FOREIGN KEY");
+				if( fk && fk<eol )
+					continue;
+				if( *src==')' )
+				{	// the comma of the last column belonged to a dropped constraint
+					while( pos && (buf[pos-1]=='\n' || buf[pos-1]==' ') )
+						--pos;
+					if( pos && buf[pos-1]==',' )
+						--pos;
+					buf[pos++] = '\n';
+				}
+				memcpy(buf+pos, src, eol-src);
+				pos += eol-src;
+			}
+			buf[pos] = 0;
+
+			query.clear();
+			query << "CREATE TABLE IF NOT EXISTS " << buf;
+			delete[] buf;
+			dbcon2.PureQuery(query);
+		}
+		query.clear();
+	}
+	// shard tables created before the slot column
+	migrate_item_table(dbcon2, tbl_inventory, "char_id");
+	migrate_item_table(dbcon2, tbl_cart, "char_id");
+}
+bool CSQLParameter::ParamCallback_Tables(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+{
+	CSQLParameter::rebuild();
+	table_count_cnt = 0;
+	CSQLParameter::reg_reset();
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// replica state.
+// the lag check runs on the sql timer, the reads only look at the result.
+// replica_mutex guards the state below, replica_check_mutex keeps a
+// reconnect from running into a lag check
+static const time_t replica_unknown = 0x7FFFFFFF;
+static time_t replica_lag[CSQLParameter::SQL_MAX_REPLICAS];	///< measured lag of each replica
+static time_t replica_stamp = 0;							///< last heartbeat written to the primary
+static size_t replica_next = 0;								///< round robin position
+static bool replica_timer_on = false;						///< lag check registered at the timer
+static CSQLMutex replica_mutex;
+static CSQLMutex replica_check_mutex;
+
+///////////////////////////////////////////////////////////////////////////////
+// recently written entities.
+// a bloom filter of expiry times, an entity is recent while all of its
+// slots expire later than now. nothing is evicted, entities that share
+// their slots with other recent writes only send a few more reads to the
+// primary than needed
+enum { RECENT_HASHES = 2 };
+static time_t recent_write[CSQLParameter::SQL_RECENT_WRITES];
+static time_t recent_any[CSQLParameter::SQL_ENTITY_MAX];	///< any entity of the type written
+static time_t recent_every[CSQLParameter::SQL_ENTITY_MAX];	///< all entities of the type written
+
+static inline size_t recent_slot(uint32 type, uint32 id, uint32 k)
+{
+	const uint32 h = (id*2654435761u) ^ (type*0x9E3779B9u) ^ (k*0x85EBCA6Bu);
+	return (size_t)(h ^ (h>>15)) % CSQLParameter::SQL_RECENT_WRITES;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// (re)connect the replicas from a "ip:port,ip:port" list.
+/// an empty list switches replica reads off
+void CSQLParameter::init_replicas(const basics::string<>& list)
+{
+	CSQLLock check(replica_check_mutex);
+	char buffer[1024];
+	char *ip, *next, *port;
+	size_t i;
+
+	{	// no reads from replicas while they are reconnected
+		CSQLLock lock(replica_mutex);
+		sqlreplica_cnt = 0;
+	}
+
+	safestrcpy(buffer, sizeof(buffer), list.c_str());
+	for(i=0, ip=buffer; ip && *ip && i<SQL_MAX_REPLICAS; ip=next)
+	{
+		next = strchr(ip, ',');
+		if(next) *next++ = 0;
+		while(*ip==' ') ++ip;
+		if(!*ip) continue;
+		port = strchr(ip, ':');
+		if(port) *port++ = 0;
+
+		sqlreplica[i].init(mysqldb_id, mysqldb_pw, mysqldb_db, basics::string<>(ip), port?(ushort)atoi(port):(ushort)mysqldb_port, mysqldb_cp);
+		ShowInfo("sql replica %u: %s:%u\n", (uint)i, ip, port?atoi(port):(int)(ushort)mysqldb_port);
+		++i;
+	}
+	if( ip && *ip )
+		ShowWarning("sql replicas: only %u replicas supported, ignoring '%s'\n", (uint)SQL_MAX_REPLICAS, ip);
+
+	CSQLLock lock(replica_mutex);
+	sqlreplica_cnt = i;
+	// unknown lag until the first check
+	for(i=0; i<SQL_MAX_REPLICAS; ++i)
+		replica_lag[i] = replica_unknown;
+	replica_stamp = 0;
+	if( sqlreplica_cnt && !replica_timer_on )
+		replica_timer_on = CSQLTimer::add("replica check", &CSQLParameter::replica_timer, NULL, SQL_REPLICA_CHECK);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// timer entry of the lag check
+void CSQLParameter::replica_timer(void*)
+{
+	if( sqlreplica_cnt )
+		check_replicas();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// measure the replica lag.
+/// the replicas are read before the next heartbeat is written, so a replica
+/// that has the last heartbeat is up to date and one with an older value is
+/// behind by the difference. runs on the sql timer, the queries are done
+/// without holding the replica state
+void CSQLParameter::check_replicas()
+{
+	CSQLLock check(replica_check_mutex);
+	const time_t now = time(NULL);
+	time_t lag[SQL_MAX_REPLICAS];
+	time_t stamp;
+	size_t i, cnt;
+	basics::string<> query;
+
+	{
+		CSQLLock lock(replica_mutex);
+		cnt = sqlreplica_cnt;
+		stamp = replica_stamp;
+	}
+
+	for(i=0; i<cnt; ++i)
+	{
+		basics::CMySQLConnection dbcon1(sqlreplica[i]);
+		query.clear();
+		query << "SELECT `stamp` "
+				 "FROM `" << dbcon1.escaped(tbl_heartbeat) << "` "
+				 "WHERE `id`='1'";
+		if( stamp && dbcon1.ResultQuery(query) && dbcon1 )
+		{
+			const time_t seen = CSQLValue(dbcon1[0]);
+			lag[i] = (seen<stamp)? stamp-seen : 0;
+		}
+		else
+			lag[i] = replica_unknown;
+	}
+
+	basics::CMySQLConnection dbcon1(sqlbase);
+	query.clear();
+	query << "REPLACE INTO `" << dbcon1.escaped(tbl_heartbeat) << "` "
+			 "(`id`,`stamp`) VALUES ('1','" << (ulong)now << "')";
+	const bool written = dbcon1.PureQuery(query);
+
+	CSQLLock lock(replica_mutex);
+	for(i=0; i<cnt; ++i)
+		replica_lag[i] = lag[i];
+	if( written )
+		replica_stamp = now;
+}
+
+basics::CMySQL& CSQLParameter::readbase()
+{
+	if( sqlreplica_cnt )
+	{
+		CSQLLock lock(replica_mutex);
+		size_t i;
+		for(i=0; i<sqlreplica_cnt; ++i)
+		{
+			const size_t k = (replica_next+i)%sqlreplica_cnt;
+			if( replica_lag[k] <= (time_t)mysqldb_replica_lag )
+			{
+				replica_next = k+1;
+				return sqlreplica[k];
+			}
+		}
+	}
+	return sqlbase;
+}
+
+basics::CMySQL& CSQLParameter::readbase(sql_entity type, uint32 id)
+{
+	if( sqlreplica_cnt )
+	{
+		const time_t now = time(NULL);
+		CSQLLock lock(replica_mutex);
+		if( now < recent_every[type] )
+			return sqlbase;
+		if( id==0 )
+		{
+			if( now < recent_any[type] )
+				return sqlbase;
+		}
+		else
+		{
+			uint32 k;
+			for(k=0; k<RECENT_HASHES; ++k)
+			{
+				if( now >= recent_write[recent_slot(type, id, k)] )
+					break;
+			}
+			if( k == RECENT_HASHES )
+				return sqlbase;
+		}
+	}
+	return readbase();
+}
+
+void CSQLParameter::written(sql_entity type, uint32 id)
+{
+	if( sqlreplica_cnt )
+	{	// a replica within the lag limit has the data after lag + check interval
+		const time_t now = time(NULL);
+		const time_t until = now + (time_t)mysqldb_replica_lag + SQL_REPLICA_CHECK + 1;
+		CSQLLock lock(replica_mutex);
+		recent_any[type] = until;
+		if( id==0 )
+			recent_every[type] = until;
+		else
+		{
+			uint32 k;
+			for(k=0; k<RECENT_HASHES; ++k)
+				recent_write[recent_slot(type, id, k)] = until;
+		}
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// returns the counter index of a table, out of range when all are used
+static size_t find_table_count(const void* tbl)
+{
+	size_t i;
+	for(i=0; i<table_count_cnt; ++i)
+	{
+		if( table_count[i].tbl == tbl )
+			return i;
+	}
+	if( i < sizeof(table_count)/sizeof(table_count[0]) )
+	{
+		table_count[i].tbl  = tbl;
+		table_count[i].rows = 0;
+		table_count[i].next = 0;
+		++table_count_cnt;
+		return i;
+	}
+	return ~((size_t)0);
+}
+
+size_t CSQLParameter::get_table_size(const basics::CParam< basics::string<> >& tbl) const
+{
+	const size_t i = find_table_count(&tbl);
+	const time_t now = time(NULL);
+	if( i < table_count_cnt && now < table_count[i].next )
+		return table_count[i].rows;
+
+	basics::CMySQLConnection dbcon1(this->readbase());
+	basics::string<> query;
+	size_t rows = 0;
+
+	if( sql_count_approx )
+	{	// estimate from the table statistics
+		query << "SELECT `TABLE_ROWS` "
+				 "FROM `information_schema`.`TABLES` "
+				 "WHERE `TABLE_SCHEMA`=DATABASE() "
+				 "AND `TABLE_NAME`='" << dbcon1.escaped(tbl) << "'";
+	}
+	else
+	{
+		query << "SELECT COUNT(*) "
+				 "FROM `" << dbcon1.escaped(tbl) << "` ";
+	}
+	if( dbcon1.ResultQuery(query) && dbcon1 )
+	{
+		rows = CSQLValue(dbcon1[0]);
+		if( i < table_count_cnt )
+		{
+			table_count[i].rows = rows;
+			table_count[i].next = now + (time_t)sql_count_interval;
+		}
+	}
+	return rows;
+}
+
+void CSQLParameter::count_rows(const basics::CParam< basics::string<> >& tbl, int diff)
+{
+	const size_t i = find_table_count(&tbl);
+	if( i < table_count_cnt && table_count[i].next )
+	{
+		if( diff < 0 && table_count[i].rows < (size_t)(-diff) )
+			table_count[i].rows = 0;
+		else
+			table_count[i].rows += diff;
+	}
+}
+
+void CSQLParameter::invalidate_rows(const basics::CParam< basics::string<> >& tbl)
+{
+	const size_t i = find_table_count(&tbl);
+	if( i < table_count_cnt )
+		table_count[i].next = 0;
+}
+bool CSQLParameter::counting_rows(const basics::CParam< basics::string<> >& tbl)
+{
+	const size_t i = find_table_count(&tbl);
+	return ( i < table_count_cnt && table_count[i].next );
+}
+size_t CSQLParameter::owner_rows(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl, const char* owner_col, uint32 owner)
+{	// runs on the owner prefix of the primary key
+	basics::string<> query;
+	query << "SELECT COUNT(*) "
+			 "FROM `" << dbcon1.escaped(tbl) << "` "
+			 "WHERE `" << owner_col << "`='" << owner << "'";
+	return ( dbcon1.ResultQuery(query) && dbcon1 ) ? (size_t)CSQLValue(dbcon1[0]) : 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// write-ahead journal
+//
+// the file starts with a journal_file header, followed by the records.
+// a record is a header followed by the statements of one CSQLBatch.
+// records are only appended; [JOURNAL_START,journal_applied[ is done,
+// [journal_applied,journal_end[ is pending, which only happens while the
+// database was not reachable.
+
+/// file header
+struct journal_file
+{
+	uint32 magic;	///< JOURNAL_FILE_MAGIC
+	uint32 unused;
+	uint64 applied;	///< offset of the first pending record
+};
+#define JOURNAL_FILE_MAGIC 0x464C5153	// "SQLF"
+#define JOURNAL_START ((long)sizeof(journal_file))
+
+/// record header
+struct journal_head
+{
+	uint32 magic;	///< JOURNAL_MAGIC
+	uint32 len;		///< payload length
+	uint32 crc;		///< crc32 of the payload
+};
+#define JOURNAL_MAGIC 0x4A4C5153	// "SQLJ"
+
+static FILE*		journal_fp = NULL;
+static basics::string<> journal_path;
+static long			journal_applied = JOURNAL_START;	///< file offset up to which records are done
+static long			journal_end = JOURNAL_START;		///< file offset of the end
+static long			journal_failed = 0;		///< offset of the last record the database rejected
+static bool			journal_tail_failed = false;	///< the newest record was not applied by the last replay
+static size_t		journal_unsynced = 0;	///< records written since the last sync
+static time_t		journal_next = 0;		///< next replay while stalled
+static bool			journal_ready = false;	///< opened by the first database object
+static bool			journal_timer_on = false;	///< replay registered at the timer
+static CSQLMutex	journal_mutex;			///< the timer commits queued saves too
+
+/// crc32 (ieee 802.3)
+static uint32 journal_crc(const char* data, size_t len)
+{
+	static uint32 table[256];
+	static bool init = false;
+	if( !init )
+	{
+		uint32 i, k, c;
+		for(i=0; i<256; ++i)
+		{
+			for(c=i, k=0; k<8; ++k)
+				c = (c&1) ? 0xEDB88320u ^ (c>>1) : (c>>1);
+			table[i] = c;
+		}
+		init = true;
+	}
+	uint32 crc = 0xFFFFFFFFu;
+	while( len-- )
+		crc = table[(crc ^ (uchar)*data++) & 0xFF] ^ (crc>>8);
+	return crc ^ 0xFFFFFFFFu;
+}
+
+/// flush the journal to disk
+static void journal_sync()
+{
+	if( journal_fp && journal_unsynced )
+	{
+		fflush(journal_fp);
+#ifdef WIN32
+		_commit(_fileno(journal_fp));
+#else
+		fsync(fileno(journal_fp));
+#endif
+		journal_unsynced = 0;
+	}
+}
+
+/// write the applied offset to the file header
+static void journal_mark()
+{
+	if( journal_fp )
+	{
+		journal_file head;
+		head.magic   = JOURNAL_FILE_MAGIC;
+		head.unused  = 0;
+		head.applied = (uint64)journal_applied;
+		fseek(journal_fp, 0, SEEK_SET);
+		fwrite(&head, sizeof(head), 1, journal_fp);
+		fseek(journal_fp, journal_end, SEEK_SET);
+	}
+}
+
+/// empty the journal, only when everything has been applied
+static void journal_truncate()
+{
+	if( journal_fp )
+	{
+		fclose(journal_fp);
+		journal_fp = fopen(journal_path.c_str(), "w+b");
+		if( !journal_fp )
+			ShowError("journal: cannot reopen '%s'\n", journal_path.c_str());
+	}
+	journal_applied = journal_end = JOURNAL_START;
+	journal_failed = 0;
+	journal_unsynced = 0;
+	journal_mark();
+	if( journal_fp )
+		fflush(journal_fp);
+}
+
+/// true when the database answers, tells a rejected statement from a lost connection
+static bool journal_reachable(basics::CMySQL& base)
+{
+	basics::CMySQLConnection dbcon(base);
+	basics::string<> query;
+	query << "SELECT 1";
+	return dbcon.ResultQuery(query) && dbcon;
+}
+
+CSQLParameter::journal_result CSQLParameter::journal_run(const char* data, size_t len, uchar& failed)
+{
+	basics::CMySQLConnection* dbcon[1+SQL_MAX_SHARDS];
+	basics::string<> query;
+	const char* end = data+len;
+	journal_result ret = JOURNAL_DONE;
+	size_t i;
+
+	memset(dbcon, 0, sizeof(dbcon));
+	failed = 0;
+	while( data+5 <= end )
+	{
+		const uchar target = (uchar)data[0];
+		uint32 qlen;
+		memcpy(&qlen, data+1, 4);
+		data += 5;
+		if( data+qlen >= end )
+		{
+			ShowError("journal: malformed record\n");
+			ret = JOURNAL_FAILED;
+			break;
+		}
+		if( target > sqlshard_cnt )
+		{	// written with more shards configured, wait for them
+			ShowError("journal: record for shard %u, only %u shards configured\n", (uint)target, (uint)sqlshard_cnt);
+			ret = JOURNAL_OFFLINE;
+			break;
+		}
+		if( !dbcon[target] )
+		{
+			dbcon[target] = new basics::CMySQLConnection(base_at(target));
+			query.clear();
+			query << "START TRANSACTION";
+			if( !dbcon[target]->PureQuery(query) )
+			{
+				failed = target;
+				ret = JOURNAL_FAILED;
+				break;
+			}
+		}
+		query.clear();
+		query << data;
+		if( !dbcon[target]->PureQuery(query) )
+		{
+			failed = target;
+			ret = JOURNAL_FAILED;
+			break;
+		}
+		data += qlen+1;	// statements are stored with their terminator
+	}
+	for(i=0; i<sizeof(dbcon)/sizeof(dbcon[0]); ++i)
+	{
+		if( !dbcon[i] )
+			continue;
+		query.clear();
+		query << ((ret==JOURNAL_DONE) ? "COMMIT" : "ROLLBACK");
+		if( !dbcon[i]->PureQuery(query) && ret==JOURNAL_DONE )
+		{
+			failed = (uchar)i;
+			ret = JOURNAL_FAILED;
+		}
+		delete dbcon[i];
+	}
+	return ret;
+}
+
+bool CSQLParameter::ParamCallback_Journal(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+{	// the constructor opens it when the config is read
+	return journal_ready ? CSQLParameter::journal_open(newval) : true;
+}
+
+uchar CSQLParameter::base_index(const basics::CMySQL& base)
+{
+	size_t i;
+	for(i=0; i<sqlshard_cnt; ++i)
+	{
+		if( &base == &sqlshard[i] )
+			return (uchar)(1+i);
+	}
+	return 0;
+}
+
+basics::CMySQL& CSQLParameter::base_at(uchar i)
+{
+	return ( i>0 && i<=sqlshard_cnt ) ? sqlshard[i-1] : sqlbase;
+}
+
+bool CSQLParameter::journal_open(const basics::string<>& path)
+{
+	// registered before the journal is locked, the timer holds its own
+	// lock while it calls into the journal
+	if( *path.c_str() && !journal_timer_on )
+		journal_timer_on = CSQLTimer::add("journal replay", &CSQLParameter::journal_timer, NULL, sql_journal_retry);
+
+	CSQLLock lock(journal_mutex);
+	journal_ready = true;
+	if( journal_fp )
+	{	// whatever is still pending stays in the old file
+		journal_sync();
+		fclose(journal_fp);
+		journal_fp = NULL;
+	}
+	journal_applied = journal_end = JOURNAL_START;
+	journal_failed = 0;
+	journal_unsynced = 0;
+	journal_path = path;
+	if( !*path.c_str() )
+		return true;
+
+	journal_fp = fopen(path.c_str(), "r+b");
+	if( !journal_fp )
+		journal_fp = fopen(path.c_str(), "w+b");
+	if( !journal_fp )
+	{
+		ShowError("journal: cannot open '%s', saves are not journaled\n", path.c_str());
+		return false;
+	}
+	fseek(journal_fp, 0, SEEK_END);
+	journal_end = ftell(journal_fp);
+	if( journal_end == 0 )
+	{
+		journal_end = JOURNAL_START;
+		journal_mark();
+		return true;
+	}
+
+	journal_file head;
+	fseek(journal_fp, 0, SEEK_SET);
+	if( journal_end < JOURNAL_START || 1 != fread(&head, sizeof(head), 1, journal_fp) || head.magic != JOURNAL_FILE_MAGIC )
+	{
+		ShowError("journal: '%s' is not a journal, saves are not journaled\n", path.c_str());
+		fclose(journal_fp);
+		journal_fp = NULL;
+		journal_applied = journal_end = JOURNAL_START;
+		return false;
+	}
+	journal_applied = ( head.applied >= (uint64)JOURNAL_START && head.applied <= (uint64)journal_end ) ? (long)head.applied : JOURNAL_START;
+	if( journal_applied < journal_end )
+	{
+		ShowInfo("journal: replaying '%s' (%ld bytes)\n", path.c_str(), journal_end-journal_applied);
+		if( !journal_replay() )
+			ShowWarning("journal: database not available, %ld bytes pending\n", journal_end-journal_applied);
+	}
+	else
+		journal_truncate();
+	return true;
+}
+
+void CSQLParameter::journal_close()
+{
+	CSQLLock lock(journal_mutex);
+	if( journal_fp )
+	{
+		if( journal_applied < journal_end )
+			journal_replay();
+		if( journal_applied >= journal_end )
+			journal_truncate();
+		journal_mark();
+		journal_sync();
+		fclose(journal_fp);
+		journal_fp = NULL;
+	}
+	journal_ready = false;
+}
+
+CSQLParameter::journal_result CSQLParameter::journal_apply(const char* data, size_t len)
+{
+	uchar failed;
+	journal_result ret = journal_run(data, len, failed);
+	if( ret == JOURNAL_FAILED )
+	{
+		if( !journal_reachable(base_at(failed)) )
+			ret = JOURNAL_OFFLINE;
+		else if( (ret = journal_run(data, len, failed)) == JOURNAL_FAILED && !journal_reachable(base_at(failed)) )
+			ret = JOURNAL_OFFLINE;	// a dropped connection looks like a rejected statement, so it got a second try
+	}
+	return ret;
+}
+
+bool CSQLParameter::journal_replay()
+{
+	CSQLLock lock(journal_mutex);
+	if( !journal_fp )
+		return true;
+
+	char* buf = NULL;
+	size_t cap = 0;
+	bool ok = true;
+	bool dropped = false;
+	long last = 0;
+	while( journal_applied < journal_end )
+	{
+		journal_head head;
+		fseek(journal_fp, journal_applied, SEEK_SET);
+		if( 1 != fread(&head, sizeof(head), 1, journal_fp) || head.magic != JOURNAL_MAGIC ||
+			journal_applied + (long)sizeof(head) + (long)head.len > journal_end )
+		{	// torn record at the end from a crash, it never got acknowledged
+			ShowWarning("journal: dropping incomplete record at %ld\n", journal_applied);
+			journal_end = journal_applied;
+			dropped = true;
+			break;
+		}
+		if( head.len > cap )
+		{
+			if(buf) delete[] buf;
+			cap = head.len;
+			buf = new char[cap];
+		}
+		if( head.len != fread(buf, 1, head.len, journal_fp) || head.crc != journal_crc(buf, head.len) )
+		{
+			ShowWarning("journal: dropping corrupted record at %ld\n", journal_applied);
+			journal_end = journal_applied;
+			dropped = true;
+			break;
+		}
+		last = journal_applied;
+		const journal_result res = journal_apply(buf, head.len);
+		if( res == JOURNAL_OFFLINE )
+		{
+			ok = false;
+			break;
+		}
+		if( res == JOURNAL_FAILED )
+		{
+			ShowError("journal: record at %ld rejected by the database, skipped\n", journal_applied);
+			journal_failed = journal_applied;
+		}
+		journal_applied += sizeof(head) + head.len;
+		journal_mark();
+	}
+	if(buf) delete[] buf;
+	fseek(journal_fp, journal_end, SEEK_SET);
+	// read before the truncate resets the offsets
+	journal_tail_failed = dropped || ( journal_failed != 0 && journal_failed == last );
+
+	if( ok )
+		journal_truncate();
+	else
+		journal_next = time(NULL) + (time_t)(uint32)sql_journal_retry;
+	return ok;
+}
+
+bool CSQLParameter::journal_settle()
+{
+	CSQLLock lock(journal_mutex);
+	if( !journal_fp || journal_applied >= journal_end )
+		return true;
+	return journal_replay();
+}
+
+void CSQLParameter::journal_timer(void*)
+{
+	CSQLLock lock(journal_mutex);
+	if( journal_fp && journal_applied < journal_end )
+	{
+		if( journal_replay() )
+			ShowInfo("journal: pending saves replayed\n");
+	}
+}
+
+bool CSQLParameter::journal_commit(const char* data, size_t len)
+{
+	CSQLLock lock(journal_mutex);
+	if( !journal_fp )
+		return journal_apply(data, len) == JOURNAL_DONE;
+
+	journal_head head;
+	head.magic = JOURNAL_MAGIC;
+	head.len   = len;
+	head.crc   = journal_crc(data, len);
+
+	const long pos = journal_end;
+	fseek(journal_fp, pos, SEEK_SET);
+	if( 1 != fwrite(&head, sizeof(head), 1, journal_fp) || len != fwrite(data, 1, len, journal_fp) )
+	{	// keep what was written before, this one goes directly
+		ShowError("journal: write failed, running the save unjournaled\n");
+		fseek(journal_fp, pos, SEEK_SET);
+		return journal_apply(data, len) == JOURNAL_DONE;
+	}
+	journal_end += sizeof(head) + len;
+
+	if( journal_applied < pos )
+	{	// older records are pending, they go first and take this one along
+		++journal_unsynced;
+		if( time(NULL) < journal_next || !journal_replay() )
+		{	// kept for the next replay
+			journal_sync();
+			return true;
+		}
+		return !journal_tail_failed;
+	}
+
+	if( ++journal_unsynced >= (uint32)sql_journal_sync )
+		journal_sync();
+
+	const journal_result res = journal_apply(data, len);
+	if( res == JOURNAL_OFFLINE )
+	{	// the record is safe on disk and replayed later
+		ShowWarning("journal: database not available, save kept in the journal\n");
+		journal_sync();
+		journal_next = time(NULL) + (time_t)(uint32)sql_journal_retry;
+		return true;
+	}
+	if( res == JOURNAL_FAILED )
+		ShowError("journal: save rejected by the database\n");
+	journal_applied = journal_end;
+	if( journal_end >= (long)(uint32)sql_journal_size )
+	{
+		journal_sync();
+		journal_truncate();
+	}
+	else
+		journal_mark();
+	return res == JOURNAL_DONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// statement batch
+void CSQLBatch::add(basics::CMySQL& base, const char* query)
+{
+	const uint32 qlen = strlen(query);
+	const size_t need = this->len + 5 + qlen + 1;
+	if( need > this->cap )
+	{
+		size_t ncap = this->cap ? this->cap : 1024;
+		while( ncap < need )
+			ncap *= 2;
+		char* nbuf = new char[ncap];
+		if( this->buf )
+		{
+			memcpy(nbuf, this->buf, this->len);
+			delete[] this->buf;
+		}
+		this->buf = nbuf;
+		this->cap = ncap;
+	}
+	this->buf[this->len] = (char)CSQLParameter::base_index(base);
+	memcpy(this->buf+this->len+1, &qlen, 4);
+	memcpy(this->buf+this->len+5, query, qlen+1);
+	this->len = need;
+}
+
+bool CSQLBatch::commit()
+{
+	bool ret = true;
+	if( this->len )
+		ret = CSQLParameter::journal_commit(this->buf, this->len);
+	this->len = 0;
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// startup warm-up
+basics::CParam<bool> CSQLWarmup::sql_warmup("sql_warmup", true);
+basics::CParam<uint32> CSQLWarmup::sql_warmup_threads("sql_warmup_threads", 4);
+basics::CParam<uint32> CSQLWarmup::sql_warmup_days("sql_warmup_days", 3);
+volatile bool CSQLWarmup::is_ready = false;
+
+bool CSQLWarmup::add(const char* name, loader func, void* obj, size_t arg)
+{
+	if( this->cnt >= MAX_TASKS )
+		return false;
+	task& t = this->tasks[this->cnt++];
+	t.name = name;
+	t.func = func;
+	t.obj  = obj;
+	t.arg  = arg;
+	t.base = NULL;
+	t.query.clear();
+	t.done = false;
+	t.ok   = false;
+	return true;
+}
+
+bool CSQLWarmup::add(const char* name, basics::CMySQL& base, const basics::string<>& query)
+{
+	if( this->cnt >= MAX_TASKS )
+		return false;
+	task& t = this->tasks[this->cnt++];
+	t.name = name;
+	t.func = NULL;
+	t.obj  = NULL;
+	t.arg  = 0;
+	t.base = &base;
+	t.query.clear();
+	t.query << query;
+	t.done = false;
+	t.ok   = false;
+	return true;
+}
 
+void CSQLWarmup::work(size_t first, size_t step)
+{
+	size_t i;
+	for(i=first; i<this->cnt; i+=step)
+	{
+		task& t = this->tasks[i];
+		if( t.func )
+		{
+			t.ok = t.func(t.obj, t.arg);
+		}
+		else
+		{	// only the reading matters
+			basics::CMySQLConnection dbcon1(*t.base);
+			t.ok = dbcon1.ResultQuery(t.query);
+			for( ; t.ok && dbcon1; ++dbcon1)
+				;
+		}
+		t.done = true;
+	}
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_login_log("tbl_login_log", "login_log", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_char_log("tbl_char_log", "char_log", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_map_log("tbl_map_log", "map_log", ParamCallback_Tables);
+struct warmup_worker
+{
+	CSQLWarmup*	self;
+	size_t		first;
+	size_t		step;
+};
+#ifdef WIN32
+static unsigned __stdcall warmup_main(void* p)
+#else
+static void* warmup_main(void* p)
+#endif
+{
+	warmup_worker* w = (warmup_worker*)p;
+	w->self->work(w->first, w->step);
+	return 0;
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_login_status("tbl_login_status", "login_status", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_char_status("tbl_char_status", "char_status", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_map_status("tbl_map_status", "map_status", ParamCallback_Tables);
+bool CSQLWarmup::run()
+{
+	const time_t start = time(NULL);
+	size_t i, started = 0, reported = 0;
+	size_t step = sql_warmup_threads;
+	bool ret = true;
+
+	if( step > this->cnt )
+		step = this->cnt;
+	is_ready = false;
+	ShowInfo("warm-up: %lu tasks on %lu threads\n", (ulong)this->cnt, (ulong)step);
+
+	warmup_worker* workers = new warmup_worker[step+1];
+	bool* shown = new bool[this->cnt+1];
+#ifdef WIN32
+	HANDLE* threads = new HANDLE[step+1];
+#else
+	pthread_t* threads = new pthread_t[step+1];
+#endif
+	for(i=0; i<this->cnt; ++i)
+		shown[i] = false;
+	for(i=0; i<step; ++i, ++started)
+	{
+		workers[i].self  = this;
+		workers[i].first = i;
+		workers[i].step  = step;
+#ifdef WIN32
+		threads[i] = (HANDLE)_beginthreadex(NULL, 0, warmup_main, &workers[i], 0, NULL);
+		if( !threads[i] )
+			break;
+#else
+		if( 0!=pthread_create(&threads[i], NULL, warmup_main, &workers[i]) )
+			break;
+#endif
+	}
+	// tasks of threads that could not be started are done here
+	if( !step )
+		this->work(0, 1);
+	for(i=started; i<step; ++i)
+		this->work(i, step);
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_account("tbl_account", "account", ParamCallback_Tables);
+	while( reported < this->cnt )
+	{
+		const size_t last = reported;
+		for(i=0; i<this->cnt; ++i)
+		{
+			if( !shown[i] && this->tasks[i].done )
+			{
+				shown[i] = true;
+				++reported;
+				if( !this->tasks[i].ok )
+				{
+					ShowWarning("warm-up %lu/%lu: %s failed\n", (ulong)reported, (ulong)this->cnt, this->tasks[i].name);
+					ret = false;
+				}
+				else
+					ShowInfo("warm-up %lu/%lu: %s\n", (ulong)reported, (ulong)this->cnt, this->tasks[i].name);
+			}
+		}
+		if( reported == last )
+		{
+#ifdef WIN32
+			Sleep(100);
+#else
+			usleep(100000);
+#endif
+		}
+	}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_char("tbl_char", "character", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_memo("tbl_memo", "memo", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_inventory("tbl_inventory", "inventory", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_cart("tbl_cart", "cart", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_skill("tbl_skill", "skill", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_friends("tbl_friends", "friends", ParamCallback_Tables);
+	for(i=0; i<started; ++i)
+	{
+#ifdef WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#else
+		pthread_join(threads[i], NULL);
+#endif
+	}
+	delete[] threads;
+	delete[] shown;
+	delete[] workers;
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_mail("tbl_mail", "mail", ParamCallback_Tables);
+	ShowInfo("warm-up finished in %lu seconds\n", (ulong)(time(NULL)-start));
+	is_ready = true;
+	return ret;
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_login_reg("tbl_login_reg", "login_reg", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_login_reg2("tbl_login_reg2", "login_reg2", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_char_reg("tbl_char_reg", "char_reg", ParamCallback_Tables);
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild("tbl_guild","guild", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_skill("tbl_guild_skill","guild_skill", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_member("tbl_guild_member","guild_member", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_position("tbl_guild_position","guild_position", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_alliance("tbl_guild_alliance","guild_alliance", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_expulsion("tbl_guild_expulsion","guild_expulsion", ParamCallback_Tables);
+///////////////////////////////////////////////////////////////////////////////
+// mutex
+CSQLMutex::CSQLMutex()
+{
+#ifdef WIN32
+	CRITICAL_SECTION* cs = new CRITICAL_SECTION;
+	InitializeCriticalSection(cs);
+	this->mx = cs;
+#else
+	pthread_mutex_t* m = new pthread_mutex_t;
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(m, &attr);
+	pthread_mutexattr_destroy(&attr);
+	this->mx = m;
+#endif
+}
+CSQLMutex::~CSQLMutex()
+{
+#ifdef WIN32
+	DeleteCriticalSection((CRITICAL_SECTION*)this->mx);
+	delete (CRITICAL_SECTION*)this->mx;
+#else
+	pthread_mutex_destroy((pthread_mutex_t*)this->mx);
+	delete (pthread_mutex_t*)this->mx;
+#endif
+}
+void CSQLMutex::lock()
+{
+#ifdef WIN32
+	EnterCriticalSection((CRITICAL_SECTION*)this->mx);
+#else
+	pthread_mutex_lock((pthread_mutex_t*)this->mx);
+#endif
+}
+void CSQLMutex::unlock()
+{
+#ifdef WIN32
+	LeaveCriticalSection((CRITICAL_SECTION*)this->mx);
+#else
+	pthread_mutex_unlock((pthread_mutex_t*)this->mx);
+#endif
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_castle("tbl_castle","castle", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_castle_guardian("tbl_castle_guardian", "castle_guardian", ParamCallback_Tables);
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_party ("tbl_party", "party", ParamCallback_Tables);
+///////////////////////////////////////////////////////////////////////////////
+// prepared statement
+bool CSQLStatement::open()
+{
+	if( this->stmt )
+		return true;
+	if( !this->prepared() )
+		return false;
+
+	const basics::string<>& id = CSQLParameter::mysqldb_id;
+	const basics::string<>& pw = CSQLParameter::mysqldb_pw;
+	const basics::string<>& db = CSQLParameter::mysqldb_db;
+	const basics::string<>& ip = CSQLParameter::mysqldb_ip;
+	const basics::string<>& cp = CSQLParameter::mysqldb_cp;
+
+	this->mysql = mysql_init(NULL);
+	if( !this->mysql ||
+		!mysql_real_connect(this->mysql, ip.c_str(), id.c_str(), pw.c_str(), db.c_str(), (ushort)CSQLParameter::mysqldb_port, NULL, 0) )
+	{
+		ShowError("sql statement: cannot connect: %s\n", this->mysql?mysql_error(this->mysql):"out of memory");
+		this->close();
+		return false;
+	}
+	if( 0!=strcasecmp(cp.c_str(), "DEFAULT") )
+		mysql_set_character_set(this->mysql, cp.c_str());
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_storage("tbl_storage", "storage", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_guild_storage("tbl_guild_storage", "guild_storage", ParamCallback_Tables);
+	this->stmt = mysql_stmt_init(this->mysql);
+	if( !this->stmt ||
+		mysql_stmt_prepare(this->stmt, this->query.c_str(), strlen(this->query.c_str())) )
+	{
+		ShowError("sql statement: cannot prepare '%s': %s\n", this->query.c_str(), this->stmt?mysql_stmt_error(this->stmt):mysql_error(this->mysql));
+		this->close();
+		return false;
+	}
+	return true;
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_pet("tbl_pet", "pet", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_homunculus("tbl_homunculus", "homunculus", ParamCallback_Tables);
-basics::CParam< basics::string<> > CSQLParameter::tbl_homunskill("tbl_homunskill", "homunskill", ParamCallback_Tables);
+void CSQLStatement::prepare(const basics::string<>& q)
+{
+	CSQLLock lock(this->mx);
+	this->close();
+	this->query = q;
+}
 
-basics::CParam< basics::string<> > CSQLParameter::tbl_variable("tbl_variable", "variable", ParamCallback_Tables);
+void CSQLStatement::close()
+{
+	CSQLLock lock(this->mx);
+	if( this->stmt )
+		mysql_stmt_close(this->stmt);
+	if( this->mysql )
+		mysql_close(this->mysql);
+	this->stmt = NULL;
+	this->mysql = NULL;
+}
 
+bool CSQLStatement::execute(uint32 key, CSQLResult& r)
+{
+	this->mx.lock();
+	if( !this->open() )
+	{
+		this->mx.unlock();
+		return false;
+	}
 
-basics::CParam<bool> CSQLParameter::wipe_sql("wipe_sql", false);
-basics::CParam< basics::string<> > CSQLParameter::sql_engine("sql_engine", "InnoDB"); // or "MyISAM"
+	MYSQL_BIND param;
+	memset(&param, 0, sizeof(param));
+	param.buffer_type	= MYSQL_TYPE_LONG;
+	param.buffer		= &key;
+	param.is_unsigned	= 1;
+
+	if( mysql_stmt_param_count(this->stmt) != 1 ||
+		mysql_stmt_field_count(this->stmt) != r.cnt ||
+		mysql_stmt_bind_param(this->stmt, &param) ||
+		mysql_stmt_execute(this->stmt) ||
+		mysql_stmt_bind_result(this->stmt, r.binds) ||
+		mysql_stmt_store_result(this->stmt) )
+	{	// the connection is opened and the statement prepared again
+		// with the next call, the caller reads this one as text
+		ShowError("sql statement: '%s' failed: %s\n", this->query.c_str(), mysql_stmt_error(this->stmt));
+		this->close();
+		this->mx.unlock();
+		return false;
+	}
+	return true;
+}
 
-basics::CParam<bool> CSQLParameter::log_login("log_login", true);
-basics::CParam<bool> CSQLParameter::log_char("log_char", true);
-basics::CParam<bool> CSQLParameter::log_map("log_map", true);
+bool CSQLStatement::fetch()
+{
+	if( !this->stmt )
+		return false;
+	const int ret = mysql_stmt_fetch(this->stmt);
+	// truncated text is cut by the decoder anyway
+	return ( ret==0 || ret==MYSQL_DATA_TRUNCATED );
+}
 
+void CSQLStatement::done()
+{
+	if( this->stmt )
+		mysql_stmt_free_result(this->stmt);
+	this->mx.unlock();
+}
 
-bool CSQLParameter::ParamCallback_Database_string(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+///////////////////////////////////////////////////////////////////////////////
+// sql timer
+static struct
 {
-	sqlbase.init(mysqldb_id, mysqldb_pw,mysqldb_db,mysqldb_ip,mysqldb_port, mysqldb_cp);
-	return true;
+	const char*			name;
+	CSQLTimer::handler	func;
+	void*				obj;
+	uint32				interval;
+	time_t				next;
+} timer_task[CSQLTimer::MAX_TASKS];
+static size_t timer_cnt = 0;
+static CSQLMutex timer_mutex;			///< guards the task table and the running call
+static volatile bool timer_running = false;
+static volatile bool timer_quit = false;
+#ifdef WIN32
+static HANDLE timer_thread;
+static unsigned __stdcall timer_main(void*)
+#else
+static pthread_t timer_thread;
+static void* timer_main(void*)
+#endif
+{
+	CSQLTimer::run();
+	return 0;
 }
-bool CSQLParameter::ParamCallback_Database_ushort(const basics::string<>& name, ushort& newval, const ushort& oldval)
+
+bool CSQLTimer::add(const char* name, handler func, void* obj, uint32 interval)
 {
-	sqlbase.init(mysqldb_id, mysqldb_pw,mysqldb_db,mysqldb_ip,mysqldb_port, mysqldb_cp);
-	return true;
+	CSQLLock lock(timer_mutex);
+	if( timer_cnt >= MAX_TASKS )
+	{
+		ShowError("sql timer: no room for task '%s'\n", name);
+		return false;
+	}
+	timer_task[timer_cnt].name = name;
+	timer_task[timer_cnt].func = func;
+	timer_task[timer_cnt].obj = obj;
+	timer_task[timer_cnt].interval = interval?interval:1;
+	timer_task[timer_cnt].next = time(NULL) + timer_task[timer_cnt].interval;
+	++timer_cnt;
+
+	if( !timer_running )
+	{
+		timer_quit = false;
+#ifdef WIN32
+		timer_thread = (HANDLE)_beginthreadex(NULL, 0, timer_main, NULL, 0, NULL);
+		timer_running = ( timer_thread != 0 );
+#else
+		timer_running = ( 0==pthread_create(&timer_thread, NULL, timer_main, NULL) );
+#endif
+		if( !timer_running )
+			ShowError("sql timer: could not start the timer thread\n");
+	}
+	return timer_running;
 }
-bool CSQLParameter::ParamCallback_Tables(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval)
+
+void CSQLTimer::remove(void* obj)
+{	// a running call holds the lock
+	CSQLLock lock(timer_mutex);
+	size_t i;
+	for(i=0; i<timer_cnt; )
+	{
+		if( timer_task[i].obj == obj )
+			timer_task[i] = timer_task[--timer_cnt];
+		else
+			++i;
+	}
+}
+
+void CSQLTimer::stop()
 {
-	CSQLParameter::rebuild();
-	return true;
+	if( timer_running )
+	{
+		timer_quit = true;
+#ifdef WIN32
+		WaitForSingleObject(timer_thread, INFINITE);
+		CloseHandle(timer_thread);
+#else
+		pthread_join(timer_thread, NULL);
+#endif
+		timer_running = false;
+	}
+}
+
+void CSQLTimer::run()
+{
+	while( !timer_quit )
+	{
+		{
+			CSQLLock lock(timer_mutex);
+			const time_t now = time(NULL);
+			size_t i;
+			for(i=0; i<timer_cnt && !timer_quit; ++i)
+			{
+				if( now >= timer_task[i].next )
+				{
+					timer_task[i].next = now + timer_task[i].interval;
+					timer_task[i].func(timer_task[i].obj);
+				}
+			}
+		}
+#ifdef WIN32
+		Sleep(100);
+#else
+		usleep(100000);
+#endif
+	}
 }
 
 
@@ -314,11 +2298,23 @@ void CSQLParameter::rebuild()
 	// drop all tables, drop child tables first
 	if( CSQLParameter::wipe_sql )
 	{
+		///////////////////////////////////////////////////////////////////////
+		query << "DROP TABLE IF EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_heartbeat) << "`";
+		dbcon1.PureQuery(query);
+		query.clear();
 		///////////////////////////////////////////////////////////////////////
 		query << "DROP TABLE IF EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_variable) << "`";
 		dbcon1.PureQuery(query);
 		query.clear();
 		///////////////////////////////////////////////////////////////////////
+		query << "DROP TABLE IF EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_registry) << "`";
+		dbcon1.PureQuery(query);
+		query.clear();
+		///////////////////////////////////////////////////////////////////////
+		query << "DROP TABLE IF EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "`";
+		dbcon1.PureQuery(query);
+		query.clear();
+		///////////////////////////////////////////////////////////////////////
 		query << "DROP TABLE IF EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_homunskill) << "`";
 		dbcon1.PureQuery(query);
 		query.clear();
@@ -452,6 +2448,7 @@ void CSQLParameter::rebuild()
 			 "`log`		VARCHAR(100) NOT NULL"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
+	CSQLParameter::partition_clause(query, "UNIX_TIMESTAMP(`time`)");
 	dbcon1.PureQuery(query);
 	query.clear();
 
@@ -555,51 +2552,6 @@ void CSQLParameter::rebuild()
 		ShowInfo("created default server accounts\n"CL_SPACE"it is recommended to modify the passwords\n");
 	}
 
-	///////////////////////////////////////////////////////////////////////////
-	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_login_reg) << "` "
-			 "("
-			 "`account_id`      INTEGER UNSIGNED NOT NULL,"
-			 "`str`             VARCHAR(34) NOT NULL,"
-			 "`value`           VARCHAR(255) NOT NULL default '',"
-			 "PRIMARY KEY (`account_id`,`str`),"
-			 "KEY `account_id` (`account_id`),"
-			 "FOREIGN KEY (`account_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_account) << "` (`account_id`) ON DELETE CASCADE ON UPDATE CASCADE"
-			 ") "
-			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
-	dbcon1.PureQuery(query);
-	query.clear();
-
-#ifdef DEVELOPING_CSQL
-	athena << sq::Table(CSQLParameter::tbl_login_reg, CSQLParameter::sql_engine)
-		<< sq::RefColumn("account_id", sq::ACTION_CASCADE, sq::ACTION_CASCADE, tbl_account) << sq::Primary()
-		<< sq::TextColumn("str",34,true,false) << sq::Primary()
-		<< sq::TextColumn("value",255,true,false) << sq::Default("");
-#endif
-
-	///////////////////////////////////////////////////////////////////////////
-	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_login_reg2) << "` "
-			 "("
-			 "`account_id`      INTEGER UNSIGNED NOT NULL,"
-			 "`str`             VARCHAR(34) NOT NULL,"
-			 "`value`           VARCHAR(255) NOT NULL default '',"
-			 "PRIMARY KEY (`account_id`,`str`),"
-			 "KEY `account_id` (`account_id`),"
-			 "FOREIGN KEY (`account_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_account) << "` (`account_id`) ON DELETE CASCADE ON UPDATE CASCADE"
-			 ") "
-			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
-	dbcon1.PureQuery(query);
-	query.clear();
-
-#ifdef DEVELOPING_CSQL
-	athena << sq::CopyTable(CSQLParameter::tbl_login_reg2,CSQLParameter::tbl_login_reg);
-	/*
-	athena << sq::Table(CSQLParameter::tbl_login_reg2, CSQLParameter::sql_engine)
-		<< sq::RefColumn("account_id", sq::ACTION_CASCADE, sq::ACTION_CASCADE, tbl_account) << sq::Primary()
-		<< sq::TextColumn("str",34,true) << sq::Primary()
-		<< sq::TextColumn("value",255,true,false) << sq::Default("");
-	*/
-#endif
-
 	///////////////////////////////////////////////////////////////////////////
 	basics::CParam<uint32> start_char_num("start_char_num", 20000000);
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` "
@@ -734,27 +2686,6 @@ void CSQLParameter::rebuild()
 
 
 
-	///////////////////////////////////////////////////////////////////////////
-	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_char_reg) << "` "
-			 "("
-			 "`char_id`			INTEGER UNSIGNED NOT NULL default '0',"
-			 "`str`				VARCHAR(32) NOT NULL,"
-			 "`value`			VARCHAR(255) NOT NULL default '',"
-			 "PRIMARY KEY (`char_id`,`str`),"
-			 "KEY `char_id` (`char_id`),"
-			 "FOREIGN KEY (`char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
-			 ") "
-			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
-	dbcon1.PureQuery(query);
-	query.clear();
-
-#ifdef DEVELOPING_CSQL
-	athena << sq::Table(CSQLParameter::tbl_char_reg, CSQLParameter::sql_engine)
-		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Primary()
-		<< sq::TextColumn("str",32,true,false) << sq::Primary()
-		<< sq::TextColumn("value",255,true,false) << sq::Default("");
-#endif
-
 	///////////////////////////////////////////////////////////////////////////
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_friends) << "` ("
 			 "`char_id` 		INTEGER UNSIGNED NOT NULL default '0',"
@@ -778,6 +2709,7 @@ void CSQLParameter::rebuild()
 	///////////////////////////////////////////////////////////////////////////
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_inventory) << "` ("
 			 "`char_id`			INTEGER UNSIGNED NOT NULL default '0',"
+			 "`pos`				SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`nameid`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`equip`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`amount`			INTEGER UNSIGNED NOT NULL default '0',"
@@ -788,16 +2720,19 @@ void CSQLParameter::rebuild()
 			 "`card1` 			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card2`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card3`			SMALLINT UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`char_id`,`pos`),"
 			 "KEY `char_id` (`char_id`),"
 			 "FOREIGN KEY (`char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
 	dbcon1.PureQuery(query);
 	query.clear();
+	migrate_item_table(dbcon1, CSQLParameter::tbl_inventory, "char_id");
 
 #ifdef DEVELOPING_CSQL
 	athena << sq::Table(CSQLParameter::tbl_inventory, CSQLParameter::sql_engine)
 		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<uint16>("pos",false) << sq::Default(0) << sq::Primary()
 		<< sq::IntColumn<uint16>("nameid",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("equip",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("amount",false) << sq::Default(0)
@@ -813,6 +2748,7 @@ void CSQLParameter::rebuild()
 	///////////////////////////////////////////////////////////////////////////
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_cart) << "` ("
 			 "`char_id`			INTEGER UNSIGNED NOT NULL default '0',"
+			 "`pos`				SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`nameid`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`equip`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`amount`			INTEGER UNSIGNED NOT NULL default '0',"
@@ -823,19 +2759,22 @@ void CSQLParameter::rebuild()
 			 "`card1` 			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card2`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card3`			SMALLINT UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`char_id`,`pos`),"
 			 "KEY `char_id` (`char_id`),"
 			 "FOREIGN KEY (`char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
 	dbcon1.PureQuery(query);
 	query.clear();
+	migrate_item_table(dbcon1, CSQLParameter::tbl_cart, "char_id");
 
 #ifdef DEVELOPING_CSQL
 	/*
 	athena << sq::CopyTable(CSQLParameter::tbl_cart, CSQLParameter::tbl_inventory);
 	*/
 	athena << sq::Table(CSQLParameter::tbl_cart, CSQLParameter::sql_engine)
-		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Default(0)
+		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<uint16>("pos",false) << sq::Default(0) << sq::Primary()
 		<< sq::IntColumn<uint16>("nameid",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("equip",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("amount",false) << sq::Default(0)
@@ -851,9 +2790,11 @@ void CSQLParameter::rebuild()
 	///////////////////////////////////////////////////////////////////////////
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_memo) << "` ("
 			 "`char_id` 		INTEGER UNSIGNED NOT NULL default '0',"
+			 "`memo_id`			TINYINT UNSIGNED NOT NULL default '0',"
 			 "`map` 			VARCHAR(20) NOT NULL default '',"
 			 "`x` 				SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`y`				SMALLINT UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`char_id`,`memo_id`),"
 			 "KEY `char_id` (`char_id`),"
 			 "FOREIGN KEY (`char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
 			 ") "
@@ -863,7 +2804,8 @@ void CSQLParameter::rebuild()
 
 #ifdef DEVELOPING_CSQL
 	athena << sq::Table(CSQLParameter::tbl_memo, CSQLParameter::sql_engine)
-		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Default(0)
+		<< sq::RefColumn("char_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_char) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<uint8>("memo_id",false) << sq::Default(0) << sq::Primary()
 		<< sq::TextColumn("map",20,true,false) << sq::Default("")
 		<< sq::IntColumn<uint16>("x",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("y",false) << sq::Default(0);
@@ -911,11 +2853,21 @@ void CSQLParameter::rebuild()
 			 "`item_card1` 		SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`item_card2` 		SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`item_card3` 		SMALLINT UNSIGNED NOT NULL default '0',"
-			 "PRIMARY KEY (`message_id`),"
-			 "KEY `to_char_id` (`to_char_id`),"
-			 "FOREIGN KEY (`to_char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
-			 ") "
-			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine) << " AUTO_INCREMENT=1";
+			 "KEY `to_char_id` (`to_char_id`),";
+	if( CSQLParameter::partition_period() )
+	{	// no foreign keys and the range column in the key
+		query << "PRIMARY KEY (`message_id`,`sendtime`)"
+				 ") "
+				 "ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine) << " AUTO_INCREMENT=1";
+		CSQLParameter::partition_clause(query, "`sendtime`");
+	}
+	else
+	{
+		query << "PRIMARY KEY (`message_id`),"
+				 "FOREIGN KEY (`to_char_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_char) << "` (`char_id`) ON DELETE CASCADE ON UPDATE CASCADE"
+				 ") "
+				 "ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine) << " AUTO_INCREMENT=1";
+	}
 	dbcon1.PureQuery(query);
 	query.clear();
 
@@ -947,6 +2899,7 @@ void CSQLParameter::rebuild()
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_storage) << "` "
 			 "("
 			 "`account_id`		INTEGER UNSIGNED NOT NULL default '0',"
+			 "`pos`				SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`nameid`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`equip`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`amount`			INTEGER UNSIGNED NOT NULL default '0',"
@@ -957,16 +2910,19 @@ void CSQLParameter::rebuild()
 			 "`card1` 			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card2`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card3`			SMALLINT UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`account_id`,`pos`),"
 			 "KEY `account_id` (`account_id`),"
 			 "FOREIGN KEY (`account_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_account) << "` (`account_id`) ON DELETE CASCADE ON UPDATE CASCADE"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
 	dbcon1.PureQuery(query);
 	query.clear();
+	migrate_item_table(dbcon1, CSQLParameter::tbl_storage, "account_id");
 
 #ifdef DEVELOPING_CSQL
 	athena << sq::Table(CSQLParameter::tbl_storage, CSQLParameter::sql_engine)
-		<< sq::RefColumn("account_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_account) << sq::Default(0)
+		<< sq::RefColumn("account_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_account) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<uint16>("pos",false) << sq::Default(0) << sq::Primary()
 		<< sq::IntColumn<uint16>("nameid",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("equip",false) << sq::Default(0)
 		<< sq::IntColumn<>("amount",false) << sq::Default(0)
@@ -1045,6 +3001,7 @@ void CSQLParameter::rebuild()
 	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_guild_storage) << "` "
 			 "("
 			 "`guild_id`		INTEGER UNSIGNED NOT NULL default '0',"
+			 "`pos`				SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`nameid`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`equip`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`amount`			INTEGER UNSIGNED NOT NULL default '0',"
@@ -1055,16 +3012,19 @@ void CSQLParameter::rebuild()
 			 "`card1` 			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card2`			SMALLINT UNSIGNED NOT NULL default '0',"
 			 "`card3`			SMALLINT UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`guild_id`,`pos`),"
 			 "KEY `guild_id` (`guild_id`),"
 			 "FOREIGN KEY (`guild_id`) REFERENCES `" << dbcon1.escaped(CSQLParameter::tbl_guild) << "` (`guild_id`) ON DELETE CASCADE ON UPDATE CASCADE"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
 	dbcon1.PureQuery(query);
 	query.clear();
+	migrate_item_table(dbcon1, CSQLParameter::tbl_guild_storage, "guild_id");
 
 #ifdef DEVELOPING_CSQL
 	athena << sq::Table(CSQLParameter::tbl_guild_storage, CSQLParameter::sql_engine)
-		<< sq::RefColumn("guild_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_guild) << sq::Default(0)
+		<< sq::RefColumn("guild_id",sq::ACTION_CASCADE,sq::ACTION_CASCADE,tbl_guild) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<uint16>("pos",false) << sq::Default(0) << sq::Primary()
 		<< sq::IntColumn<uint16>("nameid",false) << sq::Default(0)
 		<< sq::IntColumn<uint16>("equip",false) << sq::Default(0)
 		<< sq::IntColumn<>("amount",false) << sq::Default(0)
@@ -1476,28 +3436,121 @@ void CSQLParameter::rebuild()
 #endif
 
 	///////////////////////////////////////////////////////////////////////////
-	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_variable) << "` ("
-			 "`name`			VARCHAR(32) NOT NULL default '',"
-			 "`stortype`		SMALLINT UNSIGNED NOT NULL default '0',"
-			 "`storid`			INTEGER UNSIGNED NOT NULL default '0',"
-			 "`vartype`			SMALLINT UNSIGNED NOT NULL default '0',"
-			 "`value`			SMALLINT UNSIGNED NOT NULL default '0',"
-		 
-			 "PRIMARY KEY (`name`,`stortype`,`storid`),"
-			 "KEY `name` (`name`),"
-			 "KEY `storid` (`storid`)"
+	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` ("
+			 "`key_id`			INTEGER UNSIGNED AUTO_INCREMENT,"
+			 "`name`			VARCHAR(34) NOT NULL,"
+			 "PRIMARY KEY (`key_id`),"
+			 "UNIQUE KEY `name` (`name`)"
+			 ") "
+			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
+	dbcon1.PureQuery(query);
+	query.clear();
+	if( existing_tables.find(CSQLParameter::tbl_reg_key) )
+	{	// older tables cut the names at 32 chars
+		query << "ALTER TABLE `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` "
+				 "MODIFY `name` VARCHAR(34) NOT NULL";
+		dbcon1.PureQuery(query);
+		query.clear();
+	}
+
+#ifdef DEVELOPING_CSQL
+	athena << sq::Table(CSQLParameter::tbl_reg_key,CSQLParameter::sql_engine)
+		<< sq::IntColumn<>("key_id") << sq::AutoIncrements(1) << sq::Primary()
+		<< sq::TextColumn("name",34,true,false) << sq::Index();
+#endif
+
+	///////////////////////////////////////////////////////////////////////////
+	// all registers of chars, accounts and the server in one table,
+	// scope is a CSQLParameter::reg_scope, owner the char/account id or 0.
+	// no foreign key on owner since it points to different tables
+	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_registry) << "` ("
+			 "`scope`			TINYINT UNSIGNED NOT NULL,"
+			 "`owner`			INTEGER UNSIGNED NOT NULL default '0',"
+			 "`key_id`			INTEGER UNSIGNED NOT NULL,"
+			 "`ival`			INTEGER NOT NULL default '0',"
+			 "`sval`			VARCHAR(255) NOT NULL default '',"
+			 "PRIMARY KEY (`scope`,`owner`,`key_id`),"
+			 "KEY `key_id` (`key_id`)"
+			 ") "
+			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
+	dbcon1.PureQuery(query);
+	query.clear();
+
+#ifdef DEVELOPING_CSQL
+	athena << sq::Table(CSQLParameter::tbl_registry,CSQLParameter::sql_engine)
+		<< sq::IntColumn<uint8>("scope",false) << sq::Primary()
+		<< sq::IntColumn<>("owner",false) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<>("key_id",false) << sq::Primary() << sq::Index()
+		<< sq::IntColumn<>("ival") << sq::Default(0)
+		<< sq::TextColumn("sval",255,true,false) << sq::Default("");
+#endif
+
+	///////////////////////////////////////////////////////////////////////////
+	// move the registers of the old per-owner tables over.
+	// the old tables are left in place
+	if( !CSQLParameter::wipe_sql() && !existing_tables.find(CSQLParameter::tbl_registry) )
+	{
+		const struct
+		{
+			const basics::CParam< basics::string<> >* table;
+			const char* owner;
+			CSQLParameter::reg_scope scope;
+		} old_reg[] =
+		{
+			{ &CSQLParameter::tbl_char_reg,   "char_id",    CSQLParameter::REG_CHAR },
+			{ &CSQLParameter::tbl_login_reg,  "account_id", CSQLParameter::REG_ACCOUNT }
+		};
+		size_t k;
+		for(k=0; k<sizeof(old_reg)/sizeof(old_reg[0]); ++k)
+		{
+			if( !existing_tables.find(*old_reg[k].table) )
+				continue;
+			query << "INSERT IGNORE INTO `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` (`name`) "
+					 "SELECT DISTINCT `str` FROM `" << dbcon1.escaped(*old_reg[k].table) << "`";
+			dbcon1.PureQuery(query);
+			query.clear();
+			query << "INSERT IGNORE INTO `" << dbcon1.escaped(CSQLParameter::tbl_registry) << "` "
+					 "(`scope`,`owner`,`key_id`,`ival`) "
+					 "SELECT '" << (int)old_reg[k].scope << "', `r`.`" << old_reg[k].owner << "`, `k`.`key_id`, `r`.`value` "
+					 "FROM `" << dbcon1.escaped(*old_reg[k].table) << "` `r` "
+					 "JOIN `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` `k` ON `k`.`name`=`r`.`str`";
+			if( dbcon1.PureQuery(query) )
+			{
+				const basics::string<>& tbl_name = *old_reg[k].table;
+				ShowInfo("moved the registers of '%s' to the registry\n", tbl_name.c_str());
+			}
+			query.clear();
+		}
+		if( existing_tables.find(CSQLParameter::tbl_variable) )
+		{
+			query << "INSERT IGNORE INTO `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` (`name`) "
+					 "SELECT DISTINCT `name` FROM `" << dbcon1.escaped(CSQLParameter::tbl_variable) << "`";
+			dbcon1.PureQuery(query);
+			query.clear();
+			query << "INSERT IGNORE INTO `" << dbcon1.escaped(CSQLParameter::tbl_registry) << "` "
+					 "(`scope`,`owner`,`key_id`,`sval`) "
+					 "SELECT '" << (int)CSQLParameter::REG_GLOBAL << "', '0', `k`.`key_id`, `v`.`value` "
+					 "FROM `" << dbcon1.escaped(CSQLParameter::tbl_variable) << "` `v` "
+					 "JOIN `" << dbcon1.escaped(CSQLParameter::tbl_reg_key) << "` `k` ON `k`.`name`=`v`.`name`";
+			dbcon1.PureQuery(query);
+			query.clear();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	query << "CREATE TABLE IF NOT EXISTS `" << dbcon1.escaped(CSQLParameter::tbl_heartbeat) << "` ("
+			 "`id`				TINYINT UNSIGNED NOT NULL default '0',"
+			 "`stamp`			INTEGER UNSIGNED NOT NULL default '0',"
+			 "PRIMARY KEY (`id`)"
 			 ") "
 			"ENGINE = " << dbcon1.escaped(CSQLParameter::sql_engine);
 	dbcon1.PureQuery(query);
 	query.clear();
 
 #ifdef DEVELOPING_CSQL
-	athena << sq::Table(CSQLParameter::tbl_homunskill,CSQLParameter::sql_engine)
-		<< sq::TextColumn("name",32,true,false) << sq::Default(0) << sq::Primary() << sq::Index()
-		<< sq::IntColumn<uint16>("stortype",false) << sq::Default(0) << sq::Primary()
-		<< sq::IntColumn<>("storid",false) << sq::Default(0) << sq::Primary()
-		<< sq::IntColumn<uint16>("vartype",false) << sq::Default(0)
-		<< sq::IntColumn<uint16>("value",false) << sq::Default(0);
+	athena << sq::Table(CSQLParameter::tbl_heartbeat,CSQLParameter::sql_engine)
+		<< sq::IntColumn<uint8>("id",false) << sq::Default(0) << sq::Primary()
+		<< sq::IntColumn<>("stamp",false) << sq::Default(0);
 #endif
 
 	///////////////////////////////////////////////////////////////////////
@@ -1516,6 +3569,15 @@ void CSQLParameter::rebuild()
 	*/
 #endif
 
+	///////////////////////////////////////////////////////////////////////
+	// partitions of the logs and mails
+	CSQLParameter::maintain_partitions();
+
+	///////////////////////////////////////////////////////////////////////
+	// char-scoped tables on the shards
+	size_t i;
+	for(i=0; i<CSQLParameter::sqlshard_cnt; ++i)
+		CSQLParameter::rebuild_shard(CSQLParameter::sqlshard[i]);
 }
 
 
@@ -1536,6 +3598,66 @@ void CSQLParameter::rebuild()
 //////////////////////////////////////////////////////////////////////////////////////
 // CAccountDB_sql Class
 //////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+/// account sex.
+/// 'F', 'M' or 'S' (server) in the table, 0, 1 or 2 in memory
+struct CSQLSexCodec
+{
+	enum { type = sq::ENUM };
+
+	template<typename T>
+	static void decode(void* field, const char* str)
+	{
+		*static_cast<T*>(field) = (str && *str=='S') ? 2 : (str && *str=='M') ? 1 : 0;
+	}
+	template<typename T>
+	static void encode(basics::string<>& query, basics::CMySQLConnection&, const void* field)
+	{
+		const T v = *static_cast<const T*>(field);
+		query << ((v==2)?"S":(v==1)?"M":"F");
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// account columns.
+/// account_id has to stay first, it is not updated
+static const CSQLColumn<CLoginAccount> account_column_list[] =
+{
+	CSQLColumn<CLoginAccount>("account_id",		&CLoginAccount::account_id),
+	CSQLColumn<CLoginAccount>("user_id",		&CLoginAccount::userid),
+	CSQLColumn<CLoginAccount>("user_pass",		&CLoginAccount::passwd),
+	CSQLColumn<CLoginAccount>("sex",			&CLoginAccount::sex, CSQLSexCodec()),
+	CSQLColumn<CLoginAccount>("gm_level",		&CLoginAccount::gm_level),
+	CSQLColumn<CLoginAccount>("online",			&CLoginAccount::online),
+	CSQLColumn<CLoginAccount>("email",			&CLoginAccount::email),
+	CSQLColumn<CLoginAccount>("login_id1",		&CLoginAccount::login_id1),
+	CSQLColumn<CLoginAccount>("login_id2",		&CLoginAccount::login_id2),
+	CSQLColumn<CLoginAccount>("client_ip",		&CLoginAccount::client_ip),	// also read into last_ip
+	CSQLColumn<CLoginAccount>("last_login",		&CLoginAccount::last_login),
+	CSQLColumn<CLoginAccount>("login_count",	&CLoginAccount::login_count),
+	CSQLColumn<CLoginAccount>("ban_until",		&CLoginAccount::ban_until),
+	CSQLColumn<CLoginAccount>("valid_until",	&CLoginAccount::valid_until),
+};
+static const CSQLColumnMap<CLoginAccount> account_columns(account_column_list);
+enum { ACCOUNT_COLUMN_IP = 9 };
+
+///////////////////////////////////////////////////////////////////////////////
+/// account columns the char server reads
+static const CSQLColumn<CCharCharAccount> char_account_column_list[] =
+{
+	CSQLColumn<CCharCharAccount>("account_id",	&CCharCharAccount::account_id),
+	CSQLColumn<CCharCharAccount>("sex",			&CCharCharAccount::sex, CSQLSexCodec()),
+	CSQLColumn<CCharCharAccount>("gm_level",	&CCharCharAccount::gm_level),
+	CSQLColumn<CCharCharAccount>("email",		&CCharCharAccount::email),
+	CSQLColumn<CCharCharAccount>("login_id1",	&CCharCharAccount::login_id1),
+	CSQLColumn<CCharCharAccount>("login_id2",	&CCharCharAccount::login_id2),
+	CSQLColumn<CCharCharAccount>("client_ip",	&CCharCharAccount::client_ip),
+	CSQLColumn<CCharCharAccount>("ban_until",	&CCharCharAccount::ban_until),
+	CSQLColumn<CCharCharAccount>("valid_until",	&CCharCharAccount::valid_until),
+};
+static const CSQLColumnMap<CCharCharAccount> char_account_columns(char_account_column_list);
+
+
 bool CAccountDB_sql::init(const char* configfile)
 {	// init db
 	if(configfile) basics::CParamBase::loadFile(configfile);
@@ -1569,60 +3691,19 @@ bool CAccountDB_sql::sql2struct(const basics::string<>& querycondition, CLoginAc
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	size_t i;
 
-	query << "SELECT "
-			 "`account_id`,"	//  0
-			 "`user_id`,"		//  1
-			 "`user_pass`,"		//  2
-			 "`sex`,"			//  3
-			 "`gm_level`,"		//  4
-			 "`online`,"		//  5
-			 "`email`,"			//  6
-			 "`login_id1`,"		//  7
-			 "`login_id2`,"		//  8
-			 "`client_ip`,"		//  9
-			 "`last_login`,"	// 10
-			 "`login_count`,"	// 11
-			 "`ban_until`,"		// 12
-			 "`valid_until` "	// 13
+	query << "SELECT ";
+	account_columns.names(query);
+	query << " "
 			 "FROM `" << dbcon1.escaped(this->tbl_account) << "` " <<
 			 querycondition;
 
 	if( dbcon1.ResultQuery(query) )
 	{
-		account.account_id	= atol(dbcon1[0]);
-		safestrcpy(account.userid, sizeof(account.userid), dbcon1[1]);
-		safestrcpy(account.passwd, sizeof(account.passwd), dbcon1[2]);
-		account.sex			= ((dbcon1[3][0]=='S') ? (2) : (dbcon1[3][0]=='M'));
-		account.gm_level	= atol(dbcon1[4]);
-		account.online		= atol(dbcon1[5]);
-		safestrcpy(account.email, sizeof(account.email), dbcon1[6]);
-		account.login_id1	= atol(dbcon1[7]);
-		account.login_id2	= atol(dbcon1[8]);
-		account.client_ip	= basics::ipaddress(dbcon1[9]);
-		safestrcpy(account.last_ip, sizeof(account.last_ip), dbcon1[9]);
-		safestrcpy(account.last_login, sizeof(account.last_login), dbcon1[10]);
-		account.login_count	= atol(dbcon1[11]);
-		account.ban_until	= (time_t)(atol(dbcon1[12]));
-		account.valid_until	= (time_t)(atol(dbcon1[13]));
+		account_columns.decode(dbcon1, account);
+		safestrcpy(account.last_ip, sizeof(account.last_ip), dbcon1[ACCOUNT_COLUMN_IP]);
 
-		query.clear();
-		query << "SELECT `str`,`value` "
-				 "FROM `" << dbcon1.escaped(this->tbl_login_reg) << "` "
-				 "WHERE `account_id`='" << account.account_id << "'";
-		dbcon1.ResultQuery(query);
-		for(i=0; dbcon1 && i<ACCOUNT_REG2_NUM; ++dbcon1, ++i)
-		{
-			safestrcpy(account.account_reg2[i].str, sizeof(account.account_reg2[0].str), dbcon1[0]);
-			account.account_reg2[i].value = atoi(dbcon1[1]);
-		}
-		account.account_reg2_num = i;
-		for( ; i<ACCOUNT_REG2_NUM; ++i)
-		{
-			account.account_reg2[i].str[0] = 0;
-			account.account_reg2[i].value = 0;
-		}
+		account.account_reg2_num = reg_load(this->sqlbase, REG_ACCOUNT, account.account_id, account.account_reg2, ACCOUNT_REG2_NUM);
 		return true;
 	}
 	return false;
@@ -1700,8 +3781,10 @@ bool CAccountDB_sql::insertAccount(const char* userid, const char* passwd, unsig
 			 sex << "', '" << 
 			 dbcon1.escaped(email) << "')";
 
-	return	dbcon1.PureQuery(query) &&
-			searchAccount(userid, account);
+	if( !dbcon1.PureQuery(query) )
+		return false;
+	this->count_rows(this->tbl_account, +1);
+	return searchAccount(userid, account);
 }
 
 bool CAccountDB_sql::removeAccount(uint32 accid)
@@ -1710,17 +3793,26 @@ bool CAccountDB_sql::removeAccount(uint32 accid)
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
+	// the registers of the chars before the chars are gone
+	query << "DELETE `r` "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` `r` "
+			 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `c`.`char_id`=`r`.`owner` "
+			 "WHERE `r`.`scope`='" << (int)REG_CHAR << "' AND `c`.`account_id`='" << accid << "'";
+	dbcon1.PureQuery(query);
+	query.clear();
+
 	query << "DELETE "
 			 "FROM `" << this->tbl_account << "` "
 			 "WHERE `account_id`='" << accid << "'";
 	ret = dbcon1.PureQuery(query);
+	if( ret )
+	{	// the chars and storages go with the account
+		this->count_rows(this->tbl_account, -1);
+		this->invalidate_rows(this->tbl_char);
+		this->invalidate_rows(this->tbl_storage);
+	}
 
-	query.clear();
-	query << "DELETE "
-			 "FROM `" << this->tbl_login_reg << "` "
-			 "WHERE `account_id`='" << accid << "'"; // must update with the variable this->tbl_login_reg
-	ret &=dbcon1.PureQuery(query);
-
+	ret &= reg_remove(REG_ACCOUNT, accid);
 	return ret;
 }
 
@@ -1728,61 +3820,29 @@ bool CAccountDB_sql::saveAccount(const CLoginAccount& account)
 {
 	bool ret;
 	basics::CMySQLConnection dbcon1(this->sqlbase);
-	size_t i, doit;
 	basics::string<> query;
 
 	//-----------
 	// Update the this->tbl_account with new info
 	query << "UPDATE `" << dbcon1.escaped(this->tbl_account) << "` "
-			 "SET "
-			 "`user_id` = '"			<< dbcon1.escaped(account.userid)<< "', "
-			 "`user_pass` = '"			<< dbcon1.escaped(account.passwd)<< "', "
-			 "`sex` = '"				<< ((account.sex==1)?"M":"F")	<< "', "
-			 "`gm_level` = '"			<< account.gm_level				<< "', "
-			 "`online` = '"				<< account.online				<< "', "
-			 "`email` = '"				<< dbcon1.escaped(account.email)<< "', "
-			 "`login_id1` = '"			<< account.login_id1			<< "', "
-			 "`login_id2` = '"			<< account.login_id2			<< "', "
-			 "`client_ip` = '"			<< account.client_ip			<< "', "
-			 "`last_login` = '"			<< account.last_login			<< "', "
-			 "`login_count` = '"		<< account.login_count			<< "', "
-			 "`valid_until` = '"		<< (ulong)account.valid_until	<< "', "
-			 "`ban_until` = '"			<< (ulong)account.ban_until		<< "' "
+			 "SET ";
+	account_columns.update(query, dbcon1, account, 1);
+	query << " "
 			 "WHERE `account_id` = '"	<< account.account_id			<< "'";
 
 	ret = dbcon1.PureQuery(query);
 	
 
 	//----------
-	// Delete and reinsert data for the registry values
-	query.clear();
-	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_login_reg) << "` "
-			 "WHERE `account_id`='" << account.account_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
-
-	// Only need to do registry inserts if we have registry stuff to insert.. =o
-	if( account.account_reg2_num )
+	// only the changed registry values
+	CSQLBatch batch;
+	reg_save(batch, REG_ACCOUNT, account.account_id, account.account_reg2, account.account_reg2_num);
+	if( !batch.commit() )
 	{
-		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_login_reg) << "` "
-				 "(`account_id`, `str`, `value`) VALUES ";
-
-		for(i=0, doit=0; i<account.account_reg2_num; ++i)
-		{
-			if( account.account_reg2[i].str[0] && account.account_reg2[i].value )
-			{
-				query << (doit?",":"") <<
-					"("
-					"'" << account.account_id << "',"
-					"'" << dbcon1.escaped(account.account_reg2[i].str) << "',"
-					"'" << account.account_reg2[i].value << "'"
-					") ";
-				doit++;
-			}
-		}
-		if(doit) ret &= dbcon1.PureQuery(query);
+		reg_forget(REG_ACCOUNT, account.account_id);
+		ret = false;
 	}
+
 	return ret;
 }
 
@@ -1799,12 +3859,514 @@ bool CAccountDB_sql::saveAccount(const CLoginAccount& account)
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// char columns.
+/// the key columns char_id, account_id, slot and the name go first,
+/// char_id is skipped on insert, the first four on update
+static const CSQLColumn<CCharCharacter> char_column_list[] =
+{
+	CSQLColumn<CCharCharacter>("char_id",		&CCharCharacter::char_id),
+	CSQLColumn<CCharCharacter>("account_id",	&CCharCharacter::account_id),
+	CSQLColumn<CCharCharacter>("slot",			&CCharCharacter::slot),
+	CSQLColumn<CCharCharacter>("name",			&CCharCharacter::name),
+	CSQLColumn<CCharCharacter>("class",			&CCharCharacter::class_),
+	CSQLColumn<CCharCharacter>("base_level",	&CCharCharacter::base_level),
+	CSQLColumn<CCharCharacter>("job_level",		&CCharCharacter::job_level),
+	CSQLColumn<CCharCharacter>("base_exp",		&CCharCharacter::base_exp),
+	CSQLColumn<CCharCharacter>("job_exp",		&CCharCharacter::job_exp),
+	CSQLColumn<CCharCharacter>("zeny",			&CCharCharacter::zeny),
+	CSQLColumn<CCharCharacter>("str",			&CCharCharacter::str),
+	CSQLColumn<CCharCharacter>("agi",			&CCharCharacter::agi),
+	CSQLColumn<CCharCharacter>("vit",			&CCharCharacter::vit),
+	CSQLColumn<CCharCharacter>("int",			&CCharCharacter::int_),
+	CSQLColumn<CCharCharacter>("dex",			&CCharCharacter::dex),
+	CSQLColumn<CCharCharacter>("luk",			&CCharCharacter::luk),
+	CSQLColumn<CCharCharacter>("max_hp",		&CCharCharacter::max_hp),
+	CSQLColumn<CCharCharacter>("hp",			&CCharCharacter::hp),
+	CSQLColumn<CCharCharacter>("max_sp",		&CCharCharacter::max_sp),
+	CSQLColumn<CCharCharacter>("sp",			&CCharCharacter::sp),
+	CSQLColumn<CCharCharacter>("status_point",	&CCharCharacter::status_point),
+	CSQLColumn<CCharCharacter>("skill_point",	&CCharCharacter::skill_point),
+	CSQLColumn<CCharCharacter>("option",		&CCharCharacter::option),
+	CSQLColumn<CCharCharacter>("karma",			&CCharCharacter::karma),
+	CSQLColumn<CCharCharacter>("chaos",			&CCharCharacter::chaos),
+	CSQLColumn<CCharCharacter>("manner",		&CCharCharacter::manner),
+	CSQLColumn<CCharCharacter>("party_id",		&CCharCharacter::party_id),
+	CSQLColumn<CCharCharacter>("guild_id",		&CCharCharacter::guild_id),
+	CSQLColumn<CCharCharacter>("pet_id",		&CCharCharacter::pet_id),
+	CSQLColumn<CCharCharacter>("hair",			&CCharCharacter::hair),
+	CSQLColumn<CCharCharacter>("hair_color",	&CCharCharacter::hair_color),
+	CSQLColumn<CCharCharacter>("clothes_color",	&CCharCharacter::clothes_color),
+	CSQLColumn<CCharCharacter>("weapon",		&CCharCharacter::weapon),
+	CSQLColumn<CCharCharacter>("shield",		&CCharCharacter::shield),
+	CSQLColumn<CCharCharacter>("head_top",		&CCharCharacter::head_top),
+	CSQLColumn<CCharCharacter>("head_mid",		&CCharCharacter::head_mid),
+	CSQLColumn<CCharCharacter>("head_bottom",	&CCharCharacter::head_bottom),
+	CSQLColumn<CCharCharacter>("last_map",		&CCharCharacter::last_point, &point::mapname),
+	CSQLColumn<CCharCharacter>("last_x",		&CCharCharacter::last_point, &point::x),
+	CSQLColumn<CCharCharacter>("last_y",		&CCharCharacter::last_point, &point::y),
+	CSQLColumn<CCharCharacter>("save_map",		&CCharCharacter::save_point, &point::mapname),
+	CSQLColumn<CCharCharacter>("save_x",		&CCharCharacter::save_point, &point::x),
+	CSQLColumn<CCharCharacter>("save_y",		&CCharCharacter::save_point, &point::y),
+	CSQLColumn<CCharCharacter>("partner_id",	&CCharCharacter::partner_id),
+	CSQLColumn<CCharCharacter>("father_id",		&CCharCharacter::father_id),
+	CSQLColumn<CCharCharacter>("mother_id",		&CCharCharacter::mother_id),
+	CSQLColumn<CCharCharacter>("child_id",		&CCharCharacter::child_id),
+	CSQLColumn<CCharCharacter>("fame_points",	&CCharCharacter::fame_points),
+};
+static const CSQLColumnMap<CCharCharacter> char_columns(char_column_list);
+
+///////////////////////////////////////////////////////////////////////////////
+/// memo columns, the rows are keyed by (char_id,memo_id)
+static const CSQLColumn<struct point> memo_column_list[] =
+{
+	CSQLColumn<struct point>("map",	&point::mapname),
+	CSQLColumn<struct point>("x",	&point::x),
+	CSQLColumn<struct point>("y",	&point::y),
+};
+static const CSQLColumnMap<struct point> memo_columns(memo_column_list);
+
+
+basics::CParam< basics::string<> > CCharDB_sql::char_save_spool("char_save_spool", "save/charqueue.dat");
+basics::CParam<uint32> CCharDB_sql::char_save_queue("char_save_queue", 512);
+basics::CParam<uint32> CCharDB_sql::char_save_rate("char_save_rate", 20);
+basics::CParam<uint32> CCharDB_sql::char_save_burst("char_save_burst", 40);
+basics::CParam<uint32> CCharDB_sql::char_save_delay("char_save_delay", 60);
+basics::CParam<uint32> CCharDB_sql::char_save_dirty_bonus("char_save_dirty_bonus", 10);
+
 bool CCharDB_sql::init(const char* configfile)
 {	// init db
+	if( !this->save_job && char_save_queue > 0 && *char_save_spool.c_str() )
+	{
+		size_t i;
+		this->save_max    = char_save_queue;
+		this->save_job    = new savejob[this->save_max];
+		this->save_heap   = new size_t[this->save_max];
+		this->save_pos    = new size_t[this->save_max];
+		this->save_next   = new size_t[this->save_max];
+		for(this->save_mask=1; this->save_mask < this->save_max; this->save_mask*=2) ;
+		this->save_bucket = new size_t[this->save_mask];
+		for(i=0; i<this->save_mask; ++i)
+			this->save_bucket[i] = this->save_max;
+		this->save_mask  -= 1;
+		for(i=0; i<this->save_max; ++i)
+		{
+			this->save_heap[i] = i;
+			this->save_pos[i]  = i;
+			this->save_next[i] = this->save_max;
+		}
+		this->save_cnt    = 0;
+		this->save_tokens = char_save_burst;
+		this->save_stamp  = time(NULL);
+		if( !this->spool_open() )
+		{	// nothing to keep the queue safe, write at once
+			this->close();
+		}
+		else
+			CSQLTimer::add("char save queue", &CCharDB_sql::save_timer, this, 1);
+	}
+	if( sql_binary_fetch )
+	{
+		basics::CMySQLConnection dbcon1(this->sqlbase);
+		basics::string<> query;
+
+		query << "SELECT ";
+		char_columns.names(query);
+		query << " "
+				 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
+				 "WHERE `char_id`=?";
+		this->char_stmt.prepare(query);
+
+		query.clear();
+		query << "SELECT ";
+		char_account_columns.names(query);
+		query << " "
+				 "FROM `" << dbcon1.escaped(this->tbl_account) << "` "
+				 "WHERE `account_id`=?";
+		this->account_stmt.prepare(query);
+	}
+	if( CSQLWarmup::sql_warmup )
+	{
+		CSQLWarmup w;
+		this->warmup(w);
+		w.run();
+	}
+	return true;
+}
+
+bool CCharDB_sql::close()
+{
+	CSQLTimer::remove(this);
+	this->flushSaves(true);
+	this->char_stmt.close();
+	this->account_stmt.close();
+	if( this->save_job )
+	{
+		CSQLLock lock(this->save_mutex);
+		delete[] this->save_job;
+		delete[] this->save_heap;
+		delete[] this->save_pos;
+		delete[] this->save_next;
+		delete[] this->save_bucket;
+		this->save_job    = NULL;
+		this->save_heap   = NULL;
+		this->save_pos    = NULL;
+		this->save_next   = NULL;
+		this->save_bucket = NULL;
+		this->save_max    = 0;
+		this->save_cnt    = 0;
+		if( this->save_spool )
+		{	// what could not be written stays there for the next start
+			fclose(this->save_spool);
+			this->save_spool = NULL;
+		}
+	}
+	{
+		CSQLLock lock(this->warm_mutex);
+		if( this->warm_acc )
+			delete[] this->warm_acc;
+		this->warm_acc = NULL;
+		this->warm_acc_cnt = 0;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// save scheduler
+
+/// time a job counts as queued, each merged save makes it older
+static inline time_t save_key(time_t queued, uint32 dirty, uint32 bonus)
+{
+	return queued - (time_t)dirty*bonus;
+}
+
+/// bucket of a char_id in the queue index
+static inline size_t save_hash(uint32 char_id, size_t mask)
+{
+	return (size_t)((char_id * 2654435761u) >> 7) & mask;
+}
+
+bool CCharDB_sql::save_before(size_t a, size_t b) const
+{
+	const savejob& x = this->save_job[this->save_heap[a]];
+	const savejob& y = this->save_job[this->save_heap[b]];
+	return	save_key(x.queued, x.dirty, char_save_dirty_bonus) <
+			save_key(y.queued, y.dirty, char_save_dirty_bonus);
+}
+
+void CCharDB_sql::save_swap(size_t a, size_t b)
+{
+	const size_t tmp = this->save_heap[a];
+	this->save_heap[a] = this->save_heap[b];
+	this->save_heap[b] = tmp;
+	this->save_pos[this->save_heap[a]] = a;
+	this->save_pos[this->save_heap[b]] = b;
+}
+
+void CCharDB_sql::save_up(size_t k)
+{
+	while( k > 0 )
+	{
+		const size_t parent = (k-1)/2;
+		if( !this->save_before(k, parent) )
+			break;
+		this->save_swap(k, parent);
+		k = parent;
+	}
+}
+
+void CCharDB_sql::save_down(size_t k)
+{
+	for(;;)
+	{
+		size_t child = 2*k+1;
+		if( child >= this->save_cnt )
+			break;
+		if( child+1 < this->save_cnt && this->save_before(child+1, child) )
+			++child;
+		if( !this->save_before(child, k) )
+			break;
+		this->save_swap(k, child);
+		k = child;
+	}
+}
+
+size_t CCharDB_sql::save_find(uint32 char_id) const
+{
+	if( !this->save_cnt )
+		return this->save_cnt;
+	size_t slot = this->save_bucket[save_hash(char_id, this->save_mask)];
+	for( ; slot < this->save_max; slot = this->save_next[slot])
+	{
+		if( this->save_job[slot].data.char_id == char_id )
+			return this->save_pos[slot];
+	}
+	return this->save_cnt;
+}
+
+void CCharDB_sql::save_push(size_t slot)
+{
+	size_t& head = this->save_bucket[save_hash(this->save_job[slot].data.char_id, this->save_mask)];
+	this->save_next[slot] = head;
+	head = slot;
+	// the slot is the first free one
+	this->save_swap(this->save_pos[slot], this->save_cnt);
+	this->save_up(this->save_cnt++);
+}
+
+bool CCharDB_sql::save_pop(size_t k, bool write)
+{
+	const size_t slot = this->save_heap[k];
+	size_t* link = &this->save_bucket[save_hash(this->save_job[slot].data.char_id, this->save_mask)];
+	while( *link != slot )
+		link = &this->save_next[*link];
+	*link = this->save_next[slot];
+
+	// move the slot to the free part and fill the gap with the last job
+	--this->save_cnt;
+	this->save_swap(k, this->save_cnt);
+	if( k < this->save_cnt )
+	{
+		this->save_up(k);
+		this->save_down(k);
+	}
+	if( write && !this->writeChar(this->save_job[slot].data) )
+	{	// neither written nor journaled, the spool still has it
+		this->save_push(slot);
+		return false;
+	}
+	this->spool_clear(slot);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// save spool.
+// a header followed by one record per slot, a record is a spool_slot
+// and the char; char_id 0 marks a free slot.
+
+struct spool_head
+{
+	uint32 magic;	///< SPOOL_MAGIC
+	uint32 size;	///< sizeof(CCharCharacter) of the writer
+	uint32 slots;	///< number of slots
+};
+struct spool_slot
+{
+	uint32 char_id;	///< 0 when free
+	uint32 queued;
+	uint32 dirty;
+	uint32 crc;		///< crc32 of the char
+};
+#define SPOOL_MAGIC 0x51534843	// "CHSQ"
+
+static inline long spool_offset(size_t slot)
+{
+	return (long)(sizeof(spool_head) + slot*(sizeof(spool_slot)+sizeof(CCharCharacter)));
+}
+
+bool CCharDB_sql::spool_write(size_t slot)
+{
+	if( !this->save_spool )
+		return false;
+	const savejob& job = this->save_job[slot];
+	spool_slot rec;
+	rec.char_id = job.data.char_id;
+	rec.queued  = (uint32)job.queued;
+	rec.dirty   = job.dirty;
+	rec.crc     = journal_crc((const char*)&job.data, sizeof(job.data));
+	fseek(this->save_spool, spool_offset(slot), SEEK_SET);
+	return	1 == fwrite(&rec, sizeof(rec), 1, this->save_spool) &&
+			1 == fwrite(&job.data, sizeof(job.data), 1, this->save_spool) &&
+			0 == fflush(this->save_spool);
+}
+
+void CCharDB_sql::spool_clear(size_t slot)
+{
+	if( this->save_spool )
+	{
+		const uint32 zero = 0;
+		fseek(this->save_spool, spool_offset(slot), SEEK_SET);
+		fwrite(&zero, sizeof(zero), 1, this->save_spool);
+		fflush(this->save_spool);
+	}
+}
+
+bool CCharDB_sql::spool_open()
+{
+	const char* path = char_save_spool.c_str();
+	spool_head head;
+	size_t i, cnt=0;
+
+	this->save_spool = fopen(path, "r+b");
+	if( this->save_spool )
+	{
+		if( 1 == fread(&head, sizeof(head), 1, this->save_spool) && head.magic == SPOOL_MAGIC &&
+			head.size == sizeof(CCharCharacter) )
+		{	// take over the slots that were queued
+			spool_slot rec;
+			CCharCharacter* data = new CCharCharacter;
+			for(i=0; i<head.slots; ++i)
+			{
+				fseek(this->save_spool, spool_offset(i), SEEK_SET);
+				if( 1 != fread(&rec, sizeof(rec), 1, this->save_spool) || 1 != fread(data, sizeof(*data), 1, this->save_spool) )
+					break;
+				if( !rec.char_id || rec.char_id != data->char_id || rec.crc != journal_crc((const char*)data, sizeof(*data)) )
+					continue;	// free or torn by the crash, the older state is in the database
+				if( i < this->save_max )
+				{
+					savejob& job = this->save_job[i];
+					job.data   = *data;
+					job.queued = (time_t)rec.queued;
+					job.dirty  = rec.dirty;
+					this->save_push(i);
+				}
+				else if( !this->writeChar(*data) )
+					ShowError("CharDB: queued save of char %u from '%s' lost\n", rec.char_id, path);
+				++cnt;
+			}
+			delete data;
+			if( cnt )
+				ShowInfo("CharDB: %u queued saves taken from '%s'\n", (uint)cnt, path);
+			if( head.slots == this->save_max )
+				return true;
+			// other layout, the queued slots are written anew below
+		}
+		else
+		{
+			ShowError("CharDB: '%s' is not a save spool of this server, it is left alone\n", path);
+			fclose(this->save_spool);
+			this->save_spool = NULL;
+			return false;
+		}
+		fclose(this->save_spool);
+	}
+
+	this->save_spool = fopen(path, "w+b");
+	if( !this->save_spool )
+	{
+		ShowError("CharDB: cannot create '%s', char saves are not queued\n", path);
+		return false;
+	}
+	head.magic = SPOOL_MAGIC;
+	head.size  = sizeof(CCharCharacter);
+	head.slots = this->save_max;
+	fwrite(&head, sizeof(head), 1, this->save_spool);
+	// preallocate the slots, all free
+	{
+		spool_slot rec;
+		memset(&rec, 0, sizeof(rec));
+		char* pad = new char[sizeof(CCharCharacter)];
+		memset(pad, 0, sizeof(CCharCharacter));
+		for(i=0; i<this->save_max; ++i)
+		{
+			fwrite(&rec, sizeof(rec), 1, this->save_spool);
+			fwrite(pad, sizeof(CCharCharacter), 1, this->save_spool);
+		}
+		delete[] pad;
+	}
+	for(i=0; i<this->save_cnt; ++i)
+		this->spool_write(this->save_heap[i]);
+	if( fflush(this->save_spool) != 0 )
+	{
+		ShowError("CharDB: cannot write '%s', char saves are not queued\n", path);
+		fclose(this->save_spool);
+		this->save_spool = NULL;
+		return false;
+	}
+	return true;
+}
+
+void CCharDB_sql::save_timer(void* obj)
+{
+	((CCharDB_sql*)obj)->flushSaves();
+}
+
+bool CCharDB_sql::saveChar(const CCharCharacter& p)
+{
+	return this->saveChar(p, false);
+}
+
+bool CCharDB_sql::saveChar(const CCharCharacter& p, bool immediate)
+{
+	this->party_member(p.char_id, p.party_id, p.account_id, p.name, p.base_level);
+
+	CSQLLock lock(this->save_mutex);
+	const size_t k = this->save_find(p.char_id);
+	if( immediate || !this->save_max )
+	{	// this save supersedes a pending one
+		if( k < this->save_cnt )
+			this->save_pop(k, false);
+		return this->writeChar(p);
+	}
 
+	size_t slot;
+	if( k < this->save_cnt )
+	{	// merge into the pending job
+		slot = this->save_heap[k];
+		savejob& job = this->save_job[slot];
+		job.data = p;
+		++job.dirty;
+		this->save_up(k);
+	}
+	else
+	{
+		if( this->save_cnt >= this->save_max && !this->save_pop(0, true) )
+		{	// queue is full and the database is not there, do not queue more
+			return this->writeChar(p);
+		}
+		slot = this->save_heap[this->save_cnt];
+		savejob& job = this->save_job[slot];
+		job.data   = p;
+		job.queued = time(NULL);
+		job.dirty  = 0;
+		this->save_push(slot);
+	}
+	if( !this->spool_write(slot) )
+	{	// only done when it is safe somewhere
+		ShowWarning("CharDB: cannot spool char %u, writing it now\n", p.char_id);
+		return this->save_pop(this->save_pos[slot], true);
+	}
 	return true;
 }
 
+bool CCharDB_sql::flushChar(uint32 char_id)
+{
+	CSQLLock lock(this->save_mutex);
+	const size_t k = this->save_find(char_id);
+	return k >= this->save_cnt || this->save_pop(k, true);
+}
+
+size_t CCharDB_sql::flushSaves(bool all)
+{
+	const time_t now = time(NULL);
+	size_t cnt = 0;
+
+	for(;;)
+	{	// locked per job, so a save of the server does not wait for all
+		CSQLLock lock(this->save_mutex);
+		if( !this->save_cnt )
+			break;
+		if( cnt == 0 && now > this->save_stamp )
+		{	// refill the bucket
+			this->save_tokens += (double)(now - this->save_stamp) * (uint32)char_save_rate;
+			if( this->save_tokens > (uint32)char_save_burst )
+				this->save_tokens = (uint32)char_save_burst;
+			this->save_stamp = now;
+		}
+		const savejob& job = this->save_job[this->save_heap[0]];
+		// when any job is overdue the top one is at least as old
+		const bool overdue = now - save_key(job.queued, job.dirty, char_save_dirty_bonus) >= (time_t)(uint32)char_save_delay;
+		if( this->save_tokens >= 1.0 )
+			this->save_tokens -= 1.0;
+		else if( !all && !overdue )
+			break;
+		if( !this->save_pop(0, true) )
+			break;	// database is gone, the next call tries again
+		++cnt;
+	}
+	return cnt;
+}
+
 size_t CCharDB_sql::size() const
 {
 	return this->get_table_size(this->tbl_char);
@@ -1834,7 +4396,7 @@ CCharCharacter& CCharDB_sql::operator[](size_t i)
 
 bool CCharDB_sql::existChar(uint32 char_id)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::CMySQLConnection dbcon1(this->readbase(SQL_ENTITY_CHAR, char_id));
 	basics::string<> query;
 	query << "SELECT count(*) "
 			 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
@@ -1844,7 +4406,7 @@ bool CCharDB_sql::existChar(uint32 char_id)
 
 bool CCharDB_sql::existChar(const char* name)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::CMySQLConnection dbcon1(this->readbase(SQL_ENTITY_CHAR));
 	basics::string<> query;
 	query << "SELECT count(*) "
 			 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
@@ -1870,107 +4432,56 @@ bool CCharDB_sql::searchChar(const char* name, CCharCharacter &p)
 
 bool CCharDB_sql::searchChar(uint32 char_id, CCharCharacter &p)
 {
+	{
+		CSQLLock lock(this->save_mutex);
+		const size_t k = this->save_find(char_id);
+		if( k < this->save_cnt )
+		{	// the queued state is newer than the database
+			p = this->save_job[this->save_heap[k]].data;
+			return true;
+		}
+	}
+	if( !journal_settle() )
+	{	// the database would give the state before the pending saves
+		ShowWarning("char %lu not loaded, saves are pending in the journal\n", (ulong)char_id);
+		return false;
+	}
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::CMySQLConnection dbcon2(this->charbase(char_id));
 	basics::string<> query;
 	size_t i;
 
 	// Load all base stats
-	query.clear();
-	query << "SELECT "
-			 "`char_id`,"		// 0
-			 "`account_id`,"	// 1
-			 "`slot`,"			// 2
-			 "`name`,"			// 3
-			 "`class`,"			// 4
-			 "`base_level`,"	// 5
-			 "`job_level`,"		// 6
-			 "`base_exp`,"		// 7
-			 "`job_exp`,"		// 8
-			 "`zeny`,"			// 9
-			 "`str`,`agi`,`vit`,`int`,`dex`,`luk`," // 10 - 15
-			 "`max_hp`,`hp`,"	//16 - 17
-			 "`max_sp`,`sp`,"	//18 - 19
-			 "`status_point`,"	//20
-			 "`skill_point`,"	//21
-			 "`option`,"		//22
-			 "`karma`,"			//23
-			 "`chaos`,"			//24
-			 "`manner`,"		//25
-			 "`party_id`,"		//26
-			 "`guild_id`,"		//27
-			 "`pet_id`,"		//28
-			 "`hair`,"			//29
-			 "`hair_color`,"	//30
-			 "`clothes_color`,"	//31
-			 "`weapon`,"		//32
-			 "`shield`,"		//33
-			 "`head_top`,"		//34
-			 "`head_mid`,"		//35
-			 "`head_bottom`,"	//36
-			 "`last_map`,"		//37
-			 "`last_x`,"		//38
-			 "`last_y`,"		//39
-			 "`save_map`,"		//40
-			 "`save_x`,"		//41
-			 "`save_y`,"		//42
-			 "`partner_id`,"	//43
-			 "`father_id`,"		//44
-			 "`mother_id`,"		//45
-			 "`child_id`,"		//46
-			 "`fame_points` "	//47
-			 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
-			 "WHERE `char_id` = '" << char_id << "'";
+	bool found = false, read = false;
+	if( this->char_stmt.prepared() )
+	{	// the numbers are fetched straight into p
+		CSQLResult r(char_columns.size());
+		char_columns.bind(r, p);
+		if( this->char_stmt.execute(char_id, r) )
+		{
+			read  = true;
+			found = this->char_stmt.fetch();
+			if( found )
+				char_columns.fetched(r, p);
+			this->char_stmt.done();
+		}
+	}
+	if( !read )
+	{
+		query.clear();
+		query << "SELECT ";
+		char_columns.names(query);
+		query << " "
+				 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
+				 "WHERE `char_id` = '" << char_id << "'";
 
-	if( dbcon1.ResultQuery(query) && dbcon1 )
+		found = dbcon1.ResultQuery(query) && dbcon1;
+		if( found )
+			char_columns.decode(dbcon1, p);
+	}
+	if( found )
 	{
-		p.char_id 			= atoi(dbcon1[0]);
-		p.account_id 		= atoi(dbcon1[1]);
-		p.slot 				= atoi(dbcon1[2]);
-		safestrcpy(p.name, sizeof(p.name),         dbcon1[3]);
-		p.class_ 			= atoi(dbcon1[4]);
-		p.base_level 		= atoi(dbcon1[5]);
-		p.job_level 		= atoi(dbcon1[6]);
-		p.base_exp 			= atoi(dbcon1[7]);
-		p.job_exp 			= atoi(dbcon1[8]);
-		p.zeny 				= atoi(dbcon1[9]);
-		p.str 				= atoi(dbcon1[10]);
-		p.agi 				= atoi(dbcon1[11]);
-		p.vit 				= atoi(dbcon1[12]);
-		p.int_				= atoi(dbcon1[13]);
-		p.dex 				= atoi(dbcon1[14]);
-		p.luk 				= atoi(dbcon1[15]);
-		p.max_hp 			= atoi(dbcon1[16]);
-		p.hp 				= atoi(dbcon1[17]);
-		p.max_sp 			= atoi(dbcon1[18]);
-		p.sp 				= atoi(dbcon1[19]);
-		p.status_point 		= atoi(dbcon1[20]);
-		p.skill_point 		= atoi(dbcon1[21]);
-		p.option			= atoi(dbcon1[22]);
-		p.karma				= atoi(dbcon1[23]);
-		p.chaos				= atoi(dbcon1[24]);
-		p.manner			= atoi(dbcon1[25]);
-		p.party_id			= atoi(dbcon1[26]);
-		p.guild_id			= atoi(dbcon1[27]);
-		p.pet_id			= atoi(dbcon1[28]);
-		p.hair				= atoi(dbcon1[29]);
-		p.hair_color		= atoi(dbcon1[30]);
-		p.clothes_color		= atoi(dbcon1[31]);
-		p.weapon			= atoi(dbcon1[32]);
-		p.shield			= atoi(dbcon1[33]);
-		p.head_top			= atoi(dbcon1[34]);
-		p.head_mid			= atoi(dbcon1[35]);
-		p.head_bottom		= atoi(dbcon1[36]);
-		safestrcpy(p.last_point.mapname, sizeof(p.last_point.mapname),dbcon1[37]);
-		p.last_point.x		= atoi(dbcon1[38]);
-		p.last_point.y		= atoi(dbcon1[39]);
-		safestrcpy(p.save_point.mapname, sizeof(p.save_point.mapname),dbcon1[40]);
-		p.save_point.x		= atoi(dbcon1[41]);
-		p.save_point.y		= atoi(dbcon1[42]);
-		p.partner_id		= atoi(dbcon1[43]);
-		p.father_id			= atoi(dbcon1[44]);
-		p.mother_id			= atoi(dbcon1[45]);
-		p.child_id			= atoi(dbcon1[46]);
-		p.fame_points		= atoi(dbcon1[47]);
 
 		///////////////////////////////////////////////////////////////////////
 		// Check start/save locations
@@ -1989,19 +4500,18 @@ bool CCharDB_sql::searchChar(uint32 char_id, CCharCharacter &p)
 		///////////////////////////////////////////////////////////////////////
 		// Load Memo
 		query.clear();
-		query << "SELECT `map`,`x`,`y` "
-				 "FROM `" << dbcon1.escaped(this->tbl_memo) << "` "
-				 "WHERE `char_id`='" << char_id << "'";
+		query << "SELECT ";
+		memo_columns.names(query);
+		query << " "
+				 "FROM `" << dbcon2.escaped(this->tbl_memo) << "` "
+				 "WHERE `char_id`='" << char_id << "' "
+				 "ORDER BY `memo_id`";
 
 		i=0;
-		if( dbcon1.ResultQuery(query) )
+		if( dbcon2.ResultQuery(query) )
 		{
-			for( ; dbcon1 && i<MAX_MEMO; ++dbcon1, ++i)
-			{
-				safestrcpy(p.memo_point[i].mapname, sizeof(p.memo_point[i].mapname), dbcon1[0]);
-				p.memo_point[i].x=atoi(dbcon1[1]);
-				p.memo_point[i].y=atoi(dbcon1[2]);
-			}
+			for( ; dbcon2 && i<MAX_MEMO; ++dbcon2, ++i)
+				memo_columns.decode(dbcon2, p.memo_point[i]);
 		}
 		for( ; i<MAX_MEMO; ++i)
 		{
@@ -2012,104 +4522,25 @@ bool CCharDB_sql::searchChar(uint32 char_id, CCharCharacter &p)
 
 		///////////////////////////////////////////////////////////////////////
 		// Load Inventory
-		query.clear();
-		query << "SELECT "
-				 "`nameid`,"		// 0
-				 "`amount`,"		// 1
-				 "`equip`,"			// 2
-				 "`identify`,"		// 3
-				 "`refine`,"		// 4
-				 "`attribute`,"		// 5
-				 "`card0`,"			// 6
-				 "`card1`,"			// 7
-				 "`card2`,"			// 8
-				 "`card3`"			// 9
-				 "FROM `" << dbcon1.escaped(this->tbl_inventory) << "` "
-				 "WHERE `char_id`='" << char_id << "'";
-		i=0;
-		if( dbcon1.ResultQuery(query) )
 		{
-			for( ; dbcon1 && i<MAX_INVENTORY; ++dbcon1, ++i)
-			{
-				p.inventory[i].nameid		= atoi(dbcon1[0]);
-				p.inventory[i].amount		= atoi(dbcon1[1]);
-				p.inventory[i].equip		= atoi(dbcon1[2]);
-				p.inventory[i].identify		= atoi(dbcon1[3]);
-				p.inventory[i].refine		= atoi(dbcon1[4]);
-				p.inventory[i].attribute	= atoi(dbcon1[5]);
-				p.inventory[i].card[0]		= atoi(dbcon1[6]);
-				p.inventory[i].card[1]		= atoi(dbcon1[7]);
-				p.inventory[i].card[2]		= atoi(dbcon1[8]);
-				p.inventory[i].card[3]		= atoi(dbcon1[9]);
-			}
-		}
-		for( ; i<MAX_INVENTORY; ++i)
-		{
-			p.inventory[i].nameid		= 0;
-			p.inventory[i].amount		= 0;
-			p.inventory[i].equip		= 0;
-			p.inventory[i].identify		= 0;
-			p.inventory[i].refine		= 0;
-			p.inventory[i].attribute	= 0;
-			p.inventory[i].card[0]		= 0;
-			p.inventory[i].card[1]		= 0;
-			p.inventory[i].card[2]		= 0;
-			p.inventory[i].card[3]		= 0;
+			CItemList<MAX_INVENTORY> list;
+			this->load_items(dbcon2, this->tbl_inventory, "char_id", char_id, list);
+			list.scatter(p.inventory);
 		}
 
 		///////////////////////////////////////////////////////////////////////
 		// Load Cart
-		query.clear();
-		query << "SELECT "
-				 "`nameid`,"		// 0
-				 "`amount`,"		// 1
-				 "`equip`,"			// 2
-				 "`identify`,"		// 3
-				 "`refine`,"		// 4
-				 "`attribute`,"		// 5
-				 "`card0`,"			// 6
-				 "`card1`,"			// 7
-				 "`card2`,"			// 8
-				 "`card3`"			// 9
-				 "FROM `"<< dbcon1.escaped(this->tbl_cart) << "` "
-				 "WHERE `char_id`='" << char_id << "'";
-
-		i=0;
-		if( dbcon1.ResultQuery(query) )
-		{
-			for( ; dbcon1 && i<MAX_CART; ++dbcon1, ++i)
-			{
-				p.cart[i].nameid		= atoi(dbcon1[0]);
-				p.cart[i].amount		= atoi(dbcon1[1]);
-				p.cart[i].equip			= atoi(dbcon1[2]);
-				p.cart[i].identify		= atoi(dbcon1[3]);
-				p.cart[i].refine		= atoi(dbcon1[4]);
-				p.cart[i].attribute		= atoi(dbcon1[5]);
-				p.cart[i].card[0]		= atoi(dbcon1[6]);
-				p.cart[i].card[1]		= atoi(dbcon1[7]);
-				p.cart[i].card[2]		= atoi(dbcon1[8]);
-				p.cart[i].card[3]		= atoi(dbcon1[9]);
-			}
-		}
-		for( ; i<MAX_CART; ++i)
 		{
-			p.cart[i].nameid		= 0;
-			p.cart[i].amount		= 0;
-			p.cart[i].equip			= 0;
-			p.cart[i].identify		= 0;
-			p.cart[i].refine		= 0;
-			p.cart[i].attribute		= 0;
-			p.cart[i].card[0]		= 0;
-			p.cart[i].card[1]		= 0;
-			p.cart[i].card[2]		= 0;
-			p.cart[i].card[3]		= 0;
+			CItemList<MAX_CART> list;
+			this->load_items(dbcon2, this->tbl_cart, "char_id", char_id, list);
+			list.scatter(p.cart);
 		}
 
 		///////////////////////////////////////////////////////////////////////
 		// Load skill
 		query.clear();
 		query << "SELECT `id`, `lv` "
-				 "FROM `" << dbcon1.escaped(this->tbl_skill) << "` "
+				 "FROM `" << dbcon2.escaped(this->tbl_skill) << "` "
 				 "WHERE `char_id`='" << char_id << "'";
 
 		for(i=0; i<MAX_SKILL; ++i)
@@ -2118,41 +4549,22 @@ bool CCharDB_sql::searchChar(uint32 char_id, CCharCharacter &p)
 			p.skill[i].lv = 0;
 			p.skill[i].flag = 0;
 		}
-		if( dbcon1.ResultQuery(query) )
+		if( dbcon2.ResultQuery(query) )
 		{
-			for( ; dbcon1; ++dbcon1)
+			for( ; dbcon2; ++dbcon2)
 			{
-				i = atoi(dbcon1[0]);
+				i = atoi(dbcon2[0]);
 				if(i<MAX_SKILL)
 				{
 					p.skill[i].id = i;
-					p.skill[i].lv = atoi(dbcon1[1]);
+					p.skill[i].lv = CSQLValue(dbcon2[1]);
 				}
 			}
 		}
 
 		///////////////////////////////////////////////////////////////////////
 		// Load registry
-		query.clear();
-		query << "SELECT `str`, `value` "
-				 "FROM `" << dbcon1.escaped(this->tbl_char_reg) << "` "
-				 "WHERE `char_id`='" << char_id << "'";
-
-		i=0;
-		if( dbcon1.ResultQuery(query) )
-		{
-			for( ; dbcon1 && i<GLOBAL_REG_NUM; ++dbcon1, ++i)
-			{
-				safestrcpy(p.global_reg[i].str, sizeof(p.global_reg[i].str), dbcon1[0]);
-				p.global_reg[i].value = atoi(dbcon1[1]);
-			}
-		}
-		p.global_reg_num=i;
-		for( ; i<GLOBAL_REG_NUM; ++i)
-		{
-			p.global_reg[i].str[0] = 0;
-			p.global_reg[i].value = 0;
-		}
+		p.global_reg_num = reg_load(this->sqlbase, REG_CHAR, char_id, p.global_reg, GLOBAL_REG_NUM);
 
 		///////////////////////////////////////////////////////////////////////
 		// Load Friends
@@ -2166,7 +4578,7 @@ bool CCharDB_sql::searchChar(uint32 char_id, CCharCharacter &p)
 		{
 			for( ; dbcon1 && i<MAX_FRIENDLIST; ++dbcon1, ++i)
 			{
-				p.friendlist[i].friend_id = atoi(dbcon1[0]);
+				p.friendlist[i].friend_id = CSQLValue(dbcon1[0]);
 				safestrcpy(p.friendlist[i].friend_name, sizeof(p.friendlist[i].friend_name), dbcon1[1]);
 			}
 		}
@@ -2273,58 +4685,48 @@ bool CCharDB_sql::insertChar(CCharAccount &account,
 	p.head_top = 0;
 	p.head_mid = 0;
 	p.head_bottom = 0;
+	p.pet_id = 0;
+	p.partner_id = 0;
+	p.father_id = 0;
+	p.mother_id = 0;
+	p.child_id = 0;
+	p.fame_points = 0;
 	p.last_point = start_point;
 	p.save_point = start_point;	
 	
 	// make new char.
 	query.clear();
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_char) << "` "
-			 "("
-			 "`account_id`,"
-			 "`slot`,"
-			 "`name`,"
-			 "`str`,`agi`,`vit`,`int`,`dex`,`luk`,"
-			 "`hair`,"
-			 "`hair_color`,"
-			 "`zeny`,"
-			 "`hp`,`sp`,`max_hp`,`max_sp`,"
-			 "`last_map`,`last_x`,`last_y`,"
-			 "`save_map`,`save_x`,`save_y`"
-			 ") "
-			 "VALUES "
-			 "("
-			 "'" << p.account_id << "',"
-			 "'" << p.slot << "',"
-			 "'" << dbcon1.escaped(p.name) << "',"
-			 "'" << p.str << "','" << p.agi << "','" << p.vit << "',"
-			 "'" << p.int_ << "','" << p.dex << "','" << p.luk << "',"
-			 "'" << p.hair << "',"
-			 "'" << p.hair_color << "',"
-			 "'" << p.zeny << "',"
-			 "'" << p.hp << "','" << p.sp << "',"
-			 "'" << p.max_hp << "','" << p.max_sp << "',"
-			 "'" << dbcon1.escaped(p.last_point.mapname) << "',"
-			 "'" << p.last_point.x << "',"
-			 "'" << p.last_point.y << "',"
-			 "'" << dbcon1.escaped(p.save_point.mapname) << "',"
-			 "'" << p.save_point.x << "',"
-			 "'" << p.save_point.y << "'"
-			 ")";
+	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_char) << "` "
+			 "(";
+	char_columns.names(query, 1);
+	query << ") "
+			 "VALUES ";
+	char_columns.values(query, dbcon1, p, 1);
 	dbcon1.PureQuery(query);
 
 	//Now we need the charid from sql!
 	p.char_id = dbcon1.getLastID();
+	this->written(SQL_ENTITY_CHAR, p.char_id);
+	this->count_rows(this->tbl_char, +1);
+	if( slot < 9 )
+	{
+		CSQLLock lock(this->warm_mutex);
+		warm_account* wa = this->warm_find(p.account_id);
+		if( wa )
+			wa->charlist[slot] = p.char_id;
+	}
 
 	//Give the char the default items
 	//knife & cotton shirts, add on as needed ifmore items are to be included.
+	basics::CMySQLConnection dbcon2(this->charbase(p.char_id));
 	query.clear();
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_inventory) << "` "
-			 "(`char_id`,`nameid`, `amount`, `equip`, `identify`) "
+	query << "INSERT INTO `" << dbcon2.escaped(this->tbl_inventory) << "` "
+			 "(`char_id`, `pos`, `nameid`, `amount`, `equip`, `identify`) "
 			 "VALUES "
-			 "('" << p.char_id << "', '" << start_weapon << "', '1', '2', '1'),"
-			 "('" << p.char_id << "', '" << start_armor  << "', '1', '16', '1')";
+			 "('" << p.char_id << "', '0', '" << start_weapon << "', '1', '2', '1'),"
+			 "('" << p.char_id << "', '1', '" << start_armor  << "', '1', '16', '1')";
 
-	dbcon1.PureQuery(query);
+	dbcon2.PureQuery(query);
 
 	return true;
 }
@@ -2332,208 +4734,151 @@ bool CCharDB_sql::insertChar(CCharAccount &account,
 
 bool CCharDB_sql::removeChar(uint32 charid)
 {
+	{
+		CSQLLock lock(this->save_mutex);
+		const size_t k = this->save_find(charid);
+		if( k < this->save_cnt )
+			this->save_pop(k, false);
+	}
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	CSQLBatch batch;
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
 			 "WHERE `char_id`='" << charid << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
+	this->reg_remove(batch, REG_CHAR, charid);
+
+	if( this->partition_period() )
+	{	// partitioned mails have no cascading delete
+		query.clear();
+		query << "DELETE "
+				 "FROM `" << dbcon1.escaped(this->tbl_mail) << "` "
+				 "WHERE `to_char_id`='" << charid << "'";
+		batch.add(this->sqlbase, query);
+	}
+
+	basics::CMySQL& base = this->charbase(charid);
+	if( &base != &this->sqlbase )
+	{	// no cascading deletes across servers
+		basics::CMySQLConnection dbcon2(base);
+		const basics::CParam< basics::string<> >* tables[] = { &this->tbl_memo, &this->tbl_inventory, &this->tbl_cart, &this->tbl_skill };
+		size_t i;
+		for(i=0; i<sizeof(tables)/sizeof(tables[0]); ++i)
+		{
+			query.clear();
+			query << "DELETE "
+					 "FROM `" << dbcon2.escaped(*tables[i]) << "` "
+					 "WHERE `char_id`='" << charid << "'";
+			batch.add(base, query);
+		}
+	}
+	if( !batch.commit() )
+		return false;
+	this->written(SQL_ENTITY_CHAR, charid);
+	this->count_rows(this->tbl_char, -1);
+	{	// the account is not known here
+		CSQLLock lock(this->warm_mutex);
+		size_t i, k;
+		for(i=0; i<this->warm_acc_cnt; ++i)
+			for(k=0; k<9; ++k)
+				if( this->warm_acc[i].charlist[k] == charid )
+					this->warm_acc[i].charlist[k] = 0;
+	}
+	// pets and homunculi go with the char
+	this->invalidate_rows(this->tbl_pet);
+	this->invalidate_rows(this->tbl_homunculus);
+	this->party_member(charid, 0, 0, "", 0);
 	return true;
 }
 
-bool CCharDB_sql::saveChar(const CCharCharacter& p)
+bool CCharDB_sql::writeChar(const CCharCharacter& p)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::CMySQLConnection dbcon2(this->charbase(p.char_id));
+	basics::CMySQL& base2 = this->charbase(p.char_id);
 	basics::string<> query;
+	CSQLBatch batch;
+
+	this->written(SQL_ENTITY_CHAR, p.char_id);
 	size_t i, doit;
 
 	// Build the update for the character
 	query.clear();
 	query << "UPDATE `" << dbcon1.escaped(this->tbl_char) << "` "
-			 "SET "
-			 "`class` = '"		<< p.class_ 		<< "',"
-			 "`base_level`='"	<< p.base_level		<< "',"
-			 "`job_level`='"	<< p.job_level		<< "',"
-			 "`base_exp`='"		<< p.base_exp		<< "',"
-			 "`job_exp`='"		<< p.job_exp		<< "',"
-			 "`zeny`='"			<< p.zeny			<< "',"
-
-			 "`hp`='"			<< p.hp				<< "',"
-			 "`max_hp`='"		<< p.max_hp			<< "',"
-
-			 "`sp`='"			<< p.sp				<< "',"
-			 "`max_sp`='"		<< p.max_sp			<< "',"
-
-			 "`str`='"			<< p.str			<< "',"
-			 "`agi`='"			<< p.agi			<< "',"
-			 "`vit`='"			<< p.vit			<< "',"
-			 "`int`='"			<< p.int_			<< "',"
-			 "`dex`='"			<< p.dex			<< "',"
-			 "`luk`='"			<< p.luk			<< "',"
-
-			 "`status_point`='"	<< p.status_point	<< "',"
-			 "`skill_point`='"	<< p.skill_point	<< "',"
-
-			 "`option`='"		<< p.option			<< "',"
-			 "`karma`='"		<< p.karma			<< "',"
-			 "`chaos`='"		<< p.chaos			<< "',"
-			 "`manner`='"		<< p.manner			<< "',"
-			 "`party_id`='"		<< p.party_id		<< "',"
-			 "`guild_id`='"		<< p.guild_id		<< "',"
-			 "`pet_id`='"		<< p.pet_id			<< "',"
-
-			 "`hair`='"			<< p.hair			<< "',"
-			 "`hair_color`='"	<< p.hair_color		<< "',"
-			 "`clothes_color`='"<< p.clothes_color	<< "',"
-			 "`weapon`='"		<< p.weapon			<< "',"
-			 "`shield`='"		<< p.shield			<< "',"
-			 "`head_top`='"		<< p.head_top		<< "',"
-			 "`head_mid`='"		<< p.head_mid		<< "',"
-			 "`head_bottom`='"	<< p.head_bottom	<< "',"
-
-			 "`last_map`='"		<< p.last_point.mapname		<< "',"
-			 "`last_x`='"		<< p.last_point.x			<< "',"
-			 "`last_y`='"		<< p.last_point.y			<< "',"
-			 "`save_map`='"		<< p.save_point.mapname		<< "',"
-			 "`save_x`='"		<< p.save_point.x			<< "',"
-			 "`save_y`='"		<< p.save_point.y			<< "',"
-
-			 "`partner_id`='"	<< p.partner_id		<< "',"
-			 "`father_id`='"	<< p.father_id		<< "',"
-			 "`mother_id`='"	<< p.mother_id		<< "',"
-			 "`child_id`='"		<< p.child_id		<< "',"
-
-			 "`fame_points`='"	<< p.fame_points	<< "' "	// dont forget to remove commas at ends
+			 "SET ";
+	char_columns.update(query, dbcon1, p, 4);
+	query << " "
 			 "WHERE  "
 			 "`account_id`='" 	<< p.account_id		<< "' "
 			 "AND "
 			 "`char_id` = '"	<< p.char_id		<< "' "
 			 "AND "
-			 "`slot` = '" 		<< p.slot			<< "'";  // dont forget to finish the line
+			 "`slot` = '" 		<< p.slot			<< "'";
 
 
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 	query.clear();
 
 
 	///////////////////////////////////////////////////////////////////////
-	// Memo Insert
-	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_memo) << "` "
-			 "WHERE `char_id`='" << p.char_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
-
+	// child tables are upserted by their keys,
+	// only the keys that are not saved anymore get deleted
+	basics::string<> keys;
 
-	//insert here.
-	query << "REPLACE INTO `" << dbcon1.escaped(this->tbl_memo) << "`"
-			 "(`char_id`,`memo_id`,`map`,`x`,`y`) VALUES ";
+	///////////////////////////////////////////////////////////////////////
+	// Memo
+	query << "INSERT INTO `" << dbcon2.escaped(this->tbl_memo) << "`"
+			 "(`char_id`,`memo_id`,";
+	memo_columns.names(query);
+	query << ") VALUES ";
 	for(doit=0, i=0; i<MAX_MEMO; ++i)
 	{
 		if(p.memo_point[i].mapname[0])
 		{
 			query << (doit?",":"") << "("
 				"'" << 	p.char_id 			<< "',"
-				"'" <<	(ulong)i					<< "',"
-				"'" <<	dbcon1.escaped(p.memo_point[i].mapname)	<< "'," <<
-				"'" <<	p.memo_point[i].x	<< "'," <<
-				"'" <<	p.memo_point[i].y	<< "'" <<  // Dont forget to end commas
-			")";
+				"'" <<	(ulong)i			<< "',";
+			memo_columns.fields(query, dbcon2, p.memo_point[i]);
+			query << ")";
+			keys << (doit?",":"") << "'" << (ulong)i << "'";
 			++doit;
 		}
 	}
+	query << " ON DUPLICATE KEY UPDATE ";
+	memo_columns.upsert(query);
 	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
+	if(doit) batch.add(base2, query);
 	query.clear();
 
-
-	///////////////////////////////////////////////////////////////////////
-	// Inventory Insert
 	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_inventory) << "` "
-			"WHERE `char_id`='" << p.char_id << "'";
-	dbcon1.PureQuery(query);
+			 "FROM `" << dbcon2.escaped(this->tbl_memo) << "` "
+			 "WHERE `char_id`='" << p.char_id << "'";
+	if(doit) query << " AND `memo_id` NOT IN (" << keys << ")";
+	batch.add(base2, query);
 	query.clear();
+	keys.clear();
 
-	//insert here.
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_inventory) << "`"
-			 "(`char_id`, `nameid`, `amount`, `equip`, "
-			 "`identify`, `refine`, `attribute`, "
-			 "`card0`, `card1`, `card2`, `card3`) VALUES ";
-	for(doit=0,i=0; i<MAX_INVENTORY; ++i)
+	///////////////////////////////////////////////////////////////////////
+	// Inventory
 	{
-		if(p.inventory[i].nameid>0)
-		{
-			query << (doit?",":"") <<
-				"("
-				"'" <<	p.char_id					<< "',"
-				"'" <<	p.inventory[i].nameid		<< "',"
-				"'" <<	p.inventory[i].amount		<< "',"
-				"'" <<	p.inventory[i].equip		<< "',"
-				"'" <<	p.inventory[i].identify		<< "',"
-				"'" <<	p.inventory[i].refine		<< "',"
-				"'" <<	p.inventory[i].attribute	<< "',"
-				"'" <<	p.inventory[i].card[0]		<< "',"
-				"'" <<	p.inventory[i].card[1]		<< "',"
-				"'" <<	p.inventory[i].card[2]		<< "',"
-				"'" <<	p.inventory[i].card[3]		<< "'"
-				")";
-			++doit;
-		}
+		CItemList<MAX_INVENTORY> list;
+		list.assign(p.inventory);
+		this->save_items(batch, base2, dbcon2, this->tbl_inventory, "char_id", p.char_id, list);
 	}
-	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
-	query.clear();
 
 	///////////////////////////////////////////////////////////////////////
-	// Cart Insert
-	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_cart) << "` "
-			 "WHERE `char_id`='" << p.char_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
-
-	//insert here.
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_cart) << "`"
-			 "(`char_id`, `nameid`, `amount`, `equip`, "
-			 "`identify`, `refine`, `attribute`, "
-			 "`card0`, `card1`, `card2`, `card3`) VALUES ";
-	for(doit=0,i=0; i<MAX_CART; ++i)
+	// Cart
 	{
-		if(p.cart[i].nameid>0)
-		{
-			query << (doit?",":"") <<
-				"("
-				"'" <<	p.char_id				<< "',"
-				"'" <<	p.cart[i].nameid		<< "',"
-				"'" <<	p.cart[i].amount		<< "',"
-				"'" <<	p.cart[i].equip			<< "',"
-				"'" <<	p.cart[i].identify		<< "',"
-				"'" <<	p.cart[i].refine		<< "',"
-				"'" <<	p.cart[i].attribute		<< "',"
-				"'" <<	p.cart[i].card[0]		<< "',"
-				"'" <<	p.cart[i].card[1]		<< "',"
-				"'" <<	p.cart[i].card[2]		<< "',"
-				"'" <<	p.cart[i].card[3]		<< "'"
-				")";
-			++doit;
-		}
+		CItemList<MAX_CART> list;
+		list.assign(p.cart);
+		this->save_items(batch, base2, dbcon2, this->tbl_cart, "char_id", p.char_id, list);
 	}
-	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
-	query.clear();
-
 
 	///////////////////////////////////////////////////////////////////////
-	// Skill Insert
-	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_skill) << "` "
-			 "WHERE `char_id`='" << p.char_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
-
-	//insert here.
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_skill) << "` "
+	// Skill
+	query << "INSERT INTO `" << dbcon2.escaped(this->tbl_skill) << "` "
 			 "(`char_id`,`id`,`lv`) VALUES ";
 	for(doit=0,i=0; i<MAX_SKILL; ++i)
 	{
@@ -2545,52 +4890,29 @@ bool CCharDB_sql::saveChar(const CCharCharacter& p)
 				"'" << p.skill[i].id 	<< "'," <<
 				"'" << p.skill[i].lv 	<< "'" <<
 				")";
+			keys << (doit?",":"") << "'" << p.skill[i].id << "'";
 			++doit;
 		}
 	}
+	query << " ON DUPLICATE KEY UPDATE `lv`=VALUES(`lv`)";
 	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
+	if(doit) batch.add(base2, query);
 	query.clear();
 
-	///////////////////////////////////////////////////////////////////////
-	// Character Reg Insert
 	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_char_reg) << "` "
+			 "FROM `" << dbcon2.escaped(this->tbl_skill) << "` "
 			 "WHERE `char_id`='" << p.char_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
-
-	//insert here.
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_char_reg) << "`"
-			 "(`char_id`,`str`,`value`) VALUES ";
-	for(doit=0,i=0; i<p.global_reg_num && i<GLOBAL_REG_NUM; ++i)
-	{
-		if(p.global_reg[i].str && p.global_reg[i].value !=0)
-		{
-			query << (doit?",":"") <<
-				"("
-				"'" << p.char_id				<< "',"
-				"'" << p.global_reg[i].str		<< "',"
-				"'" << p.global_reg[i].value	<< "'" <<   // end commas at the end
-				")";
-			++doit;
-		}
-	}
-	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
+	if(doit) query << " AND `id` NOT IN (" << keys << ")";
+	batch.add(base2, query);
 	query.clear();
-
-
+	keys.clear();
 
 	///////////////////////////////////////////////////////////////////////
-	// Friends Insert
-	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_friends) << "` "
-			 "WHERE `char_id` = '" << p.char_id << "'";
-	dbcon1.PureQuery(query);
-	query.clear();
+	// Character Reg, only the changed values
+	reg_save(batch, REG_CHAR, p.char_id, p.global_reg, (p.global_reg_num<GLOBAL_REG_NUM)?p.global_reg_num:GLOBAL_REG_NUM);
 
-	//insert here.
+	///////////////////////////////////////////////////////////////////////
+	// Friends
 	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_friends) << "`"
 			 "(`char_id`, `friend_id`) VALUES ";
 	for(doit=0,i=0; i<MAX_FRIENDLIST; ++i)
@@ -2602,13 +4924,28 @@ bool CCharDB_sql::saveChar(const CCharCharacter& p)
 				"'" << p.char_id					<< "',"
 				"'" << p.friendlist[i].friend_id	<< "'"
 				")";
+			keys << (doit?",":"") << "'" << p.friendlist[i].friend_id << "'";
 			++doit;
 		}
 	}
+	// the row is all key, existing ones stay as they are
+	query << " ON DUPLICATE KEY UPDATE `friend_id`=`friend_id`";
 	// if at least one entry spotted.
-	if(doit) dbcon1.PureQuery(query);
+	if(doit) batch.add(this->sqlbase, query);
+	query.clear();
+
+	query << "DELETE "
+			 "FROM `" << dbcon1.escaped(this->tbl_friends) << "` "
+			 "WHERE `char_id`='" << p.char_id << "'";
+	if(doit) query << " AND `friend_id` NOT IN (" << keys << ")";
+	batch.add(this->sqlbase, query);
 	query.clear();
 
+	if( !batch.commit() )
+	{
+		reg_forget(REG_CHAR, p.char_id);
+		return false;
+	}
 	return true;
 }
 bool CCharDB_sql::searchAccount(uint32 accid, CCharCharAccount& account)
@@ -2620,41 +4957,54 @@ bool CCharDB_sql::searchAccount(uint32 accid, CCharCharAccount& account)
 		basics::string<> query;
 		size_t i;
 
-		query << "SELECT "
-				 "`account_id`,"	//  0
-				 "`sex`,"			//  1
-				 "`gm_level`,"		//  2
-				 "`email`,"			//  3
-				 "`login_id1`,"		//  4
-				 "`login_id2`,"		//  5
-				 "`client_ip`,"		//  6
-				 "`ban_until`,"		//  7
-				 "`valid_until` "	//  8
-				 "FROM `" << dbcon1.escaped(this->tbl_account) << "` "
-				 "WHERE `account_id`='" << accid << "'";
-
-		if( dbcon1.ResultQuery(query) && dbcon1 )
+		bool found = false, read = false;
+		if( this->account_stmt.prepared() )
+		{
+			CSQLResult r(char_account_columns.size());
+			char_account_columns.bind(r, account);
+			if( this->account_stmt.execute(accid, r) )
+			{
+				read  = true;
+				found = this->account_stmt.fetch();
+				if( found )
+					char_account_columns.fetched(r, account);
+				this->account_stmt.done();
+			}
+		}
+		if( !read )
+		{
+			query << "SELECT ";
+			char_account_columns.names(query);
+			query << " "
+					 "FROM `" << dbcon1.escaped(this->tbl_account) << "` "
+					 "WHERE `account_id`='" << accid << "'";
+
+			found = dbcon1.ResultQuery(query) && dbcon1;
+			if( found )
+				char_account_columns.decode(dbcon1, account);
+		}
+		if( found )
 		{	
-			account.account_id	= atol(dbcon1[0]);
-			account.sex			= dbcon1[1][0] == 'S' ? 2 : dbcon1[1][0]=='M';
-			account.gm_level	= atol(dbcon1[2]);
-			safestrcpy(account.email, sizeof(account.email), dbcon1[3]);
-			account.login_id1	= atol(dbcon1[4]);
-			account.login_id2	= atol(dbcon1[5]);
-			account.client_ip	= basics::ipaddress(dbcon1[6]);
-			account.ban_until	= (time_t)(atol(dbcon1[7]));
-			account.valid_until	= (time_t)(atol(dbcon1[8]));
-
-			// read accociated char_id's
+
+			for(i=0; i<9; ++i) account.charlist[i]=0;
+
+			// read accociated char_id's, from the warm-up when it has them
+			bool warm = false;
+			{
+				CSQLLock lock(this->warm_mutex);
+				const warm_account* wa = this->warm_find(accid);
+				if( wa )
+				{
+					for(i=0; i<9; ++i) account.charlist[i] = wa->charlist[i];
+					warm = true;
+				}
+			}
 			query.clear();
 			query << "SELECT `char_id`,`slot` "
 					 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
 					 "WHERE `account_id` = '" << accid << "'";
 
-			
-			for(i=0; i<9; ++i) account.charlist[i]=0;
-
-			if( dbcon1.ResultQuery(query) )
+			if( !warm && dbcon1.ResultQuery(query) )
 			{
 				for( ; dbcon1; ++dbcon1)
 				{
@@ -2668,25 +5018,7 @@ bool CCharDB_sql::searchAccount(uint32 accid, CCharCharAccount& account)
 				}
 			}
 
-			query.clear();
-			query << "SELECT `str`,`value` "
-					 "FROM `" << dbcon1.escaped(this->tbl_login_reg) << "` "
-					 "WHERE `account_id`='" << account.account_id << "'";
-			i=0;
-			if( dbcon1.ResultQuery(query) )
-			{
-				for( ; dbcon1 && i<ACCOUNT_REG2_NUM; ++dbcon1, ++i)
-				{
-					safestrcpy(account.account_reg2[i].str, sizeof(account.account_reg2[0].str), dbcon1[0]);
-					account.account_reg2[i].value = atoi(dbcon1[1]);
-				}
-			}
-			account.account_reg2_num = i;
-			for( ; i<ACCOUNT_REG2_NUM; ++i)
-			{
-				account.account_reg2[i].str[0] = 0;
-				account.account_reg2[i].value = 0;
-			}
+			account.account_reg2_num = reg_load(this->sqlbase, REG_ACCOUNT, account.account_id, account.account_reg2, ACCOUNT_REG2_NUM);
 			ret = true;
 		}
 	}
@@ -2722,7 +5054,7 @@ bool CCharDB_sql::removeAccount(uint32 accid)
 // MAIL STUFF
 size_t CCharDB_sql::getMailCount(uint32 cid, uint32 &all, uint32 &unread)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::CMySQLConnection dbcon1(this->readbase(SQL_ENTITY_MAIL, cid));
 	basics::string<> query;
 	all = 0;
 	unread = 0;
@@ -2776,6 +5108,23 @@ size_t CCharDB_sql::listMail(uint32 cid, unsigned char box, unsigned char *buffe
 	return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// columns of the item attached to a mail
+static const CSQLColumn<struct item> mail_item_column_list[] =
+{
+	CSQLColumn<struct item>("item_nameid",		&item::nameid),
+	CSQLColumn<struct item>("item_amount",		&item::amount),
+	CSQLColumn<struct item>("item_equip",		&item::equip),
+	CSQLColumn<struct item>("item_identify",	&item::identify),
+	CSQLColumn<struct item>("item_refine",		&item::refine),
+	CSQLColumn<struct item>("item_attribute",	&item::attribute),
+	CSQLColumn<struct item>("item_card0",		&item::card, 0),
+	CSQLColumn<struct item>("item_card1",		&item::card, 1),
+	CSQLColumn<struct item>("item_card2",		&item::card, 2),
+	CSQLColumn<struct item>("item_card3",		&item::card, 3),
+};
+static const CSQLColumnMap<struct item> mail_item_columns(mail_item_column_list);
+
 bool CCharDB_sql::readMail(uint32 cid, uint32 mid, CMail& mail)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
@@ -2783,11 +5132,10 @@ bool CCharDB_sql::readMail(uint32 cid, uint32 mid, CMail& mail)
 	bool ret = false;
 
 	query << "SELECT "
-			 "`read_flag`,`from_char_name`,`header`,`sendtime`,`message` "
-			 "`zeny`,"
-			 "`item_nameid`,`item_amount`,`item_equip`,`item_identify`,"
-			 "`item_refine`,`item_attribute`,"
-			 "`item_card0`,`item_card1`,`item_card2`,`item_card3` "
+			 "`read_flag`,`from_char_name`,`header`,`sendtime`,`message`,"
+			 "`zeny`,";
+	mail_item_columns.names(query);
+	query << " "
 			 "FROM `" << dbcon1.escaped(this->tbl_mail) << "` "
 			 "WHERE `to_char_id` = '" << cid << "' "
 			 "AND `message_id` = '" << mid << "'";
@@ -2803,16 +5151,7 @@ bool CCharDB_sql::readMail(uint32 cid, uint32 mid, CMail& mail)
 		ret = true;
 
 		struct item item;
-		item.nameid		= atol(dbcon1[ 6]);
-		item.amount		= atol(dbcon1[ 7]);
-		item.equip  	= atol(dbcon1[ 8]);
-		item.identify	= atol(dbcon1[ 9]);
-		item.refine 	= atol(dbcon1[10]);
-		item.attribute	= atol(dbcon1[11]);
-		item.card[0]	= atol(dbcon1[12]);
-		item.card[1]	= atol(dbcon1[13]);
-		item.card[2]	= atol(dbcon1[14]);
-		item.card[3]	= atol(dbcon1[15]);
+		mail_item_columns.decode(dbcon1, item, 6);
 
 		mail = CMail( mid, atol(dbcon1[0]), dbcon1[1], dbcon1[2], atol(dbcon1[3]),
 						atol(dbcon1[5]), item, dbcon1[4]);
@@ -2827,6 +5166,7 @@ bool CCharDB_sql::readMail(uint32 cid, uint32 mid, CMail& mail)
 					 "`item_card0`='0',`item_card1`='0',`item_card2`='0',`item_card3`='0' "
 					 "WHERE `message_id`= '" << mid << "'";
 			dbcon1.PureQuery(query);
+			this->written(SQL_ENTITY_MAIL, cid);
 		}
 	}
 	return ret;
@@ -2840,6 +5180,7 @@ bool CCharDB_sql::deleteMail(uint32 cid, uint32 mid)
 			 "FROM `" << dbcon1.escaped(this->tbl_mail) << "` "
 			 "WHERE `to_char_id` = '" << cid << "' "
 			 "AND `message_id` = '" << mid << "'";
+	this->written(SQL_ENTITY_MAIL, cid);
 	return dbcon1.PureQuery(query);
 }
 
@@ -2878,25 +5219,29 @@ bool CCharDB_sql::sendMail(uint32 senderid, const char* sendername, const char*
 				 "("
 				 "`to_char_id`,`to_char_name`,"
 				 "`from_char_id`,`from_char_name`,"
-				 "`header`,`message`,`read_flag`"
-				 "`zeny`,"
-				 "`item_nameid`,`item_amount`,`item_equip`,`item_identify`,`item_refine`,`item_attribute`,"
-				 "`item_card0`,`item_card1`,`item_card2`,`item_card3`"
-				 ") "
+				 "`header`,`message`,`read_flag`,"
+				 "`zeny`,";
+		mail_item_columns.names(query);
+		query << ") "
 				 "VALUES ";
 
+		// the item is sent unequipped
+		struct item sent = item;
+		sent.equip = 0;
+
+		if( 0==strcmp(targetname,"*") )
+			this->written(SQL_ENTITY_MAIL);
 		for( ; dbcon1; ++dbcon1)
 		{
+			this->written(SQL_ENTITY_MAIL, CSQLValue(dbcon1[0]));
 			query << (doit?",":"") <<
 				"("
 				"'" << dbcon1[0] << "','" << dbcon1.escaped(dbcon1[1]) << "',"
 				"'" << senderid << "','" << _sendername << "',"				
 				"'" << _head << "','" << _body << "','0',"
-				"'" << zeny << "',"
-				"'" << item.nameid << "','" << item.amount << "','" << /*item.equip*/0 << "',"
-				"'" << item.identify << "','" << item.refine << "','" << item.attribute << "',"
-				"'" << item.card[0] << "','" << item.card[1] << "','" << item.card[2] << "','" << item.card[3] << "'"
-				")";
+				"'" << zeny << "',";
+			mail_item_columns.fields(query, dbcon1, sent);
+			query << ")";
 			++doit;
 		}
 		if(doit) ret = dbcon1.PureQuery(query);
@@ -2907,53 +5252,186 @@ bool CCharDB_sql::sendMail(uint32 senderid, const char* sendername, const char*
 
 void CCharDB_sql::loadfamelist()
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
+	size_t i;
+	for(i=0; i<4; ++i)
+		this->loadfame(i, this->readbase());
+}
+
+void CCharDB_sql::loadfame(size_t i, basics::CMySQL& base)
+{
+	basics::CMySQLConnection dbcon1(base);
 	basics::string<> query;
 
 	const static fame_t fametype[] = {FAME_PK, FAME_SMITH, FAME_CHEM, FAME_TEAK};
+	const char* famekey[4] = { "PC_PK_FAME", "PC_SMITH_FAME", "PC_CHEM_FAME", "PC_TEAK_FAME" };
 	const char* queryselect[4] = 
 	{	// pk
-		"(`s`.`str`='PC_PK_FAME')",
+		"",
 		// blacksmith
-		"(`s`.`str`='PC_SMITH_FAME' AND (`c`.`class`='10' OR `c`.`class`='4011' OR `c`.`class`='4033'))",
+		" AND (`c`.`class`='10' OR `c`.`class`='4011' OR `c`.`class`='4033')",
 		// alchemist
-		"(`s`.`str`='PC_CHEM_FAME' AND (`c`.`class`='18' OR `c`.`class`='4019' OR `c`.`class`='4041'))",
+		" AND (`c`.`class`='18' OR `c`.`class`='4019' OR `c`.`class`='4041')",
 		// teakwon
-		"(`s`.`str`='PC_TEAK_FAME' AND (`c`.`class`='4046'))"
+		" AND (`c`.`class`='4046')"
 	};
 
-	size_t i,k;
-	for(i=0; i<4; ++i)
+	size_t k;
+	CFameList &fl = this->famelists[fametype[i]];
+	fl.clear();
+	query << "SELECT "
+			 "`s`.`owner`,`c`.`name`,`s`.`ival` "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` `s` "
+			 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `c`.`char_id` = `s`.`owner` "
+			 "WHERE `s`.`scope`='" << (int)REG_CHAR << "' AND `s`.`key_id`='" << this->reg_key(famekey[i]) << "' "
+			 "AND `s`.`ival`>'0'" << queryselect[i] << " "
+			 "ORDER BY `s`.`ival` DESC LIMIT 0," << (MAX_FAMELIST+1);
+
+	if( dbcon1.ResultQuery(query) )
 	{
-		CFameList &fl = this->famelists[fametype[i]];
-		fl.clear();
-		query.clear();
-		query << "SELECT "
-				 "`s`.`char_id`,`c`.`name`,`s`.`value` "
-				 "FROM `" << dbcon1.escaped(this->tbl_char_reg) << "` `s` "
-				 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `c`.`char_id` = `s`.`char_id` "
-				 "WHERE `s`.`value`>'0' AND " << queryselect[i] <<
-				 "ORDER BY `s`.`value` LIMIT 0," << (MAX_FAMELIST+1);
+		for(k=0; dbcon1 && k<MAX_FAMELIST+1; ++dbcon1, ++k )
+		{
+			if( atol(dbcon1[0]) && dbcon1[1][0] && atol(dbcon1[2]) )
+			{
+				fl.cEntry[k] = 
+					CFameList::fameentry(atol(dbcon1[0]), dbcon1[1], atol(dbcon1[2]));
+			}
+		}
+		fl.cCount=k;
+		// clear the rest
+		for( ; k<MAX_FAMELIST+1; ++k )
+		{
+			fl.cEntry[k] = 
+				CFameList::fameentry(0, "", 0);
+		}
+	}
+}
 
-		if( dbcon1.ResultQuery(query) )
+bool CCharDB_sql::warm_fame(void* obj, size_t i)
+{
+	CCharDB_sql* db = (CCharDB_sql*)obj;
+	db->loadfame(i, db->readbase());
+	return true;
+}
+
+/// accounts that logged in within sql_warmup_days, for a query joining the
+/// char table as `c`
+static void warm_recent(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl_account, basics::string<>& query)
+{
+	query << "JOIN `" << dbcon1.escaped(tbl_account) << "` `a` ON `a`.`account_id` = `c`.`account_id` "
+			 "WHERE `a`.`last_login` >= DATE_FORMAT(NOW() - INTERVAL " << (uint32)CSQLWarmup::sql_warmup_days << " DAY, '%Y-%m-%d')";
+}
+
+CCharDB_sql::warm_account* CCharDB_sql::warm_find(uint32 accid)
+{
+	size_t a = 0, b = this->warm_acc_cnt;
+	while( a < b )
+	{
+		const size_t m = (a+b)/2;
+		if( this->warm_acc[m].account_id < accid )
+			a = m+1;
+		else
+			b = m;
+	}
+	return ( a < this->warm_acc_cnt && this->warm_acc[a].account_id == accid ) ? &this->warm_acc[a] : NULL;
+}
+
+bool CCharDB_sql::warm_accounts(void* obj, size_t arg)
+{
+	CCharDB_sql* db = (CCharDB_sql*)obj;
+	basics::CMySQLConnection dbcon1(db->sqlbase);
+	basics::string<> query;
+	warm_account* list = NULL;
+	size_t cnt = 0, cap = 0, i;
+
+	query << "SELECT `c`.`account_id`,`c`.`char_id`,`c`.`slot` "
+			 "FROM `" << dbcon1.escaped(db->tbl_char) << "` `c` ";
+	warm_recent(dbcon1, db->tbl_account, query);
+	query << " ORDER BY `c`.`account_id`";
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		const uint32 accid = atol(dbcon1[0]);
+		const uint32 char_id = atol(dbcon1[1]);
+		const size_t slot = atoi(dbcon1[2]);
+		if( !cnt || list[cnt-1].account_id != accid )
 		{
-			for(k=0; dbcon1 && k<MAX_FAMELIST+1; ++dbcon1, ++k )
+			if( cnt >= cap )
 			{
-				if( atol(dbcon1[0]) && dbcon1[1][0] && atol(dbcon1[2]) )
+				warm_account* tmp = new warm_account[cap ? cap*2 : 1024];
+				if( list )
 				{
-					fl.cEntry[k] = 
-						CFameList::fameentry(atol(dbcon1[0]), dbcon1[1], atol(dbcon1[2]));
+					memcpy(tmp, list, cnt*sizeof(warm_account));
+					delete[] list;
 				}
+				list = tmp;
+				cap = cap ? cap*2 : 1024;
 			}
-			fl.cCount=k;
-			// clear the rest
-			for( ; k<MAX_FAMELIST+1; ++k )
-			{
-				fl.cEntry[k] = 
-					CFameList::fameentry(0, "", 0);
-			}
+			list[cnt].account_id = accid;
+			for(i=0; i<9; ++i)
+				list[cnt].charlist[i] = 0;
+			++cnt;
+		}
+		if( slot < 9 && char_id )
+		{
+			if( list[cnt-1].charlist[slot] != 0 )
+				ShowError("CharDB: doubled used slot %i for account_id %i\n", (int)slot, accid);
+			list[cnt-1].charlist[slot] = char_id;
 		}
 	}
+
+	CSQLLock lock(db->warm_mutex);
+	if( db->warm_acc )
+		delete[] db->warm_acc;
+	db->warm_acc = list;
+	db->warm_acc_cnt = cnt;
+	return true;
+}
+
+bool CCharDB_sql::warm_registers(void* obj, size_t arg)
+{
+	CCharDB_sql* db = (CCharDB_sql*)obj;
+	basics::CMySQLConnection dbcon1(db->sqlbase);
+	basics::string<> query;
+	query << "SELECT `r`.`owner`,`r`.`key_id`,`r`.`ival` "
+			 "FROM `" << dbcon1.escaped(db->tbl_registry) << "` `r` "
+			 "JOIN `" << dbcon1.escaped(db->tbl_char) << "` `c` ON `c`.`char_id` = `r`.`owner` AND `r`.`scope`='" << (int)REG_CHAR << "' ";
+	warm_recent(dbcon1, db->tbl_account, query);
+	query << " ORDER BY `r`.`owner`";
+	return reg_prime(db->sqlbase, REG_CHAR, query, GLOBAL_REG_NUM);
+}
+
+void CCharDB_sql::warmup(CSQLWarmup& w)
+{
+	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::string<> query;
+	size_t i;
+
+	// the key dictionary is not threadsafe, fill it before the tasks run
+	this->reg_key("PC_PK_FAME");
+	this->reg_key("PC_SMITH_FAME");
+	this->reg_key("PC_CHEM_FAME");
+	this->reg_key("PC_TEAK_FAME");
+	for(i=0; i<4; ++i)
+		w.add("fame list", &CCharDB_sql::warm_fame, this, i);
+
+	// char lists and the register states for the first saves
+	w.add("accounts", &CCharDB_sql::warm_accounts, this);
+	w.add("char registers", &CCharDB_sql::warm_registers, this);
+
+	// the login server owns the account rows and registers,
+	// they are only brought into the buffer pool
+	query << "SELECT `a`.* "
+			 "FROM `" << dbcon1.escaped(this->tbl_account) << "` `a` "
+			 "WHERE `a`.`last_login` >= DATE_FORMAT(NOW() - INTERVAL " << (uint32)CSQLWarmup::sql_warmup_days << " DAY, '%Y-%m-%d')";
+	w.add("account rows", this->sqlbase, query);
+	query.clear();
+
+	query << "SELECT `r`.* "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` `r` "
+			 "JOIN `" << dbcon1.escaped(this->tbl_account) << "` `a` ON `a`.`account_id` = `r`.`owner` "
+			 "WHERE `r`.`scope`='" << (int)REG_ACCOUNT << "' AND `a`.`last_login` >= DATE_FORMAT(NOW() - INTERVAL " << (uint32)CSQLWarmup::sql_warmup_days << " DAY, '%Y-%m-%d')";
+	w.add("account registers", this->sqlbase, query);
 }
 
 
@@ -2970,6 +5448,55 @@ void CCharDB_sql::loadfamelist()
 //******      ******  ****  ****  ***          ***  ***      ***  *****  *******
 //*******************      *****  ***          ***       *******        ********
 //****************************************************************    **********
+///////////////////////////////////////////////////////////////////////////////
+/// guild columns.
+/// guild_id and name go first, they are not updated.
+/// the master name is joined from the char table, the emblem is hex encoded
+static const CSQLColumn<CGuild> guild_column_list[] =
+{
+	CSQLColumn<CGuild>("guild_id",			&CGuild::guild_id),
+	CSQLColumn<CGuild>("name",				&CGuild::name),
+	CSQLColumn<CGuild>("guild_lv",			&CGuild::guild_lv),
+	CSQLColumn<CGuild>("connect_member",	&CGuild::connect_member),
+	CSQLColumn<CGuild>("max_member",		&CGuild::max_member),
+	CSQLColumn<CGuild>("average_lv",		&CGuild::average_lv),
+	CSQLColumn<CGuild>("exp",				&CGuild::exp),
+	CSQLColumn<CGuild>("next_exp",			&CGuild::next_exp),
+	CSQLColumn<CGuild>("skill_point",		&CGuild::skill_point),
+	CSQLColumn<CGuild>("mes1",				&CGuild::mes1),
+	CSQLColumn<CGuild>("mes2",				&CGuild::mes2),
+	CSQLColumn<CGuild>("emblem_id",			&CGuild::emblem_id),
+	CSQLColumn<CGuild>("emblem_len",		&CGuild::emblem_len),
+};
+static const CSQLColumnMap<CGuild> guild_columns(guild_column_list);
+
+///////////////////////////////////////////////////////////////////////////////
+/// guild position columns, the rows are keyed by (guild_id,position)
+static const CSQLColumn<struct guild_position> guild_position_column_list[] =
+{
+	CSQLColumn<struct guild_position>("name",		&guild_position::name),
+	CSQLColumn<struct guild_position>("mode",		&guild_position::mode),
+	CSQLColumn<struct guild_position>("exp_mode",	&guild_position::exp_mode),
+};
+static const CSQLColumnMap<struct guild_position> guild_position_columns(guild_position_column_list);
+
+///////////////////////////////////////////////////////////////////////////////
+/// castle columns, the guardians are in their own table
+static const CSQLColumn<CCastle> castle_column_list[] =
+{
+	CSQLColumn<CCastle>("castle_id",	&CCastle::castle_id),
+	CSQLColumn<CCastle>("guild_id",		&CCastle::guild_id),
+	CSQLColumn<CCastle>("economy",		&CCastle::economy),
+	CSQLColumn<CCastle>("defense",		&CCastle::defense),
+	CSQLColumn<CCastle>("triggerE",		&CCastle::triggerE),
+	CSQLColumn<CCastle>("triggerD",		&CCastle::triggerD),
+	CSQLColumn<CCastle>("nextTime",		&CCastle::nextTime),
+	CSQLColumn<CCastle>("payTime",		&CCastle::payTime),
+	CSQLColumn<CCastle>("createTime",	&CCastle::createTime),
+	CSQLColumn<CCastle>("visibleC",		&CCastle::visibleC),
+};
+static const CSQLColumnMap<CCastle> castle_columns(castle_column_list);
+
 bool CGuildDB_sql::init(const char* configfile)
 {	// init db
 	if(configfile) basics::CParamBase::loadFile(configfile);
@@ -2977,21 +5504,245 @@ bool CGuildDB_sql::init(const char* configfile)
 
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	bool exists[MAX_GUILDCASTLE];
+	size_t i;
+
+	for(i = 0; i < MAX_GUILDCASTLE; ++i)
+	{
+		this->castle_cached[i] = false;
+		exists[i] = false;
+	}
+
+	// check if all castles exist
+	query <<  "SELECT "
+			  "`castle_id` "
+			  "FROM `" << dbcon1.escaped(this->tbl_castle) << "`";
+	for( dbcon1.ResultQuery(query); dbcon1; ++dbcon1)
+	{
+		i = atoi(dbcon1[0]);
+		if( i < MAX_GUILDCASTLE )
+			exists[i] = true;
+	}
+	for(i = 0; i < MAX_GUILDCASTLE; ++i)
+	{	
+		if( !exists[i] )
+		{
+			this->saveCastle( CCastle(i) ); // constructor takes care of all settings
+			this->invalidate_rows(this->tbl_castle);
+		}
+	}
+	if( CSQLWarmup::sql_warmup )
+	{
+		CSQLWarmup w;
+		this->warmup(w);
+		w.run();
+	}
+	return true;
+}
+
+bool CGuildDB_sql::loadCastles()
+{
+	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::string<> query;
+	CCastle tmp[MAX_GUILDCASTLE];
+	bool found[MAX_GUILDCASTLE];
+	size_t i, k;
+
+	for(i=0; i<MAX_GUILDCASTLE; ++i)
+		found[i] = false;
+
+	query << "SELECT ";
+	castle_columns.names(query);
+	query << " "
+			 "FROM `" << dbcon1.escaped(this->tbl_castle) << "`";
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		i = atoi(dbcon1[0]);
+		if( i >= MAX_GUILDCASTLE )
+			continue;
+		CCastle& castle = tmp[i];
+		castle_columns.decode(dbcon1, castle);
+		for(k=0; k<MAX_GUARDIAN; ++k)
+		{
+			castle.guardian[k].guardian_id = 0;
+			castle.guardian[k].guardian_hp = 0;
+			castle.guardian[k].visible = 0;
+		}
+		found[i] = true;
+	}
+
+	// guardians in the same order as searchCastle reads them
+	size_t cnt[MAX_GUILDCASTLE];
+	for(i=0; i<MAX_GUILDCASTLE; ++i)
+		cnt[i] = 0;
+	query.clear();
+	query << "SELECT "
+			 "`castle_id`, `guardian_hp`, `guardian_visible` "
+			 "FROM `" << dbcon1.escaped(this->tbl_castle_guardian) << "`";
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		i = atoi(dbcon1[0]);
+		if( i >= MAX_GUILDCASTLE || cnt[i] >= MAX_GUARDIAN )
+			continue;
+		tmp[i].guardian[cnt[i]].guardian_hp = CSQLValue(dbcon1[1]);
+		tmp[i].guardian[cnt[i]].visible = CSQLValue(dbcon1[2]);
+		++cnt[i];
+	}
+
+	for(i=0; i<MAX_GUILDCASTLE; ++i)
+	{
+		if( found[i] )
+		{
+			this->castle_cache[i] = tmp[i];
+			this->castle_cached[i] = true;
+		}
+	}
+	return true;
+}
+
+bool CGuildDB_sql::warm_castles(void* obj, size_t arg)
+{
+	return ((CGuildDB_sql*)obj)->loadCastles();
+}
+
+static int warm_guild_cmp(const void* a, const void* b)
+{
+	const uint32 x = (*(const CGuild*const*)a)->guild_id, y = (*(const CGuild*const*)b)->guild_id;
+	return (x<y) ? -1 : (x>y);
+}
+
+bool CGuildDB_sql::warm_take(uint32 guild_id, CGuild* g)
+{
+	CSQLLock lock(this->warm_mutex);
+	size_t a = 0, b = this->warm_guild_cnt;
+	while( a < b )
+	{
+		const size_t m = (a+b)/2;
+		if( this->warm_guild[m]->guild_id < guild_id )
+			a = m+1;
+		else
+			b = m;
+	}
+	if( a >= this->warm_guild_cnt || this->warm_guild[a]->guild_id != guild_id )
+		return false;
+	if( g )
+		*g = *this->warm_guild[a];
+	delete this->warm_guild[a];
+	--this->warm_guild_cnt;
+	memmove(this->warm_guild+a, this->warm_guild+a+1, (this->warm_guild_cnt-a)*sizeof(CGuild*));
+	return true;
+}
+
+void CGuildDB_sql::warm_drop(uint32 guild_id)
+{
+	if( guild_id )
+	{
+		this->warm_take(guild_id, NULL);
+		return;
+	}
+	CSQLLock lock(this->warm_mutex);
+	size_t i;
+	for(i=0; i<this->warm_guild_cnt; ++i)
+		delete this->warm_guild[i];
+	if( this->warm_guild )
+		delete[] this->warm_guild;
+	this->warm_guild = NULL;
+	this->warm_guild_cnt = this->warm_guild_cap = 0;
+}
+
+bool CGuildDB_sql::warm_guilds(void* obj, size_t arg)
+{
+	CGuildDB_sql* db = (CGuildDB_sql*)obj;
+	basics::CMySQLConnection dbcon1(db->sqlbase);
+	basics::string<> query;
+	uint32* ids = NULL;
+	size_t cnt = 0, cap = 0, i, k;
+	bool ret = true;
+
+	query << "SELECT `guild_id` "
+			 "FROM `" << dbcon1.escaped(db->tbl_guild) << "` "
+			 "WHERE `guild_id` % " << (uint32)WARM_GUILD_TASKS << " = " << (uint32)arg;
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		if( cnt >= cap )
+		{
+			uint32* tmp = new uint32[cap ? cap*2 : 256];
+			if( ids )
+			{
+				memcpy(tmp, ids, cnt*sizeof(uint32));
+				delete[] ids;
+			}
+			ids = tmp;
+			cap = cap ? cap*2 : 256;
+		}
+		ids[cnt++] = atol(dbcon1[0]);
+	}
 
-	// check if all castles exist
-	size_t i;
-	for(i = 0; i < MAX_GUILDCASTLE; ++i, query.clear())
-	{	
-		query <<  "SELECT "
-				  "count(*) "
-				  "FROM `" << dbcon1.escaped(this->tbl_castle) << "` "
-				  "WHERE `castle_id`='" << i << "'";
-		if( !dbcon1.ResultQuery(query) || 0==atoi(dbcon1[0]) )
+	CGuild** list = new CGuild*[cnt+1];
+	size_t num = 0;
+	for(i=0; i<cnt; ++i)
+	{
+		CGuild* g = new CGuild;
+		if( !db->loadGuild(ids[i], *g) )
 		{
-			this->saveCastle( CCastle(i) ); // constructor takes care of all settings
+			delete g;
+			ret = false;
+			continue;
+		}
+		// aggregates from the members
+		size_t members = 0, lv = 0;
+		g->connect_member = 0;
+		for(k=0; k<MAX_GUILD; ++k)
+		{
+			if( g->member[k].account_id )
+			{
+				++members;
+				lv += g->member[k].lv;
+				if( g->member[k].online )
+					++g->connect_member;
+			}
 		}
+		g->average_lv = members ? lv/members : 0;
+		list[num++] = g;
 	}
-	return true;
+	if( ids )
+		delete[] ids;
+
+	CSQLLock lock(db->warm_mutex);
+	if( db->warm_guild_cnt+num > db->warm_guild_cap )
+	{
+		size_t c = db->warm_guild_cap ? db->warm_guild_cap : 256;
+		while( c < db->warm_guild_cnt+num )
+			c *= 2;
+		CGuild** tmp = new CGuild*[c];
+		if( db->warm_guild )
+		{
+			memcpy(tmp, db->warm_guild, db->warm_guild_cnt*sizeof(CGuild*));
+			delete[] db->warm_guild;
+		}
+		db->warm_guild = tmp;
+		db->warm_guild_cap = c;
+	}
+	if( num )
+		memcpy(db->warm_guild+db->warm_guild_cnt, list, num*sizeof(CGuild*));
+	db->warm_guild_cnt += num;
+	qsort(db->warm_guild, db->warm_guild_cnt, sizeof(CGuild*), warm_guild_cmp);
+	delete[] list;
+	return ret;
+}
+
+void CGuildDB_sql::warmup(CSQLWarmup& w)
+{
+	size_t i;
+	w.add("castles", &CGuildDB_sql::warm_castles, this);
+	for(i=0; i<WARM_GUILD_TASKS; ++i)
+		w.add("guilds", &CGuildDB_sql::warm_guilds, this, i);
 }
 
 size_t CGuildDB_sql::size() const
@@ -3073,17 +5824,19 @@ bool CGuildDB_sql::searchGuild(const char* name, CGuild& g)
 }
 
 bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
+{
+	return this->warm_take(guild_id, &g) || this->loadGuild(guild_id, g);
+}
+
+bool CGuildDB_sql::loadGuild(uint32 guild_id, CGuild& g)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 	size_t i;
 
-	query << "SELECT "
-			 "`g`.`guild_id`, `g`.`guild_lv`, "
-			 "`g`.`connect_member`, `g`.`max_member`, `g`.`average_lv`,"
-			 "`g`.`exp`, `g`.`next_exp`, `g`.`skill_point`, "
-			 "`g`.`name`, `c`.`name`, `g`.`mes1`, `g`.`mes2`,"
-			 "`g`.`emblem_id`, `g`.`emblem_len`, `g`.`emblem_data` "
+	query << "SELECT ";
+	guild_columns.names(query, 0, "g");
+	query << ",`c`.`name`,`g`.`emblem_data` "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild) << "` `g`"
 			 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `c`.`char_id` = `g`.`master_id`"
 			 "WHERE `g`.`guild_id` = " << guild_id;
@@ -3091,20 +5844,8 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
 		///////////////////////////////////////////////////////////////////////
-		g.guild_id		= atoi(dbcon1[0]);
-		g.guild_lv		= atoi(dbcon1[1]);
-		g.connect_member= atoi(dbcon1[2]);
-		g.max_member	= atoi(dbcon1[3]);
-		g.average_lv	= atoi(dbcon1[4]);
-		g.exp			= atoi(dbcon1[5]);
-		g.next_exp		= atoi(dbcon1[6]);
-		g.skill_point	= atoi(dbcon1[7]);
-		safestrcpy(g.name, sizeof(g.name), dbcon1[8]);
-		safestrcpy(g.master, sizeof(g.name), dbcon1[9]);
-		safestrcpy(g.mes1, sizeof(g.mes1), dbcon1[10]);
-		safestrcpy(g.mes2, sizeof(g.mes2), dbcon1[11]);
-		g.emblem_id		= atoi(dbcon1[12]);
-		g.emblem_len	= atoi(dbcon1[13]);
+		guild_columns.decode(dbcon1, g);
+		safestrcpy(g.master, sizeof(g.master), dbcon1[guild_columns.size()]);
 		g.chaos = 0;
 		g.honour = 0;
 		g.save_flags = 0;
@@ -3114,7 +5855,7 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 
 		///////////////////////////////////////////////////////////////////////
 		{	// Decode the emblem from SQL
-			const uchar *ptr = (uchar*)dbcon1[14];
+			const uchar *ptr = (uchar*)dbcon1[guild_columns.size()+1];
 			uchar val1, val2;
 			if(ptr)
 			{
@@ -3170,19 +5911,19 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		dbcon1.ResultQuery(query);
 		for(i=0; dbcon1 && i<MAX_GUILD; ++dbcon1, ++i)
 		{
-			g.member[i].account_id = atoi(dbcon1[0]);
-			g.member[i].char_id = atoi(dbcon1[1]);
-			g.member[i].hair = atoi(dbcon1[2]);
-			g.member[i].hair_color = atoi(dbcon1[3]);
-			g.member[i].gender = atoi(dbcon1[4]);
-			g.member[i].class_ = atoi(dbcon1[5]);
-			g.member[i].lv = atoi(dbcon1[6]);
-			g.member[i].exp = atoi(dbcon1[7]);
-			g.member[i].exp_payper = atoi(dbcon1[8]);
-			g.member[i].online = atoi(dbcon1[9]);
-			g.member[i].position = atoi(dbcon1[10]);
-			g.member[i].rsv1 = atoi(dbcon1[11]);
-			g.member[i].rsv2 = atoi(dbcon1[12]);
+			g.member[i].account_id = CSQLValue(dbcon1[0]);
+			g.member[i].char_id = CSQLValue(dbcon1[1]);
+			g.member[i].hair = CSQLValue(dbcon1[2]);
+			g.member[i].hair_color = CSQLValue(dbcon1[3]);
+			g.member[i].gender = CSQLValue(dbcon1[4]);
+			g.member[i].class_ = CSQLValue(dbcon1[5]);
+			g.member[i].lv = CSQLValue(dbcon1[6]);
+			g.member[i].exp = CSQLValue(dbcon1[7]);
+			g.member[i].exp_payper = CSQLValue(dbcon1[8]);
+			g.member[i].online = CSQLValue(dbcon1[9]);
+			g.member[i].position = CSQLValue(dbcon1[10]);
+			g.member[i].rsv1 = CSQLValue(dbcon1[11]);
+			g.member[i].rsv2 = CSQLValue(dbcon1[12]);
 			safestrcpy(g.member[i].name, sizeof(g.member[i].name), dbcon1[13]);
 		}
 		for( ; i<MAX_GUILD; ++i)
@@ -3208,8 +5949,9 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		///////////////////////////////////////////////////////////////////////
 		// Get the guild's positions
 		query.clear();
-		query << "SELECT "
-				 "`name`, `mode`, `exp_mode` "
+		query << "SELECT ";
+		guild_position_columns.names(query);
+		query << " "
 				 "FROM `" << dbcon1.escaped(this->tbl_guild_position) << "` "
 				 "WHERE `guild_id` = '" << g.guild_id << "' "
 				 "ORDER BY `position` ASC";
@@ -3219,11 +5961,7 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		// SQL may not provide data for all of the positions, so we
 		// get as much as we can from the DB and fill that in.
 		for(i=0; dbcon1 && i<MAX_GUILDPOSITION; ++dbcon1, ++i)
-		{
-			safestrcpy(g.position[i].name, sizeof(g.position[i].name), dbcon1[0]);
-			g.position[i].mode = atoi(dbcon1[1]);
-			g.position[i].exp_mode = atoi(dbcon1[2]);
-		}
+			guild_position_columns.decode(dbcon1, g.position[i]);
 		// If the guild positions array isn't full, we generate names
 		for (; i < MAX_GUILDPOSITION; ++i)
 		{
@@ -3245,8 +5983,8 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		dbcon1.ResultQuery(query);
 		for(i=0; dbcon1 && i<MAX_GUILDALLIANCE; ++dbcon1, ++i)
 		{
-			g.alliance[i].opposition = atoi(dbcon1[0]);
-			g.alliance[i].guild_id = atoi(dbcon1[1]);
+			g.alliance[i].opposition = CSQLValue(dbcon1[0]);
+			g.alliance[i].guild_id = CSQLValue(dbcon1[1]);
 			safestrcpy(g.alliance[i].name, sizeof(g.alliance[i].name), dbcon1[2]);
 		}
 		for( ; i<MAX_GUILDALLIANCE; ++i)
@@ -3259,7 +5997,7 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		// Get the guild's history of expulsions
 		query.clear();
 		query << "SELECT "
-				 "`c`.`name`, `e`.`mes`, `e`.`acc`, `c`.`account_id`, `e`.`rsv1`, `e`.`rsv2`, `e`.`rsv3` "
+				 "`c`.`name`, `e`.`mes`, `e`.`acc`, `c`.`account_id`, `e`.`char_id`, `e`.`rsv1`, `e`.`rsv2`, `e`.`rsv3` "
 				 "FROM `" << dbcon1.escaped(this->tbl_guild_expulsion) << "` `e`"
 				 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `e`.`char_id`=`c`.`char_id` "
 				 "WHERE `e`.`guild_id` = " << g.guild_id;
@@ -3269,11 +6007,11 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 			safestrcpy(g.explusion[i].name, sizeof(g.explusion[i].name), dbcon1[0]);
 			safestrcpy(g.explusion[i].mes, sizeof(g.explusion[i].mes), dbcon1[1]);
 			safestrcpy(g.explusion[i].acc, sizeof(g.explusion[i].acc), dbcon1[2]);
-			g.explusion[i].account_id = atoi(dbcon1[3]);
-			g.explusion[i].char_id = atoi(dbcon1[4]);
-			g.explusion[i].rsv1 = atoi(dbcon1[5]);
-			g.explusion[i].rsv2 = atoi(dbcon1[6]);
-			g.explusion[i].rsv3 = atoi(dbcon1[7]);
+			g.explusion[i].account_id = CSQLValue(dbcon1[3]);
+			g.explusion[i].char_id = CSQLValue(dbcon1[4]);
+			g.explusion[i].rsv1 = CSQLValue(dbcon1[5]);
+			g.explusion[i].rsv2 = CSQLValue(dbcon1[6]);
+			g.explusion[i].rsv3 = CSQLValue(dbcon1[7]);
 		}
 		for( ; i<MAX_GUILDEXPLUSION; ++i)
 		{
@@ -3304,7 +6042,7 @@ bool CGuildDB_sql::searchGuild(uint32 guild_id, CGuild& g)
 		{
 			i = atol(dbcon1[0])-GD_SKILLBASE;
 			if(i<MAX_GUILDSKILL)
-				g.skill[i].lv = atol(dbcon1[1]);
+				g.skill[i].lv = CSQLValue(dbcon1[1]);
 		}
 		return true;
 	}
@@ -3347,6 +6085,7 @@ bool CGuildDB_sql::insertGuild(const struct guild_member &m, const char *name, C
 	if( dbcon1.PureQuery(query) )
 	{
 		g.guild_id = dbcon1.getLastID();
+		this->count_rows(this->tbl_guild, +1);
 		// Save the rest of the guild now that we have the basics inserted
 		return this->saveGuild(g) && searchGuild(g.guild_id, g);
 	}
@@ -3357,63 +6096,72 @@ bool CGuildDB_sql::removeGuild(uint32 guild_id)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	CSQLBatch batch;
 
 	query << "UPDATE `" << dbcon1.escaped(this->tbl_char) << "` "
 			 "SET `guild_id`='0' "
 			 "WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 	query.clear();
 
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_member) << "` "
 			 "WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_skill) << "` "
 			"WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_storage) << "` "
 			"WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_position) << "` "
 			"WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_alliance) << "` "
 			"WHERE `guild_id` = '" << guild_id << "' "
 			"OR `alliance_id` = '" << guild_id << "' ";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_expulsion) << "` "
 			"WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild) << "` "
 			"WHERE `guild_id` = '" << guild_id << "'";
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
+	if( !batch.commit() )
+		return false;
+	this->count_rows(this->tbl_guild, -1);
+	this->invalidate_rows(this->tbl_guild_storage);
+	// the alliances of other guilds went with it
+	this->warm_drop(0);
 
 	return true;
 }
 
 bool CGuildDB_sql::saveGuild(const CGuild& g)
 {
+	this->warm_drop(g.guild_id);
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 	basics::string<> query2;
+	CSQLBatch batch;
 	uint doit;
 	size_t i;
 
@@ -3432,22 +6180,13 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 		*ptr = '\0';
 
 		query << "UPDATE `" << dbcon1.escaped(this->tbl_guild) << "` "
-				 "SET"
-				 "`guild_lv`='" 		<< g.guild_lv		<< "',"
-				 "`connect_member`='"	<< g.connect_member	<< "',"
-				 "`max_member`='"		<< g.max_member		<< "',"
-				 "`average_lv`='"		<< g.average_lv		<< "',"
-				 "`exp`='"				<< g.exp 			<< "',"
-				 "`next_exp`='"			<< g.next_exp		<< "',"
-				 "`skill_point`='"		<< g.skill_point	<< "',"
-				 "`mes1`='"				<< dbcon1.escaped(g.mes1) << "',"
-				 "`mes2`='" 			<< dbcon1.escaped(g.mes2) << "',"
-				 "`emblem_len`='"		<< g.emblem_len		<< "',"
-				 "`emblem_id`='"		<< g.emblem_id		<< "',"
-				 "`emblem_data`='"		<< emblem_data			<< "'"
+				 "SET ";
+		guild_columns.update(query, dbcon1, g, 2);
+		query << ","
+				 "`emblem_data`='"		<< emblem_data		<< "' "
 				 "WHERE `guild_id`='"	<< g.guild_id 		<< "'";
 
-		dbcon1.PureQuery(query);
+		batch.add(this->sqlbase, query);
 	}
 
 	if(g.save_flags&GUILD_SAFE_MEMBER)
@@ -3458,14 +6197,14 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 			query << "DELETE "
 					 "FROM `" << dbcon1.escaped(this->tbl_guild_member) << "` "
 					 "WHERE `guild_id` = '" << g.guild_id << "'";
-			dbcon1.PureQuery(query);
+			batch.add(this->sqlbase, query);
 
 			// Remove guild IDs' from the character information sheets
 			query.clear();
 			query << "UPDATE `" << dbcon1.escaped(this->tbl_char) << "` "
 					 "SET `guild_id` = '0' "
 					 "WHERE `guild_id` = '" << g.guild_id << "'";
-			dbcon1.PureQuery(query);
+			batch.add(this->sqlbase, query);
 
 		}
 
@@ -3504,9 +6243,9 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 		}
 		if(doit)
 		{
-			dbcon1.PureQuery(query);
+			batch.add(this->sqlbase, query);
 			query2 << ")";	// -> WHERE <field> IN ( <list> )
-			dbcon1.PureQuery(query2);
+			batch.add(this->sqlbase, query2);
 		}
 	}
 
@@ -3515,33 +6254,27 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 		query.clear();
 		query << "REPLACE "
 				 "INTO `" << dbcon1.escaped(this->tbl_guild_position) << "` "
-				 "(`guild_id`,`position`,`name`,`mode`,`exp_mode`) VALUES ";
+				 "(`guild_id`,`position`,";
+		guild_position_columns.names(query);
+		query << ") VALUES ";
 		for(i=0, doit=0; i<MAX_GUILDPOSITION; ++i)
 		{
 			query << (doit?",":"") <<
 				"("
 				"'" << g.guild_id				<< "',"
-				"'" << i							<< "',"
-				"'" << dbcon1.escaped(g.position[i].name)<< "',"
-				"'" << g.position[i].mode		<< "',"
-				"'" << g.position[i].exp_mode	<< "'"
-				")";
+				"'" << (ulong)i					<< "',";
+			guild_position_columns.fields(query, dbcon1, g.position[i]);
+			query << ")";
 			++doit;
 		}
-		if(doit) dbcon1.PureQuery(query);
+		if(doit) batch.add(this->sqlbase, query);
 	}
 
 	if(g.save_flags&GUILD_SAFE_ALLIANCE)
 	{
+		basics::string<> keys;
 		query.clear();
-		query << "DELETE "
-				 "FROM `" << dbcon1.escaped(this->tbl_guild_alliance) << "` "
-				 "WHERE '" << g.guild_id << "' IN (`alliance_id`,`guild_id`)";
-		dbcon1.PureQuery(query);
-
-
-		query.clear();
-		query << "REPLACE INTO `" << dbcon1.escaped(this->tbl_guild_alliance) << "` "
+		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_guild_alliance) << "` "
 				 "(`guild_id`,`alliance_id`,`opposition`) VALUES ";
 		for(i=0, doit=0;i<MAX_GUILDALLIANCE;++i)
 		{
@@ -3550,18 +6283,31 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 				query << (doit?",":"") <<
 					"(" // Guild alliance for the current guild
 					"'" << g.guild_id				<< "',"
-					"'" << g.alliance[i].opposition	<< "',"
 					"'" << g.alliance[i].guild_id	<< "',"
-					")"
+					"'" << g.alliance[i].opposition	<< "'"
+					"),"
 					"(" // Guild alliance for the other guild
 					"'" << g.alliance[i].guild_id	<< "',"
-					"'" << g.alliance[i].opposition	<< "',"
 					"'" << g.guild_id				<< "',"
+					"'" << g.alliance[i].opposition	<< "'"
 					")";
+				keys << (doit?",":"") << "'" << g.alliance[i].guild_id << "'";
 				++doit;
 			}
 		}
-		if(doit) dbcon1.PureQuery(query);
+		query << " ON DUPLICATE KEY UPDATE `opposition`=VALUES(`opposition`)";
+		if(doit) batch.add(this->sqlbase, query);
+
+		// remove the alliances that are gone, on both sides
+		query.clear();
+		query << "DELETE "
+				 "FROM `" << dbcon1.escaped(this->tbl_guild_alliance) << "` ";
+		if(doit)
+			query << "WHERE (`guild_id`='" << g.guild_id << "' AND `alliance_id` NOT IN (" << keys << ")) "
+					 "OR (`alliance_id`='" << g.guild_id << "' AND `guild_id` NOT IN (" << keys << "))";
+		else
+			query << "WHERE '" << g.guild_id << "' IN (`alliance_id`,`guild_id`)";
+		batch.add(this->sqlbase, query);
 	}
 
 	if(g.save_flags&GUILD_SAFE_EXPULSE)
@@ -3588,18 +6334,14 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 				++doit;
 			}
 		}
-		if(doit) dbcon1.PureQuery(query);
+		if(doit) batch.add(this->sqlbase, query);
 
 	}
 
 	if(g.save_flags&GUILD_SAFE_SKILL)
 	{
+		basics::string<> keys;
 		query.clear();
-		query << "DELETE "
-				 "FROM `" << dbcon1.escaped(this->tbl_guild_skill) << "` "
-				 "WHERE `guild_id` = '" << g.guild_id << "'";
-		dbcon1.PureQuery(query);
-
 		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_guild_skill) << "` "
 				 "(`guild_id`,`id`,`lv`) VALUES ";
 
@@ -3613,13 +6355,22 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 					"'" << g.skill[i].id	<< "',"
 					"'" << g.skill[i].lv	<< "'"
 					")";
+				keys << (doit?",":"") << "'" << g.skill[i].id << "'";
 				++doit;
 			}
 		}
-		if(doit) dbcon1.PureQuery(query);
+		query << " ON DUPLICATE KEY UPDATE `lv`=VALUES(`lv`)";
+		if(doit) batch.add(this->sqlbase, query);
+
+		query.clear();
+		query << "DELETE "
+				 "FROM `" << dbcon1.escaped(this->tbl_guild_skill) << "` "
+				 "WHERE `guild_id` = '" << g.guild_id << "'";
+		if(doit) query << " AND `id` NOT IN (" << keys << ")";
+		batch.add(this->sqlbase, query);
 	}
 	const_cast<CGuild&>(g).save_flags = 0;
-	return true;
+	return batch.commit();
 }
 
 //////
@@ -3628,27 +6379,23 @@ bool CGuildDB_sql::saveGuild(const CGuild& g)
 //////
 bool CGuildDB_sql::searchCastle(ushort castle_id, CCastle& castle)
 {
+	if( castle_id < MAX_GUILDCASTLE && this->castle_cached[castle_id] )
+	{
+		castle = this->castle_cache[castle_id];
+		return true;
+	}
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 	size_t i;
-	query << "SELECT "
-			 "`castle_id`, `guild_id`, `economy`, `defense`, `triggerE`, `triggerD`, "
-			 "`nextTime`, `payTime`, `createTime`, `visibleC`"
-			 " FROM `" << dbcon1.escaped(this->tbl_castle) << "` "
+	query << "SELECT ";
+	castle_columns.names(query);
+	query << " "
+			 "FROM `" << dbcon1.escaped(this->tbl_castle) << "` "
 			 "WHERE `castle_id` = " << castle_id;
 
 	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
-		castle.castle_id = atoi(dbcon1[0]);
-		castle.guild_id = atoi(dbcon1[1]);
-		castle.economy = atoi(dbcon1[2]);
-		castle.defense = atoi(dbcon1[3]);
-		castle.triggerE = atoi(dbcon1[4]);
-		castle.triggerD = atoi(dbcon1[5]);
-		castle.nextTime = atoi(dbcon1[6]);
-		castle.payTime = atoi(dbcon1[7]);
-		castle.createTime = atoi(dbcon1[8]);
-		castle.visibleC = atoi(dbcon1[9]);
+		castle_columns.decode(dbcon1, castle);
 
 		query.clear();
 		query << "SELECT "
@@ -3660,8 +6407,8 @@ bool CGuildDB_sql::searchCastle(ushort castle_id, CCastle& castle)
 		for(i=0; dbcon1 && i<MAX_GUARDIAN; ++dbcon1, ++i)
 		{
 			castle.guardian[i].guardian_id = 0;
-			castle.guardian[i].guardian_hp = atoi(dbcon1[0]);
-			castle.guardian[i].visible = atoi(dbcon1[1]);
+			castle.guardian[i].guardian_hp = CSQLValue(dbcon1[0]);
+			castle.guardian[i].visible = CSQLValue(dbcon1[1]);
 		}
 		for( ; i<MAX_GUARDIAN; ++i)
 		{
@@ -3676,36 +6423,24 @@ bool CGuildDB_sql::saveCastle(const CCastle& castle)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	CSQLBatch batch;
 	size_t i;
 
 	// create/update the castle's information
 	query << "REPLACE INTO `" << dbcon1.escaped(this->tbl_castle) << "` "
-			 "("
-			 "`castle_id`,`guild_id`,`economy`,`defense`,`triggerE`,`triggerD`,"
-			 "`nextTime`,`payTime`,`createTime`,`visibleC`"
-			 ") "
-			 "VALUES "
-			 "("
-			 "'" << castle.castle_id	<< "',"
-			 "'" << castle.guild_id		<< "',"
-			 "'" << castle.economy		<< "',"
-			 "'" << castle.defense		<< "',"
-			 "'" << castle.triggerE		<< "',"
-			 "'" << castle.triggerD		<< "',"
-			 "'" << castle.nextTime		<< "',"
-			 "'" << castle.payTime		<< "',"
-			 "'" << castle.createTime	<< "',"
-			 "'" << castle.visibleC		<< "'"
-			 ") ";
-
-	dbcon1.PureQuery(query);
+			 "(";
+	castle_columns.names(query);
+	query << ") "
+			 "VALUES ";
+	castle_columns.values(query, dbcon1, castle);
+	batch.add(this->sqlbase, query);
 
 	// Clear the guardians
 	query.clear();
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_castle_guardian) << "` "
 			 "WHERE castle_id = " << castle.castle_id;
-	dbcon1.PureQuery(query);
+	batch.add(this->sqlbase, query);
 
 	// Update the guardians
 	for (i=0; i<MAX_GUARDIAN; ++i)
@@ -3722,13 +6457,44 @@ bool CGuildDB_sql::saveCastle(const CCastle& castle)
 					 castle.guardian[i].guardian_hp << ", " << 
 					 castle.guardian[i].visible << 
 					 ")";
-			dbcon1.PureQuery(query);
+			batch.add(this->sqlbase, query);
 		}
 	}
-	return true;
+	const bool ok = batch.commit();
+
+	if( castle.castle_id < MAX_GUILDCASTLE )
+	{	// the cache follows only a successful write, otherwise the
+		// next read goes to the database
+		this->castle_cached[castle.castle_id] = ok;
+		if( ok )
+		{	// the guardians are read back without their ids
+			CCastle& c = this->castle_cache[castle.castle_id];
+			size_t k = 0;
+			c = castle;
+			for(i=0; i<MAX_GUARDIAN; ++i)
+			{
+				if( castle.guardian[i].guardian_id )
+				{
+					c.guardian[k].guardian_id = 0;
+					c.guardian[k].guardian_hp = castle.guardian[i].guardian_hp;
+					c.guardian[k].visible = castle.guardian[i].visible;
+					++k;
+				}
+			}
+			for( ; k<MAX_GUARDIAN; ++k)
+			{
+				c.guardian[k].guardian_id = 0;
+				c.guardian[k].guardian_hp = 0;
+				c.guardian[k].visible = 0;
+			}
+		}
+	}
+	return ok;
 }
 bool CGuildDB_sql::removeCastle(ushort castle_id)
 {	// Delete from this->tbl_castle where castle_id = *cid
+	if( castle_id < MAX_GUILDCASTLE )
+		this->castle_cached[castle_id] = false;
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
@@ -3742,7 +6508,8 @@ bool CGuildDB_sql::removeCastle(ushort castle_id)
 			 "FROM `" << dbcon1.escaped(this->tbl_castle) << "` "
 			 "WHERE castle_id = '" << castle_id << "'";
 
-	dbcon1.PureQuery(query);
+	if( dbcon1.PureQuery(query) )
+		this->count_rows(this->tbl_castle, -1);
 	return true;
 }
 
@@ -3795,138 +6562,537 @@ uint32 CGuildDB_sql::has_conflict(uint32 guild_id, uint32 account_id, uint32 cha
 //////////
 // Party
 ///////
+basics::CParam<uint32> CPartyDB_sql::party_save_delay("party_save_delay", 5);
+
+/// resident party, sorted by party_id in party_tab
+struct party_res
+{
+	CParty	party;
+	uint32	char_id[MAX_PARTY];	///< char of each member
+	char	leader[24];			///< leader as stored in the database
+	time_t	dirty;				///< first unwritten change, 0 when written
+};
+static party_res* party_tab = NULL;
+static size_t party_cnt = 0;
+static size_t party_cap = 0;
+static bool party_loaded = false;
+/// guards the party tables, flushParties runs on the sql timer
+static CSQLMutex party_mutex;
+
+/// party_ids with unwritten changes, in the order of their first change
+static uint32* party_dirty = NULL;
+static size_t party_dirty_cnt = 0;
+static size_t party_dirty_cap = 0;
+
+/// party_ids sorted by name, case insensitive like the column
+static uint32* party_names = NULL;
+static size_t party_names_cnt = 0;
+static size_t party_names_cap = 0;
+static bool party_timer = false;
+
+/// char_id to party_id, open addressing, char_id 0 is free
+static struct party_idx
+{
+	uint32	char_id;
+	uint32	party_id;
+} *party_chars = NULL;
+static size_t party_chars_cnt = 0;
+static size_t party_chars_cap = 0;
+
+static size_t party_find(uint32 pid)
+{	// position of the party or the insert position
+	size_t a = 0, b = party_cnt;
+	while( a < b )
+	{
+		const size_t m = (a+b)/2;
+		if( party_tab[m].party.party_id < pid )
+			a = m+1;
+		else
+			b = m;
+	}
+	return a;
+}
+
+static party_res* party_get(uint32 pid)
+{
+	const size_t k = party_find(pid);
+	return ( k < party_cnt && party_tab[k].party.party_id == pid ) ? &party_tab[k] : NULL;
+}
+
+static party_res& party_add(uint32 pid)
+{
+	const size_t k = party_find(pid);
+	if( party_cnt >= party_cap )
+	{
+		party_res* tmp = new party_res[party_cap ? party_cap*2 : 256];
+		if( party_tab )
+		{
+			memcpy(tmp, party_tab, party_cnt*sizeof(party_res));
+			delete[] party_tab;
+		}
+		party_tab = tmp;
+		party_cap = party_cap ? party_cap*2 : 256;
+	}
+	// new ids are increasing, this is almost always an append
+	memmove(party_tab+k+1, party_tab+k, (party_cnt-k)*sizeof(party_res));
+	++party_cnt;
+	party_res& r = party_tab[k];
+	memset(&r, 0, sizeof(r));
+	r.party.party_id = pid;
+	return r;
+}
+
+static size_t party_name_find(const char* name)
+{	// position of the name or the insert position
+	size_t a = 0, b = party_names_cnt;
+	while( a < b )
+	{
+		const size_t m = (a+b)/2;
+		const party_res* r = party_get(party_names[m]);
+		if( strcasecmp(r->party.name, name) < 0 )
+			a = m+1;
+		else
+			b = m;
+	}
+	return a;
+}
+
+static int party_name_cmp(const void* a, const void* b)
+{
+	return strcasecmp(party_get(*(const uint32*)a)->party.name, party_get(*(const uint32*)b)->party.name);
+}
+
+/// add a party with its name set to the name index,
+/// unsorted appends the id and leaves the sorting to the caller
+static void party_name_add(uint32 pid, bool unsorted=false)
+{
+	if( party_names_cnt >= party_names_cap )
+	{
+		const size_t cap = party_names_cap ? party_names_cap*2 : 256;
+		uint32* tmp = new uint32[cap];
+		if( party_names )
+		{
+			memcpy(tmp, party_names, party_names_cnt*sizeof(uint32));
+			delete[] party_names;
+		}
+		party_names = tmp;
+		party_names_cap = cap;
+	}
+	const size_t k = unsorted ? party_names_cnt : party_name_find(party_get(pid)->party.name);
+	memmove(party_names+k+1, party_names+k, (party_names_cnt-k)*sizeof(uint32));
+	party_names[k] = pid;
+	++party_names_cnt;
+}
+
+static party_res* party_named(const char* name)
+{
+	const size_t k = party_name_find(name);
+	if( k < party_names_cnt )
+	{
+		party_res* r = party_get(party_names[k]);
+		if( 0==strcasecmp(r->party.name, name) )
+			return r;
+	}
+	return NULL;
+}
+
+static void party_del(uint32 pid)
+{
+	size_t k = party_find(pid);
+	if( k < party_cnt && party_tab[k].party.party_id == pid )
+	{
+		// equal names are next to each other, find the own entry
+		size_t i = party_name_find(party_tab[k].party.name);
+		while( i < party_names_cnt && party_names[i] != pid )
+			++i;
+		if( i < party_names_cnt )
+		{
+			--party_names_cnt;
+			memmove(party_names+i, party_names+i+1, (party_names_cnt-i)*sizeof(uint32));
+		}
+		--party_cnt;
+		memmove(party_tab+k, party_tab+k+1, (party_cnt-k)*sizeof(party_res));
+	}
+}
+
+/// note a change of the party, it is written by the next flushParties
+/// after "party_save_delay" seconds
+static void party_touch(party_res& r)
+{
+	if( r.dirty )
+		return;
+	if( party_dirty_cnt >= party_dirty_cap )
+	{
+		const size_t cap = party_dirty_cap ? party_dirty_cap*2 : 64;
+		uint32* tmp = new uint32[cap];
+		if( party_dirty )
+		{
+			memcpy(tmp, party_dirty, party_dirty_cnt*sizeof(uint32));
+			delete[] party_dirty;
+		}
+		party_dirty = tmp;
+		party_dirty_cap = cap;
+	}
+	party_dirty[party_dirty_cnt++] = r.party.party_id;
+	r.dirty = time(NULL);
+}
+
+static inline size_t party_slot(uint32 char_id)
+{
+	return (size_t)(char_id*2654435761u) & (party_chars_cap-1);
+}
+
+static uint32 party_of(uint32 char_id)
+{
+	if( party_chars_cap )
+	{
+		size_t i = party_slot(char_id);
+		for( ; party_chars[i].char_id; i = (i+1) & (party_chars_cap-1))
+		{
+			if( party_chars[i].char_id == char_id )
+				return party_chars[i].party_id;
+		}
+	}
+	return 0;
+}
+
+static void party_index(uint32 char_id, uint32 pid)
+{
+	size_t i;
+	if( !pid )
+	{	// remove and move the following entries of the cluster back
+		if( !party_chars_cap )
+			return;
+		for(i=party_slot(char_id); party_chars[i].char_id && party_chars[i].char_id != char_id; i = (i+1) & (party_chars_cap-1)) ;
+		if( !party_chars[i].char_id )
+			return;
+		size_t j = i;
+		for(;;)
+		{
+			party_chars[i].char_id = 0;
+			size_t home;
+			do
+			{
+				j = (j+1) & (party_chars_cap-1);
+				if( !party_chars[j].char_id )
+				{
+					--party_chars_cnt;
+					return;
+				}
+				home = party_slot(party_chars[j].char_id);
+			} while( (i<=j) ? (i<home && home<=j) : (i<home || home<=j) );
+			party_chars[i] = party_chars[j];
+			i = j;
+		}
+	}
+
+	if( (party_chars_cnt+1)*2 > party_chars_cap )
+	{
+		party_idx* old = party_chars;
+		const size_t oldcap = party_chars_cap;
+		party_chars_cap = oldcap ? oldcap*2 : 4096;
+		party_chars = new party_idx[party_chars_cap];
+		memset(party_chars, 0, party_chars_cap*sizeof(party_idx));
+		party_chars_cnt = 0;
+		if( old )
+		{
+			for(i=0; i<oldcap; ++i)
+				if( old[i].char_id ) party_index(old[i].char_id, old[i].party_id);
+			delete[] old;
+		}
+	}
+	for(i=party_slot(char_id); party_chars[i].char_id && party_chars[i].char_id != char_id; i = (i+1) & (party_chars_cap-1)) ;
+	if( !party_chars[i].char_id )
+		++party_chars_cnt;
+	party_chars[i].char_id  = char_id;
+	party_chars[i].party_id = pid;
+}
+
+/// the first member takes over a party without leader
+static void party_leader(party_res& r)
+{
+	size_t i;
+	for(i=0; i<MAX_PARTY; ++i)
+		if( r.party.member[i].account_id && r.party.member[i].leader )
+			return;
+	for(i=0; i<MAX_PARTY; ++i)
+	{
+		if( r.party.member[i].account_id )
+		{
+			r.party.member[i].leader = 1;
+			party_touch(r);
+			return;
+		}
+	}
+}
+
+static void party_join(party_res& r, uint32 char_id, uint32 account_id, const char* name, ushort lv)
+{
+	size_t i, k = MAX_PARTY;
+	for(i=0; i<MAX_PARTY; ++i)
+	{
+		if( r.char_id[i] == char_id )
+			break;
+		if( !r.char_id[i] && r.party.member[i].account_id == account_id && 0==strcmp(r.party.member[i].name, name) )
+		{	// the founder of a new party
+			r.char_id[i] = char_id;
+			break;
+		}
+		if( k == MAX_PARTY && !r.party.member[i].account_id )
+			k = i;
+	}
+	if( i == MAX_PARTY )
+	{
+		if( k == MAX_PARTY )
+		{
+			ShowWarning("party %u is full, char %u not added\n", (uint)r.party.party_id, (uint)char_id);
+			return;
+		}
+		i = k;
+		r.char_id[i] = char_id;
+		r.party.member[i].leader = 0;
+		r.party.member[i].online = 0;
+		r.party.member[i].mapname[0] = 0;
+	}
+	struct party_member &m = r.party.member[i];
+	m.account_id = account_id;
+	safestrcpy(m.name, sizeof(m.name), name);
+	m.lv = lv;
+	party_index(char_id, r.party.party_id);
+}
+
+static void party_leave(party_res& r, uint32 char_id)
+{
+	size_t i;
+	for(i=0; i<MAX_PARTY; ++i)
+	{
+		if( r.char_id[i] == char_id )
+		{
+			memset(&r.party.member[i], 0, sizeof(r.party.member[i]));
+			r.char_id[i] = 0;
+			party_leader(r);
+			break;
+		}
+	}
+	party_index(char_id, 0);
+}
+
+void CSQLParameter::party_member(uint32 char_id, uint32 party_id, uint32 account_id, const char* name, ushort lv)
+{
+	if( !party_loaded || !char_id )
+		return;
+	CSQLLock lock(party_mutex);
+	const uint32 old = party_of(char_id);
+	party_res* r;
+	if( old && old != party_id && (r = party_get(old)) != NULL )
+		party_leave(*r, char_id);
+	if( party_id && (r = party_get(party_id)) != NULL )
+		party_join(*r, char_id, account_id, name, lv);
+	else if( old )
+		party_index(char_id, 0);
+}
+
 bool CPartyDB_sql::init(const char* configfile)
 {	// init db
 	if(configfile) basics::CParamBase::loadFile(configfile);
+	if( !party_loaded && !this->load() )
+		return false;
+	party_timer = CSQLTimer::add("party flush", &CPartyDB_sql::flush_timer, this, party_save_delay);
 	return true;
 }
-size_t CPartyDB_sql::size() const
+
+bool CPartyDB_sql::close()
 {
-	return this->get_table_size(this->tbl_party);
+	CSQLTimer::remove(this);
+	this->flushParties(true);
+	return true;
 }
 
-CParty& CPartyDB_sql::operator[](size_t i)
-{	// not threadsafe
-	static CParty p;
+void CPartyDB_sql::flush_timer(void* obj)
+{
+	((CPartyDB_sql*)obj)->flushParties();
+}
 
+bool CPartyDB_sql::load()
+{
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	
-	query << "SELECT `party_id` "
+
+	query << "SELECT "
+			 "`party_id`, `name`, `expshare`, `itemshare`, `itemc`, `leader` "
 			 "FROM `" << dbcon1.escaped(this->tbl_party) << "` "
-			 "ORDER BY `party_id`"
-			 "LIMIT "<< i << ",1 ";
+			 "ORDER BY `party_id`";
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+
+	CSQLLock lock(party_mutex);
+	party_cnt = 0;
+	party_names_cnt = 0;
+	party_dirty_cnt = 0;
+	for( ; dbcon1; ++dbcon1)
+	{
+		party_res& r = party_add(atol(dbcon1[0]));
+		safestrcpy(r.party.name, sizeof(r.party.name), dbcon1[1]);
+		r.party.expshare = CSQLValue(dbcon1[2]);
+		r.party.itemshare= CSQLValue(dbcon1[3]);
+		r.party.itemc    = CSQLValue(dbcon1[4]);
+		safestrcpy(r.leader, sizeof(r.leader), dbcon1[5]);
+		party_name_add(r.party.party_id, true);
+	}
+	qsort(party_names, party_names_cnt, sizeof(uint32), party_name_cmp);
 
-	if( !dbcon1.ResultQuery(query) || !searchParty( atol(dbcon1[0]), p) )
-			p.party_id = 0;
-	return p;
+	query.clear();
+	query << "SELECT "
+			 "`char_id`, `party_id`, `account_id`, `name`, `base_level` "
+			 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
+			 "WHERE `party_id` > '0'";
+	if( dbcon1.ResultQuery(query) )
+	{
+		for( ; dbcon1; ++dbcon1)
+		{
+			party_res* r = party_get(atol(dbcon1[1]));
+			if( r )
+				party_join(*r, atol(dbcon1[0]), atol(dbcon1[2]), dbcon1[3], CSQLValue(dbcon1[4]));
+		}
+	}
+
+	size_t k, i;
+	for(k=0; k<party_cnt; ++k)
+	{
+		party_res& r = party_tab[k];
+		for(i=0; i<MAX_PARTY; ++i)
+			r.party.member[i].leader = ( r.party.member[i].account_id && 0==strcmp(r.leader, r.party.member[i].name) );
+		party_leader(r);
+	}
+	party_loaded = true;
+	ShowInfo("loaded %u parties with %u members\n", (uint)party_cnt, (uint)party_chars_cnt);
+	return true;
 }
-bool CPartyDB_sql::searchParty(const char* name, CParty& p)
-{
+
+size_t CPartyDB_sql::flushParties(bool all)
+{	// the lock is held over the commit, so nothing changes the parties
+	// between writing them and taking their marks
+	CSQLLock lock(party_mutex);
+	const time_t now = time(NULL);
+	const time_t delay = (time_t)(uint32)party_save_delay;
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	
-	query << "SELECT `party_id` "
-			 "FROM `" << dbcon1.escaped(this->tbl_party) << "` "
-			 "WHERE `name` = '" << dbcon1.escaped(name) << "'";
+	CSQLBatch batch;
+	size_t k, i, n, cnt=0;
 
-	if( dbcon1.ResultQuery(query) )
+	for(k=0; k<party_dirty_cnt; ++k)
+	{
+		party_res* rp = party_get(party_dirty[k]);
+		if( !rp || !rp->dirty || (!all && now - rp->dirty < delay) )
+			continue;
+		party_res& r = *rp;
+
+		for(i=0; i<MAX_PARTY; ++i)
+			if( r.party.member[i].account_id && r.party.member[i].leader )
+				break;
+		safestrcpy(r.leader, sizeof(r.leader), (i<MAX_PARTY) ? r.party.member[i].name : "");
+
+		query.clear();
+		query << "UPDATE `" << dbcon1.escaped(this->tbl_party) << "` "
+				 "SET "
+				 "`leader` ='"     << dbcon1.escaped(r.leader) << "',"
+				 "`expshare` = '"  << r.party.expshare << "',"
+				 "`itemshare` = '" << r.party.itemshare << "',"
+				 "`itemc` = '"     << r.party.itemc << "' "
+				 "WHERE `party_id` = '" << r.party.party_id << "'";
+		batch.add(this->sqlbase, query);
+		++cnt;
+	}
+	if( cnt && !batch.commit() )
+	{	// the marks stay, the next flush tries again
+		ShowError("party: writing %lu changed parties failed\n", (ulong)cnt);
+		return 0;
+	}
+	// drop the written and the removed parties from the list
+	for(k=0, n=0; k<party_dirty_cnt; ++k)
 	{
-		return searchParty( atol(dbcon1[0]), p);
+		party_res* rp = party_get(party_dirty[k]);
+		if( !rp || !rp->dirty )
+			continue;
+		if( all || now - rp->dirty >= delay )
+			rp->dirty = 0;
+		else
+			party_dirty[n++] = party_dirty[k];
 	}
-	return false;
+	party_dirty_cnt = n;
+	return cnt;
+}
+
+size_t CPartyDB_sql::size() const
+{
+	return party_cnt;
+}
+
+CParty& CPartyDB_sql::operator[](size_t i)
+{	// not threadsafe
+	static CParty p;
+	CSQLLock lock(party_mutex);
+	if( i < party_cnt )
+		p = party_tab[i].party;
+	else
+		p.party_id = 0;
+	return p;
+}
+bool CPartyDB_sql::searchParty(const char* name, CParty& p)
+{	// case insensitive like the column
+	CSQLLock lock(party_mutex);
+	const party_res* r = party_named(name);
+	return r && searchParty(r->party.party_id, p);
 }
 
 
 bool CPartyDB_sql::searchParty(uint32 pid, CParty& p)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
+	CSQLLock lock(party_mutex);
+	const party_res* r = party_get(pid);
 	size_t i;
-	bool found, ret = false;
-	query << "SELECT "
-			 "`party_id`, `name`, `expshare`, `itemshare`, `itemc`, `leader` "
-			 "FROM `" << dbcon1.escaped(this->tbl_party) << "` "
-			 "WHERE `party_id` = '" << pid << "'";
-
-	if( dbcon1.ResultQuery(query) )
-	{
-		p.party_id = atol( dbcon1[0] );
-		safestrcpy(p.name, sizeof(p.name), dbcon1[1]);
-		p.expshare = atol( dbcon1[2] );
-		p.itemshare= atol( dbcon1[3] );
-		p.itemc    = atol( dbcon1[4] );
-		basics::string<> leader = atol( dbcon1[5] );
-
-		query.clear();
-		query << "SELECT "
-				 "`account_id`, `name`, `base_level` "
-				 "FROM `" << dbcon1.escaped(this->tbl_char) << "` "
-				 "WHERE `party_id` = '" << p.party_id << "'";
-		dbcon1.ResultQuery(query);
-
-
-		for(i=0, found=false; dbcon1 && i<MAX_PARTY; ++dbcon1, ++i)
-		{
-			struct party_member &m = p.member[i];
-			m.account_id = atol( dbcon1[0] );
-			safestrcpy(m.name, sizeof(m.name), dbcon1[1]);
-			m.lv = atol( dbcon1[2] );
-
-			found |= m.leader = (leader==m.name);
-		}
-		if(i==0)
-		{	// party is empty but still there
-			this->removeParty(pid);
-		}
-		else
-		{
-			if(!found)
-			{	// first member takes over the party
-				p.member[0].leader=1;
-			}
-			ret = true;
-		}
-		// clear the other members
-		for( ; i<MAX_PARTY; ++i)
-		{
-			struct party_member &m = p.member[i];
-			m.account_id = 0;
-			m.name[0] = 0;
-			m.lv = 0;
-
-			found |= m.leader = (leader==m.name);
-		}
+	if( !r )
+		return false;
+	for(i=0; i<MAX_PARTY; ++i)
+		if( r->party.member[i].account_id )
+			break;
+	if( i == MAX_PARTY )
+	{	// party is empty but still there
+		this->removeParty(pid);
+		return false;
 	}
-	return ret;
+	p = r->party;
+	return true;
 }
 
 bool CPartyDB_sql::insertParty(uint32 accid, const char* nick, const char* mapname, ushort lv, const char* name, CParty& p)
 {	// insert into party values (*party)
+	CSQLLock lock(party_mutex);
 	if( !searchParty(name,p) )
 	{	// not in the database, better create the entry and insert into the database
-		safestrcpy(p.name,sizeof(p.name),name);
-		p.expshare = 0;
-		p.itemshare= 0;
-		p.itemc    = 0;
-		p.member[0].account_id = accid;
-		safestrcpy( p.member[0].name, sizeof(p.member[0].name), nick );
-		safestrcpy( p.member[0].mapname, sizeof(p.member[0].mapname), mapname );
-		p.member[0].leader = 1;
-		p.member[0].online = 1;
-		p.member[0].lv = lv;
-
 		basics::CMySQLConnection dbcon1(this->sqlbase);
 		basics::string<> query;
 
 		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_party) << "` "
 				 "(`name`, `leader`) VALUES "
 				 "('" << dbcon1.escaped(name) << "','" << dbcon1.escaped(nick) << "')";
-		bool ret = dbcon1.PureQuery(query);
+		if( !dbcon1.PureQuery(query) )
+			return false;
 		// now we get the ID from the last inserted INSERT statement 
 		//(returns the last ID for this client, other clients wont affect this)
-		p.party_id = dbcon1.getLastID();
-		return ret;
+		party_res& r = party_add(dbcon1.getLastID());
+		safestrcpy(r.party.name,sizeof(r.party.name),name);
+		safestrcpy(r.leader,sizeof(r.leader),nick);
+		r.party.member[0].account_id = accid;
+		safestrcpy( r.party.member[0].name, sizeof(r.party.member[0].name), nick );
+		safestrcpy( r.party.member[0].mapname, sizeof(r.party.member[0].mapname), mapname );
+		r.party.member[0].leader = 1;
+		r.party.member[0].online = 1;
+		r.party.member[0].lv = lv;
+		party_name_add(r.party.party_id);
+		// the char is indexed with its next save
+		p = r.party;
+		return true;
 	}
 	return false;
 }
@@ -3943,30 +7109,58 @@ bool CPartyDB_sql::removeParty(uint32 pid)
 	query.clear();
 	query << "DELETE FROM `" << dbcon1.escaped(this->tbl_party) << "` "
 			 "WHERE `party_id` = '" << pid << "'";
-	return dbcon1.PureQuery(query);
+	if( !dbcon1.PureQuery(query) )
+		return false;
+
+	CSQLLock lock(party_mutex);
+	const party_res* r = party_get(pid);
+	if( r )
+	{
+		size_t i;
+		for(i=0; i<MAX_PARTY; ++i)
+			if( r->char_id[i] ) party_index(r->char_id[i], 0);
+		party_del(pid);
+	}
+	return true;
 }
 
 bool CPartyDB_sql::saveParty(const CParty& p)
 {
-	size_t i;
-	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
-
-	// check for existing leader, or just set one
-	for(i=0; i<MAX_PARTY; ++i)
-		if(p.member[i].leader)
-			break;
-	if(i>=MAX_PARTY)
-		i=0;
-
-	query << "UPDATE `" << dbcon1.escaped(this->tbl_party) << "` "
-			 "SET "
-			 "`leader` ='"     << dbcon1.escaped(p.member[i].name) << "',"
-			 "`expshare` = '"  << p.expshare << "',"
-			 "`itemshare` = '" << p.itemshare << "',"
-			 "`itemc` = '"     << p.itemc << "' "
-			 "WHERE `party_id` = '" << p.party_id << "'";
-	dbcon1.PureQuery(query);
+	CSQLLock lock(party_mutex);
+	party_res* r = party_get(p.party_id);
+	size_t i, k;
+	if( !r )
+		return false;
+
+	bool changed = ( r->party.expshare != p.expshare || r->party.itemshare != p.itemshare || r->party.itemc != p.itemc );
+	r->party.expshare = p.expshare;
+	r->party.itemshare= p.itemshare;
+	r->party.itemc    = p.itemc;
+	// the members are kept, take their state from the map server
+	for(k=0; k<MAX_PARTY; ++k)
+	{
+		struct party_member &m = r->party.member[k];
+		if( !m.account_id )
+			continue;
+		for(i=0; i<MAX_PARTY; ++i)
+		{
+			const struct party_member &n = p.member[i];
+			if( n.account_id == m.account_id && 0==strcmp(n.name, m.name) )
+			{
+				changed |= ( (m.leader!=0) != (n.leader!=0) );
+				m.leader = n.leader;
+				m.online = n.online;
+				safestrcpy(m.mapname, sizeof(m.mapname), n.mapname);
+				if( n.lv ) m.lv = n.lv;
+				break;
+			}
+		}
+	}
+	party_leader(*r);
+	if( changed )
+		party_touch(*r);
+	if( !party_timer )
+		this->flushParties();
 	return true;
 }
 
@@ -4008,46 +7202,19 @@ CPCStorage& CPCStorageDB_sql::operator[](size_t i)
 
 bool CPCStorageDB_sql::searchStorage(uint32 accid, CPCStorage& stor)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
-	size_t i;
+	if( !journal_settle() )
+	{
+		ShowWarning("storage %lu not loaded, saves are pending in the journal\n", (ulong)accid);
+		return false;
+	}
+	basics::CMySQLConnection dbcon1(this->readbase(SQL_ENTITY_STORAGE, accid));
+	CItemList<MAX_STORAGE> list;
 
-	query << "SELECT "
-			 "`nameid`, `amount`, `equip`, `identify`, "
-			 "`refine`, `attribute`, `card0`, `card1`, `card2`, `card3` "
-			 "FROM `" << dbcon1.escaped(this->tbl_storage) << "` "
-			 "WHERE `account_id` = '" << accid << "'";
-	if( dbcon1.ResultQuery(query) )
+	if( this->load_items(dbcon1, this->tbl_storage, "account_id", accid, list) )
 	{
 		stor.account_id = accid;
-
-		for(i=0; dbcon1 && i<MAX_STORAGE; ++dbcon1, ++i)
-		{
-			stor.storage[i].nameid		= atol( dbcon1[0] );
-			stor.storage[i].amount		= atol( dbcon1[1] );
-			stor.storage[i].equip		= atol( dbcon1[2] );
-			stor.storage[i].identify	= atol( dbcon1[3] );
-			stor.storage[i].refine		= atol( dbcon1[4] );
-			stor.storage[i].attribute	= atol( dbcon1[5] );
-			stor.storage[i].card[0]		= atol( dbcon1[6] );
-			stor.storage[i].card[1]		= atol( dbcon1[7] );
-			stor.storage[i].card[2]		= atol( dbcon1[8] );
-			stor.storage[i].card[3]		= atol( dbcon1[9] );
-		}
-		stor.storage_amount = i;
-		for( ; i<MAX_STORAGE; ++i)
-		{
-			stor.storage[i].nameid		= 0;
-			stor.storage[i].amount		= 0;
-			stor.storage[i].equip		= 0;
-			stor.storage[i].identify	= 0;
-			stor.storage[i].refine		= 0;
-			stor.storage[i].attribute	= 0;
-			stor.storage[i].card[0]		= 0;
-			stor.storage[i].card[1]		= 0;
-			stor.storage[i].card[2]		= 0;
-			stor.storage[i].card[3]		= 0;
-		}
+		stor.storage_amount = list.count;
+		list.scatter(stor.storage);
 		return true;
 	}
 	return false;
@@ -4057,47 +7224,36 @@ bool CPCStorageDB_sql::removeStorage(uint32 accid)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	CSQLBatch batch;
+	const size_t rows = this->counting_rows(this->tbl_storage) ? this->owner_rows(dbcon1, this->tbl_storage, "account_id", accid) : 0;
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_storage) << "` "
 			 "WHERE `account_id`='" << accid << "'";
-	return dbcon1.PureQuery( query );
+	batch.add(this->sqlbase, query);
+	this->written(SQL_ENTITY_STORAGE, accid);
+	if( !batch.commit() )
+		return false;
+	this->count_rows(this->tbl_storage, -(int)rows);
+	return true;
 }
 
 bool CPCStorageDB_sql::saveStorage(const CPCStorage& stor)
 {
-	this->removeStorage(stor.account_id);
-
 	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
-	size_t i, doit;
-
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_storage) << "`"
-			 "(`account_id`, `nameid`, `amount`, `equip`, `identify`, "
-			 "`refine`, `attribute`, `card0`, `card1`, `card2`, `card3`) VALUES ";
-
-	for(i=0,doit=0; i<MAX_STORAGE; ++i)
-	{
-		if(stor.storage[i].nameid>0)
-		{
-			query << (doit?",":"") <<
-				"("
-				"'" <<	stor.account_id				<< "',"
-				"'" <<	stor.storage[i].nameid		<< "',"
-				"'" <<	stor.storage[i].amount		<< "',"
-				"'" <<	stor.storage[i].equip		<< "',"
-				"'" <<	stor.storage[i].identify	<< "',"
-				"'" <<	stor.storage[i].refine		<< "',"
-				"'" <<	stor.storage[i].attribute	<< "',"
-				"'" <<	stor.storage[i].card[0]		<< "',"
-				"'" <<	stor.storage[i].card[1]		<< "',"
-				"'" <<	stor.storage[i].card[2]		<< "',"
-				"'" <<	stor.storage[i].card[3]		<< "'"
-				")";
-			++doit;
-		}
-	}
-	if(doit) dbcon1.PureQuery(query);
-	return true;
+	CItemList<MAX_STORAGE> list;
+
+	CSQLBatch batch;
+
+	list.assign(stor.storage);
+	// the counter counts item rows, the rows of empty slots get deleted
+	const bool counting = this->counting_rows(this->tbl_storage);
+	const size_t rows = counting ? this->owner_rows(dbcon1, this->tbl_storage, "account_id", stor.account_id) : 0;
+	this->save_items(batch, this->sqlbase, dbcon1, this->tbl_storage, "account_id", stor.account_id, list);
+	const bool ret = batch.commit();
+	this->written(SQL_ENTITY_STORAGE, stor.account_id);
+	if( ret && counting )
+		this->count_rows(this->tbl_storage, (int)list.count - (int)rows);
+	return ret;
 }
 
 ///////////
@@ -4137,46 +7293,18 @@ CGuildStorage& CGuildStorageDB_sql::operator[](size_t i)
 
 bool CGuildStorageDB_sql::searchStorage(uint32 gid, CGuildStorage& stor)
 {
-	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
-	size_t i;
-
-	query << "SELECT "
-			 "`nameid`, `amount`, `equip`, `identify`, "
-			 "`refine`, `attribute`, `card0`, `card1`, `card2`, `card3` "
-			 "FROM `" << dbcon1.escaped(this->tbl_guild_storage) << "` "
-			 "WHERE `guild_id` = '" << gid << "'";
+	if( !journal_settle() )
+	{
+		ShowWarning("guild storage %lu not loaded, saves are pending in the journal\n", (ulong)gid);
+		return false;
+	}
+	basics::CMySQLConnection dbcon1(this->readbase(SQL_ENTITY_GUILDSTORAGE, gid));
+	CItemList<MAX_GUILD_STORAGE> list;
 
-	if( dbcon1.ResultQuery(query) )
+	if( this->load_items(dbcon1, this->tbl_guild_storage, "guild_id", gid, list) )
 	{
 		stor.guild_id = gid;
-
-		for(i=0; dbcon1 && i<MAX_GUILD_STORAGE; ++dbcon1, ++i)
-		{
-			stor.storage[i].nameid		= atol( dbcon1[0] );
-			stor.storage[i].amount		= atol( dbcon1[1] );
-			stor.storage[i].equip		= atol( dbcon1[2] );
-			stor.storage[i].identify	= atol( dbcon1[3] );
-			stor.storage[i].refine		= atol( dbcon1[4] );
-			stor.storage[i].attribute	= atol( dbcon1[5] );
-			stor.storage[i].card[0]		= atol( dbcon1[6] );
-			stor.storage[i].card[1]		= atol( dbcon1[7] );
-			stor.storage[i].card[2]		= atol( dbcon1[8] );
-			stor.storage[i].card[3]		= atol( dbcon1[9] );
-		}
-		for( ; i<MAX_GUILD_STORAGE; ++i)
-		{
-			stor.storage[i].nameid		= 0;
-			stor.storage[i].amount		= 0;
-			stor.storage[i].equip		= 0;
-			stor.storage[i].identify	= 0;
-			stor.storage[i].refine		= 0;
-			stor.storage[i].attribute	= 0;
-			stor.storage[i].card[0]		= 0;
-			stor.storage[i].card[1]		= 0;
-			stor.storage[i].card[2]		= 0;
-			stor.storage[i].card[3]		= 0;
-		}
+		list.scatter(stor.storage);
 		return true;
 	}
 	return false;
@@ -4185,51 +7313,61 @@ bool CGuildStorageDB_sql::removeStorage(uint32 gid)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
+	CSQLBatch batch;
+	const size_t rows = this->counting_rows(this->tbl_guild_storage) ? this->owner_rows(dbcon1, this->tbl_guild_storage, "guild_id", gid) : 0;
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_guild_storage) << "` "
 			 "WHERE `guild_id`='" << gid << "'";
-	return dbcon1.PureQuery( query );
+	batch.add(this->sqlbase, query);
+	this->written(SQL_ENTITY_GUILDSTORAGE, gid);
+	if( !batch.commit() )
+		return false;
+	this->count_rows(this->tbl_guild_storage, -(int)rows);
+	return true;
 }
 bool CGuildStorageDB_sql::saveStorage(const CGuildStorage& stor)
 {
-	this->removeStorage(stor.guild_id);
-
 	basics::CMySQLConnection dbcon1(this->sqlbase);
-	basics::string<> query;
-	size_t i, doit;
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_guild_storage) << "`"
-			 "(`guild_id`, `nameid`, `amount`, `equip`, `identify`, "
-			 "`refine`, `attribute`, `card0`, `card1`, `card2`, `card3`) VALUES ";
-
-	for(i=0,doit=0; i<MAX_STORAGE; ++i)
-	{
-		if(stor.storage[i].nameid>0)
-		{
-			query << (doit?",":"") <<
-				"("
-				"'" <<	stor.guild_id				<< "',"
-				"'" <<	stor.storage[i].nameid		<< "',"
-				"'" <<	stor.storage[i].amount		<< "',"
-				"'" <<	stor.storage[i].equip		<< "',"
-				"'" <<	stor.storage[i].identify	<< "',"
-				"'" <<	stor.storage[i].refine		<< "',"
-				"'" <<	stor.storage[i].attribute	<< "',"
-				"'" <<	stor.storage[i].card[0]		<< "',"
-				"'" <<	stor.storage[i].card[1]		<< "',"
-				"'" <<	stor.storage[i].card[2]		<< "',"
-				"'" <<	stor.storage[i].card[3]		<< "'"
-				")";
-			++doit;
-		}
-	}
-	if(doit) dbcon1.PureQuery(query);
-	return true;
+	CItemList<MAX_GUILD_STORAGE> list;
+
+	CSQLBatch batch;
+
+	list.assign(stor.storage);
+	// the counter counts item rows, the rows of empty slots get deleted
+	const bool counting = this->counting_rows(this->tbl_guild_storage);
+	const size_t rows = counting ? this->owner_rows(dbcon1, this->tbl_guild_storage, "guild_id", stor.guild_id) : 0;
+	this->save_items(batch, this->sqlbase, dbcon1, this->tbl_guild_storage, "guild_id", stor.guild_id, list);
+	const bool ret = batch.commit();
+	this->written(SQL_ENTITY_GUILDSTORAGE, stor.guild_id);
+	if( ret && counting )
+		this->count_rows(this->tbl_guild_storage, (int)list.count - (int)rows);
+	return ret;
 }
 
 
 ////////
 // Pets
 ////
+///////////////////////////////////////////////////////////////////////////////
+/// pet columns.
+/// pet_id has to stay first, it is skipped on insert and update.
+/// the account_id is not stored with the pet, it is joined from the char
+static const CSQLColumn<CPet> pet_column_list[] =
+{
+	CSQLColumn<CPet>("pet_id",		&CPet::pet_id),
+	CSQLColumn<CPet>("char_id",		&CPet::char_id),
+	CSQLColumn<CPet>("class",		&CPet::class_),
+	CSQLColumn<CPet>("level",		&CPet::level),
+	CSQLColumn<CPet>("egg_id",		&CPet::egg_id),
+	CSQLColumn<CPet>("equip_id",	&CPet::equip_id),
+	CSQLColumn<CPet>("intimate",	&CPet::intimate),
+	CSQLColumn<CPet>("hungry",		&CPet::hungry),
+	CSQLColumn<CPet>("name",		&CPet::name),
+	CSQLColumn<CPet>("rename_flag",	&CPet::rename_flag),
+	CSQLColumn<CPet>("incuvate",	&CPet::incuvate),
+};
+static const CSQLColumnMap<CPet> pet_columns(pet_column_list);
+
 bool CPetDB_sql::init(const char *dbcfgfile)
 {
 	if(dbcfgfile) basics::CParamBase::loadFile(dbcfgfile);
@@ -4246,29 +7384,18 @@ CPet& CPetDB_sql::operator[](size_t i)
 	static CPet pet;
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	query << "SELECT "
-			 "`p`.`pet_id`,`c`.`account_id`,`p`.`char_id`,`p`.`class`,`p`.`level`,"
-			 "`p`.`egg_id`,`p`.`equip_id`,`p`.`intimate`,`p`.`hungry`,`p`.`name`,"
-			 "`p`.`rename_flag`,`p`.`incuvate` "
+	query << "SELECT ";
+	pet_columns.names(query, 0, "p");
+	query << ",`c`.`account_id` "
 			 "FROM `" << dbcon1.escaped(this->tbl_pet) << "` `p`"
 			 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `p`.`char_id`=`c`.`char_id` "
 			 "ORDER BY `pet_id`"
 			 "LIMIT "<< i << ",1 ";
 
-	if( dbcon1.ResultQuery(query) )
+	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
-		pet.pet_id = atoi(dbcon1[0]);
-		pet.account_id = atoi(dbcon1[1]);
-		pet.char_id = atoi(dbcon1[2]);
-		pet.class_ = atoi(dbcon1[3]);
-		pet.level = atoi(dbcon1[4]);
-		pet.egg_id = atoi(dbcon1[5]);
-		pet.equip_id = atoi(dbcon1[6]);
-		pet.intimate = atoi(dbcon1[7]);
-		pet.hungry = atoi(dbcon1[8]);
-		safestrcpy(pet.name, sizeof(pet.name), dbcon1[9]);
-		pet.rename_flag = atoi(dbcon1[10]);
-		pet.incuvate = atoi(dbcon1[11]);
+		pet_columns.decode(dbcon1, pet);
+		pet.account_id = CSQLValue(dbcon1[pet_columns.size()]);
 	}
 	else
 	{
@@ -4282,27 +7409,16 @@ bool CPetDB_sql::searchPet(uint32 pid, CPet& pet)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	query << "SELECT "
-			 "`p`.`pet_id`,`c`.`account_id`,`p`.`char_id`,`p`.`class`,`p`.`level`,"
-			 "`p`.`egg_id`,`p`.`equip_id`,`p`.`intimate`,`p`.`hungry`,`p`.`name`,"
-			 "`p`.`rename_flag`,`p`.`incuvate` "
+	query << "SELECT ";
+	pet_columns.names(query, 0, "p");
+	query << ",`c`.`account_id` "
 			 "FROM `" << dbcon1.escaped(this->tbl_pet) << "` `p` "
 			 "JOIN `" << dbcon1.escaped(this->tbl_char) << "` `c` ON `p`.`char_id`=`c`.`char_id` "
 			 "WHERE `p`.`pet_id` = '" << pid << "'";
-	if( dbcon1.ResultQuery(query) )
+	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
-		pet.pet_id = atoi(dbcon1[0]);
-		pet.account_id = atoi(dbcon1[1]);
-		pet.char_id = atoi(dbcon1[2]);
-		pet.class_ = atoi(dbcon1[3]);
-		pet.level = atoi(dbcon1[4]);
-		pet.egg_id = atoi(dbcon1[5]);
-		pet.equip_id = atoi(dbcon1[6]);
-		pet.intimate = atoi(dbcon1[7]);
-		pet.hungry = atoi(dbcon1[8]);
-		safestrcpy(pet.name, sizeof(pet.name), dbcon1[9]);
-		pet.rename_flag = atoi(dbcon1[10]);
-		pet.incuvate = atoi(dbcon1[11]);
+		pet_columns.decode(dbcon1, pet);
+		pet.account_id = CSQLValue(dbcon1[pet_columns.size()]);
 		return true;
 	}
 	return false;
@@ -4313,48 +7429,30 @@ bool CPetDB_sql::insertPet(uint32 accid, uint32 cid, short pet_class, short pet_
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
+	pd.pet_id = 0;
+	pd.account_id = accid;
+	pd.char_id = cid;
+	pd.class_ = pet_class;
+	pd.level = pet_lv;
+	pd.egg_id = pet_egg_id;
+	pd.equip_id = pet_equip;
+	pd.intimate = intimate;
+	pd.hungry = hungry;
+	safestrcpy(pd.name, sizeof(pd.name), pet_name);
+	pd.rename_flag = renameflag;
+	pd.incuvate = incuvat;
 
 	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_pet) << "` "
-			 "("
-			 "`char_id`,"
-			 "`class`,"
-			 "`level`,"
-			 "`egg_id`,"
-			 "`equip_id`,"
-			 "`intimate`,"
-			 "`hungry`,"
-			 "`name`,"
-			 "`rename_flag`,"
-			 "`incuvate`"
-			 ") "
-			 "VALUES "
-			 "(" 
-			 "'" << cid << "',"
-			 "'" << pet_class << "',"
-			 "'" << pet_lv << "',"
-			 "'" << pet_egg_id << "',"
-			 "'" << pet_equip << "',"
-			 "'" << intimate << "',"
-			 "'" << hungry << "',"
-			 "'" << dbcon1.escaped(pet_name) << "',"
-			 "'" << ((int)renameflag) << "',"
-			 "'" << ((int)incuvat) << "'"
-			 ")";
+			 "(";
+	pet_columns.names(query, 1);
+	query << ") "
+			 "VALUES ";
+	pet_columns.values(query, dbcon1, pd, 1);
 
 	if( dbcon1.PureQuery(query) )
 	{
 		pd.pet_id = dbcon1.getLastID();
-		pd.account_id = accid;
-		pd.char_id = cid;
-		pd.class_ = pet_class;
-		pd.level = pet_lv;
-		pd.egg_id = pet_egg_id;
-		pd.equip_id = pet_equip;
-		pd.intimate = intimate;
-		pd.hungry = hungry;
-		safestrcpy(pd.name, sizeof(pd.name), pet_name);
-		pd.rename_flag = renameflag;
-		pd.incuvate = incuvat;
+		this->count_rows(this->tbl_pet, +1);
 		return true;
 	}
 	return false;
@@ -4368,7 +7466,10 @@ bool CPetDB_sql::removePet(uint32 pid)
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_pet) << "` "
 			 "WHERE `pet_id` = '" << pid <<"'";
-	return dbcon1.PureQuery( query );
+	if( !dbcon1.PureQuery( query ) )
+		return false;
+	this->count_rows(this->tbl_pet, -1);
+	return true;
 }
 
 bool CPetDB_sql::savePet(const CPet& pet)
@@ -4377,17 +7478,9 @@ bool CPetDB_sql::savePet(const CPet& pet)
 	basics::string<> query;
 
 	query << "UPDATE `" << dbcon1.escaped(this->tbl_pet) << "` "
-			 "SET "
-			 "`char_id` = '" << pet.char_id << "',"
-			 "`class` = '" << pet.class_ << "',"
-			 "`level` = '" << pet.level << "',"
-			 "`egg_id` = '" << pet.egg_id << "',"
-			 "`equip_id` = '" << pet.equip_id << "',"
-			 "`intimate` = '" << pet.intimate << "',"
-			 "`hungry` = '" << pet.hungry << "',"
-			 "`name` = '" << dbcon1.escaped(pet.name) << "',"
-			 "`rename_flag` = '" << pet.rename_flag << "',"
-			 "`incuvate` = '" << pet.incuvate << "'"
+			 "SET ";
+	pet_columns.update(query, dbcon1, pet, 1);
+	query << " "
 			 "WHERE `pet_id` = '" << pet.pet_id << "'";
 	
 	return dbcon1.PureQuery( query );
@@ -4399,6 +7492,40 @@ bool CPetDB_sql::savePet(const CPet& pet)
 ////////
 // Homunculus
 ////
+///////////////////////////////////////////////////////////////////////////////
+/// homunculus columns.
+/// homun_id has to stay first, it is skipped on insert
+static const CSQLColumn<CHomunculus> homunculus_columns[] =
+{
+	CSQLColumn<CHomunculus>("homun_id",		&CHomunculus::homun_id),
+	CSQLColumn<CHomunculus>("account_id",	&CHomunculus::account_id),
+	CSQLColumn<CHomunculus>("char_id",		&CHomunculus::char_id),
+	CSQLColumn<CHomunculus>("base_exp",		&CHomunculus::base_exp),
+	CSQLColumn<CHomunculus>("name",			&CHomunculus::name),
+	CSQLColumn<CHomunculus>("hp",			&CHomunculus::hp),
+	CSQLColumn<CHomunculus>("max_hp",		&CHomunculus::max_hp),
+	CSQLColumn<CHomunculus>("sp",			&CHomunculus::sp),
+	CSQLColumn<CHomunculus>("max_sp",		&CHomunculus::max_sp),
+	CSQLColumn<CHomunculus>("class",		&CHomunculus::class_),
+	CSQLColumn<CHomunculus>("status_point",	&CHomunculus::status_point),
+	CSQLColumn<CHomunculus>("skill_point",	&CHomunculus::skill_point),
+	CSQLColumn<CHomunculus>("str",			&CHomunculus::str),
+	CSQLColumn<CHomunculus>("agi",			&CHomunculus::agi),
+	CSQLColumn<CHomunculus>("vit",			&CHomunculus::vit),
+	CSQLColumn<CHomunculus>("int",			&CHomunculus::int_),
+	CSQLColumn<CHomunculus>("dex",			&CHomunculus::dex),
+	CSQLColumn<CHomunculus>("luk",			&CHomunculus::luk),
+	CSQLColumn<CHomunculus>("option",		&CHomunculus::option),
+	CSQLColumn<CHomunculus>("equip",		&CHomunculus::equip),
+	CSQLColumn<CHomunculus>("intimate",		&CHomunculus::intimate),
+	CSQLColumn<CHomunculus>("hungry",		&CHomunculus::hungry),
+	CSQLColumn<CHomunculus>("base_level",	&CHomunculus::base_level),
+	CSQLColumn<CHomunculus>("rename_flag",	&CHomunculus::rename_flag),
+	CSQLColumn<CHomunculus>("incubate",		&CHomunculus::incubate),
+};
+const CSQLColumnMap<CHomunculus> CHomunculusDB_sql::columns(homunculus_columns);
+
+
 bool CHomunculusDB_sql::init(const char *dbcfgfile)
 {
 	if(dbcfgfile) basics::CParamBase::loadFile(dbcfgfile);
@@ -4415,84 +7542,20 @@ CHomunculus& CHomunculusDB_sql::operator[](size_t i)
 	static CHomunculus hom;
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	query << "SELECT "
-			 "`homun_id`,"
-			 "`account_id`,"
-			 "`char_id`,"
-			 "`base_exp`,"
-			 "`name`,"
-			 "`hp`,"
-			 "`max_hp`,"
-			 "`sp`,"
-			 "`max_sp`,"
-			 "`class`,"
-			 "`status_point`,"
-			 "`skill_point`,"
-			 "`str`,"
-			 "`agi`,"
-			 "`vit`,"
-			 "`int`,"
-			 "`dex`,"
-			 "`luk`,"
-			 "`option`,"
-			 "`equip`,"
-			 "`intimate`,"
-			 "`hungry`,"
-			 "`base_level`,"
-			 "`rename_flag`,"
-			 "`incubate` "
+	query << "SELECT ";
+	this->columns.names(query);
+	query << " "
 			 "FROM `" << dbcon1.escaped(this->tbl_homunculus) << "` "
 			 "ORDER BY `homun_id`"
 			 "LIMIT "<< i << ",1 ";
-	if( dbcon1.ResultQuery(query) )
+	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
-		hom.homun_id		= atoi(dbcon1[ 0]);
-		hom.account_id		= atoi(dbcon1[ 1]);
-		hom.char_id			= atoi(dbcon1[ 2]);
-		hom.base_exp		= atoi(dbcon1[ 3]);
-		safestrcpy(hom.name, sizeof(hom.name), dbcon1[ 4]);
-		hom.hp				= atoi(dbcon1[ 5]);
-		hom.max_hp			= atoi(dbcon1[ 6]);
-		hom.sp				= atoi(dbcon1[ 7]);
-		hom.max_sp			= atoi(dbcon1[ 8]);
-		hom.class_			= atoi(dbcon1[ 9]);
-		hom.status_point	= atoi(dbcon1[10]);
-		hom.skill_point		= atoi(dbcon1[11]);
-		hom.str				= atoi(dbcon1[12]);
-		hom.agi				= atoi(dbcon1[13]);
-		hom.vit				= atoi(dbcon1[14]);
-		hom.int_			= atoi(dbcon1[15]);
-		hom.dex				= atoi(dbcon1[16]);
-		hom.luk				= atoi(dbcon1[17]);
-		hom.option			= atoi(dbcon1[18]);
-		hom.equip			= atoi(dbcon1[19]);
-		hom.intimate		= atoi(dbcon1[20]);
-		hom.hungry			= atoi(dbcon1[21]);
-		hom.base_level		= atoi(dbcon1[22]);
-		hom.rename_flag		= atoi(dbcon1[23]);
-		hom.incubate		= atoi(dbcon1[24]);
-		
-
-		///////////////////////////////////////////////////////////////////////
-		// Get the skills
-		query.clear();
-		query << "SELECT "
-				 "`id`, `lv` "
-				 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "WHERE `homun_id` = " << hom.homun_id;
-		dbcon1.ResultQuery(query);
-		size_t i;
-		for(i=0; i<MAX_HOMSKILL; ++i)
-		{
-			hom.skill[i].id = i+HOM_SKILLID;
-			hom.skill[i].lv = 0;
-		}
-		for( ; dbcon1; ++dbcon1)
-		{
-			i = atol(dbcon1[0])-HOM_SKILLID;
-			if(i<MAX_HOMSKILL)
-				hom.skill[i].lv = atol(dbcon1[1]);
-		}
+		this->columns.decode(dbcon1, hom);
+		this->loadSkills(dbcon1, hom);
+	}
+	else
+	{
+		hom.homun_id = 0;
 	}
 	return hom;
 }
@@ -4501,86 +7564,74 @@ bool CHomunculusDB_sql::searchHomunculus(uint32 hid, CHomunculus& hom)
 {
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	query << "SELECT "
-			 "`homun_id`,"
-			 "`account_id`,"
-			 "`char_id`,"
-			 "`base_exp`,"
-			 "`name`,"
-			 "`hp`,"
-			 "`max_hp`,"
-			 "`sp`,"
-			 "`max_sp`,"
-			 "`class`,"
-			 "`status_point`,"
-			 "`skill_point`,"
-			 "`str`,"
-			 "`agi`,"
-			 "`vit`,"
-			 "`int`,"
-			 "`dex`,"
-			 "`luk`,"
-			 "`option`,"
-			 "`equip`,"
-			 "`intimate`,"
-			 "`hungry`,"
-			 "`base_level`,"
-			 "`rename_flag`,"
-			 "`incubate` "
+	query << "SELECT ";
+	this->columns.names(query);
+	query << " "
 			 "FROM `" << dbcon1.escaped(this->tbl_homunculus) << "` "
 			 "WHERE `homun_id` = '" << hid << "'";
-	if( dbcon1.ResultQuery(query) )
+	if( dbcon1.ResultQuery(query) && dbcon1 )
 	{
-		hom.homun_id		= atoi(dbcon1[ 0]);
-		hom.account_id		= atoi(dbcon1[ 1]);
-		hom.char_id			= atoi(dbcon1[ 2]);
-		hom.base_exp		= atoi(dbcon1[ 3]);
-		safestrcpy(hom.name, sizeof(hom.name), dbcon1[ 4]);
-		hom.hp				= atoi(dbcon1[ 5]);
-		hom.max_hp			= atoi(dbcon1[ 6]);
-		hom.sp				= atoi(dbcon1[ 7]);
-		hom.max_sp			= atoi(dbcon1[ 8]);
-		hom.class_			= atoi(dbcon1[ 9]);
-		hom.status_point	= atoi(dbcon1[10]);
-		hom.skill_point		= atoi(dbcon1[11]);
-		hom.str				= atoi(dbcon1[12]);
-		hom.agi				= atoi(dbcon1[13]);
-		hom.vit				= atoi(dbcon1[14]);
-		hom.int_			= atoi(dbcon1[15]);
-		hom.dex				= atoi(dbcon1[16]);
-		hom.luk				= atoi(dbcon1[17]);
-		hom.option			= atoi(dbcon1[18]);
-		hom.equip			= atoi(dbcon1[19]);
-		hom.intimate		= atoi(dbcon1[20]);
-		hom.hungry			= atoi(dbcon1[21]);
-		hom.base_level		= atoi(dbcon1[22]);
-		hom.rename_flag		= atoi(dbcon1[23]);
-		hom.incubate		= atoi(dbcon1[24]);
-		
+		this->columns.decode(dbcon1, hom);
+		this->loadSkills(dbcon1, hom);
+		return true;
+	}
+	return false;
+}
 
-		///////////////////////////////////////////////////////////////////////
-		// Get the skills
-		query.clear();
-		query << "SELECT "
-				 "`id`, `lv` "
-				 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "WHERE `homun_id` = " << hom.homun_id;
-		dbcon1.ResultQuery(query);
-		size_t i;
-		for(i=0; i<MAX_HOMSKILL; ++i)
-		{
-			hom.skill[i].id = i+HOM_SKILLID;
-			hom.skill[i].lv = 0;
-		}
-		for( ; dbcon1; ++dbcon1)
+bool CHomunculusDB_sql::loadSkills(basics::CMySQLConnection& dbcon1, CHomunculus& hom)
+{
+	basics::string<> query;
+	query << "SELECT "
+			 "`id`, `lv` "
+			 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
+			 "WHERE `homun_id` = '" << hom.homun_id << "'";
+	size_t i;
+	for(i=0; i<MAX_HOMSKILL; ++i)
+	{
+		hom.skill[i].id = i+HOM_SKILLID;
+		hom.skill[i].lv = 0;
+	}
+	if( !dbcon1.ResultQuery(query) )
+		return false;
+	for( ; dbcon1; ++dbcon1)
+	{
+		i = atol(dbcon1[0])-HOM_SKILLID;
+		if(i<MAX_HOMSKILL)
+			hom.skill[i].lv = CSQLValue(dbcon1[1]);
+	}
+	return true;
+}
+
+bool CHomunculusDB_sql::saveSkills(basics::CMySQLConnection& dbcon1, const CHomunculus& hom)
+{
+	basics::string<> query, keys;
+	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_homunskill) << "` "
+			 "(`homun_id`,`id`,`lv`) VALUES ";
+
+	size_t i, doit;
+	for(i=0,doit=0; i<MAX_HOMSKILL; ++i)
+	{
+		if(hom.skill[i].lv>0)
 		{
-			i = atol(dbcon1[0])-HOM_SKILLID;
-			if(i<MAX_HOMSKILL)
-				hom.skill[i].lv = atol(dbcon1[1]);
+			query << (doit?",":"") <<
+				"("
+				"'" << hom.homun_id		<< "',"
+				"'" << hom.skill[i].id	<< "',"
+				"'" << hom.skill[i].lv	<< "'"
+				")";
+			keys << (doit?",":"") << "'" << hom.skill[i].id << "'";
+			++doit;
 		}
-		return true;
 	}
-	return false;
+	query << " ON DUPLICATE KEY UPDATE `lv`=VALUES(`lv`)";
+	bool ret = !doit || dbcon1.PureQuery(query);
+
+	query.clear();
+	query << "DELETE "
+			 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
+			 "WHERE `homun_id` = '" << hom.homun_id <<"'";
+	if(doit) query << " AND `id` NOT IN (" << keys << ")";
+	return dbcon1.PureQuery(query) && ret;
 }
 
 bool CHomunculusDB_sql::insertHomunculus(CHomunculus& hom)
@@ -4589,88 +7640,16 @@ bool CHomunculusDB_sql::insertHomunculus(CHomunculus& hom)
 	basics::string<> query;
 
 	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_homunculus) << "` "
-			 "("
-			 "`account_id`,"
-			 "`char_id`,"
-			 "`base_exp`,"
-			 "`name`,"
-			 "`hp`,"
-			 "`max_hp`,"
-			 "`sp`,"
-			 "`max_sp`,"
-			 "`class`,"
-			 "`status_point`,"
-			 "`skill_point`,"
-			 "`str`,"
-			 "`agi`,"
-			 "`vit`,"
-			 "`int`,"
-			 "`dex`,"
-			 "`luk`,"
-			 "`option`,"
-			 "`equip`,"
-			 "`intimate`,"
-			 "`hungry`,"
-			 "`base_level`,"
-			 "`rename_flag`,"
-			 "`incubate`"
-			 ") "
-			 "VALUES "
-			 "(" 
-			 "'" << hom.account_id << "',"
-			 "'" << hom.char_id << "',"
-			 "'" << hom.base_exp << "',"
-			 "'" << dbcon1.escaped(hom.name) << "',"
-			 "'" << hom.hp << "',"
-			 "'" << hom.max_hp << "',"
-			 "'" << hom.sp << "',"
-			 "'" << hom.max_sp << "',"
-			 "'" << hom.class_ << "',"
-			 "'" << hom.status_point << "',"
-			 "'" << hom.skill_point << "',"
-			 "'" << hom.str << "',"
-			 "'" << hom.agi << "',"
-			 "'" << hom.vit << "',"
-			 "'" << hom.int_ << "',"
-			 "'" << hom.dex << "',"
-			 "'" << hom.luk << "',"
-			 "'" << hom.option << "',"
-			 "'" << hom.equip << "',"
-			 "'" << hom.intimate << "',"
-			 "'" << hom.hungry << "',"
-			 "'" << hom.base_level << "',"			 
-			 "'" << ((int)hom.rename_flag) << "',"
-			 "'" << ((int)hom.incubate) << "'"
-			 ")";
+			 "(";
+	this->columns.names(query, 1);
+	query << ") "
+			 "VALUES ";
+	this->columns.values(query, dbcon1, hom, 1);
 	if( dbcon1.PureQuery(query) )
 	{
 		hom.homun_id = dbcon1.getLastID();
-
-		query.clear();
-		query << "DELETE "
-				 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "WHERE `homun_id` = '" << hom.homun_id <<"'";
-		dbcon1.PureQuery(query);
-
-
-		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "(`homun_id`,`id`,`lv`) VALUES ";
-
-		size_t i, doit;
-		for(i=0,doit=0; i<MAX_HOMSKILL; ++i)
-		{
-			if(hom.skill[i].lv>0)
-			{
-				query << (doit?",":"") <<
-					"("
-					"'" << hom.homun_id		<< "',"
-					"'" << hom.skill[i].id	<< "',"
-					"'" << hom.skill[i].lv	<< "'"
-					")";
-				++doit;
-			}
-		}
-		if(doit) dbcon1.PureQuery(query);
+		this->count_rows(this->tbl_homunculus, +1);
+		this->saveSkills(dbcon1, hom);
 		return true;
 	}
 	return false;
@@ -4690,8 +7669,10 @@ bool CHomunculusDB_sql::removeHomunculus(uint32 hid)
 	query << "DELETE "
 			 "FROM `" << dbcon1.escaped(this->tbl_homunculus) << "` "
 			 "WHERE `homun_id` = '" << hid <<"'";
-
-	return ret && dbcon1.PureQuery( query );
+	if( !ret || !dbcon1.PureQuery( query ) )
+		return false;
+	this->count_rows(this->tbl_homunculus, -1);
+	return true;
 }
 
 bool CHomunculusDB_sql::saveHomunculus(const CHomunculus& hom)
@@ -4706,69 +7687,13 @@ bool CHomunculusDB_sql::saveHomunculus(const CHomunculus& hom)
 		basics::string<> query;
 
 		query << "UPDATE `" << dbcon1.escaped(this->tbl_homunculus) << "` "
-				 "SET "
-				 "`homun_id` = '"		<< hom.homun_id << "',"
-				 "`account_id` = '"		<< hom.account_id << "',"
-				 "`char_id` = '"		<< hom.char_id << "',"
-
-				 "`base_exp` = '"		<< hom.base_exp << "',"
-				 "`name` = '"			<< hom.name << "',"
-
-				 "`hp` = '"				<< hom.hp << "',"
-				 "`max_hp` = '"			<< hom.max_hp << "',"
-				 "`sp` = '"				<< hom.sp << "',"
-				 "`max_sp` = '"			<< hom.max_sp << "',"
-
-				 "`class` = '"			<< hom.class_ << "',"
-				 "`status_point` = '"	<< hom.status_point << "',"
-				 "`skill_point` = '"	<< hom.skill_point << "',"
-
-				 "`str` = '"			<< hom.str << "',"
-				 "`agi` = '"			<< hom.agi << "',"
-				 "`vit` = '"			<< hom.vit << "',"
-				 "`int` = '"			<< hom.int_ << "',"
-				 "`dex` = '"			<< hom.dex << "',"
-				 "`luk` = '"			<< hom.luk << "',"
-
-				 "`option` = '"			<< hom.option << "',"
-				 "`equip` = '"			<< hom.equip << "',"
-
-				 "`intimate` = '"		<< hom.intimate << "',"
-				 "`hungry` = '"			<< hom.hungry << "',"
-				 "`base_level` = '"		<< hom.base_level << "',"
-				 
-				 "`rename_flag` = '"	<< hom.rename_flag << "',"
-				 "`incubate` = '"		<< hom.incubate << "' "
-
+				 "SET ";
+		this->columns.update(query, dbcon1, hom);
+		query << " "
 				 "WHERE `homun_id` = '" << hom.homun_id << "'";
 		
 		bool ret = dbcon1.PureQuery( query );
-
-		query.clear();
-		query << "DELETE "
-				 "FROM `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "WHERE `homun_id` = '" << hom.homun_id <<"'";
-		dbcon1.PureQuery(query);
-
-
-		query << "INSERT INTO `" << dbcon1.escaped(this->tbl_homunskill) << "` "
-				 "(`homun_id`,`id`,`lv`) VALUES ";
-
-		size_t i, doit;
-		for(i=0,doit=0; i<MAX_HOMSKILL; ++i)
-		{
-			if(hom.skill[i].lv>0)
-			{
-				query << (doit?",":"") <<
-					"("
-					"'" << hom.homun_id		<< "',"
-					"'" << hom.skill[i].id	<< "',"
-					"'" << hom.skill[i].lv	<< "'"
-					")";
-				++doit;
-			}
-		}
-		if(doit) ret &= dbcon1.PureQuery(query);
+		ret &= this->saveSkills(dbcon1, hom);
 		return ret;
 	}
 }
@@ -4789,8 +7714,15 @@ bool CVarDB_sql::init(const char *dbcfgfile)
 }
 
 size_t CVarDB_sql::size() const
-{
-	return this->get_table_size(this->tbl_variable);
+{	// the global scope is a small part of the registry, count it directly
+	basics::CMySQLConnection dbcon1(this->sqlbase);
+	basics::string<> query;
+	query << "SELECT COUNT(*) "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` "
+			 "WHERE `scope`='" << (int)REG_GLOBAL << "'";
+	if( dbcon1.ResultQuery(query) && dbcon1 )
+		return atol(dbcon1[0]);
+	return 0;
 }
 CVar& CVarDB_sql::operator[](size_t i)
 {	// not threadsafe
@@ -4800,24 +7732,16 @@ CVar& CVarDB_sql::operator[](size_t i)
 	basics::string<> query;
 
 	query << "SELECT "
-			 "`name`,"
-			 "`stortype`,"
-			 "`storid`,"
-			 "`vartype`,"
-			 "`value`"
-			 "FROM `" << dbcon1.escaped(this->tbl_variable) << "` "
-			 "ORDER BY `name`"
+			 "`k`.`name`,"
+			 "`r`.`sval` "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` `r` "
+			 "JOIN `" << dbcon1.escaped(this->tbl_reg_key) << "` `k` ON `k`.`key_id`=`r`.`key_id` "
+			 "WHERE `r`.`scope`='" << (int)REG_GLOBAL << "' "
+			 "ORDER BY `k`.`name` "
 			 "LIMIT "<< i << ",1 ";
 
 	if( dbcon1.ResultQuery(query) && dbcon1 )
-	{
-		var = CVar(
-				dbcon1[0],		// name
-				//dbcon1[1],	// stortype
-				//dbcon1[2],	// storid
-				//dbcon1[3],	// vartype
-				dbcon1[4] );	// value
-	}
+		var = CVar(dbcon1[0], dbcon1[1]);
 	else
 		var = CVar("","");
 	return var;
@@ -4825,76 +7749,66 @@ CVar& CVarDB_sql::operator[](size_t i)
 
 bool CVarDB_sql::searchVar(const char* name, CVar& var)
 {
+	const uint32 key = this->reg_key(name);
+	if( !key )
+		return false;
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
 	query << "SELECT "
-			 "`name`,"
-			 "`stortype`,"
-			 "`storid`,"
-			 "`vartype`,"
-			 "`value`"
-			 "FROM `" << dbcon1.escaped(this->tbl_variable) << "` "
-			 "WHERE `name` = " << dbcon1.escaped(var.name());
-	dbcon1.ResultQuery(query);
-	if(dbcon1)
-	{
-		var = CVar(
-				dbcon1[0],		// name
-				//dbcon1[1],	// stortype
-				//dbcon1[2],	// storid
-				//dbcon1[3],	// vartype
-				dbcon1[4] );	// value
+			 "`sval` "
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` "
+			 "WHERE `scope`='" << (int)REG_GLOBAL << "' AND `owner`='0' AND `key_id`='" << key << "'";
+	if( dbcon1.ResultQuery(query) && dbcon1 )
+	{
+		var = CVar(this->reg_name(key), dbcon1[0]);
 		return true;
 	}
 	return false;
 }
 bool CVarDB_sql::insertVar(const char* name, const char* value)
 {
+	const uint32 key = this->reg_key(name);
+	if( !key )
+		return false;
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
-	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_variable) << "` "
-			 "("
-			 "`name`,"
-			 "`stortype`,"
-			 "`storid`,"
-			 "`vartype`,"
-			 "`value`"
-			 ") "
+	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_registry) << "` "
+			 "(`scope`,`owner`,`key_id`,`sval`) "
 			 "VALUES "
-			 "(" 
-			 "'" << dbcon1.escaped(name) << "',"
-			 "'" << 0 << "',"
-			 "'" << 0 << "',"
-			 "'" << 0 << "',"
-			 "'" << dbcon1.escaped(value) << "'"
-			 ")";
+			 "('" << (int)REG_GLOBAL << "','0','" << key << "','" << dbcon1.escaped(value) << "')";
 	return dbcon1.PureQuery( query );
 }
 bool CVarDB_sql::removeVar(const char* name)
 {
+	const uint32 key = this->reg_key(name);
+	if( !key )
+		return false;
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
 	query << "DELETE "
-			 "FROM `" << dbcon1.escaped(this->tbl_variable) << "` "
-			 "WHERE `name` = '" << dbcon1.escaped(name) <<"'";
+			 "FROM `" << dbcon1.escaped(this->tbl_registry) << "` "
+			 "WHERE `scope`='" << (int)REG_GLOBAL << "' AND `owner`='0' AND `key_id`='" << key << "'";
 	return dbcon1.PureQuery( query );
 }
 bool CVarDB_sql::saveVar(const CVar& var)
 {
+	const uint32 key = this->reg_key(var.name());
+	if( !key )
+		return false;
+
 	basics::CMySQLConnection dbcon1(this->sqlbase);
 	basics::string<> query;
 
-	query << "UPDATE `" << dbcon1.escaped(this->tbl_variable) << "` "
-			 "SET "
-			 "`name` = '"		<< dbcon1.escaped(var.name()) << "',"
-			 "`stortype` = '"	<< 0 << "',"
-			 "`storid` = '"		<< 0 << "',"
-			 "`vartype` = '"	<< 0 << "',"
-			 "`value` = '"		<< dbcon1.escaped(var.value()) << "',"
-
-			 "WHERE `name` = '" << dbcon1.escaped(var.name()) << "'";
+	query << "INSERT INTO `" << dbcon1.escaped(this->tbl_registry) << "` "
+			 "(`scope`,`owner`,`key_id`,`sval`) "
+			 "VALUES "
+			 "('" << (int)REG_GLOBAL << "','0','" << key << "','" << dbcon1.escaped(var.value()) << "') "
+			 "ON DUPLICATE KEY UPDATE `sval`=VALUES(`sval`)";
 	return dbcon1.PureQuery( query );
 }
 
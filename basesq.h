@@ -6,10 +6,13 @@
 
 #include "baseio.h"
 #include "basemysql.h"
+#include "baseitemlist.h"
 
 
 #if defined(WITH_MYSQL)
 
+#include <mysql.h>
+
 #define DEVELOPING_CSQL
 #ifdef DEVELOPING_CSQL
 
@@ -275,6 +278,27 @@ private:
 	basics::string<> col_default;
 };
 
+inline const basics::string<>& Column::name() const
+{
+	return this->col_name;
+}
+inline ColType Column::type() const
+{
+	return this->col_type;
+}
+inline bool Column::hasDefault() const
+{
+	return this->col_hasDefault;
+}
+inline const basics::string<>& Column::defaultsTo() const
+{
+	return this->col_default;
+}
+inline bool Column::null() const
+{
+	return this->col_null;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 /// Int column.
@@ -559,11 +583,582 @@ NAMESPACE_END(sq)
 
 #endif // DEVELOPING_CSQL
 
+
+///////////////////////////////////////////////////////////////////////////////
+/// typed column value.
+/// converts a column of the current result row directly into the type of
+/// the field it is assigned to, so the loaders do not need atol/atoi.
+/// the conversion is selected at compile time by the target type;
+/// NULL columns decode as 0.
+/// usage: p.zeny = CSQLValue(dbcon1[9]);
+class CSQLValue
+{
+	const char* str;
+public:
+	explicit CSQLValue(const char* s) : str(s)
+	{}
+
+	template<typename T>
+	operator T() const
+	{
+		return CSQLValue::decode<T>(this->str);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// decode a decimal number.
+	/// signed and unsigned targets wrap the same way as the old
+	/// atol assignments did, but 64bit values are not truncated to long
+	template<typename T>
+	static T decode(const char* s)
+	{
+		uint64 val=0;
+		bool neg=false;
+		if(!s)
+			return (T)0;
+		while(*s==' ')
+			++s;
+		if(*s=='-')
+			neg=true, ++s;
+		else if(*s=='+')
+			++s;
+		for( ; (uint)(*s-'0')<10; ++s)
+			val = val*10 + (uint)(*s-'0');
+		return (T)(neg?(0-val):val);
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// binary fetch of a column that is not a number.
+/// the column is fetched as text and given to the decoder of the codec
+inline bool CSQLBindText(MYSQL_BIND&, void*)
+{
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// column codec.
+/// reads and writes one field of type T, numbers are written as numbers
+/// also for the char types, char arrays are written escaped.
+/// all codecs share one signature, the connection is only needed by the
+/// ones that escape.
+/// bind sets up the binary fetch of a prepared statement, numbers are
+/// fetched straight into the field in the width of T; codecs without
+/// a binary form use CSQLBindText.
+template<typename T>
+struct CSQLCodec
+{
+	enum { type = (sizeof(T)>4)?sq::BIGINT:(sizeof(T)>2)?sq::INT:(sizeof(T)>1)?sq::SMALLINT:sq::TINYINT };
+
+	static void decode(void* field, const char* str)
+	{
+		*static_cast<T*>(field) = CSQLValue(str);
+	}
+	static bool bind(MYSQL_BIND& b, void* field)
+	{
+		b.buffer_type	= (sizeof(T)>4)?MYSQL_TYPE_LONGLONG:(sizeof(T)>2)?MYSQL_TYPE_LONG:(sizeof(T)>1)?MYSQL_TYPE_SHORT:MYSQL_TYPE_TINY;
+		b.buffer		= field;
+		b.buffer_length	= sizeof(T);
+		b.is_unsigned	= ( (T)-1 > (T)0 );
+		return true;
+	}
+	static void encode(basics::string<>& query, basics::CMySQLConnection&, const void* field)
+	{
+		query << +*static_cast<const T*>(field);
+	}
+};
+template<size_t N>
+struct CSQLCodec<char[N]>
+{
+	enum { type = sq::TEXT };
+
+	static void decode(void* field, const char* str)
+	{
+		safestrcpy(static_cast<char*>(field), N, str?str:"");
+	}
+	static bool bind(MYSQL_BIND& b, void* field)
+	{
+		return CSQLBindText(b, field);
+	}
+	static void encode(basics::string<>& query, basics::CMySQLConnection& dbcon1, const void* field)
+	{
+		query << dbcon1.escaped(static_cast<const char*>(field));
+	}
+};
+template<>
+struct CSQLCodec<basics::ipaddress>
+{
+	enum { type = sq::TEXT };
+
+	static void decode(void* field, const char* str)
+	{
+		*static_cast<basics::ipaddress*>(field) = basics::ipaddress(str?str:"");
+	}
+	static bool bind(MYSQL_BIND& b, void* field)
+	{
+		return CSQLBindText(b, field);
+	}
+	static void encode(basics::string<>& query, basics::CMySQLConnection&, const void* field)
+	{
+		query << *static_cast<const basics::ipaddress*>(field);
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// default constructed object of a struct.
+/// the column descriptors take the field offsets from it
+template<typename S>
+struct CSQLProbe
+{
+	static const char* base()
+	{
+		return reinterpret_cast<const char*>(&object());
+	}
+	static S& object()
+	{
+		static S s;
+		return s;
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// column descriptor.
+/// a sq::Column that is bound to a field of S, the codec is selected at
+/// compile time from the type of the field, or given explicitly.
+/// explicit codecs provide decode<T> and encode<T> for the field type,
+/// they are fetched as text by prepared statements.
+/// fields of a member struct are bound with two member pointers,
+/// elements of a member array with the member and the index.
+template<typename S>
+struct CSQLColumn : public sq::Column
+{
+	typedef void (*decoder)(void* field, const char* str);
+	typedef void (*encoder)(basics::string<>& query, basics::CMySQLConnection& dbcon1, const void* field);
+	typedef bool (*binder)(MYSQL_BIND& b, void* field);
+
+	size_t		offset;
+	decoder		decode;
+	encoder		encode;
+	binder		bind;
+
+	template<typename T, typename B>
+	CSQLColumn(const char* n, T B::*member)
+		: sq::Column((sq::ColType)CSQLCodec<T>::type, n, false)
+		, offset( reinterpret_cast<const char*>(&(CSQLProbe<S>::object().*member)) - CSQLProbe<S>::base() )
+		, decode(&CSQLCodec<T>::decode)
+		, encode(&CSQLCodec<T>::encode)
+		, bind(&CSQLCodec<T>::bind)
+	{}
+	template<typename T, typename B, typename C>
+	CSQLColumn(const char* n, T B::*member, const C&)
+		: sq::Column((sq::ColType)C::type, n, false)
+		, offset( reinterpret_cast<const char*>(&(CSQLProbe<S>::object().*member)) - CSQLProbe<S>::base() )
+		, decode(&C::template decode<T>)
+		, encode(&C::template encode<T>)
+		, bind(&CSQLBindText)
+	{}
+	template<typename T, size_t N, typename B, typename I>
+	CSQLColumn(const char* n, T (B::*member)[N], I idx)
+		: sq::Column((sq::ColType)CSQLCodec<T>::type, n, false)
+		, offset( reinterpret_cast<const char*>(&(CSQLProbe<S>::object().*member)[idx]) - CSQLProbe<S>::base() )
+		, decode(&CSQLCodec<T>::decode)
+		, encode(&CSQLCodec<T>::encode)
+		, bind(&CSQLCodec<T>::bind)
+	{}
+	template<typename M, typename B, typename T, typename BM>
+	CSQLColumn(const char* n, M B::*outer, T BM::*inner)
+		: sq::Column((sq::ColType)CSQLCodec<T>::type, n, false)
+		, offset( reinterpret_cast<const char*>(&((CSQLProbe<S>::object().*outer).*inner)) - CSQLProbe<S>::base() )
+		, decode(&CSQLCodec<T>::decode)
+		, encode(&CSQLCodec<T>::encode)
+		, bind(&CSQLCodec<T>::bind)
+	{}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// result buffers of a prepared statement.
+/// one MYSQL_BIND per column, the numbers point into the target struct,
+/// the other columns into a text buffer of their own
+class CSQLResult
+{
+	CSQLResult(const CSQLResult&);
+	const CSQLResult& operator=(const CSQLResult&);
+public:
+	enum { TEXT_LEN = 256 };
+
+	MYSQL_BIND*		binds;
+	unsigned long*	lens;
+	my_bool*		nulls;
+	char			(*text)[TEXT_LEN];
+	size_t			cnt;
+
+	explicit CSQLResult(size_t n)
+		: binds(new MYSQL_BIND[n]), lens(new unsigned long[n]), nulls(new my_bool[n])
+		, text(new char[n][TEXT_LEN]), cnt(n)
+	{
+		memset(this->binds, 0, n*sizeof(MYSQL_BIND));
+	}
+	~CSQLResult()
+	{
+		delete[] this->binds;
+		delete[] this->lens;
+		delete[] this->nulls;
+		delete[] this->text;
+	}
+	/// bind column i, as text when the binder has no binary form
+	void bind(size_t i, bool (*fn)(MYSQL_BIND&, void*), void* field)
+	{
+		MYSQL_BIND& b = this->binds[i];
+		memset(&b, 0, sizeof(b));
+		if( !fn(b, field) )
+		{
+			b.buffer_type	= MYSQL_TYPE_STRING;
+			b.buffer		= this->text[i];
+			b.buffer_length	= TEXT_LEN-1;
+		}
+		b.length	= &this->lens[i];
+		b.is_null	= &this->nulls[i];
+	}
+	/// text of column i after a fetch, NULL for a NULL column
+	const char* str(size_t i)
+	{
+		if( this->nulls[i] )
+			return NULL;
+		this->text[i][ (this->lens[i]<TEXT_LEN-1) ? this->lens[i] : TEXT_LEN-1 ] = 0;
+		return this->text[i];
+	}
+	/// column i was fetched in binary
+	bool binary(size_t i) const
+	{
+		return this->binds[i].buffer != this->text[i];
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// column map.
+/// one descriptor array generates the select list, the row decoder,
+/// the update set list and the insert values of a table.
+/// the "from" parameters skip leading columns (ie. auto increment keys),
+/// so the key columns go first.
+template<typename S>
+class CSQLColumnMap
+{
+	const CSQLColumn<S>*	cols;
+	size_t					cnt;
+public:
+	template<size_t N>
+	CSQLColumnMap(const CSQLColumn<S> (&c)[N]) : cols(c), cnt(N)
+	{}
+
+	size_t size() const
+	{
+		return this->cnt;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// append the column list; "`a`,`b`,`c`",
+	/// with an alias the names are qualified; "`t`.`a`,`t`.`b`"
+	void names(basics::string<>& query, size_t from=0, const char* alias=NULL) const
+	{
+		size_t i;
+		for(i=from; i<this->cnt; ++i)
+		{
+			query << (i>from?",":"");
+			if(alias) query << "`" << alias << "`.";
+			query << "`" << this->cols[i].name() << "`";
+		}
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// decode the current row, column i of the map is read from result
+	/// column first+i
+	void decode(basics::CMySQLConnection& dbcon1, S& s, size_t first=0) const
+	{
+		size_t i;
+		char* base = reinterpret_cast<char*>(&s);
+		for(i=0; i<this->cnt; ++i)
+			this->cols[i].decode(base+this->cols[i].offset, dbcon1[first+i]);
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// bind the result of a prepared statement to s, column i of the map
+	/// is result column first+i, the result needs first+size() columns
+	void bind(CSQLResult& r, S& s, size_t first=0) const
+	{
+		size_t i;
+		char* base = reinterpret_cast<char*>(&s);
+		for(i=0; i<this->cnt && first+i<r.cnt; ++i)
+			r.bind(first+i, this->cols[i].bind, base+this->cols[i].offset);
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// finish a fetched row, the numbers are already in s, the text
+	/// columns are decoded and NULL numbers are cleared
+	void fetched(CSQLResult& r, S& s, size_t first=0) const
+	{
+		size_t i;
+		char* base = reinterpret_cast<char*>(&s);
+		for(i=0; i<this->cnt && first+i<r.cnt; ++i)
+		{
+			if( !r.binary(first+i) )
+				this->cols[i].decode(base+this->cols[i].offset, r.str(first+i));
+			else if( r.nulls[first+i] )
+				this->cols[i].decode(base+this->cols[i].offset, NULL);
+		}
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// append the values without parenthesis; "'1','2','3'",
+	/// for rows that start with columns that are not in the map
+	void fields(basics::string<>& query, basics::CMySQLConnection& dbcon1, const S& s, size_t from=0) const
+	{
+		size_t i;
+		const char* base = reinterpret_cast<const char*>(&s);
+		for(i=from; i<this->cnt; ++i)
+		{
+			query << (i>from?",'":"'");
+			this->cols[i].encode(query, dbcon1, base+this->cols[i].offset);
+			query << "'";
+		}
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// append a value tuple; "('1','2','3')"
+	void values(basics::string<>& query, basics::CMySQLConnection& dbcon1, const S& s, size_t from=0) const
+	{
+		query << "(";
+		this->fields(query, dbcon1, s, from);
+		query << ")";
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// append the set list; "`a`='1',`b`='2'"
+	void update(basics::string<>& query, basics::CMySQLConnection& dbcon1, const S& s, size_t from=0) const
+	{
+		size_t i;
+		const char* base = reinterpret_cast<const char*>(&s);
+		for(i=from; i<this->cnt; ++i)
+		{
+			query << (i>from?",":"") << "`" << this->cols[i].name() << "`='";
+			this->cols[i].encode(query, dbcon1, base+this->cols[i].offset);
+			query << "'";
+		}
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// append the update list of an upsert; "`a`=VALUES(`a`),`b`=VALUES(`b`)"
+	void upsert(basics::string<>& query, size_t from=0) const
+	{
+		size_t i;
+		for(i=from; i<this->cnt; ++i)
+			query << (i>from?",":"") << "`" << this->cols[i].name() << "`=VALUES(`" << this->cols[i].name() << "`)";
+	}
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // sql base interface.
 // wrapper for the sql handle, table control and parameter storage
+///////////////////////////////////////////////////////////////////////////////
+/// statements of one save.
+/// the saves collect their statements here instead of running them, commit
+/// writes them as one record to the journal and then runs them. when the
+/// database cannot be reached the record stays in the journal and is
+/// replayed later, in order, so a save is never lost once committed.
+/// a record is [target:1][length:4][statement] for each statement,
+/// target 0 is the primary database, 1..n are the shards.
+class CSQLBatch
+{
+	char*	buf;
+	size_t	len;
+	size_t	cap;
+
+	CSQLBatch(const CSQLBatch&);
+	const CSQLBatch& operator=(const CSQLBatch&);
+public:
+	CSQLBatch() : buf(NULL), len(0), cap(0)
+	{}
+	~CSQLBatch()
+	{
+		if(buf) delete[] buf;
+	}
+	/// add a statement for the given database
+	void add(basics::CMySQL& base, const char* query);
+	/// journal and run the statements.
+	/// returns false when the database rejected them,
+	/// or when they could neither be run nor journaled
+	bool commit();
+	/// number of bytes collected
+	size_t size() const	{ return this->len; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// startup warm-up.
+/// the databases register their load tasks with warmup(), run() works them
+/// off on "sql_warmup_threads" threads, each task with a connection of its
+/// own from the pool, and reports the progress. a task is either a loader
+/// that fills a cache of its database, or a query whose rows are read and
+/// dropped, which brings the pages into the buffer pool of the server.
+/// with "sql_warmup" set the char and guild database run their warm-up at
+/// the end of init, the servers create their databases before they open
+/// their ports; ready() tells other parts that the warm-up has finished.
+class CSQLWarmup
+{
+public:
+	typedef bool (*loader)(void* obj, size_t arg);
+	enum { MAX_TASKS = 64 };
+private:
+	struct task
+	{
+		const char*			name;
+		loader				func;	///< loader, or NULL for a query
+		void*				obj;
+		size_t				arg;
+		basics::CMySQL*		base;
+		basics::string<>	query;
+		volatile bool		done;
+		bool				ok;
+	};
+	task	tasks[MAX_TASKS];
+	size_t	cnt;
+	static volatile bool is_ready;
+
+	CSQLWarmup(const CSQLWarmup&);
+	const CSQLWarmup& operator=(const CSQLWarmup&);
+public:
+	/// warm up the databases when they are created
+	static basics::CParam<bool> sql_warmup;
+	/// number of threads, 0 runs the tasks in the calling thread
+	static basics::CParam<uint32> sql_warmup_threads;
+	/// accounts that logged in within this number of days are preloaded
+	static basics::CParam<uint32> sql_warmup_days;
+
+	CSQLWarmup() : cnt(0)
+	{}
+	/// register a loader, obj and arg are passed to it
+	bool add(const char* name, loader func, void* obj, size_t arg=0);
+	/// register a query to run on the given database
+	bool add(const char* name, basics::CMySQL& base, const basics::string<>& query);
+	/// run all tasks and wait for them; false when a task failed
+	bool run();
+	/// run the tasks first, first+step, ... (worker threads)
+	void work(size_t first, size_t step);
+	/// true once a warm-up has finished
+	static bool ready()	{ return is_ready; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// mutex for the state the sql timer shares with the server thread.
+/// recursive, a locked owner can call into functions that lock again
+class CSQLMutex
+{
+	void* mx;
+
+	CSQLMutex(const CSQLMutex&);
+	const CSQLMutex& operator=(const CSQLMutex&);
+public:
+	CSQLMutex();
+	~CSQLMutex();
+	void lock();
+	void unlock();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// scoped lock of a CSQLMutex
+class CSQLLock
+{
+	CSQLMutex& mx;
+
+	CSQLLock(const CSQLLock&);
+	const CSQLLock& operator=(const CSQLLock&);
+public:
+	CSQLLock(CSQLMutex& m) : mx(m)
+	{
+		this->mx.lock();
+	}
+	~CSQLLock()
+	{
+		this->mx.unlock();
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// prepared statement with one key parameter.
+/// runs on a connection of its own to the primary database, opened with
+/// the login of CSQLParameter on the first use and again after an error.
+/// the results come in the binary protocol, the numbers are not parsed.
+/// the statement is shared by the threads of a database object, the lock
+/// is held from execute to done.
+class CSQLStatement
+{
+	MYSQL*				mysql;
+	MYSQL_STMT*			stmt;
+	basics::string<>	query;
+	CSQLMutex			mx;
+
+	CSQLStatement(const CSQLStatement&);
+	const CSQLStatement& operator=(const CSQLStatement&);
+
+	bool open();
+public:
+	CSQLStatement() : mysql(NULL), stmt(NULL)
+	{}
+	~CSQLStatement()
+	{
+		this->close();
+	}
+	/// set the query, a "?" takes the key
+	void prepare(const basics::string<>& q);
+	/// close the statement and the connection
+	void close();
+	/// lock the statement, run it with the key and bind the result,
+	/// false (and unlocked) on error
+	bool execute(uint32 key, CSQLResult& r);
+	/// fetch the next row, false at the end or on error
+	bool fetch();
+	/// drop the rest of the result and unlock
+	void done();
+	/// a query is set
+	bool prepared() const	{ return 0!=*this->query.c_str(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// background timer of the sql layer.
+/// one thread calls the registered tasks in their intervals, so periodic
+/// work (replica checks, queued saves) does not run inside a request.
+/// the tasks lock the state they share with the server thread themselves.
+/// the thread is started with the first task and stopped with the last
+/// sql database object; remove() waits for a running call of the object
+class CSQLTimer
+{
+public:
+	typedef void (*handler)(void* obj);
+	enum { MAX_TASKS = 16 };
+
+	/// call func(obj) every interval seconds
+	static bool add(const char* name, handler func, void* obj, uint32 interval);
+	/// unregister all tasks of obj
+	static void remove(void* obj);
+	/// stop the thread, the tasks stay registered
+	static void stop();
+	/// thread body
+	static void run();
+};
+
+
 class CSQLParameter
 {
+public:
+	///////////////////////////////////////////////////////////////////////////
+	/// replica limits and entity types for read-your-writes
+	enum { SQL_MAX_REPLICAS = 8, SQL_RECENT_WRITES = 16384, SQL_REPLICA_CHECK = 2 };
+	enum sql_entity
+	{
+		SQL_ENTITY_CHAR,
+		SQL_ENTITY_MAIL,
+		SQL_ENTITY_STORAGE,
+		SQL_ENTITY_GUILDSTORAGE,
+		SQL_ENTITY_MAX
+	};
+
 protected:
 
 	///////////////////////////////////////////////////////////////////////////
@@ -576,6 +1171,42 @@ protected:
 	static basics::CParam< basics::string<> > mysqldb_cp;	///< server code page
 	static basics::CParam< ushort   >         mysqldb_port;	///< server port
 
+	///////////////////////////////////////////////////////////////////////////
+	/// sharding.
+	/// the char-scoped detail tables (memo, inventory, cart, skill) can be
+	/// spread over several servers, the shard is selected by char_id.
+	/// these tables are only accessed by char_id and never joined; all other
+	/// tables (incl. char, char_reg, friends, mail) stay on the primary.
+	/// "sql_shards" is a comma seperated list of ip:port, the shards use the
+	/// username, password and database of the primary.
+	/// for a local test setup start additional mysqld instances, ie.
+	///   mysqld --port=3307 --datadir=/tmp/shard0 --socket=/tmp/shard0.sock
+	///   mysqld --port=3308 --datadir=/tmp/shard1 --socket=/tmp/shard1.sock
+	/// create the database and user on each and set
+	///   sql_shards: 127.0.0.1:3307,127.0.0.1:3308
+	/// the tables are created on the shards at startup.
+	/// changing the number of shards requires moving the rows of the
+	/// sharded tables to their new shard (char_id % number of shards).
+	enum { SQL_MAX_SHARDS = 16 };
+	static basics::CMySQL sqlshard[SQL_MAX_SHARDS];			///< shard handles
+	static size_t sqlshard_cnt;								///< number of shards in use
+	static basics::CParam< basics::string<> > mysqldb_shards;	///< shard list
+
+	///////////////////////////////////////////////////////////////////////////
+	/// read replicas.
+	/// read-only queries that do not need the latest data can be sent to the
+	/// replicas listed in "sql_replicas" (ip:port, same login as the primary).
+	/// the lag of the replicas is measured on the sql timer with a heartbeat
+	/// row that is written on the primary and read back from the replicas;
+	/// replicas lagging more than "sql_replica_lag" seconds are not used.
+	/// entities written through this server are read from the primary until
+	/// the replicas had the time to catch up (read-your-writes).
+	static basics::CMySQL sqlreplica[SQL_MAX_REPLICAS];		///< replica handles
+	static size_t sqlreplica_cnt;								///< number of replicas in use
+	static basics::CParam< basics::string<> > mysqldb_replicas;	///< replica list
+	static basics::CParam<uint32> mysqldb_replica_lag;			///< max. tolerated lag in seconds
+	static basics::CParam< basics::string<> > tbl_heartbeat;
+
 	///////////////////////////////////////////////////////////////////////////
 	// parameters
 	static basics::CParam< basics::string<> > tbl_login_log;
@@ -635,41 +1266,367 @@ protected:
 	static bool ParamCallback_Database_string(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval);
 	static bool ParamCallback_Database_ushort(const basics::string<>& name, ushort& newval, const ushort& oldval);
 	static bool ParamCallback_Tables(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval);
+	static bool ParamCallback_Shards(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval);
+	static bool ParamCallback_Replicas(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval);
+
+	static void init_shards(const basics::string<>& list);
+	static void rebuild_shard(basics::CMySQL& shard);
+	static void init_replicas(const basics::string<>& list);
+	static void check_replicas();
+	static void replica_timer(void* obj);
 
+	static size_t instances;	///< number of sql database objects
 
 	///////////////////////////////////////////////////////////////////////////
-	/// read number of rows from given table
-	size_t get_table_size(basics::string<> tbl_name) const
+	/// sql handle for a read-only query.
+	/// returns a replica that is not lagging behind, or the primary.
+	/// with an entity type the primary is used while an entity of this type
+	/// that was written recently could still be missing on the replicas,
+	/// id 0 stands for any entity of the type.
+	static basics::CMySQL& readbase();
+	static basics::CMySQL& readbase(sql_entity type, uint32 id=0);
+	///////////////////////////////////////////////////////////////////////////
+	/// remember a write for read-your-writes, id 0 marks all entities
+	static void written(sql_entity type, uint32 id=0);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// sql handle that holds the char-scoped tables of the given char
+	static basics::CMySQL& charbase(uint32 char_id)
 	{
-		basics::CMySQLConnection dbcon1(this->sqlbase);
-		basics::string<> query;
+		return (sqlshard_cnt)? sqlshard[char_id%sqlshard_cnt] : sqlbase;
+	}
+
 
-		query << "SELECT COUNT(*) "
-				 "FROM `" << dbcon1.escaped(tbl_name) << "` ";
-		
+	///////////////////////////////////////////////////////////////////////////
+	/// write-ahead journal.
+	/// with "sql_journal" set to a file, every CSQLBatch is appended there
+	/// before it is run. the file is synced every "sql_journal_sync" records,
+	/// and at once when the database is not available; then the records are
+	/// kept until a replay got them all into the database. the sql timer
+	/// tries a replay every "sql_journal_retry" seconds, and the loads of
+	/// chars and storages replay first, or refuse to load while records
+	/// are pending, so they never read the state before them. the file is truncated when everything in it
+	/// has been applied and it grew over "sql_journal_size" bytes, and on
+	/// a clean shutdown. the file header holds the offset up to which the
+	/// records are applied, a journal left from a crash is replayed from
+	/// there on startup; the header is not synced, this relies on the saves
+	/// writing full state with upserts, so a record that was already
+	/// applied does no harm when it is applied again.
+	/// each record runs in a transaction per database. a statement the
+	/// database rejects while it is reachable fails its record, which is
+	/// logged and skipped; only a lost connection stalls the journal.
+	/// the journal is opened by the first database object, after its
+	/// config is read, so the shards of the records are known.
+	static basics::CParam< basics::string<> > sql_journal;
+	static basics::CParam<uint32> sql_journal_sync;
+	static basics::CParam<uint32> sql_journal_size;
+	static basics::CParam<uint32> sql_journal_retry;
+	static bool ParamCallback_Journal(const basics::string<>& name, basics::string<>& newval, const basics::string<>& oldval);
+public:
+	/// database number of a connection pool for the journal
+	static uchar base_index(const basics::CMySQL& base);
+	/// connection pool of a database number, the primary when unknown
+	static basics::CMySQL& base_at(uchar i);
+	/// result of running a record
+	enum journal_result
+	{
+		JOURNAL_DONE,		///< applied
+		JOURNAL_FAILED,		///< rejected by the database, not applied
+		JOURNAL_OFFLINE		///< database not reachable, try again later
+	};
+	/// open the journal and replay what is left in it, empty path closes it
+	static bool journal_open(const basics::string<>& path);
+	/// close the journal, it is emptied when everything has been applied
+	static void journal_close();
+	/// append a record and run it, or keep it when the journal is stalled.
+	/// false when the record was rejected or could neither be run nor kept
+	static bool journal_commit(const char* data, size_t len);
+	/// run the pending records; true when nothing is pending anymore
+	static bool journal_replay();
+	/// replay before a load; false when records are still pending
+	static bool journal_settle();
+	/// run the statements of one record
+	static journal_result journal_apply(const char* data, size_t len);
+private:
+	/// run a record once, each database in a transaction.
+	/// failed is the database number of the failing statement
+	static journal_result journal_run(const char* data, size_t len, uchar& failed);
+	/// timer entry of the replay
+	static void journal_timer(void* obj);
+protected:
+
+	///////////////////////////////////////////////////////////////////////////
+	/// row counters.
+	/// the size() of the tables is served from a counter per table, it is
+	/// updated by the inserts and removes done through this server and
+	/// reconciled with the database every "sql_count_interval" seconds,
+	/// so changes from other servers show up after that time.
+	/// with "sql_count_approx" the reconciliation reads the row estimate of
+	/// the table statistics instead of counting the rows.
+	static basics::CParam<uint32> sql_count_interval;
+	static basics::CParam<bool> sql_count_approx;
+
+	/// with "sql_binary_fetch" the rows that are read by their id come
+	/// from prepared statements in the binary protocol, the text query
+	/// is the fallback when a statement fails
+	static basics::CParam<bool> sql_binary_fetch;
+
+	/// number of rows of the given table
+	size_t get_table_size(const basics::CParam< basics::string<> >& tbl) const;
+	/// adjust the row counter of a table after an insert or remove
+	static void count_rows(const basics::CParam< basics::string<> >& tbl, int diff);
+	/// reconcile the row counter of a table on the next access
+	static void invalidate_rows(const basics::CParam< basics::string<> >& tbl);
+	/// true while the row counter of a table is in use, so callers only
+	/// look up row differences when they are needed
+	static bool counting_rows(const basics::CParam< basics::string<> >& tbl);
+	/// number of rows of one owner in an item table
+	static size_t owner_rows(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl, const char* owner_col, uint32 owner);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// time partitioned logs and mails.
+	/// with "sql_partition" set to day, week or month the log tables and the
+	/// mail table are partitioned by time range, one partition per period
+	/// and an empty catch-all partition "pmax" at the end. the maintenance
+	/// keeps "sql_partition_ahead" periods in advance and drops the
+	/// partitions older than "sql_log_retention" resp. "sql_mail_retention"
+	/// days (0 keeps everything), which costs the same for any number of
+	/// rows. existing tables are converted on the first maintenance.
+	/// a partitioned mail table has no foreign key and the primary key
+	/// (message_id,sendtime), removeChar deletes the mails itself.
+	static basics::CParam< basics::string<> > sql_partition;
+	static basics::CParam<uint32> sql_partition_ahead;
+	static basics::CParam<uint32> sql_log_retention;
+	static basics::CParam<uint32> sql_mail_retention;
+	/// seconds between two maintenances
+	enum { SQL_PARTITION_CHECK = 86400 };
+
+	/// 0 when not partitioned, otherwise 1 day, 7 week, 31 month
+	static int partition_period();
+	/// start of the period that contains t
+	static time_t partition_start(time_t t);
+	/// start of the period after the one starting at t
+	static time_t partition_next(time_t t);
+	/// append "PARTITION BY RANGE(expr) (...)" for a new table
+	static void partition_clause(basics::string<>& query, const char* expr);
+	/// convert, extend and expire one table
+	static bool partition_table(basics::CMySQLConnection& dbcon1, const basics::CParam< basics::string<> >& tbl, const char* expr, uint32 retention);
+	/// timer entry of the maintenance
+	static void partition_timer(void* obj);
+public:
+	/// add the partitions of the coming periods and drop the expired ones.
+	/// runs with rebuild and then once a day on the sql timer
+	static bool maintain_partitions();
+protected:
+
+	///////////////////////////////////////////////////////////////////////////
+	/// registry.
+	/// all registry values are rows of "tbl_registry", keyed by scope, owner
+	/// and the id of the name. the names are interned in "tbl_reg_key" and
+	/// kept in memory. a value is either an integer or a string.
+	/// the last loaded or saved state of an owner is cached, so a save only
+	/// writes the keys that changed and deletes the ones that are gone.
+	/// without a cached state all keys are written. the cache has a slot
+	/// for each of "sql_reg_cache" owners, a new owner replaces the one
+	/// in its slot.
+	/// the old per-scope tables are copied over when the registry table is
+	/// created and are not used after that.
+	enum reg_scope
+	{
+		REG_CHAR = 1,		///< char_reg
+		REG_ACCOUNT,		///< login_reg
+		REG_ACCOUNT2,		///< unused, login_reg2 was never read and is not copied
+		REG_GUILD,			///< guild_reg
+		REG_GLOBAL			///< variable, string values
+	};
+	static basics::CParam< basics::string<> > tbl_reg_key;
+	static basics::CParam< basics::string<> > tbl_registry;
+	static basics::CParam<uint32> sql_reg_cache;
+
+	/// id of a registry name, interned when new; 0 on error
+	static uint32 reg_key(const char* name);
+	/// name of a registry id or NULL
+	static const char* reg_name(uint32 id);
+	/// load the integer values of an owner, returns the number of values
+	static size_t reg_load(basics::CMySQL& base, reg_scope scope, uint32 owner, struct global_reg* regs, size_t max);
+	/// write the changed integer values of an owner, a value of 0 is removed.
+	/// the new state is cached right away, call reg_forget when the batch
+	/// fails to commit
+	static void reg_save(CSQLBatch& batch, reg_scope scope, uint32 owner, const struct global_reg* regs, size_t num);
+	/// fill the cached states of many owners at once, the query has to
+	/// return owner, key_id and ival ordered by owner. owners with a state
+	/// already are skipped, it may be newer than the rows read
+	static bool reg_prime(basics::CMySQL& base, reg_scope scope, const basics::string<>& query, size_t max);
+	/// remove all values of an owner
+	static bool reg_remove(reg_scope scope, uint32 owner);
+	static void reg_remove(CSQLBatch& batch, reg_scope scope, uint32 owner);
+	/// drop the cached state of an owner, the next save writes everything
+	static void reg_forget(reg_scope scope, uint32 owner);
+	/// drop the cached dictionary and states
+	static void reg_reset();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// keep the resident party table in step with a char that is saved,
+	/// party_id 0 takes the char out of its party.
+	/// does nothing as long as no party table is loaded
+	static void party_member(uint32 char_id, uint32 party_id, uint32 account_id, const char* name, ushort lv);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// append the item columns in the order fetch_items and insert_items use
+	static void item_names(basics::string<>& query)
+	{
+		query << "`nameid`,`amount`,`equip`,`identify`,`refine`,`attribute`,"
+				 "`card0`,`card1`,`card2`,`card3`";
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// read the items of one owner from an item table.
+	/// shared by inventory, cart and the storages, returns false when the
+	/// query failed, the list is empty then
+	template<size_t SZ>
+	static bool load_items(basics::CMySQLConnection& dbcon1, const basics::string<>& tbl, const char* owner_col, uint32 owner, CItemList<SZ>& list)
+	{
+		basics::string<> query;
+		query << "SELECT `pos`,";
+		item_names(query);
+		query << " "
+				 "FROM `" << dbcon1.escaped(tbl) << "` "
+				 "WHERE `" << owner_col << "`='" << owner << "' "
+				 "ORDER BY `pos`";
 		if( dbcon1.ResultQuery(query) )
 		{
-			return atol( dbcon1[0] );
+			fetch_items(dbcon1, list);
+			return true;
+		}
+		list.clear();
+		return false;
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// read item rows into an item list.
+	/// the result columns have to be pos followed by the ones of item_names,
+	/// rows beyond SZ are dropped, slots out of range or taken twice
+	/// are moved to free ones
+	template<size_t SZ>
+	static size_t fetch_items(basics::CMySQLConnection& dbcon1, CItemList<SZ>& list)
+	{
+		size_t i;
+		list.clear();
+		for(i=0; dbcon1 && i<SZ; ++dbcon1, ++i)
+		{
+			list.slot[i]		= CSQLValue(dbcon1[0]);
+			list.nameid[i]		= CSQLValue(dbcon1[1]);
+			list.amount[i]		= CSQLValue(dbcon1[2]);
+			list.equip[i]		= CSQLValue(dbcon1[3]);
+			list.identify[i]	= CSQLValue(dbcon1[4]);
+			list.refine[i]		= CSQLValue(dbcon1[5]);
+			list.attribute[i]	= CSQLValue(dbcon1[6]);
+			list.card[0][i]		= CSQLValue(dbcon1[7]);
+			list.card[1][i]		= CSQLValue(dbcon1[8]);
+			list.card[2][i]		= CSQLValue(dbcon1[9]);
+			list.card[3][i]		= CSQLValue(dbcon1[10]);
+		}
+		list.count = i;
+		list.fix_slots();
+		return i;
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// append the used slots of a compacted item list as insert values.
+	/// pos is the index of the item in the item array (slot[]),
+	/// the column order is owner,pos,nameid,amount,equip,identify,refine,
+	/// attribute,card0,card1,card2,card3; returns the number of rows
+	template<size_t SZ>
+	static size_t insert_items(basics::string<>& query, uint32 owner, const CItemList<SZ>& list)
+	{
+		size_t i;
+		for(i=0; i<list.count; ++i)
+		{
+			query << (i?",":"") <<
+				"("
+				"'" <<	owner						<< "',"
+				"'" <<	list.slot[i]				<< "',"
+				"'" <<	list.nameid[i]				<< "',"
+				"'" <<	list.amount[i]				<< "',"
+				"'" <<	list.equip[i]				<< "',"
+				"'" <<	(int)list.identify[i]		<< "',"
+				"'" <<	(int)list.refine[i]			<< "',"
+				"'" <<	(int)list.attribute[i]		<< "',"
+				"'" <<	list.card[0][i]				<< "',"
+				"'" <<	list.card[1][i]				<< "',"
+				"'" <<	list.card[2][i]				<< "',"
+				"'" <<	list.card[3][i]				<< "'"
+				")";
+		}
+		return i;
+	}
+	///////////////////////////////////////////////////////////////////////////
+	/// save an item list to an item table keyed by (owner,pos).
+	/// dbcon1 is only used for escaping, the statements go to the batch.
+	/// the rows are upserted in place and only the rows of slots that are
+	/// empty now are deleted, so an unchanged list does not touch the table
+	template<size_t SZ>
+	static void save_items(CSQLBatch& batch, basics::CMySQL& base, basics::CMySQLConnection& dbcon1, const basics::string<>& tbl, const char* owner_col, uint32 owner, const CItemList<SZ>& list)
+	{
+		basics::string<> query;
+		if( list.count )
+		{
+			query << "INSERT INTO `" << dbcon1.escaped(tbl) << "` "
+					 "(`" << owner_col << "`,`pos`,";
+			item_names(query);
+			query << ") VALUES ";
+			insert_items(query, owner, list);
+			query << " ON DUPLICATE KEY UPDATE "
+					 "`nameid`=VALUES(`nameid`),"
+					 "`amount`=VALUES(`amount`),"
+					 "`equip`=VALUES(`equip`),"
+					 "`identify`=VALUES(`identify`),"
+					 "`refine`=VALUES(`refine`),"
+					 "`attribute`=VALUES(`attribute`),"
+					 "`card0`=VALUES(`card0`),"
+					 "`card1`=VALUES(`card1`),"
+					 "`card2`=VALUES(`card2`),"
+					 "`card3`=VALUES(`card3`)";
+			batch.add(base, query);
+			query.clear();
+		}
+		query << "DELETE "
+				 "FROM `" << dbcon1.escaped(tbl) << "` "
+				 "WHERE `" << owner_col << "`='" << owner << "'";
+		if( list.count )
+		{
+			size_t i;
+			query << " AND `pos` NOT IN (";
+			for(i=0; i<list.count; ++i)
+				query << (i?",":"") << "'" << list.slot[i] << "'";
+			query << ")";
 		}
-		return 0;
+		batch.add(base, query);
 	}
 	///////////////////////////////////////////////////////////////////////////
 	/// constructor.
 	/// initialize the database on the first run
 	CSQLParameter(const char* configfile)		
 	{
+		++instances;
 		if(configfile) basics::CParamBase::loadFile(configfile);
 		static bool first=true;
 		if(first)
 		{
 			this->rebuild();
 			first = false;
+			journal_open(sql_journal);
 		}
 	}
 public:
 	///////////////////////////////////////////////////////////////////////////
-	/// destructor
-	~CSQLParameter()	{}
+	/// destructor.
+	/// the last object stops the timer thread and closes the journal
+	~CSQLParameter()
+	{
+		if( --instances == 0 )
+		{
+			CSQLTimer::stop();
+			journal_close();
+		}
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// rebuild the tables
@@ -715,17 +1672,128 @@ public:
 class CCharDB_sql : public CCharDBInterface, public CSQLParameter
 {
 public:
-	CCharDB_sql(const char *dbcfgfile) : CSQLParameter(dbcfgfile)
+	CCharDB_sql(const char *dbcfgfile) : CSQLParameter(dbcfgfile),
+		save_job(NULL), save_heap(NULL), save_pos(NULL), save_next(NULL), save_bucket(NULL),
+		save_cnt(0), save_max(0), save_mask(0), save_tokens(0), save_stamp(0), save_spool(NULL),
+		warm_acc(NULL), warm_acc_cnt(0)
 	{
 		init(dbcfgfile);
 	}
 	virtual ~CCharDB_sql()
-	{}
+	{
+		close();
+	}
 protected:
 	///////////////////////////////////////////////////////////////////////////
 	// normal function
 	bool init(const char* configfile);
-	bool close(){ return true; }
+	bool close();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// save scheduler.
+	/// saveChar only queues the char, the queue is written to the database
+	/// by a token bucket of "char_save_rate" saves per second, so the
+	/// autosaves of the map servers are spread out instead of hitting the
+	/// database at once. the most urgent job goes first, that is the one
+	/// waiting longest, where each save merged into a pending job counts as
+	/// "char_save_dirty_bonus" seconds of waiting.
+	/// no job waits longer than "char_save_delay" seconds.
+	/// the queue is drained by the sql timer once a second. every queued
+	/// char is written to its slot in the "char_save_spool" file before
+	/// saveChar returns and the slot is cleared after the database write,
+	/// a spool left by a crash is queued again on startup. without a
+	/// spool the queue is off and every save is written at once
+	static basics::CParam< basics::string<> > char_save_spool;
+	static basics::CParam<uint32> char_save_queue;
+	static basics::CParam<uint32> char_save_rate;
+	static basics::CParam<uint32> char_save_burst;
+	static basics::CParam<uint32> char_save_delay;
+	static basics::CParam<uint32> char_save_dirty_bonus;
+
+	struct savejob
+	{
+		CCharCharacter	data;	///< latest state of the char
+		time_t			queued;	///< time of the oldest pending change
+		uint32			dirty;	///< number of saves merged into the job
+	};
+	savejob*	save_job;		///< job slots
+	size_t*		save_heap;		///< slot numbers, [0,save_cnt[ is the heap, the rest are free
+	size_t*		save_pos;		///< heap position of each slot
+	size_t*		save_next;		///< next slot in the same bucket, save_max ends
+	size_t*		save_bucket;	///< first slot of each char_id bucket, save_max when empty
+	size_t		save_cnt;		///< number of queued jobs
+	size_t		save_max;		///< number of slots
+	size_t		save_mask;		///< number of buckets -1
+	double		save_tokens;	///< tokens in the bucket
+	time_t		save_stamp;		///< last refill of the bucket
+	FILE*		save_spool;		///< spool file of the slots
+	CSQLMutex	save_mutex;		///< guards the queue against the timer
+
+	CSQLStatement	char_stmt;		///< char row by char_id
+	CSQLStatement	account_stmt;	///< account row by account_id
+
+	/// true when job a is more urgent than job b
+	bool save_before(size_t a, size_t b) const;
+	/// exchange the jobs at heap positions a and b
+	void save_swap(size_t a, size_t b);
+	/// restore the heap from position k up/downwards
+	void save_up(size_t k);
+	void save_down(size_t k);
+	/// heap position of the job of a char or save_cnt when not queued
+	size_t save_find(uint32 char_id) const;
+	/// put the job in a free slot into the heap and the char_id index
+	void save_push(size_t slot);
+	/// remove the job at heap position k from the queue and write it,
+	/// a job that could not be written stays queued
+	bool save_pop(size_t k, bool write);
+	/// write a slot to the spool, or clear it there
+	bool spool_write(size_t slot);
+	void spool_clear(size_t slot);
+	/// open the spool and queue what a crash left in it
+	bool spool_open();
+	/// timer callback
+	static void save_timer(void* obj);
+
+	/// write a char to the database
+	bool writeChar(const CCharCharacter& data);
+public:
+	///////////////////////////////////////////////////////////////////////////
+	/// save a char, immediate skips the queue (logout, trade, storage close)
+	bool saveChar(const CCharCharacter& data, bool immediate);
+	/// write the pending save of a char now
+	bool flushChar(uint32 char_id);
+	/// write the queued saves the token bucket allows,
+	/// or all queued saves when all is set; returns the number written
+	size_t flushSaves(bool all=false);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// register the startup tasks: the fame lists, the char lists and the
+	/// char registers of the recently active accounts
+	void warmup(CSQLWarmup& w);
+private:
+	/// load one fame list
+	void loadfame(size_t i, basics::CMySQL& base);
+	static bool warm_fame(void* obj, size_t i);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// char lists of the recently active accounts.
+	/// filled by the warm-up, searchAccount takes the chars of these
+	/// accounts from here instead of the char table. only the char server
+	/// changes the char list, insertChar and removeChar keep it in step.
+	/// the account rows and registers are read every time, the login
+	/// server changes them with each login
+	struct warm_account
+	{
+		uint32	account_id;
+		uint32	charlist[9];
+	};
+	warm_account*	warm_acc;		///< sorted by account_id
+	size_t			warm_acc_cnt;
+	CSQLMutex		warm_mutex;		///< the list is built on a warm-up thread
+
+	warm_account* warm_find(uint32 accid);
+	static bool warm_accounts(void* obj, size_t arg);
+	static bool warm_registers(void* obj, size_t arg);
 
 public:
 	///////////////////////////////////////////////////////////////////////////
@@ -763,7 +1831,8 @@ class CGuildDB_sql : public CGuildDBInterface, public CSQLParameter
 public:
 	///////////////////////////////////////////////////////////////////////////
 	// construct/destruct
-	CGuildDB_sql(const char *dbcfgfile) : CSQLParameter(dbcfgfile)
+	CGuildDB_sql(const char *dbcfgfile) : CSQLParameter(dbcfgfile),
+		warm_guild(NULL), warm_guild_cnt(0), warm_guild_cap(0)
 	{
 		this->init(dbcfgfile);
 	}
@@ -778,10 +1847,47 @@ private:
 	bool init(const char* configfile);
 	bool close()
 	{
+		this->warm_drop(0);
 		return true;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// resident castles.
+	/// there are only MAX_GUILDCASTLE castles and the map servers ask for
+	/// them all at once on connect, so they are kept here after the first
+	/// load; saveCastle writes through.
+	CCastle	castle_cache[MAX_GUILDCASTLE];
+	bool	castle_cached[MAX_GUILDCASTLE];
+
+	/// load all castles into the cache
+	bool loadCastles();
+	static bool warm_castles(void* obj, size_t arg);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// guilds read by the warm-up, with their aggregates.
+	/// each one is handed out by the first searchGuild and dropped then,
+	/// saveGuild and removeGuild drop it too, so it is never older than the
+	/// database. connect_member and average_lv are counted from the members,
+	/// the stored columns are only as recent as the last guild save.
+	/// the guilds are split on "WARM_GUILD_TASKS" tasks by guild_id
+	enum { WARM_GUILD_TASKS = 4 };
+	CGuild**	warm_guild;		///< sorted by guild_id
+	size_t		warm_guild_cnt;
+	size_t		warm_guild_cap;
+	CSQLMutex	warm_mutex;		///< filled by several warm-up threads
+
+	/// read a guild from the database
+	bool loadGuild(uint32 guild_id, CGuild& g);
+	/// take a guild out of the warm-up cache, false when not there
+	bool warm_take(uint32 guild_id, CGuild* g);
+	/// drop a guild from the warm-up cache, 0 drops all
+	void warm_drop(uint32 guild_id);
+	static bool warm_guilds(void* obj, size_t arg);
 public:
+	///////////////////////////////////////////////////////////////////////////
+	/// register the startup tasks: the castles and the guilds
+	void warmup(CSQLWarmup& w);
+
 	///////////////////////////////////////////////////////////////////////////
 	// access interface
 	virtual size_t size() const;
@@ -821,14 +1927,31 @@ public:
 	{
 		close();
 	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// resident parties.
+	/// all parties and their members are read at startup and served from
+	/// memory, a char_id to party_id index follows the party_id of every
+	/// char save, and a name index serves the search by name.
+	/// inserts and removes go to the database at once, the changed
+	/// parties of saveParty are listed and written together after
+	/// "party_save_delay" seconds by flushParties on the sql timer, or on
+	/// every save when the timer does not run.
+	/// a party stays listed until its write is committed.
+	/// membership itself is stored with the chars.
+	static basics::CParam<uint32> party_save_delay;
+
+	/// write the pending party changes, the overdue ones or all;
+	/// returns the number of parties written
+	size_t flushParties(bool all=false);
 private:
+	static void flush_timer(void* obj);
+
 	///////////////////////////////////////////////////////////////////////////
 	// normal function
 	bool init(const char* configfile);
-	bool close()
-	{
-		return true;
-	}
+	bool close();
+	bool load();
 	///////////////////////////////////////////////////////////////////////////
 	// access interface
 	virtual size_t size() const;
@@ -970,6 +2093,10 @@ public:
 	virtual bool insertHomunculus(CHomunculus& hom);
 	virtual bool removeHomunculus(uint32 hid);
 	virtual bool saveHomunculus(const CHomunculus& hom);
+private:
+	static const CSQLColumnMap<CHomunculus> columns;
+	bool loadSkills(basics::CMySQLConnection& dbcon1, CHomunculus& hom);
+	bool saveSkills(basics::CMySQLConnection& dbcon1, const CHomunculus& hom);
 };
 
 
@@ -0,0 +1,145 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#include "gat.h"
+#include <string.h>
+
+using namespace NGAT;
+
+/// Cells decoded per read
+enum { ChunkRecords = 512 };
+
+static inline FXuint GATReadUInt(const FXuchar* p)
+{
+	return (FXuint)p[0] | ((FXuint)p[1]<<8) | ((FXuint)p[2]<<16) | ((FXuint)p[3]<<24);
+}
+static inline FXfloat GATReadFloat(const FXuchar* p)
+{
+	FXuint u = GATReadUInt(p);
+	FXfloat f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+
+GAT::GAT() : width(0), height(0), heights(NULL), types(NULL)
+{
+	memcpy(magic, "GRAT", 4);
+	major_ver = 1;
+	minor_ver = 2;
+}
+
+GAT::~GAT()
+{
+	clear();
+}
+
+/// Free the cells, heights and types share one block
+void GAT::clear()
+{
+	if( heights )
+		fxfree((void**)&heights);
+	heights = NULL;
+	types = NULL;
+	width = 0;
+	height = 0;
+}
+
+/// If this GAT is compatible with the target version (version >= target)
+bool GAT::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
+{
+	return ( ( this->major_ver == major_ver && this->minor_ver >= minor_ver ) || this->major_ver > major_ver );
+}
+
+/// Load GAT from a stream
+FXStream& operator>>(FXStream& store, GAT& gat)
+{
+	gat.load(store);
+	return store;
+}
+bool GAT::load(FXStream& store)
+{
+	bool bigEndian = store.isBigEndian();
+	FXuchar chunk[ChunkRecords*CellRecordSize];
+	FXint i, k, n;
+
+	clear();
+	store.setBigEndian(false);// data is in little endian
+	store.load(magic, 4);
+	store >> major_ver;
+	store >> minor_ver;
+	store >> width;
+	store >> height;
+	if( memcmp(magic, "GRAT", 4) != 0 || store.status() != FXStreamOK ||
+		width < 0 || height < 0 || (width && height > 0x7FFFFFFF/CellRecordSize/width) )
+	{
+		fxwarning("not a GAT file or corrupt header (%dx%d cells)\n", width, height);
+		width = height = 0;
+		store.setBigEndian(bigEndian);
+		return false;
+	}
+	const FXint cells = width*height;
+	if( !fxmalloc((void**)&heights, cells*(4*sizeof(FXfloat) + sizeof(FXint)) + 1) )
+	{
+		fxwarning("GAT out of memory for %dx%d cells\n", width, height);
+		width = height = 0;
+		store.setBigEndian(bigEndian);
+		return false;
+	}
+	types = (FXint*)(heights + 4*cells);
+	for( i = 0; i < cells; i += n )
+	{
+		n = ( cells - i < ChunkRecords ) ? cells - i : (FXint)ChunkRecords;
+		store.load(chunk, n*CellRecordSize);
+		for( k = 0; k < n; ++k )
+		{
+			const FXuchar* p = chunk + k*CellRecordSize;
+			FXfloat* h = heights + 4*(i + k);
+			h[0] = GATReadFloat(p);	h[1] = GATReadFloat(p+4);	h[2] = GATReadFloat(p+8);	h[3] = GATReadFloat(p+12);
+			types[i + k] = (FXint)GATReadUInt(p+16);
+		}
+	}
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+	if( store.status() != FXStreamOK )
+	{// the cells past the end would be garbage
+		fxwarning("GAT is truncated\n");
+		clear();
+		return false;
+	}
+	return true;
+}
+
+/// Save GAT to a stream
+FXStream& operator<<(FXStream& store, const GAT& gat)
+{
+	gat.save(store);
+	return store;
+}
+void GAT::save(FXStream& store) const
+{
+	bool bigEndian = store.isBigEndian();
+	store.setBigEndian(false);// data is in little endian
+	store.save(magic, 4);
+	store << major_ver;
+	store << minor_ver;
+	store << width;
+	store << height;
+	const FXint cells = width*height;
+	for( FXint i = 0; i < cells; ++i )
+	{
+		store.save(heights + 4*i, 4);
+		store << types[i];
+	}
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+}
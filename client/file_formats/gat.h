@@ -0,0 +1,92 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#ifndef _GAT_H_
+#define _GAT_H_
+
+#include "fx.h"
+
+//-----------------------------------------------------------------------------
+namespace NGAT {
+//-----------------------------------------------------------------------------
+// 1.2 - base supported version
+//
+// [ Header ]
+// magic "GRAT", major 1, minor 2, width (int), height (int)
+// { * width*height
+//   [ Cell ] sizeof=20
+//   height[4] (float) south west, south east, north west, north east, y is down
+//   type (int)
+// }
+
+/// Cell types
+enum CellType
+{
+	WalkableCell = 0,
+	BlockedCell = 1,
+	WalkableCell2 = 2,// walkable, meaning unknown
+	WaterCell = 3,// walkable water
+	WalkableCell4 = 4,// walkable, meaning unknown
+	GapCell = 5,// not walkable, can be shot over
+	WalkableCell6 = 6// walkable, meaning unknown
+};
+
+enum RecordSize
+{
+	CellRecordSize = 20
+};
+
+/// Altitude (server cells, 2 per ground cell in each direction)
+struct GAT
+{
+	FXchar magic[4];// "GRAT"
+	FXchar major_ver;
+	FXchar minor_ver;
+	FXint width;
+	FXint height;
+	FXfloat* heights;// 4 per cell, row by row
+	FXint* types;// CellType of each cell
+
+	GAT();
+	~GAT();
+
+	/// Free the cells
+	void clear();
+
+	/// If this GAT is compatible with the target version (version >= target)
+	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
+
+	/// Average height of a cell
+	FXfloat cellHeight(FXint i) const	{ return (heights[4*i] + heights[4*i+1] + heights[4*i+2] + heights[4*i+3])*0.25f; }
+	static bool isWalkable(FXint type)	{ return type != BlockedCell && type != GapCell; }
+	static bool isShootable(FXint type)	{ return type != BlockedCell; }
+
+	/// Read the cells, false and empty when it is not a GAT or truncated
+	bool load(FXStream& store);
+	void save(FXStream& store) const;
+
+	friend FXStream& operator>>(FXStream& store,GAT& gat);
+	friend FXStream& operator<<(FXStream& store,const GAT& gat);
+
+private:
+	GAT(const GAT&);
+	GAT& operator=(const GAT&);
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NGAT
+//-----------------------------------------------------------------------------
+
+#endif // _GAT_H_
@@ -0,0 +1,486 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Special thanks to:
+**    http://www.vsoftonline.com/blog/?page_id=58
+**
+** $Id$
+*/
+#include "gnd.h"
+#include <string.h>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#define GND_SSSE3
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GND_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace NGND;
+// 1.6 - indexed lightmaps with color channels, 2 byte surface ids in the cells
+// 1.7 - 8x8 brightness and color lightmaps, 4 byte surface ids in the cells
+
+/// Records decoded per read, the surfaces and cells come in blocks of this many
+enum { ChunkRecords = 512 };
+
+/// little endian field readers, the records are not aligned
+static inline FXuint GNDReadUInt(const FXuchar* p)
+{
+	return (FXuint)p[0] | ((FXuint)p[1]<<8) | ((FXuint)p[2]<<16) | ((FXuint)p[3]<<24);
+}
+static inline FXfloat GNDReadFloat(const FXuchar* p)
+{
+	FXuint u = GNDReadUInt(p);
+	FXfloat f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+static inline FXushort GNDReadUShort(const FXuchar* p)
+{
+	return (FXushort)(p[0] | (p[1]<<8));
+}
+
+//-----------------------------------------------------------------------------
+// GND
+
+GND::GND()
+: width(0)
+, height(0)
+, zoom(10.0f)
+, texture_count(0)
+, texture_name_size(0)
+, texture_names(NULL)
+, lightmap_count(0)
+, lightmap_width(LightmapSize)
+, lightmap_height(LightmapSize)
+, lightmap_cells(1)
+, lightmaps(NULL)
+, lightmap_index(NULL)
+, channel_count(0)
+, channels(NULL)
+, surface_count(0)
+, surface_u(NULL)
+, surface_v(NULL)
+, surface_texture(NULL)
+, surface_lightmap(NULL)
+, surface_color(NULL)
+, cell_height(NULL)
+, cell_top(NULL)
+, cell_front(NULL)
+, cell_right(NULL)
+{
+	memcpy(magic, "GRGN", 4);
+	major_ver = 1;
+	minor_ver = 7;
+}
+
+GND::~GND()
+{
+	clear();
+}
+
+/// Free the arrays, the fields of a section share one block
+void GND::clear()
+{
+	if( texture_names )
+		fxfree((void**)&texture_names);
+	if( lightmaps )
+		fxfree((void**)&lightmaps);
+	if( lightmap_index )
+		fxfree((void**)&lightmap_index);
+	if( channels )
+		fxfree((void**)&channels);
+	if( surface_u )
+		fxfree((void**)&surface_u);
+	if( cell_height )
+		fxfree((void**)&cell_height);
+	texture_names = NULL;
+	lightmaps = NULL;
+	lightmap_index = NULL;
+	channels = NULL;
+	surface_u = NULL;
+	surface_v = NULL;
+	surface_texture = NULL;
+	surface_lightmap = NULL;
+	surface_color = NULL;
+	cell_height = NULL;
+	cell_top = NULL;
+	cell_front = NULL;
+	cell_right = NULL;
+	texture_count = 0;
+	lightmap_count = 0;
+	channel_count = 0;
+	surface_count = 0;
+	width = 0;
+	height = 0;
+}
+
+/// If this GND is compatible with the target version (version >= target)
+bool GND::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
+{
+	return ( ( this->major_ver == major_ver && this->minor_ver >= minor_ver ) || this->major_ver > major_ver );
+}
+
+/// Load GND from a stream
+FXStream& operator>>(FXStream& store, GND& gnd)
+{
+	gnd.load(store);
+	return store;
+}
+void GND::load(FXStream& store)
+{
+	bool bigEndian = store.isBigEndian();
+	FXuchar chunk[ChunkRecords*SurfaceRecordSize];
+	FXint i, k, n;
+
+	clear();
+	store.setBigEndian(false);// data is in little endian
+	store.load(magic, 4);
+	store >> major_ver;
+	store >> minor_ver;
+	if( memcmp(magic, "GRGN", 4) != 0 || !IsCompatibleWith(1,6) )
+	{
+		fxwarning("not a GND 1.6/1.7 file (alpha GND is not supported)\n");
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	store >> width;
+	store >> height;
+	store >> zoom;
+	store >> texture_count;
+	store >> texture_name_size;
+	if( width < 0 || height < 0 || (width && height > 0x7FFFFFFF/CellRecordSize/width) ||
+		texture_count < 0 || texture_name_size <= 0 || texture_name_size > 1024 || store.status() != FXStreamOK )
+	{
+		fxwarning("GND header is corrupt (%dx%d cells, %d textures of %d bytes)\n", width, height, texture_count, texture_name_size);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+
+	// textures
+	if( !fxmalloc((void**)&texture_names, texture_count*texture_name_size + 1) )
+	{
+		fxwarning("GND out of memory for %d textures\n", texture_count);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	store.load(texture_names, texture_count*texture_name_size);
+	for( i = 0; i < texture_count; ++i )
+		texture_names[i*texture_name_size + texture_name_size - 1] = 0;
+
+	// lightmaps
+	store >> lightmap_count;
+	store >> lightmap_width;
+	store >> lightmap_height;
+	store >> lightmap_cells;
+	if( lightmap_count < 0 || lightmap_count > 0x7FFFFFFF/LightmapRecordSize )
+		lightmap_count = 0;
+	if( lightmap_width != LightmapSize || lightmap_height != LightmapSize || lightmap_cells != 1 )
+		fxwarning("GND lightmaps are %dx%d with %d cells, 8x8 with 1 cell assumed\n", lightmap_width, lightmap_height, lightmap_cells);
+	if( IsCompatibleWith(1,7) )
+	{
+		if( !fxmalloc((void**)&lightmaps, lightmap_count*LightmapRecordSize + 1) )
+		{
+			fxwarning("GND out of memory for %d lightmaps\n", lightmap_count);
+			clear();
+			store.setBigEndian(bigEndian);
+			return;
+		}
+		store.load(lightmaps, lightmap_count*LightmapRecordSize);
+	}
+	else
+	{
+		if( !fxmalloc((void**)&lightmap_index, lightmap_count*4*sizeof(FXuint) + 1) )
+		{
+			fxwarning("GND out of memory for %d lightmaps\n", lightmap_count);
+			clear();
+			store.setBigEndian(bigEndian);
+			return;
+		}
+		for( i = 0; i < lightmap_count; i += n )
+		{
+			n = ( lightmap_count - i < ChunkRecords ) ? lightmap_count - i : (FXint)ChunkRecords;
+			store.load(chunk, n*LightmapIndexRecordSize);
+			for( k = 0; k < 4*n; ++k )
+				lightmap_index[4*i + k] = GNDReadUInt(chunk + 4*k);
+		}
+		store >> channel_count;
+		if( channel_count < 0 || channel_count > 0x7FFFFFFF/ColorChannelRecordSize )
+			channel_count = 0;
+		if( !fxmalloc((void**)&channels, channel_count*ColorChannelRecordSize + 1) )
+		{
+			fxwarning("GND out of memory for %d color channels\n", channel_count);
+			clear();
+			store.setBigEndian(bigEndian);
+			return;
+		}
+		store.load(channels, channel_count*ColorChannelRecordSize);
+	}
+
+	// surfaces, one block: u, v, color, texture, lightmap
+	store >> surface_count;
+	if( surface_count < 0 || surface_count > 0x7FFFFFFF/SurfaceRecordSize || store.status() != FXStreamOK )
+	{
+		fxwarning("GND surface count %d is corrupt\n", surface_count);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	if( !fxmalloc((void**)&surface_u, surface_count*SurfaceRecordSize + 1) )
+	{
+		fxwarning("GND out of memory for %d surfaces\n", surface_count);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	surface_v = surface_u + 4*surface_count;
+	surface_color = (FXuint*)(surface_v + 4*surface_count);
+	surface_texture = (FXshort*)(surface_color + surface_count);
+	surface_lightmap = (FXushort*)(surface_texture + surface_count);
+	for( i = 0; i < surface_count; i += n )
+	{
+		n = ( surface_count - i < ChunkRecords ) ? surface_count - i : (FXint)ChunkRecords;
+		store.load(chunk, n*SurfaceRecordSize);
+		for( k = 0; k < n; ++k )
+		{
+			const FXuchar* p = chunk + k*SurfaceRecordSize;
+			FXfloat* u = surface_u + 4*(i + k);
+			FXfloat* v = surface_v + 4*(i + k);
+			u[0] = GNDReadFloat(p);		u[1] = GNDReadFloat(p+4);	u[2] = GNDReadFloat(p+8);	u[3] = GNDReadFloat(p+12);
+			v[0] = GNDReadFloat(p+16);	v[1] = GNDReadFloat(p+20);	v[2] = GNDReadFloat(p+24);	v[3] = GNDReadFloat(p+28);
+			surface_texture[i + k] = (FXshort)GNDReadUShort(p+32);
+			surface_lightmap[i + k] = GNDReadUShort(p+34);
+			surface_color[i + k] = GNDReadUInt(p+36);
+		}
+	}
+
+	// cells, one block: heights, top, front, right
+	const FXint cells = width*height;
+	const FXint cell_size = IsCompatibleWith(1,7) ? CellRecordSize : CellRecordSizeBase;
+	if( !fxmalloc((void**)&cell_height, cells*(4*sizeof(FXfloat) + 3*sizeof(FXint)) + 1) )
+	{
+		fxwarning("GND out of memory for %dx%d cells\n", width, height);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	cell_top = (FXint*)(cell_height + 4*cells);
+	cell_front = cell_top + cells;
+	cell_right = cell_front + cells;
+	for( i = 0; i < cells; i += n )
+	{
+		n = ( cells - i < ChunkRecords ) ? cells - i : (FXint)ChunkRecords;
+		store.load(chunk, n*cell_size);
+		for( k = 0; k < n; ++k )
+		{
+			const FXuchar* p = chunk + k*cell_size;
+			FXfloat* h = cell_height + 4*(i + k);
+			h[0] = GNDReadFloat(p);	h[1] = GNDReadFloat(p+4);	h[2] = GNDReadFloat(p+8);	h[3] = GNDReadFloat(p+12);
+			if( cell_size == CellRecordSize )
+			{
+				cell_top[i + k] = (FXint)GNDReadUInt(p+16);
+				cell_front[i + k] = (FXint)GNDReadUInt(p+20);
+				cell_right[i + k] = (FXint)GNDReadUInt(p+24);
+			}
+			else
+			{
+				cell_top[i + k] = (FXshort)GNDReadUShort(p+16);
+				cell_front[i + k] = (FXshort)GNDReadUShort(p+18);
+				cell_right[i + k] = (FXshort)GNDReadUShort(p+20);
+			}
+		}
+	}
+	if( store.status() != FXStreamOK )
+		fxwarning("GND is truncated\n");
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+}
+
+/// Save GND to a stream
+FXStream& operator<<(FXStream& store, const GND& gnd)
+{
+	gnd.save(store);
+	return store;
+}
+void GND::save(FXStream& store) const
+{
+	bool bigEndian = store.isBigEndian();
+	FXint i;
+
+	store.setBigEndian(false);// data is in little endian
+	store.save(magic, 4);
+	store << major_ver;
+	store << minor_ver;
+	store << width;
+	store << height;
+	store << zoom;
+	store << texture_count;
+	store << texture_name_size;
+	store.save(texture_names, texture_count*texture_name_size);
+	store << lightmap_count;
+	store << lightmap_width;
+	store << lightmap_height;
+	store << lightmap_cells;
+	if( IsCompatibleWith(1,7) )
+		store.save(lightmaps, lightmap_count*LightmapRecordSize);
+	else
+	{
+		store.save(lightmap_index, 4*lightmap_count);
+		store << channel_count;
+		store.save(channels, channel_count*ColorChannelRecordSize);
+	}
+	store << surface_count;
+	for( i = 0; i < surface_count; ++i )
+	{
+		store.save(surface_u + 4*i, 4);
+		store.save(surface_v + 4*i, 4);
+		store << surface_texture[i];
+		store << surface_lightmap[i];
+		store << surface_color[i];
+	}
+	const FXint cells = width*height;
+	for( i = 0; i < cells; ++i )
+	{
+		store.save(cell_height + 4*i, 4);
+		if( IsCompatibleWith(1,7) )
+		{
+			store << cell_top[i];
+			store << cell_front[i];
+			store << cell_right[i];
+		}
+		else
+		{
+			store << (FXshort)cell_top[i];
+			store << (FXshort)cell_front[i];
+			store << (FXshort)cell_right[i];
+		}
+	}
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+}
+
+//-----------------------------------------------------------------------------
+// Lightmap atlas
+
+LightmapAtlas::LightmapAtlas() : width(0), height(0), tiles_per_row(1), pixels(NULL)
+{
+}
+
+LightmapAtlas::~LightmapAtlas()
+{
+	clear();
+}
+
+void LightmapAtlas::clear()
+{
+	if( pixels )
+		fxfree((void**)&pixels);
+	pixels = NULL;
+	width = 0;
+	height = 0;
+	tiles_per_row = 1;
+}
+
+/// Interleave 4 pixels: 4 brightness bytes and 12 color bytes become 4 rgba words.
+/// the bytes are moved inside 32 bit words, the readers compile to plain loads
+static inline void GNDPack4(FXuint* dst, const FXuchar* brightness, const FXuchar* rgb)
+{
+	const FXuint a = GNDReadUInt(brightness);
+	const FXuint w0 = GNDReadUInt(rgb);// r0 g0 b0 r1
+	const FXuint w1 = GNDReadUInt(rgb+4);// g1 b1 r2 g2
+	const FXuint w2 = GNDReadUInt(rgb+8);// b2 r3 g3 b3
+	dst[0] = (w0&0x00FFFFFF) | (a<<24);
+	dst[1] = (w0>>24) | ((w1&0x0000FFFF)<<8) | ((a<<16)&0xFF000000);
+	dst[2] = (w1>>16) | ((w2&0x000000FF)<<16) | ((a<<8)&0xFF000000);
+	dst[3] = (w2>>8) | (a&0xFF000000);
+}
+
+/// Interleave a lightmap row: 8 brightness bytes and 24 color bytes become 8 rgba words.
+/// the two color loads overlap, so nothing past the row is read
+static inline void GNDPack8(FXuint* dst, const FXuchar* brightness, const FXuchar* rgb)
+{
+#if defined(GND_SSSE3)
+	const __m128i lo = _mm_loadu_si128((const __m128i*)rgb);// pixels 0-3 in bytes 0-11
+	const __m128i hi = _mm_loadu_si128((const __m128i*)(rgb + 8));// pixels 4-7 in bytes 4-15
+	const __m128i a = _mm_loadl_epi64((const __m128i*)brightness);
+	const __m128i color_lo = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+	const __m128i color_hi = _mm_setr_epi8(4,5,6,-1, 7,8,9,-1, 10,11,12,-1, 13,14,15,-1);
+	const __m128i alpha_lo = _mm_setr_epi8(-1,-1,-1,0, -1,-1,-1,1, -1,-1,-1,2, -1,-1,-1,3);
+	const __m128i alpha_hi = _mm_setr_epi8(-1,-1,-1,4, -1,-1,-1,5, -1,-1,-1,6, -1,-1,-1,7);
+	_mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_shuffle_epi8(lo, color_lo), _mm_shuffle_epi8(a, alpha_lo)));
+	_mm_storeu_si128((__m128i*)(dst + 4), _mm_or_si128(_mm_shuffle_epi8(hi, color_hi), _mm_shuffle_epi8(a, alpha_hi)));
+#elif defined(GND_SSE2)
+	// pixel k of a group moves up by k bytes, each shift keeps one pixel
+	const __m128i m0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+	const __m128i m1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+	const __m128i m2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+	const __m128i m3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo = _mm_loadu_si128((const __m128i*)rgb);
+	const __m128i hi = _mm_srli_si128(_mm_loadu_si128((const __m128i*)(rgb + 8)), 4);
+	const __m128i a = _mm_unpacklo_epi8(zero, _mm_loadl_epi64((const __m128i*)brightness));// brightness in the high byte of 8 words
+	__m128i c0 = _mm_or_si128(_mm_and_si128(lo, m0), _mm_and_si128(_mm_slli_si128(lo, 1), m1));
+	__m128i c1 = _mm_or_si128(_mm_and_si128(hi, m0), _mm_and_si128(_mm_slli_si128(hi, 1), m1));
+	c0 = _mm_or_si128(c0, _mm_or_si128(_mm_and_si128(_mm_slli_si128(lo, 2), m2), _mm_and_si128(_mm_slli_si128(lo, 3), m3)));
+	c1 = _mm_or_si128(c1, _mm_or_si128(_mm_and_si128(_mm_slli_si128(hi, 2), m2), _mm_and_si128(_mm_slli_si128(hi, 3), m3)));
+	_mm_storeu_si128((__m128i*)dst, _mm_or_si128(c0, _mm_unpacklo_epi16(zero, a)));
+	_mm_storeu_si128((__m128i*)(dst + 4), _mm_or_si128(c1, _mm_unpackhi_epi16(zero, a)));
+#else
+	GNDPack4(dst, brightness, rgb);
+	GNDPack4(dst + 4, brightness + 4, rgb + 12);
+#endif
+}
+
+/// Tiles in rows of a power of two, the color bytes are taken in file order (rgb)
+bool LightmapAtlas::build(const GND& gnd)
+{
+	clear();
+	const FXint count = gnd.lightmap_count;
+	if( count <= 0 || gnd.lightmaps == NULL )
+		return false;
+	while( tiles_per_row*tiles_per_row < count )
+		tiles_per_row <<= 1;
+	const FXint rows = (count + tiles_per_row - 1)/tiles_per_row;
+	width = tiles_per_row*LightmapSize;
+	height = LightmapSize;
+	while( height < rows*LightmapSize )
+		height <<= 1;
+	if( !fxmalloc((void**)&pixels, width*height*sizeof(FXuint)) )
+	{
+		fxwarning("GND out of memory for a %dx%d lightmap atlas\n", width, height);
+		clear();
+		return false;
+	}
+	if( rows*LightmapSize < height )
+		memset(pixels + rows*LightmapSize*width, 0, (height - rows*LightmapSize)*width*sizeof(FXuint));
+	if( count < rows*tiles_per_row )
+	{// unused tiles of the last row
+		const FXint x0 = (count%tiles_per_row)*LightmapSize;
+		for( FXint y = (rows - 1)*LightmapSize; y < rows*LightmapSize; ++y )
+			memset(pixels + y*width + x0, 0, (width - x0)*sizeof(FXuint));
+	}
+	for( FXint i = 0; i < count; ++i )
+	{
+		const FXuchar* brightness = gnd.lightmaps + i*LightmapRecordSize;
+		const FXuchar* rgb = brightness + LightmapPixels;
+		FXint x, y;
+		tileOrigin(i, x, y);
+		FXuint* dst = pixels + y*width + x;
+		for( FXint row = 0; row < LightmapSize; ++row, dst += width, brightness += LightmapSize, rgb += 3*LightmapSize )
+		{
+			GNDPack8(dst, brightness, rgb);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,139 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Special thanks to:
+**    http://www.vsoftonline.com/blog/?page_id=58
+**
+** $Id$
+*/
+#ifndef _GND_H_
+#define _GND_H_
+
+#include "fx.h"
+
+//-----------------------------------------------------------------------------
+namespace NGND {
+//-----------------------------------------------------------------------------
+// 1.6 - indexed lightmaps with color channels, 2 byte surface ids in the cells
+// 1.7 - 8x8 brightness and color lightmaps, 4 byte surface ids in the cells
+
+enum RecordSize
+{
+	LightmapSize = 8,// lightmaps are 8x8
+	LightmapPixels = LightmapSize*LightmapSize,
+	LightmapRecordSize = 4*LightmapPixels,// brightness[64] then rgb[64][3]
+	LightmapIndexRecordSize = 16,// (version 1.6)
+	ColorChannelRecordSize = 40,// (version 1.6)
+	SurfaceRecordSize = 40,
+	CellRecordSize = 28,
+	CellRecordSizeBase = 22// (version 1.6)
+};
+
+/// Ground - 1.6 and 1.7
+/// The surfaces and cells are kept as one array per field.
+struct GND
+{
+	FXchar magic[4];// "GRGN"
+	FXchar major_ver;
+	FXchar minor_ver;
+	FXint width;// cells in x
+	FXint height;// cells in y
+	FXfloat zoom;// cell size, default 10.0f
+
+	// textures, texture_count names of texture_name_size bytes each
+	FXint texture_count;
+	FXint texture_name_size;
+	FXchar* texture_names;
+
+	// lightmaps
+	FXint lightmap_count;
+	FXint lightmap_width;// must be 8
+	FXint lightmap_height;// must be 8
+	FXint lightmap_cells;// must be 1
+	FXuchar* lightmaps;// lightmap_count records as in the file (version >= 1.7)
+	FXuint* lightmap_index;// a, r, g, b of each lightmap (version 1.6)
+	FXint channel_count;// (version 1.6)
+	FXuchar* channels;// channel_count records of 40 bytes (version 1.6)
+
+	// surfaces
+	FXint surface_count;
+	FXfloat* surface_u;// 4 per surface: south west, south east, north west, north east
+	FXfloat* surface_v;// 4 per surface
+	FXshort* surface_texture;// -1 for none
+	FXushort* surface_lightmap;
+	FXuint* surface_color;// bgra
+
+	// cells, row by row
+	FXfloat* cell_height;// 4 per cell: south west, south east, north west, north east
+	FXint* cell_top;// surface index, -1 for none
+	FXint* cell_front;
+	FXint* cell_right;
+
+	GND();
+	~GND();
+
+	/// Free the arrays
+	void clear();
+
+	/// If this GND is compatible with the target version (version >= target)
+	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
+
+	const FXchar* textureName(FXint i) const	{ return texture_names + i*texture_name_size; }
+	FXint cellCount() const						{ return width*height; }
+
+	void load(FXStream& store);
+	void save(FXStream& store) const;
+
+	friend FXStream& operator>>(FXStream& store,GND& gnd);
+	friend FXStream& operator<<(FXStream& store,const GND& gnd);
+
+private:
+	GND(const GND&);
+	GND& operator=(const GND&);
+};
+
+/// Lightmaps of a GND packed in one RGBA texture (version >= 1.7).
+/// each lightmap is a 8x8 tile, the color in rgb and the brightness in alpha
+struct LightmapAtlas
+{
+	FXint width;// pixels, powers of two
+	FXint height;
+	FXint tiles_per_row;
+	FXuint* pixels;// r in the lowest byte
+
+	LightmapAtlas();
+	~LightmapAtlas();
+
+	/// Free the pixels
+	void clear();
+
+	/// Decode and pack the lightmaps, false when there are none or no memory
+	bool build(const GND& gnd);
+
+	/// Top left pixel of the tile of a lightmap
+	void tileOrigin(FXint lightmap, FXint& x, FXint& y) const
+	{
+		x = (lightmap%tiles_per_row)*LightmapSize;
+		y = (lightmap/tiles_per_row)*LightmapSize;
+	}
+
+private:
+	LightmapAtlas(const LightmapAtlas&);
+	LightmapAtlas& operator=(const LightmapAtlas&);
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NGND
+//-----------------------------------------------------------------------------
+
+#endif // _GND_H_
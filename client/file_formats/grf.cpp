@@ -0,0 +1,473 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#include "grf.h"
+#include <string.h>
+
+using namespace NGRF;
+
+static inline FXuint GRFReadUInt(const FXuchar* p)
+{
+	return (FXuint)p[0] | ((FXuint)p[1]<<8) | ((FXuint)p[2]<<16) | ((FXuint)p[3]<<24);
+}
+
+/// Names are looked up without case and with either separator
+static inline FXuchar GRFNameChar(FXuchar c)
+{
+	if( c == '\\' )
+		return '/';
+	if( c >= 'A' && c <= 'Z' )
+		return c - 'A' + 'a';
+	return c;
+}
+
+/// FNV-1a of a name
+static FXuint GRFNameHash(const FXchar* name)
+{
+	FXuint hash = 2166136261u;
+	for( const FXuchar* p = (const FXuchar*)name; *p; ++p )
+		hash = (hash ^ GRFNameChar(*p))*16777619u;
+	return hash;
+}
+
+static bool GRFNameEqual(const FXchar* a, const FXchar* b)
+{
+	const FXuchar* p = (const FXuchar*)a;
+	const FXuchar* q = (const FXuchar*)b;
+	for( ; *p && GRFNameChar(*p) == GRFNameChar(*q); ++p, ++q )
+		;
+	return ( *p == 0 && *q == 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Compression
+
+// LZSS as grf_alpha.txt describes it: a 4096 byte window, matches of 2 to
+// 17 bytes and the flags in groups of 8 (lowest bit first, 1 is a literal
+// byte). A match is 2 bytes: the low 8 bits of the ring position, then the
+// high 4 bits and the length - 2 in the low nibble.
+// grf_alpha.txt leaves the ring start and fill open. The ring starts at
+// window - longest match and is filled with spaces; grfbench -g checks
+// this against the entries of an existing archive.
+enum
+{
+	LZSSWindow = 4096,
+	LZSSMinMatch = 2,
+	LZSSMaxMatch = 15 + LZSSMinMatch,
+	LZSSRingStart = LZSSWindow - LZSSMaxMatch,
+	LZSSRingFill = ' '
+};
+
+/// Decoding straight into dst: the ring position of output byte o is
+/// (LZSSRingStart + o) mod LZSSWindow, so a match is a copy from dist bytes
+/// back and the bytes before the output are the ring fill.
+FXuint NGRF::GRFDecompress(const FXuchar* src, FXuint src_len, FXuchar* dst, FXuint dst_len)
+{
+	FXuint in = 0, out = 0;
+
+	while( in < src_len && out < dst_len )
+	{
+		FXuint flags = src[in++];
+		if( flags == 0xFF && in + 8 <= src_len && out + 8 <= dst_len )
+		{// 8 literals
+			memcpy(dst + out, src + in, 8);
+			in += 8;
+			out += 8;
+			continue;
+		}
+		if( in + 16 <= src_len && out + 8*LZSSMaxMatch <= dst_len && out >= LZSSWindow )
+		{// the whole group fits, no bounds checks and no ring fill
+			for( FXint bit = 0; bit < 8; ++bit, flags >>= 1 )
+			{
+				if( flags & 1 )
+				{
+					dst[out++] = src[in++];
+					continue;
+				}
+				const FXuint pos = src[in] | ((FXuint)(src[in+1]&0xF0)<<4);
+				const FXuint len = (src[in+1]&0x0F) + LZSSMinMatch;
+				in += 2;
+				FXuint dist = (LZSSRingStart + out - pos)&(LZSSWindow - 1);
+				if( dist == 0 )
+					dist = LZSSWindow;
+				const FXuchar* from = dst + out - dist;
+				if( len <= 3 )
+				{// short matches are the most common, byte by byte at any distance
+					dst[out] = from[0];
+					dst[out + 1] = from[1];
+					dst[out + 2] = from[2];// overwritten later after a 2 byte match
+				}
+				else
+				{
+					if( dist >= 16 )
+					{// no overlap, wide copy (the extra bytes are overwritten later)
+						memcpy(dst + out, from, 16);
+						dst[out + 16] = from[16];
+					}
+					else if( dist >= 8 )
+					{
+						memcpy(dst + out, from, 8);
+						memcpy(dst + out + 8, from + 8, 8);
+						dst[out + 16] = from[16];
+					}
+					else
+					{
+						for( FXuint k = 0; k < len; ++k )
+							dst[out + k] = from[k];
+					}
+				}
+				out += len;
+			}
+			continue;
+		}
+		for( FXint bit = 0; bit < 8 && out < dst_len; ++bit, flags >>= 1 )
+		{
+			if( flags & 1 )
+			{// literal
+				if( in >= src_len )
+					return out;
+				dst[out++] = src[in++];
+				continue;
+			}
+			// match
+			if( in + 2 > src_len )
+				return out;
+			const FXuint pos = src[in] | ((FXuint)(src[in+1]&0xF0)<<4);
+			const FXuint len = (src[in+1]&0x0F) + LZSSMinMatch;
+			in += 2;
+			FXuint dist = (LZSSRingStart + out - pos)&(LZSSWindow - 1);
+			if( dist == 0 )
+				dist = LZSSWindow;
+			if( dist >= 16 && dist <= out && out + LZSSMaxMatch <= dst_len )
+			{// no overlap, wide copy (the extra bytes are overwritten later)
+				const FXuchar* from = dst + out - dist;
+				memcpy(dst + out, from, 16);
+				dst[out + 16] = from[16];
+				out += len;
+				continue;
+			}
+			const FXuint n = ( len < dst_len - out ) ? len : dst_len - out;
+			if( dist <= out )
+			{
+				const FXuchar* from = dst + out - dist;
+				for( FXuint k = 0; k < n; ++k )
+					dst[out + k] = from[k];
+			}
+			else
+			{// reaches into the ring fill
+				for( FXuint k = 0; k < n; ++k )
+					dst[out + k] = ( out + k >= dist ) ? dst[out + k - dist] : (FXuchar)LZSSRingFill;
+			}
+			out += n;
+		}
+	}
+	return out;
+}
+
+/// Greedy compression with hash chains over 3 bytes, returns the size
+/// written to dst or 0 when it does not fit
+FXuint NGRF::GRFCompress(const FXuchar* src, FXuint src_len, FXuchar* dst, FXuint dst_len)
+{
+	enum { HashBits = 12, ChainDepth = 32 };
+	FXint head[1<<HashBits];
+	FXint prev[LZSSWindow];
+	FXuint in = 0, out = 0, flag_pos = 0, bit = 8;
+
+	memset(head, 0xFF, sizeof(head));// -1
+	while( in < src_len )
+	{
+		if( bit == 8 )
+		{
+			if( out >= dst_len )
+				return 0;
+			flag_pos = out;
+			dst[out++] = 0;
+			bit = 0;
+		}
+		FXuint best_len = 0, best_dist = 0;
+		const FXuint max_len = ( src_len - in < LZSSMaxMatch ) ? src_len - in : (FXuint)LZSSMaxMatch;
+		if( max_len >= 3 )
+		{
+			const FXuint h = ((((FXuint)src[in]<<16) | ((FXuint)src[in+1]<<8) | src[in+2])*2654435761u)>>(32 - HashBits);
+			FXint cand = head[h];
+			for( FXint depth = 0; cand >= 0 && in - cand < LZSSWindow && depth < ChainDepth; ++depth )
+			{
+				FXuint n = 0;
+				while( n < max_len && src[cand + n] == src[in + n] )
+					++n;
+				if( n > best_len )
+				{
+					best_len = n;
+					best_dist = in - cand;
+					if( n == max_len )
+						break;
+				}
+				cand = prev[cand&(LZSSWindow - 1)];
+			}
+		}
+		const FXuint step = ( best_len >= 3 ) ? best_len : 1;
+		if( step > 1 )
+		{
+			if( out + 2 > dst_len )
+				return 0;
+			const FXuint pos = (LZSSRingStart + in - best_dist)&(LZSSWindow - 1);
+			dst[out++] = (FXuchar)(pos&0xFF);
+			dst[out++] = (FXuchar)(((pos>>4)&0xF0) | (best_len - LZSSMinMatch));
+		}
+		else
+		{
+			if( out >= dst_len )
+				return 0;
+			dst[flag_pos] |= (FXuchar)(1<<bit);
+			dst[out++] = src[in];
+		}
+		++bit;
+		for( FXuint end = in + step; in < end; ++in )
+		{
+			if( in + 3 > src_len )
+				continue;
+			const FXuint h = ((((FXuint)src[in]<<16) | ((FXuint)src[in+1]<<8) | src[in+2])*2654435761u)>>(32 - HashBits);
+			prev[in&(LZSSWindow - 1)] = head[h];
+			head[h] = (FXint)in;
+		}
+	}
+	return out;
+}
+
+//-----------------------------------------------------------------------------
+// Archive
+
+GRF::GRF() : data(NULL), size(0), block(NULL), entries(NULL), entry_count(0), table(NULL), table_mask(0)
+{
+}
+
+GRF::~GRF()
+{
+	close();
+}
+
+bool GRF::open(const FXString& filename)
+{
+	close();
+	data = (const FXuchar*)file.map(filename);
+	if( data == NULL )
+	{
+		error.format("%s: can not be mapped", filename.text());
+		return false;
+	}
+	size = file.length();
+	if( !parse() )
+	{
+		error.prepend(filename + ": ");
+		close();
+		return false;
+	}
+	return true;
+}
+
+void GRF::close()
+{
+	if( data )
+		file.unmap();
+	data = NULL;
+	size = 0;
+	if( block )
+		fxfree((void**)&block);
+	block = NULL;
+	entries = NULL;
+	entry_count = 0;
+	table = NULL;
+	table_mask = 0;
+}
+
+/// Check the entry list once, decode the names and hash them
+bool GRF::parse()
+{
+	if( size < DescriptorSize )
+	{
+		error = "not a GRF file";
+		return false;
+	}
+	const FXuchar* desc = data + size - DescriptorSize;
+	const FXuint list_off = GRFReadUInt(desc);
+	FXuint count = GRFReadUInt(desc+4);
+	count = (count<<16) | (count>>16);// words are switched
+	if( desc[8] != AlphaVersion )
+	{
+		error.format("unsupported version 0x%02X", desc[8]);
+		return false;
+	}
+	const FXuval list_end = (FXuval)(size - DescriptorSize);
+	if( list_off > list_end || count > (list_end - list_off)/(EntryHeaderSize + 1) )
+	{
+		error.format("bad entry list (offset %u, %u entries)", list_off, count);
+		return false;
+	}
+
+	// first pass for the size of the names
+	FXuval pos = list_off;
+	FXuval names_size = 0;
+	FXuint i;
+	for( i = 0; i < count; ++i )
+	{
+		if( pos + EntryHeaderSize > list_end || pos + EntryHeaderSize + data[pos] + 1 > list_end )
+		{
+			error.format("truncated at entry %u/%u", (i+1), count);
+			return false;
+		}
+		names_size += data[pos] + 1;
+		pos += EntryHeaderSize + data[pos] + 1;
+	}
+
+	FXuint table_size = 16;
+	while( table_size < 2*count )
+		table_size <<= 1;
+	if( !fxmalloc((void**)&block, count*sizeof(Entry) + table_size*sizeof(FXint) + names_size + 1) )
+	{
+		error = "out of memory";
+		return false;
+	}
+	entries = (Entry*)block;
+	table = (FXint*)(block + count*sizeof(Entry));
+	table_mask = table_size - 1;
+	memset(table, 0, table_size*sizeof(FXint));
+	FXchar* names = (FXchar*)(table + table_size);
+	entry_count = (FXint)count;
+
+	pos = list_off;
+	for( i = 0; i < count; ++i )
+	{
+		const FXuchar* p = data + pos;
+		const FXuint name_len = p[0];
+		Entry& e = entries[i];
+		e.type = p[1];
+		e.offset = GRFReadUInt(p+2);
+		e.packed_size = GRFReadUInt(p+6);
+		e.real_size = GRFReadUInt(p+10);
+		for( FXuint k = 0; k < name_len; ++k )
+		{
+			const FXuchar c = p[EntryHeaderSize + k];
+			names[k] = (FXchar)((c<<4) | (c>>4));// half bytes are switched
+		}
+		names[name_len] = 0;
+		e.name = names;
+		e.hash = GRFNameHash(names);
+		names += name_len + 1;
+		pos += EntryHeaderSize + name_len + 1;
+
+		if( e.type > DirectoryEntryType )
+		{
+			error.format("unknown type %u for entry '%s'", e.type, e.name);
+			return false;
+		}
+		if( e.isFile() && ( e.offset > list_off || e.packed_size > list_off - e.offset ) )
+		{
+			error.format("data of entry '%s' is outside the archive", e.name);
+			return false;
+		}
+		if( e.type == RawEntryType && e.packed_size != e.real_size )
+		{
+			error.format("raw entry '%s' has packed size %u and real size %u", e.name, e.packed_size, e.real_size);
+			return false;
+		}
+
+		// the first entry of a name wins
+		FXuint slot = e.hash&table_mask;
+		for( ; table[slot]; slot = (slot + 1)&table_mask )
+		{
+			const Entry& other = entries[table[slot] - 1];
+			if( other.hash == e.hash && GRFNameEqual(other.name, e.name) )
+				break;
+		}
+		if( table[slot] == 0 )
+			table[slot] = (FXint)i + 1;
+		else
+			fxwarning("GRF: duplicate entry '%s'\n", e.name);
+	}
+	return true;
+}
+
+FXint GRF::find(const FXchar* name) const
+{
+	if( table == NULL || name == NULL )
+		return -1;
+	const FXuint hash = GRFNameHash(name);
+	for( FXuint slot = hash&table_mask; table[slot]; slot = (slot + 1)&table_mask )
+	{
+		const FXint i = table[slot] - 1;
+		if( entries[i].hash == hash && GRFNameEqual(entries[i].name, name) )
+			return i;
+	}
+	return -1;
+}
+
+bool GRF::read(const Entry& e, FXuchar* buffer) const
+{
+	switch( e.type )
+	{
+	case RawEntryType:
+		memcpy(buffer, data + e.offset, e.real_size);
+		return true;
+	case CompressedEntryType:
+		return GRFDecompress(data + e.offset, e.packed_size, buffer, e.real_size) == e.real_size;
+	default:
+		return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Stream
+
+GRFStream::GRFStream() : buffer(NULL)
+{
+}
+
+GRFStream::~GRFStream()
+{
+	close();
+}
+
+bool GRFStream::open(const GRF& grf, const FXchar* name)
+{
+	close();
+	const FXint i = grf.find(name);
+	if( i < 0 || !grf.entry(i).isFile() )
+		return false;
+	const Entry& e = grf.entry(i);
+	FXuchar* ptr = (FXuchar*)grf.inplace(e);
+	if( ptr == NULL )
+	{
+		if( !fxmalloc((void**)&buffer, e.real_size + 1) )
+			return false;
+		if( !grf.read(e, buffer) )
+		{
+			fxwarning("GRF: entry '%s' is corrupt\n", e.name);
+			fxfree((void**)&buffer);
+			buffer = NULL;
+			return false;
+		}
+		ptr = buffer;
+	}
+	return FXMemoryStream::open(FXStreamLoad, e.real_size, ptr);
+}
+
+bool GRFStream::close()
+{
+	bool ok = FXMemoryStream::close();
+	if( buffer )
+		fxfree((void**)&buffer);
+	buffer = NULL;
+	return ok;
+}
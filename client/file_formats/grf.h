@@ -0,0 +1,132 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Reader for the alpha GRF archives (grf_alpha.txt).
+** The archive is memory mapped and the entry list is decoded once into a
+** single block with the entries, their names and a hash table of the
+** names. Raw entries are read in place, compressed ones are unpacked into
+** a buffer.
+**
+** $Id$
+*/
+#ifndef _GRF_H_
+#define _GRF_H_
+
+#include "fx.h"
+
+//-----------------------------------------------------------------------------
+namespace NGRF {
+//-----------------------------------------------------------------------------
+
+/// Entry types
+enum EntryType
+{
+	RawEntryType = 0,// file, uncompressed
+	CompressedEntryType = 1,// file, compressed
+	DirectoryEntryType = 2
+};
+
+enum
+{
+	DescriptorSize = 9,// <entry_list_off>.4B <num_entries>.4B <version>.B at the end
+	EntryHeaderSize = 14,// <name_len>.B <type>.B <offset>.4B <packed_size>.4B <real_size>.4B
+	AlphaVersion = 0x12
+};
+
+/// Entry of the archive
+struct Entry
+{
+	const FXchar* name;// decoded pathname, '/' separated
+	FXuint hash;// of the name without case
+	FXuint type;// EntryType
+	FXuint offset;// data in the archive, 0 for directories
+	FXuint packed_size;
+	FXuint real_size;
+
+	bool isFile() const			{ return type != DirectoryEntryType; }
+	bool isDirectory() const	{ return type == DirectoryEntryType; }
+};
+
+/// Unpack a compressed entry into a buffer of dst_len bytes, returns the number of bytes written.
+/// nothing is allocated and at most dst_len bytes are written
+FXuint GRFDecompress(const FXuchar* src, FXuint src_len, FXuchar* dst, FXuint dst_len);
+/// Pack data, returns the packed size or 0 when it does not fit in dst_len bytes
+FXuint GRFCompress(const FXuchar* src, FXuint src_len, FXuchar* dst, FXuint dst_len);
+/// Room that GRFCompress needs in the worst case (one flag byte per 8 literals)
+inline FXuint GRFCompressBound(FXuint src_len)	{ return src_len + (src_len + 7)/8; }
+
+/// Alpha GRF archive mapped into memory
+class GRF
+{
+	FXMemMap file;
+	const FXuchar* data;
+	FXival size;
+	FXuchar* block;// entries, hash table and names
+	Entry* entries;// in archive order, directories come before their contents
+	FXint entry_count;
+	FXint* table;// entry index + 1 by name hash, 0 when free
+	FXuint table_mask;
+	FXString error;
+
+	bool parse();
+
+	GRF(const GRF&);
+	GRF& operator=(const GRF&);
+public:
+	GRF();
+	~GRF();
+
+	/// Map and index an archive, false with getError() set when it is not valid
+	bool open(const FXString& filename);
+	/// Unmap the archive, the entries and the in place data become invalid
+	void close();
+
+	const FXString& getError() const	{ return error; }
+
+	/// Entries in archive order
+	FXint entryCount() const			{ return entry_count; }
+	const Entry& entry(FXint i) const	{ return entries[i]; }
+
+	/// Index of an entry, case and separator ('/' or '\') insensitive. -1 when not found
+	FXint find(const FXchar* name) const;
+
+	/// Packed data of an entry as stored in the archive
+	const FXuchar* packed(const Entry& e) const	{ return data + e.offset; }
+	/// Data of a raw entry in place, NULL for compressed entries and directories
+	const FXuchar* inplace(const Entry& e) const	{ return e.type == RawEntryType ? data + e.offset : NULL; }
+	/// Unpack an entry into a buffer of at least real_size bytes
+	bool read(const Entry& e, FXuchar* buffer) const;
+};
+
+/// Load stream over a file of an archive, for the RSW/RSM/GND loaders.
+/// raw entries are read in place, compressed ones from a private buffer
+class GRFStream : public FXMemoryStream
+{
+	FXuchar* buffer;
+
+	GRFStream(const GRFStream&);
+	GRFStream& operator=(const GRFStream&);
+public:
+	GRFStream();
+	virtual ~GRFStream();
+
+	/// Open a file of the archive, the archive must stay open while the stream is used
+	bool open(const GRF& grf, const FXchar* name);
+	virtual bool close();
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NGRF
+//-----------------------------------------------------------------------------
+
+#endif // _GRF_H_
@@ -0,0 +1,397 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** grfbench - throughput of the GRF alpha LZSS decoder over a synthetic corpus.
+**
+** usage: grfbench [-m megabytes] [-r rounds] [-s seed] [-g archive]
+**
+** the corpus has files like the ones found in the archives:
+**   text     scripts and tables, words from a small dictionary
+**   bitmap   texture rows with runs and gradients
+**   mesh     little endian floats of models and ground
+**   noise    already compressed data, only literals
+** each kind is packed with GRFCompress and unpacked with the byte-wise
+** ring buffer decoder and with GRFDecompress, both results are checked.
+** GRFCompress never writes matches of 2 bytes or into the ring fill, so
+** random packed streams with such matches are unpacked with both decoders
+** and compared as well.
+**
+** -g also checks the compressed entries of an existing archive: the packed
+** data has to unpack to real_size bytes with both decoders, and the
+** unpacked data has to come back from GRFCompress and GRFDecompress.
+**
+** $Id$
+*/
+#include "grf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+using namespace NGRF;
+
+/// microsecond clock
+static FXulong bench_clock()
+{
+#ifdef WIN32
+	static LARGE_INTEGER freq = {{0,0}};
+	LARGE_INTEGER now;
+	if( !freq.QuadPart )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (FXulong)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (FXulong)tv.tv_sec*1000000 + tv.tv_usec;
+#endif
+}
+
+/// reproducible random numbers
+static FXuint bench_seed = 1;
+static FXuint bench_rand(FXuint range)
+{
+	bench_seed = bench_seed*1103515245 + 12345;
+	return range ? (bench_seed>>8) % range : 0;
+}
+
+/// The decoder as the format describes it, one byte at a time through the ring
+static FXuint bench_reference(const FXuchar* src, FXuint src_len, FXuchar* dst, FXuint dst_len)
+{
+	FXuchar ring[4096];
+	FXuint r = 4096 - 17;
+	FXuint flags = 0;
+	FXuint in = 0, out = 0;
+
+	memset(ring, ' ', 4096);
+	while( in < src_len && out < dst_len )
+	{
+		flags >>= 1;
+		if( (flags & 0x100) == 0 )
+		{
+			flags = src[in++] | 0xFF00;
+			if( in >= src_len )
+				break;
+		}
+		if( flags & 1 )
+		{
+			ring[r] = dst[out++] = src[in++];
+			r = (r + 1)&4095;
+		}
+		else
+		{
+			if( in + 2 > src_len )
+				break;
+			FXuint pos = src[in] | ((FXuint)(src[in+1]&0xF0)<<4);
+			FXuint len = (src[in+1]&0x0F) + 2;
+			in += 2;
+			for( FXuint k = 0; k < len && out < dst_len; ++k )
+			{
+				ring[r] = dst[out++] = ring[(pos + k)&4095];
+				r = (r + 1)&4095;
+			}
+		}
+	}
+	return out;
+}
+
+//-----------------------------------------------------------------------------
+// corpus
+
+static void bench_text(FXuchar* p, FXuint len)
+{
+	static const char* words[] = { "the", "monster", "item", "npc", "warp", "prontera", "script", "mes", "close", "next", "if", "set", "goto", "end", "\r\n", "\t", "0", "1", "100", "data\\texture\\" };
+	FXuint i = 0;
+	while( i < len )
+	{
+		const char* w = words[bench_rand(sizeof(words)/sizeof(words[0]))];
+		for( ; *w && i < len; ++w )
+			p[i++] = (FXuchar)*w;
+		if( i < len )
+			p[i++] = ' ';
+	}
+}
+
+static void bench_bitmap(FXuchar* p, FXuint len)
+{
+	FXuint i = 0;
+	while( i < len )
+	{// 256 pixel rows, a run of one color then a gradient
+		FXuint run = bench_rand(256);
+		const FXuchar c = (FXuchar)bench_rand(256);
+		for( ; run && i < len; --run )
+			p[i++] = c;
+		for( FXuint k = 0; k < 256 && i < len; ++k )
+			p[i++] = (FXuchar)(c + k/4);
+	}
+}
+
+static void bench_mesh(FXuchar* p, FXuint len)
+{
+	FXuint i = 0;
+	FXfloat v = 0.0f;
+	while( i < len )
+	{
+		v += (FXfloat)bench_rand(16)*0.25f;
+		FXuchar b[4];
+		memcpy(b, &v, 4);
+		for( FXuint k = 0; k < 4 && i < len; ++k )
+			p[i++] = b[k];
+	}
+}
+
+static void bench_noise(FXuchar* p, FXuint len)
+{
+	for( FXuint i = 0; i < len; ++i )
+		p[i] = (FXuchar)bench_rand(256);
+}
+
+//-----------------------------------------------------------------------------
+
+/// Random packed data: any flags, matches of every length at any ring
+/// position, so the early ones reach into the ring fill. returns the
+/// number of unpacked bytes
+static FXuint bench_stream(FXuchar* p, FXuint groups)
+{
+	FXuint len = 0;
+	for( FXuint g = 0; g < groups; ++g )
+	{
+		const FXuint flags = bench_rand(256);
+		*p++ = (FXuchar)flags;
+		for( FXuint bit = 0; bit < 8; ++bit )
+		{
+			if( flags & (1<<bit) )
+			{
+				*p++ = (FXuchar)bench_rand(256);
+				++len;
+				continue;
+			}
+			// half of the matches are 2 bytes, the shortest there is
+			const FXuint n = bench_rand(2) ? 0 : bench_rand(16);
+			FXuint pos = bench_rand(4096);
+			if( bench_rand(2) )
+				pos = (4096 - 17 + len - 1 - bench_rand(32))&4095;// close behind, overlapping
+			*p++ = (FXuchar)pos;
+			*p++ = (FXuchar)(((pos>>4)&0xF0) | n);
+			len += n + 2;
+		}
+	}
+	return len;
+}
+
+/// Unpack random streams with both decoders, returns the number of mismatches
+static FXuint bench_streams(FXuint count)
+{
+	enum { MaxGroups = 1024 };
+	FXuchar* packed = (FXuchar*)malloc(MaxGroups*17);
+	FXuchar* ref = (FXuchar*)malloc(MaxGroups*8*17);
+	FXuchar* out = (FXuchar*)malloc(MaxGroups*8*17);
+	FXuint bad = 0;
+	if( !packed || !ref || !out )
+	{
+		printf("out of memory\n");
+		free(packed); free(ref); free(out);
+		return 1;
+	}
+	for( FXuint i = 0; i < count; ++i )
+	{
+		const FXuint groups = 1 + bench_rand(MaxGroups);
+		const FXuint len = bench_stream(packed, groups);
+		FXuint plen = 0;
+		for( FXuint g = 0, pos = 0; g < groups; ++g )
+		{// size of the packed data
+			const FXuint flags = packed[pos];
+			FXuint k = 1;
+			for( FXuint bit = 0; bit < 8; ++bit )
+				k += ( flags & (1<<bit) ) ? 1 : 2;
+			pos += k;
+			plen = pos;
+		}
+		// the whole stream and a cut one, the decoders stop at dst_len
+		const FXuint cut = bench_rand(len) + 1;
+		const FXuint lens[2] = { len, cut };
+		for( FXuint k = 0; k < 2; ++k )
+		{
+			memset(ref, 0, lens[k]);
+			memset(out, 0xAA, lens[k]);
+			const FXuint a = bench_reference(packed, plen, ref, lens[k]);
+			const FXuint b = GRFDecompress(packed, plen, out, lens[k]);
+			if( a != lens[k] || b != lens[k] || memcmp(ref, out, lens[k]) != 0 )
+				++bad;
+		}
+	}
+	printf("streams  %5u checked with 2 byte and ring fill matches%s\n", count, bad ? "  MISMATCH" : "");
+	free(packed);
+	free(ref);
+	free(out);
+	return bad;
+}
+
+/// Check the compressed entries of an archive, returns the number of bad entries
+static FXuint bench_archive(const char* filename)
+{
+	GRF grf;
+	if( !grf.open(filename) )
+	{
+		printf("%s: %s\n", filename, grf.getError().text());
+		return 1;
+	}
+	FXuint checked = 0, bad = 0;
+	for( FXint i = 0; i < grf.entryCount(); ++i )
+	{
+		const Entry& e = grf.entry(i);
+		if( e.type != CompressedEntryType )
+			continue;
+		FXuchar* ref = (FXuchar*)malloc(e.real_size + 1);
+		FXuchar* out = (FXuchar*)malloc(e.real_size + 1);
+		FXuchar* packed = (FXuchar*)malloc(GRFCompressBound(e.real_size) + 1);
+		if( !ref || !out || !packed )
+		{
+			printf("out of memory\n");
+			free(ref); free(out); free(packed);
+			return bad + 1;
+		}
+		bool ok = ( bench_reference(grf.packed(e), e.packed_size, ref, e.real_size) == e.real_size );
+		ok = ok && GRFDecompress(grf.packed(e), e.packed_size, out, e.real_size) == e.real_size;
+		ok = ok && memcmp(ref, out, e.real_size) == 0;
+		if( ok )
+		{// round trip of the unpacked data
+			const FXuint plen = GRFCompress(ref, e.real_size, packed, GRFCompressBound(e.real_size));
+			ok = ( plen != 0 || e.real_size == 0 );
+			ok = ok && GRFDecompress(packed, plen, out, e.real_size) == e.real_size;
+			ok = ok && memcmp(ref, out, e.real_size) == 0;
+		}
+		if( !ok )
+		{
+			printf("%s: MISMATCH\n", e.name);
+			++bad;
+		}
+		++checked;
+		free(ref);
+		free(out);
+		free(packed);
+	}
+	printf("%s: %u compressed entries, %u bad\n", filename, checked, bad);
+	return bad;
+}
+
+struct bench_kind
+{
+	const char* name;
+	void (*fill)(FXuchar* p, FXuint len);
+};
+
+int main(int argc, char* argv[])
+{
+	static const bench_kind kinds[] = { {"text", bench_text}, {"bitmap", bench_bitmap}, {"mesh", bench_mesh}, {"noise", bench_noise} };
+	FXuint megabytes = 16, rounds = 5;
+	const char* archive = NULL;
+	int i;
+
+	for( i = 1; i < argc; ++i )
+	{
+		const char* arg = argv[i];
+		const char* val = (i+1<argc) ? argv[i+1] : NULL;
+		if( arg[0] != '-' || !val )
+		{
+			printf("usage: %s [-m megabytes] [-r rounds] [-s seed] [-g archive]\n", argv[0]);
+			return 1;
+		}
+		switch( arg[1] )
+		{
+		case 'm': megabytes = strtoul(val, NULL, 10); break;
+		case 'r': rounds = strtoul(val, NULL, 10); break;
+		case 's': bench_seed = strtoul(val, NULL, 10); break;
+		case 'g': archive = val; break;
+		}
+		++i;
+	}
+	if( !megabytes ) megabytes = 1;
+	if( !rounds ) rounds = 1;
+	if( archive && bench_archive(archive) )
+		return 1;
+
+	// files of 4 to 256 KB like the textures and models
+	const FXuint total = megabytes<<20;
+	FXuchar* plain = (FXuchar*)malloc(total);
+	FXuchar* packed = (FXuchar*)malloc(GRFCompressBound(total) + total/4096 + 1);// a flag byte more per file
+	FXuchar* out = (FXuchar*)malloc(total);
+	FXuint* sizes = (FXuint*)malloc((total/4096 + 1)*sizeof(FXuint));
+	FXuint* psizes = (FXuint*)malloc((total/4096 + 1)*sizeof(FXuint));
+	if( !plain || !packed || !out || !sizes || !psizes )
+	{
+		printf("out of memory\n");
+		return 1;
+	}
+	printf("%u MB per kind, %u rounds\n", megabytes, rounds);
+
+	int failed = ( bench_streams(256) != 0 );
+	for( size_t kind = 0; kind < sizeof(kinds)/sizeof(kinds[0]); ++kind )
+	{
+		FXuint files = 0, pos = 0, ppos = 0;
+		bool bad = false;
+		while( pos < total )
+		{
+			FXuint len = 4096 + bench_rand(252*1024);
+			if( len > total - pos )
+				len = total - pos;
+			kinds[kind].fill(plain + pos, len);
+			const FXuint plen = GRFCompress(plain + pos, len, packed + ppos, GRFCompressBound(len));
+			sizes[files] = len;
+			psizes[files] = plen;
+			++files;
+			pos += len;
+			ppos += plen;
+		}
+
+		FXulong t_ref = 0, t_fast = 0;
+		for( FXuint round = 0; round < rounds; ++round )
+		{
+			FXuint f;
+			FXulong t = bench_clock();
+			for( f = 0, pos = 0, ppos = 0; f < files; pos += sizes[f], ppos += psizes[f], ++f )
+				bench_reference(packed + ppos, psizes[f], out + pos, sizes[f]);
+			t_ref += bench_clock() - t;
+			if( memcmp(out, plain, total) != 0 )
+				bad = true;
+
+			memset(out, 0, total);
+			t = bench_clock();
+			for( f = 0, pos = 0, ppos = 0; f < files; pos += sizes[f], ppos += psizes[f], ++f )
+				GRFDecompress(packed + ppos, psizes[f], out + pos, sizes[f]);
+			t_fast += bench_clock() - t;
+			if( memcmp(out, plain, total) != 0 )
+				bad = true;
+		}
+		if( bad )
+			failed = 1;
+		const double mb = (double)megabytes*rounds;
+		printf("%-8s %5u files  ratio %5.1f%%   reference %8.1f MB/s   GRFDecompress %8.1f MB/s   x%.2f%s\n",
+			kinds[kind].name, files, 100.0*ppos/total,
+			mb/(t_ref ? t_ref/1000000.0 : 1e-6), mb/(t_fast ? t_fast/1000000.0 : 1e-6),
+			t_fast ? (double)t_ref/t_fast : 0.0,
+			bad ? "  MISMATCH" : "");
+	}
+
+	free(plain);
+	free(packed);
+	free(out);
+	free(sizes);
+	free(psizes);
+	return failed;
+}
@@ -0,0 +1,751 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** grftool - extracts and repacks alpha GRF archives (grf_alpha.txt).
+**
+** usage: grftool x <archive> <outdir> [-j threads]
+**        grftool c <archive> <indir> [-j threads] [-r old_archive]
+**
+** x  unpacks every entry below outdir, entries with an absolute name or a
+**    ".." in their path are refused
+** c  packs the files below indir into a new archive, the entries ordered by
+**    path so every directory comes before its contents. with -r the packed
+**    data of files that did not change (same content hash, size and bytes)
+**    is copied from the old archive instead of being compressed again.
+**    the archive is written to <archive>.tmp and renamed when it is
+**    complete, so the old archive may be the one that is replaced
+**
+** the entries are unpacked/packed by a pool of threads, each with its own
+** range of entries; a thread without work takes entries from the end of
+** the busiest range. the archive is written in order with large writes.
+**
+** $Id$
+*/
+#include "grf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace NGRF;
+
+enum
+{
+	WriteBufferSize = 4<<20,// sequential writes to the archive
+	BatchSize = 64<<20// input read and packed before it is written
+};
+
+/// FNV-1a 64 of the contents
+static FXulong grf_hash(const FXuchar* p, FXuval len)
+{
+	FXulong hash = FXULONG(14695981039346656037);
+	for( FXuval i = 0; i < len; ++i )
+		hash = (hash ^ p[i])*FXULONG(1099511628211);
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Thread pool
+
+/// Work done for each job
+class GRFTask
+{
+public:
+	virtual ~GRFTask(){}
+	virtual void work(FXint job, FXint worker) = 0;
+};
+
+/// Jobs split in ranges, one per worker. A worker takes jobs from the front
+/// of its range and steals from the back of the largest other range
+class GRFPool
+{
+	struct Range
+	{
+		FXMutex lock;
+		FXint head;
+		FXint tail;
+	};
+	class Worker : public FXThread
+	{
+	public:
+		GRFPool* pool;
+		FXint id;
+		virtual FXint run()	{ pool->loop(id); return 0; }
+	};
+
+	FXint count;
+	Range* ranges;
+	Worker* workers;
+	GRFTask* task;
+
+	bool take(FXint w, FXint& job)
+	{
+		{
+			FXMutexLock lock(ranges[w].lock);
+			if( ranges[w].head < ranges[w].tail )
+			{
+				job = ranges[w].head++;
+				return true;
+			}
+		}
+		for( ;; )
+		{// steal
+			FXint victim = -1, most = 0;
+			for( FXint i = 0; i < count; ++i )
+			{
+				const FXint left = ranges[i].tail - ranges[i].head;// unlocked peek
+				if( i != w && left > most )
+				{
+					most = left;
+					victim = i;
+				}
+			}
+			if( victim < 0 )
+				return false;
+			FXMutexLock lock(ranges[victim].lock);
+			if( ranges[victim].head < ranges[victim].tail )
+			{
+				job = --ranges[victim].tail;
+				return true;
+			}
+		}
+	}
+
+	void loop(FXint w)
+	{
+		FXint job;
+		while( take(w, job) )
+			task->work(job, w);
+	}
+
+	GRFPool(const GRFPool&);
+	GRFPool& operator=(const GRFPool&);
+public:
+	GRFPool(FXint threads) : count(threads > 0 ? threads : 1), task(NULL)
+	{
+		ranges = new Range[count];
+		workers = new Worker[count];
+	}
+	~GRFPool()
+	{
+		delete[] workers;
+		delete[] ranges;
+	}
+
+	FXint threads() const	{ return count; }
+
+	/// Run jobs first..last-1, worker 0 is the calling thread
+	void run(GRFTask& t, FXint first, FXint last)
+	{
+		FXint i;
+		task = &t;
+		for( i = 0; i < count; ++i )
+		{
+			ranges[i].head = first + (FXint)((FXlong)(last - first)*i/count);
+			ranges[i].tail = first + (FXint)((FXlong)(last - first)*(i + 1)/count);
+		}
+		bool* started = new bool[count];
+		for( i = 1; i < count; ++i )
+		{
+			workers[i].pool = this;
+			workers[i].id = i;
+			started[i] = workers[i].start();
+		}
+		loop(0);// also takes the ranges of threads that did not start
+		for( i = 1; i < count; ++i )
+		{
+			if( started[i] )
+				workers[i].join();
+		}
+		delete[] started;
+		task = NULL;
+	}
+};
+
+/// Growing buffer of a worker
+struct GRFScratch
+{
+	FXuchar* data;
+	FXuint size;
+
+	GRFScratch() : data(NULL), size(0){}
+	~GRFScratch()	{ if( data ) fxfree((void**)&data); }
+
+	FXuchar* reserve(FXuint n)
+	{
+		if( n > size || data == NULL )
+		{
+			if( !fxresize((void**)&data, n + 1) )
+				return NULL;
+			size = n;
+		}
+		return data;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Extract
+
+class GRFExtract : public GRFTask
+{
+public:
+	const GRF& grf;
+	FXString dir;
+	GRFScratch* scratch;
+	FXint failed;
+	FXMutex lock;
+
+	GRFExtract(const GRF& grf, const FXString& dir, FXint threads) : grf(grf), dir(dir), failed(0)
+	{
+		scratch = new GRFScratch[threads];
+	}
+	~GRFExtract()
+	{
+		delete[] scratch;
+	}
+
+	/// Path below dir, false when the name would leave it
+	bool path(const Entry& e, FXString& p) const
+	{
+		const FXchar* name = e.name;
+		if( name[0] == '/' || name[0] == '\\' || ( name[0] && name[1] == ':' ) )
+			return false;
+		for( const FXchar* s = name; *s; )
+		{// no ".." component
+			const FXchar* end = s;
+			while( *end && *end != '/' && *end != '\\' )
+				++end;
+			if( end - s == 2 && s[0] == '.' && s[1] == '.' )
+				return false;
+			s = *end ? end + 1 : end;
+		}
+		p = dir + PATHSEPSTRING + name;
+		p.substitute('/', PATHSEP);
+		p.substitute('\\', PATHSEP);
+		return true;
+	}
+
+	/// Create the folders of a file below dir, the archive may not list them
+	void parents(const FXString& p) const
+	{
+		for( FXint i = dir.length() + 1; i < p.length(); ++i )
+		{
+			if( p[i] == PATHSEP && !FXStat::isDirectory(p.left(i)) )
+				FXDir::create(p.left(i));
+		}
+	}
+
+	virtual void work(FXint job, FXint worker)
+	{
+		const Entry& e = grf.entry(job);
+		if( !e.isFile() )
+			return;
+		FXString p;
+		if( !path(e, p) )
+		{
+			fail(e, "has an unsafe name");
+			return;
+		}
+		const FXuchar* data = grf.inplace(e);
+		if( data == NULL )
+		{
+			FXuchar* buffer = scratch[worker].reserve(e.real_size);
+			if( buffer == NULL || !grf.read(e, buffer) )
+			{
+				fail(e, "is corrupt");
+				return;
+			}
+			data = buffer;
+		}
+		// one write per file, the folders are made when the first file fails
+		FXFile file;
+		if( !file.open(p, FXIO::Writing) )
+		{
+			parents(p);
+			file.open(p, FXIO::Writing);
+		}
+		if( !file.isOpen() || file.writeBlock(data, e.real_size) != (FXival)e.real_size )
+			fail(e, "can not be written");
+	}
+
+	void fail(const Entry& e, const char* why)
+	{
+		FXMutexLock l(lock);
+		fprintf(stderr, "%s %s\n", e.name, why);
+		++failed;
+	}
+};
+
+static int grf_extract(const FXString& archive, const FXString& dir, FXint threads)
+{
+	GRF grf;
+	if( !grf.open(archive) )
+	{
+		fprintf(stderr, "%s\n", grf.getError().text());
+		return 1;
+	}
+	GRFPool pool(threads);
+	GRFExtract task(grf, dir, pool.threads());
+	// the directories come before their contents, empty ones are only
+	// made here
+	FXDir::create(dir);
+	for( FXint i = 0; i < grf.entryCount(); ++i )
+	{
+		const Entry& e = grf.entry(i);
+		FXString p;
+		if( !e.isDirectory() )
+			continue;
+		if( task.path(e, p) )
+			FXDir::create(p);
+		else
+			task.fail(e, "has an unsafe name");
+	}
+	pool.run(task, 0, grf.entryCount());
+	printf("%d entries, %d failed\n", grf.entryCount(), task.failed);
+	return task.failed ? 1 : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Repack
+
+/// Entry of the new archive
+struct GRFNewEntry
+{
+	FXString name;// '/' separated, relative to the input directory
+	FXuint type;
+	FXuint real_size;
+	FXuint packed_size;
+	FXuint offset;
+	FXuchar* packed;// packed data waiting to be written
+	const FXuchar* reuse;// packed data in the old archive
+};
+
+static int grf_cmp_entry(const void* a, const void* b)
+{
+	return strcmp((*(const GRFNewEntry* const*)a)->name.text(), (*(const GRFNewEntry* const*)b)->name.text());
+}
+
+/// Packed data of the old archive by content
+struct GRFOldData
+{
+	FXulong hash;
+	FXuint real_size;
+	FXint entry;
+};
+
+static int grf_cmp_old(const void* a, const void* b)
+{
+	const GRFOldData& x = *(const GRFOldData*)a;
+	const GRFOldData& y = *(const GRFOldData*)b;
+	if( x.hash != y.hash )
+		return x.hash < y.hash ? -1 : 1;
+	if( x.real_size != y.real_size )
+		return x.real_size < y.real_size ? -1 : 1;
+	return 0;
+}
+
+/// Hash the files of the old archive
+class GRFHashOld : public GRFTask
+{
+public:
+	const GRF& grf;
+	GRFOldData* data;
+	GRFScratch* scratch;
+
+	GRFHashOld(const GRF& grf, GRFOldData* data, FXint threads) : grf(grf), data(data)
+	{
+		scratch = new GRFScratch[threads];
+	}
+	~GRFHashOld()
+	{
+		delete[] scratch;
+	}
+
+	virtual void work(FXint job, FXint worker)
+	{
+		const Entry& e = grf.entry(job);
+		data[job].entry = -1;
+		if( !e.isFile() )
+			return;
+		const FXuchar* p = grf.inplace(e);
+		if( p == NULL )
+		{
+			FXuchar* buffer = scratch[worker].reserve(e.real_size);
+			if( buffer == NULL || !grf.read(e, buffer) )
+				return;
+			p = buffer;
+		}
+		data[job].hash = grf_hash(p, e.real_size);
+		data[job].real_size = e.real_size;
+		data[job].entry = job;
+	}
+};
+
+/// Read and pack a batch of files
+class GRFPack : public GRFTask
+{
+public:
+	FXString dir;
+	GRFNewEntry* entries;
+	const GRF* old;
+	const GRFOldData* old_data;
+	FXint old_count;
+	GRFScratch* scratch;
+	GRFScratch* old_scratch;
+	FXint failed;
+	FXint reused;
+	FXMutex lock;
+
+	GRFPack(const FXString& dir, GRFNewEntry* entries, const GRF* old, const GRFOldData* old_data, FXint old_count, FXint threads)
+	: dir(dir), entries(entries), old(old), old_data(old_data), old_count(old_count), failed(0), reused(0)
+	{
+		scratch = new GRFScratch[threads];
+		old_scratch = new GRFScratch[threads];
+	}
+	~GRFPack()
+	{
+		delete[] scratch;
+		delete[] old_scratch;
+	}
+
+	/// The old entry has the same bytes, the hash alone may collide
+	bool same(const Entry& o, const FXuchar* data, FXint worker)
+	{
+		const FXuchar* p = old->inplace(o);
+		if( p == NULL )
+		{
+			FXuchar* buffer = old_scratch[worker].reserve(o.real_size);
+			if( buffer == NULL || !old->read(o, buffer) )
+				return false;
+			p = buffer;
+		}
+		return memcmp(p, data, o.real_size) == 0;
+	}
+
+	virtual void work(FXint job, FXint worker)
+	{
+		GRFNewEntry& e = entries[job];
+		if( e.type == DirectoryEntryType )
+			return;
+		FXString path = dir + PATHSEPSTRING + e.name;
+		path.substitute('/', PATHSEP);
+		FXFile file;
+		FXuchar* data = scratch[worker].reserve(e.real_size);
+		if( data == NULL || !file.open(path, FXIO::Reading) || file.readBlock(data, e.real_size) != (FXival)e.real_size )
+		{
+			fail(e, "can not be read");
+			return;
+		}
+		file.close();
+		if( old_count )
+		{
+			GRFOldData key;
+			key.hash = grf_hash(data, e.real_size);
+			key.real_size = e.real_size;
+			const GRFOldData* found = (const GRFOldData*)bsearch(&key, old_data, old_count, sizeof(GRFOldData), grf_cmp_old);
+			if( found && same(old->entry(found->entry), data, worker) )
+			{
+				const Entry& o = old->entry(found->entry);
+				e.type = o.type;
+				e.packed_size = o.packed_size;
+				e.reuse = old->packed(o);
+				FXMutexLock l(lock);
+				++reused;
+				return;
+			}
+		}
+		if( !fxmalloc((void**)&e.packed, e.real_size + 1) )
+		{
+			fail(e, "out of memory");
+			return;
+		}
+		const FXuint n = GRFCompress(data, e.real_size, e.packed, e.real_size);
+		if( n == 0 )
+		{// does not get smaller
+			memcpy(e.packed, data, e.real_size);
+			e.type = RawEntryType;
+			e.packed_size = e.real_size;
+		}
+		else
+		{
+			e.type = CompressedEntryType;
+			e.packed_size = n;
+		}
+	}
+
+	void fail(const GRFNewEntry& e, const char* why)
+	{
+		FXMutexLock l(lock);
+		fprintf(stderr, "%s %s\n", e.name.text(), why);
+		++failed;
+	}
+};
+
+/// Large sequential writes
+class GRFWriter
+{
+	FXFile file;
+	FXuchar* buffer;
+	FXuint used;
+	FXulong total;
+	bool ok;
+public:
+	GRFWriter() : buffer(NULL), used(0), total(0), ok(false){}
+	~GRFWriter()	{ close(); }
+
+	bool open(const FXString& path)
+	{
+		ok = file.open(path, FXIO::Writing) && fxmalloc((void**)&buffer, WriteBufferSize);
+		return ok;
+	}
+	void flush()
+	{
+		if( used && ok )
+			ok = ( file.writeBlock(buffer, used) == (FXival)used );
+		used = 0;
+	}
+	void write(const void* data, FXuint len)
+	{
+		total += len;
+		if( len >= WriteBufferSize/2 )
+		{
+			flush();
+			if( ok )
+				ok = ( file.writeBlock(data, len) == (FXival)len );
+			return;
+		}
+		if( used + len > WriteBufferSize )
+			flush();
+		memcpy(buffer + used, data, len);
+		used += len;
+	}
+	bool close()
+	{
+		flush();
+		if( buffer )
+			fxfree((void**)&buffer);
+		buffer = NULL;
+		file.close();
+		return ok;
+	}
+	FXulong position() const	{ return total; }
+	bool good() const			{ return ok; }
+};
+
+/// Files and directories below dir, with their path relative to the input directory
+static void grf_scan(const FXString& root, const FXString& rel, FXArray<GRFNewEntry>& list)
+{
+	const FXString dir = rel.empty() ? root : root + PATHSEPSTRING + rel;
+	FXString* names = NULL;
+	FXint i, n = FXDir::listFiles(names, dir, "*", FXDir::NoDirs);
+	for( i = 0; i < n; ++i )
+	{
+		GRFNewEntry e;
+		e.name = rel.empty() ? names[i] : rel + "/" + names[i];
+		e.type = RawEntryType;
+		e.real_size = (FXuint)FXStat::size(dir + PATHSEPSTRING + names[i]);
+		e.packed_size = 0;
+		e.offset = 0;
+		e.packed = NULL;
+		e.reuse = NULL;
+		list.append(e);
+	}
+	delete[] names;
+	names = NULL;
+	n = FXDir::listFiles(names, dir, "*", FXDir::NoFiles);
+	for( i = 0; i < n; ++i )
+	{
+		if( names[i] == "." || names[i] == ".." )
+			continue;
+		GRFNewEntry e;
+		e.name = rel.empty() ? names[i] : rel + "/" + names[i];
+		e.type = DirectoryEntryType;
+		e.real_size = 0;
+		e.packed_size = 0;
+		e.offset = 0;
+		e.packed = NULL;
+		e.reuse = NULL;
+		list.append(e);
+		grf_scan(root, e.name, list);
+	}
+	delete[] names;
+}
+
+static int grf_repack(const FXString& archive, const FXString& dir, FXint threads, const FXString& old_archive)
+{
+	GRFPool pool(threads);
+	FXint i;
+
+	// the old archive by content
+	GRF old;
+	GRFOldData* old_data = NULL;
+	FXint old_count = 0;
+	if( !old_archive.empty() )
+	{
+		if( !old.open(old_archive) )
+		{
+			fprintf(stderr, "%s\n", old.getError().text());
+			return 1;
+		}
+		old_data = new GRFOldData[old.entryCount() + 1];
+		GRFHashOld task(old, old_data, pool.threads());
+		pool.run(task, 0, old.entryCount());
+		for( i = 0; i < old.entryCount(); ++i )
+		{
+			if( old_data[i].entry >= 0 )
+				old_data[old_count++] = old_data[i];
+		}
+		qsort(old_data, old_count, sizeof(GRFOldData), grf_cmp_old);
+	}
+
+	// a parent path is a prefix, so it sorts before its contents
+	FXArray<GRFNewEntry> found, list;
+	grf_scan(dir, FXString::null, found);
+	GRFNewEntry** order = new GRFNewEntry*[found.no() + 1];
+	for( i = 0; i < found.no(); ++i )
+		order[i] = &found[i];
+	qsort(order, found.no(), sizeof(GRFNewEntry*), grf_cmp_entry);
+	for( i = 0; i < found.no(); ++i )
+		list.append(*order[i]);
+	delete[] order;
+	for( i = 0; i < list.no(); ++i )
+	{
+		if( list[i].name.length() > 255 )
+		{
+			fprintf(stderr, "%s: name is too long\n", list[i].name.text());
+			delete[] old_data;
+			return 1;
+		}
+	}
+
+	// the old archive stays mapped while the new one is written
+	const FXString temp = archive + ".tmp";
+	GRFWriter out;
+	if( !out.open(temp) )
+	{
+		fprintf(stderr, "%s: can not be written\n", temp.text());
+		delete[] old_data;
+		return 1;
+	}
+	GRFPack task(dir, list.data(), &old, old_data, old_count, pool.threads());
+	FXint first = 0;
+	while( first < list.no() && !task.failed )
+	{
+		// a batch of input, packed in parallel then written in order
+		FXint last = first;
+		FXulong batch = 0;
+		while( last < list.no() && ( last == first || batch + list[last].real_size <= BatchSize ) )
+			batch += list[last++].real_size;
+		pool.run(task, first, last);
+		for( i = first; i < last; ++i )
+		{
+			GRFNewEntry& e = list[i];
+			if( e.type == DirectoryEntryType )
+				continue;
+			if( out.position() + e.packed_size > FXULONG(0xFFFFFFFF) )
+			{
+				fprintf(stderr, "%s: archive is larger than 4 GB\n", archive.text());
+				task.failed = 1;
+				break;
+			}
+			e.offset = (FXuint)out.position();
+			if( e.reuse )
+				out.write(e.reuse, e.packed_size);
+			else if( e.packed )
+				out.write(e.packed, e.packed_size);
+			if( e.packed )
+				fxfree((void**)&e.packed);
+			e.packed = NULL;
+		}
+		first = last;
+	}
+
+	// entry list and descriptor
+	const FXuint list_off = (FXuint)out.position();
+	for( i = 0; i < list.no() && !task.failed; ++i )
+	{
+		const GRFNewEntry& e = list[i];
+		FXuchar head[EntryHeaderSize + 256];
+		const FXuint name_len = (FXuint)e.name.length();
+		head[0] = (FXuchar)name_len;
+		head[1] = (FXuchar)e.type;
+		const FXuint fields[3] = { e.offset, e.packed_size, e.real_size };
+		for( FXint k = 0; k < 3; ++k )
+		{
+			head[2 + 4*k] = (FXuchar)fields[k];
+			head[3 + 4*k] = (FXuchar)(fields[k]>>8);
+			head[4 + 4*k] = (FXuchar)(fields[k]>>16);
+			head[5 + 4*k] = (FXuchar)(fields[k]>>24);
+		}
+		for( FXuint k = 0; k <= name_len; ++k )
+		{
+			const FXuchar c = (FXuchar)e.name[k];
+			head[EntryHeaderSize + k] = (FXuchar)((c<<4) | (c>>4));// half bytes are switched
+		}
+		out.write(head, EntryHeaderSize + name_len + 1);
+	}
+	const FXuint count = (FXuint)list.no();
+	const FXuint swapped = (count<<16) | (count>>16);// words are switched
+	FXuchar desc[DescriptorSize] = {
+		(FXuchar)list_off, (FXuchar)(list_off>>8), (FXuchar)(list_off>>16), (FXuchar)(list_off>>24),
+		(FXuchar)swapped, (FXuchar)(swapped>>8), (FXuchar)(swapped>>16), (FXuchar)(swapped>>24),
+		AlphaVersion };
+	out.write(desc, DescriptorSize);
+
+	bool ok = out.close() && !task.failed;
+	printf("%d entries, %d reused, %d failed\n", list.no(), task.reused, task.failed);
+	for( i = 0; i < list.no(); ++i )
+	{
+		if( list[i].packed )
+			fxfree((void**)&list[i].packed);
+	}
+	delete[] old_data;
+	old.close();
+	if( !ok )
+		FXFile::remove(temp);
+	else if( !FXFile::rename(temp, archive) )
+	{// rename does not replace a file everywhere
+		FXFile::remove(archive);
+		ok = FXFile::rename(temp, archive);
+		if( !ok )
+			fprintf(stderr, "%s: can not be renamed, the new archive is %s\n", archive.text(), temp.text());
+	}
+	return ok ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	FXint threads = 4;
+	FXString old_archive;
+	int i;
+
+	if( argc < 4 || ( strcmp(argv[1], "x") != 0 && strcmp(argv[1], "c") != 0 ) )
+	{
+		printf("usage: %s x <archive> <outdir> [-j threads]\n", argv[0]);
+		printf("       %s c <archive> <indir> [-j threads] [-r old_archive]\n", argv[0]);
+		return 1;
+	}
+	for( i = 4; i + 1 < argc; i += 2 )
+	{
+		if( strcmp(argv[i], "-j") == 0 )
+			threads = atoi(argv[i+1]);
+		else if( strcmp(argv[i], "-r") == 0 )
+			old_archive = argv[i+1];
+	}
+	if( threads < 1 )
+		threads = 1;
+	if( argv[1][0] == 'x' )
+		return grf_extract(argv[2], argv[3], threads);
+	return grf_repack(argv[2], argv[3], threads, old_archive);
+}
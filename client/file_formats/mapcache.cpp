@@ -0,0 +1,276 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#include "mapcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace NMapCache;
+using namespace NGAT;
+
+static inline FXuint MCReadUInt(const FXuchar* p)
+{
+	return (FXuint)p[0] | ((FXuint)p[1]<<8) | ((FXuint)p[2]<<16) | ((FXuint)p[3]<<24);
+}
+static inline void MCWriteUInt(FXuchar* p, FXuint v)
+{
+	p[0] = (FXuchar)v;
+	p[1] = (FXuchar)(v>>8);
+	p[2] = (FXuchar)(v>>16);
+	p[3] = (FXuchar)(v>>24);
+}
+
+/// Bytes of a bit plane, padded to 4
+static inline FXuint MCPlaneSize(FXuint cells)
+{
+	return ((cells + 31)/32)*4;
+}
+
+/// Bytes of the heights, padded to 4
+static inline FXuint MCHeightSize(FXuint cells)
+{
+	return ((2*cells + 3)/4)*4;
+}
+
+//-----------------------------------------------------------------------------
+// Reader
+
+MapCache::MapCache() : data(NULL), size(0), map_count(0)
+{
+}
+
+MapCache::~MapCache()
+{
+	close();
+}
+
+bool MapCache::open(const FXString& filename)
+{
+	close();
+	data = (const FXuchar*)file.map(filename);
+	if( data == NULL )
+	{
+		error.format("%s: can not be mapped", filename.text());
+		return false;
+	}
+	size = file.length();
+	// check everything once, the lookups trust the file
+	if( size < HeaderSize || memcmp(data, "GMCC", 4) != 0 )
+		error.format("%s: not a map cache", filename.text());
+	else if( MCReadUInt(data+4) != CacheVersion )
+		error.format("%s: unsupported version %u", filename.text(), MCReadUInt(data+4));
+	else if( MCReadUInt(data+12) != HeightScale )
+		error.format("%s: unsupported height scale %u", filename.text(), MCReadUInt(data+12));
+	else
+	{
+		const FXuint count = MCReadUInt(data+8);
+		if( count > (FXuval)(size - HeaderSize)/MapEntrySize )
+			error.format("%s: truncated map list", filename.text());
+		else
+		{
+			FXuint i;
+			for( i = 0; i < count; ++i )
+			{
+				const FXuchar* e = data + HeaderSize + i*MapEntrySize;
+				const FXuval cells = (FXuval)MCReadUInt(e+24)*MCReadUInt(e+28);
+				const FXuval need = 3*(FXuval)MCPlaneSize((FXuint)cells) + MCHeightSize((FXuint)cells);
+				if( e[MapNameSize-1] != 0 || cells > 0x7FFFFFFF || MCReadUInt(e+44) < need ||
+					MCReadUInt(e+32) > (FXuval)size || MCReadUInt(e+44) > (FXuval)size - MCReadUInt(e+32) )
+					break;
+				if( i > 0 && strcmp((const FXchar*)e - MapEntrySize, (const FXchar*)e) >= 0 )
+					break;// not sorted
+			}
+			if( i < count )
+				error.format("%s: map %u/%u is corrupt", filename.text(), (i+1), count);
+			else
+			{
+				map_count = (FXint)count;
+				return true;
+			}
+		}
+	}
+	close();
+	return false;
+}
+
+void MapCache::close()
+{
+	if( data )
+		file.unmap();
+	data = NULL;
+	size = 0;
+	map_count = 0;
+}
+
+FXint MapCache::find(const FXchar* name) const
+{
+	FXint lo = 0, hi = map_count - 1;
+	while( lo <= hi )
+	{
+		const FXint mid = (lo + hi)/2;
+		const FXint cmp = strcmp((const FXchar*)data + HeaderSize + mid*MapEntrySize, name);
+		if( cmp == 0 )
+			return mid;
+		if( cmp < 0 )
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+void MapCache::get(FXint i, MapCells& cells) const
+{
+	const FXuchar* e = data + HeaderSize + i*MapEntrySize;
+	const FXuint water = MCReadUInt(e+36);
+	cells.name = (const FXchar*)e;
+	cells.width = (FXint)MCReadUInt(e+24);
+	cells.height = (FXint)MCReadUInt(e+28);
+	memcpy(&cells.water_height, &water, 4);
+	cells.has_water = ( MCReadUInt(e+40) != 0 );
+	const FXuint plane = MCPlaneSize((FXuint)(cells.width*cells.height));
+	cells.walk_bits = data + MCReadUInt(e+32);
+	cells.shoot_bits = cells.walk_bits + plane;
+	cells.water_bits = cells.shoot_bits + plane;
+	cells.heights = cells.water_bits + plane;
+}
+
+//-----------------------------------------------------------------------------
+// Writer
+
+MapCacheWriter::MapCacheWriter()
+{
+}
+
+MapCacheWriter::~MapCacheWriter()
+{
+	for( FXint i = 0; i < maps.no(); ++i )
+	{
+		if( maps[i].data )
+			fxfree((void**)&maps[i].data);
+	}
+}
+
+bool MapCacheWriter::add(const FXchar* name, const GAT& gat, FXfloat water_height, bool has_water)
+{
+	Map map;
+	if( strlen(name) >= MapNameSize )
+	{
+		fxwarning("map name '%s' is too long for the cache\n", name);
+		return false;
+	}
+	memset(map.name, 0, MapNameSize);
+	strcpy(map.name, name);
+	map.width = gat.width;
+	map.height = gat.height;
+	map.water_height = water_height;
+	map.has_water = has_water;
+	const FXuint cells = (FXuint)(gat.width*gat.height);
+	const FXuint plane = MCPlaneSize(cells);
+	map.size = 3*plane + MCHeightSize(cells);
+	if( !fxmalloc((void**)&map.data, map.size + 1) )
+	{
+		fxwarning("out of memory for the cells of map '%s'\n", name);
+		return false;
+	}
+	memset(map.data, 0, map.size);
+	FXuchar* walk = map.data;
+	FXuchar* shoot = walk + plane;
+	FXuchar* water = shoot + plane;
+	FXuchar* heights = water + plane;
+	for( FXuint i = 0; i < cells; ++i )
+	{
+		const FXint type = gat.types[i];
+		const FXfloat h = gat.cellHeight(i);
+		const FXuchar bit = (FXuchar)(1<<(i&7));
+		if( GAT::isWalkable(type) )
+			walk[i>>3] |= bit;
+		if( GAT::isShootable(type) )
+			shoot[i>>3] |= bit;
+		if( type == WaterCell || ( type == WalkableCell && has_water && h > water_height ) )
+			water[i>>3] |= bit;
+		FXfloat scaled = h*HeightScale;
+		if( scaled > 32767.0f ) scaled = 32767.0f;
+		if( scaled < -32768.0f ) scaled = -32768.0f;
+		const FXshort s = (FXshort)( scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f );
+		heights[2*i] = (FXuchar)s;
+		heights[2*i+1] = (FXuchar)((FXushort)s>>8);
+	}
+	FXMutexLock l(lock);
+	maps.append(map);
+	return true;
+}
+
+static int MCCompareMap(const void* a, const void* b)
+{
+	return strcmp((const FXchar*)a, (const FXchar*)b);// the name comes first
+}
+
+bool MapCacheWriter::save(const FXString& filename)
+{
+	FXMutexLock l(lock);
+	if( maps.no() > 0 )
+		qsort(maps.data(), maps.no(), sizeof(Map), MCCompareMap);
+	for( FXint i = 1; i < maps.no(); ++i )
+	{
+		if( strcmp(maps[i-1].name, maps[i].name) == 0 )
+		{
+			fxwarning("map '%s' is in the cache twice\n", maps[i].name);
+			return false;
+		}
+	}
+
+	FXFile file;
+	if( !file.open(filename, FXIO::Writing) )
+	{
+		fxwarning("%s: can not be written\n", filename.text());
+		return false;
+	}
+	const FXuint list_size = HeaderSize + maps.no()*MapEntrySize;
+	FXuchar* list;
+	if( !fxmalloc((void**)&list, list_size) )
+		return false;
+	memcpy(list, "GMCC", 4);
+	MCWriteUInt(list+4, CacheVersion);
+	MCWriteUInt(list+8, (FXuint)maps.no());
+	MCWriteUInt(list+12, HeightScale);
+	FXuval offset = list_size;
+	for( FXint i = 0; i < maps.no(); ++i )
+	{
+		const Map& map = maps[i];
+		FXuchar* e = list + HeaderSize + i*MapEntrySize;
+		FXuint water;
+		memcpy(&water, &map.water_height, 4);
+		memcpy(e, map.name, MapNameSize);
+		MCWriteUInt(e+24, (FXuint)map.width);
+		MCWriteUInt(e+28, (FXuint)map.height);
+		MCWriteUInt(e+32, (FXuint)offset);
+		MCWriteUInt(e+36, water);
+		MCWriteUInt(e+40, map.has_water ? 1 : 0);
+		MCWriteUInt(e+44, map.size);
+		offset += map.size;
+	}
+	bool ok = ( offset <= 0xFFFFFFFF && file.writeBlock(list, list_size) == (FXival)list_size );
+	fxfree((void**)&list);
+	for( FXint i = 0; i < maps.no() && ok; ++i )
+		ok = ( file.writeBlock(maps[i].data, maps[i].size) == (FXival)maps[i].size );
+	file.close();
+	if( !ok )
+	{
+		fxwarning("%s: can not be written\n", filename.text());
+		FXFile::remove(filename);
+	}
+	return ok;
+}
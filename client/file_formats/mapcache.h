@@ -0,0 +1,152 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Map cell cache for the map server.
+** The walkable, shootable and water flags and the height of every cell of
+** every map in one file, so the server maps a single file at startup
+** instead of reading the client RSW/GAT files.
+**
+** [ Header ] sizeof=16
+** magic "GMCC", version (uint), map_count (uint), height_scale (uint)
+** { * map_count, sorted by name
+**   [ MapEntry ] sizeof=48
+**   name[24] (nul terminated), width (uint), height (uint), offset (uint),
+**   water_height (float), has_water (uint), size (uint)
+** }
+** { * map_count, at offset
+**   walkable bits, shootable bits, water bits: 1 per cell, lowest bit first,
+**   each plane padded to 4 bytes
+**   heights: 1 short per cell (height*height_scale), padded to 4 bytes
+** }
+** All values are little endian.
+**
+** $Id$
+*/
+#ifndef _MAPCACHE_H_
+#define _MAPCACHE_H_
+
+#include "fx.h"
+#include "gat.h"
+
+//-----------------------------------------------------------------------------
+namespace NMapCache {
+//-----------------------------------------------------------------------------
+// 1 - base version
+
+enum
+{
+	CacheVersion = 1,
+	HeaderSize = 16,
+	MapEntrySize = 48,
+	MapNameSize = 24,
+	HeightScale = 4// heights are stored in quarter units
+};
+
+/// Cells of one map in a cache, read in place
+struct MapCells
+{
+	const FXchar* name;
+	FXint width;
+	FXint height;
+	FXfloat water_height;
+	bool has_water;
+	const FXuchar* walk_bits;
+	const FXuchar* shoot_bits;
+	const FXuchar* water_bits;
+	const FXuchar* heights;
+
+	bool walkable(FXint x, FXint y) const	{ return bit(walk_bits, x, y); }
+	bool shootable(FXint x, FXint y) const	{ return bit(shoot_bits, x, y); }
+	bool water(FXint x, FXint y) const		{ return bit(water_bits, x, y); }
+	/// Average height of a cell, y is down
+	FXfloat cellHeight(FXint x, FXint y) const
+	{
+		const FXuchar* p = heights + 2*(y*width + x);
+		return (FXfloat)(FXshort)(p[0] | (p[1]<<8))/HeightScale;
+	}
+
+private:
+	bool bit(const FXuchar* bits, FXint x, FXint y) const
+	{
+		if( x < 0 || y < 0 || x >= width || y >= height )
+			return false;
+		const FXint i = y*width + x;
+		return ( bits[i>>3]>>(i&7) )&1;
+	}
+};
+
+/// Cache file mapped into memory
+class MapCache
+{
+	FXMemMap file;
+	const FXuchar* data;
+	FXival size;
+	FXint map_count;
+	FXString error;
+
+	MapCache(const MapCache&);
+	MapCache& operator=(const MapCache&);
+public:
+	MapCache();
+	~MapCache();
+
+	/// Map and check a cache, false with getError() set when it is not valid
+	bool open(const FXString& filename);
+	/// Unmap the file, the cells become invalid
+	void close();
+
+	const FXString& getError() const	{ return error; }
+	FXint mapCount() const				{ return map_count; }
+
+	/// Index of a map by name, -1 when it is not in the cache
+	FXint find(const FXchar* name) const;
+	/// Cells of the i-th map
+	void get(FXint i, MapCells& cells) const;
+};
+
+/// Builds a cache, maps can be added from several threads
+class MapCacheWriter
+{
+	struct Map
+	{
+		FXchar name[MapNameSize];
+		FXint width;
+		FXint height;
+		FXfloat water_height;
+		bool has_water;
+		FXuchar* data;
+		FXuint size;
+	};
+	FXArray<Map> maps;
+	FXMutex lock;
+
+	MapCacheWriter(const MapCacheWriter&);
+	MapCacheWriter& operator=(const MapCacheWriter&);
+public:
+	MapCacheWriter();
+	~MapCacheWriter();
+
+	/// Encode the cells of a map, water is below water_height (y is down) when has_water
+	bool add(const FXchar* name, const NGAT::GAT& gat, FXfloat water_height, bool has_water);
+
+	FXint mapCount() const	{ return maps.no(); }
+
+	/// Write the cache, the maps sorted by name
+	bool save(const FXString& filename);
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NMapCache
+//-----------------------------------------------------------------------------
+
+#endif // _MAPCACHE_H_
@@ -0,0 +1,214 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** mapcachetool - builds the map server cell cache (mapcache.h) from the
+** client maps.
+**
+** usage: mapcachetool <cachefile> <datadir> [-g archive] [-j threads]
+**
+** every RSW in datadir (or in the datadir folder of the archive) is loaded
+** for its water height and GAT file name, then its GAT for the cells.
+** the maps are loaded by a number of threads at the same time.
+**
+** $Id$
+*/
+#include "grf.h"
+#include "rsw.h"
+#include "gat.h"
+#include "mapcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace NMapCache;
+
+/// Maps shared by the threads, each takes the next one
+struct MapJobs
+{
+	FXString dir;
+	const NGRF::GRF* grf;
+	FXString* names;// RSW file names, relative to dir
+	FXint count;
+	FXint next;
+	FXint failed;
+	FXMutex lock;
+	MapCacheWriter cache;
+
+	/// Open a file of the data folder
+	bool open(FXFileStream& fs, NGRF::GRFStream& gs, const FXString& name, FXStream*& store)
+	{
+		if( grf )
+		{
+			store = &gs;
+			return gs.open(*grf, (dir + "/" + name).text());
+		}
+		store = &fs;
+		return fs.open(dir + PATHSEPSTRING + name, FXStreamLoad);
+	}
+
+	bool take(FXint& i)
+	{
+		FXMutexLock l(lock);
+		if( next >= count )
+			return false;
+		i = next++;
+		return true;
+	}
+
+	void fail(const FXString& name, const char* why)
+	{
+		FXMutexLock l(lock);
+		fprintf(stderr, "%s: %s\n", name.text(), why);
+		++failed;
+	}
+
+	void build(const FXString& rsw_name)
+	{
+		FXFileStream fs;
+		NGRF::GRFStream gs;
+		FXStream* store;
+		NRSW::RSW rsw;
+		if( !open(fs, gs, rsw_name, store) )
+		{
+			fail(rsw_name, "can not be read");
+			return;
+		}
+		memset(rsw.magic, 0, 4);
+		rsw.load(*store);
+		store->close();
+		if( memcmp(rsw.magic, "GRSW", 4) != 0 )
+		{
+			fail(rsw_name, "not a RSW file");
+			return;
+		}
+		// older maps have no gat name, it is the name of the map
+		const FXString map = FXPath::title(rsw_name);
+		FXString gat_name;
+		if( rsw.IsCompatibleWith(1,4) && rsw.gat_file[0] )
+		{
+			const FXchar* end = (const FXchar*)memchr(rsw.gat_file, 0, sizeof(rsw.gat_file));
+			gat_name = FXString(rsw.gat_file, end ? (FXint)(end - rsw.gat_file) : (FXint)sizeof(rsw.gat_file));
+		}
+		else
+			gat_name = map + ".gat";
+		NGAT::GAT gat;
+		if( !open(fs, gs, gat_name, store) )
+		{
+			fail(gat_name, "can not be read");
+			return;
+		}
+		const bool loaded = gat.load(*store);
+		store->close();
+		if( !loaded )
+		{
+			fail(gat_name, "not a GAT file or truncated");
+			return;
+		}
+		FXString key = map;
+		key.lower();
+		if( !cache.add(key.text(), gat, rsw.water_height, rsw.IsCompatibleWith(1,3)) )
+			fail(rsw_name, "not added");
+	}
+};
+
+class MapWorker : public FXThread
+{
+public:
+	MapJobs* jobs;
+
+	virtual FXint run()
+	{
+		FXint i;
+		while( jobs->take(i) )
+			jobs->build(jobs->names[i]);
+		return 0;
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	FXint threads = 4;
+	FXString archive;
+	FXint i;
+
+	if( argc < 3 )
+	{
+		printf("usage: %s <cachefile> <datadir> [-g archive] [-j threads]\n", argv[0]);
+		return 1;
+	}
+	for( i = 3; i + 1 < argc; i += 2 )
+	{
+		if( strcmp(argv[i], "-j") == 0 )
+			threads = atoi(argv[i+1]);
+		else if( strcmp(argv[i], "-g") == 0 )
+			archive = argv[i+1];
+	}
+	if( threads < 1 )
+		threads = 1;
+
+	MapJobs jobs;
+	NGRF::GRF grf;
+	jobs.dir = argv[2];
+	jobs.grf = NULL;
+	jobs.names = NULL;
+	jobs.count = 0;
+	jobs.next = 0;
+	jobs.failed = 0;
+	if( archive.empty() )
+		jobs.count = FXDir::listFiles(jobs.names, jobs.dir, "*.rsw", FXDir::NoDirs|FXDir::CaseFold);
+	else
+	{
+		if( !grf.open(archive) )
+		{
+			fprintf(stderr, "%s\n", grf.getError().text());
+			return 1;
+		}
+		jobs.grf = &grf;
+		// the RSW files directly in the data folder of the archive
+		FXArray<FXString> found;
+		const FXString prefix = jobs.dir + "/";
+		for( i = 0; i < grf.entryCount(); ++i )
+		{
+			const FXString name = grf.entry(i).name;
+			if( grf.entry(i).isFile() && comparecase(name.left(prefix.length()), prefix) == 0 &&
+				name.find('/', prefix.length()) < 0 && comparecase(name.right(4), ".rsw") == 0 )
+				found.append(name.mid(prefix.length(), name.length()));
+		}
+		jobs.count = found.no();
+		jobs.names = new FXString[jobs.count + 1];
+		for( i = 0; i < jobs.count; ++i )
+			jobs.names[i] = found[i];
+	}
+
+	MapWorker* workers = new MapWorker[threads];
+	bool* started = new bool[threads];
+	for( i = 1; i < threads; ++i )
+	{
+		workers[i].jobs = &jobs;
+		started[i] = workers[i].start();
+	}
+	workers[0].jobs = &jobs;
+	workers[0].run();
+	for( i = 1; i < threads; ++i )
+	{
+		if( started[i] )
+			workers[i].join();
+	}
+	delete[] started;
+	delete[] workers;
+
+	const bool ok = jobs.cache.save(argv[1]);
+	printf("%d maps, %d in the cache, %d failed\n", jobs.count, jobs.cache.mapCount(), jobs.failed);
+	delete[] jobs.names;
+	return ( ok && !jobs.failed ) ? 0 : 1;
+}
@@ -0,0 +1,744 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Special thanks to:
+**    ximosoft and who he's thanking for info -> http://rolaboratory.ximosoft.com/file-format/rsm/
+**    Gravity
+**
+** $Id$
+*/
+#include "rsm.h"
+#include <math.h>
+#include <string.h>
+
+using namespace NRSM;
+// 1.1 - base supported version
+// 1.2 - color added to texture vertices; smoothGroup added to faces
+// 1.3 - flag added to volume boxes
+// 1.4 - alpha added to header
+// 1.5 - position animation for each node instead of global(?)
+
+//-----------------------------------------------------------------------------
+// Matrix
+
+void RSMMatrix::identity()
+{
+	v11 = 1.0f; v12 = 0.0f; v13 = 0.0f;
+	v21 = 0.0f; v22 = 1.0f; v23 = 0.0f;
+	v31 = 0.0f; v32 = 0.0f; v33 = 1.0f;
+	v41 = 0.0f; v42 = 0.0f; v43 = 0.0f;
+}
+
+void RSMMatrix::translation(const FXVec3f& t)
+{
+	identity();
+	v41 = t.x; v42 = t.y; v43 = t.z;
+}
+
+void RSMMatrix::rotation(FXfloat angle, const FXVec3f& axis)
+{
+	FXfloat len = sqrtf(axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+	identity();
+	if( len == 0.0f )
+		return;
+	const FXfloat x = axis.x/len, y = axis.y/len, z = axis.z/len;
+	const FXfloat c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+	// transposed, the points are row vectors
+	v11 = t*x*x + c;	v12 = t*x*y + s*z;	v13 = t*x*z - s*y;
+	v21 = t*x*y - s*z;	v22 = t*y*y + c;	v23 = t*y*z + s*x;
+	v31 = t*x*z + s*y;	v32 = t*y*z - s*x;	v33 = t*z*z + c;
+}
+
+void RSMMatrix::scaling(const FXVec3f& s)
+{
+	identity();
+	v11 = s.x; v22 = s.y; v33 = s.z;
+}
+
+RSMMatrix RSMMatrix::multiply(const RSMMatrix& a, const RSMMatrix& b)
+{
+	RSMMatrix m;
+	m.v11 = a.v11*b.v11 + a.v12*b.v21 + a.v13*b.v31;
+	m.v12 = a.v11*b.v12 + a.v12*b.v22 + a.v13*b.v32;
+	m.v13 = a.v11*b.v13 + a.v12*b.v23 + a.v13*b.v33;
+	m.v21 = a.v21*b.v11 + a.v22*b.v21 + a.v23*b.v31;
+	m.v22 = a.v21*b.v12 + a.v22*b.v22 + a.v23*b.v32;
+	m.v23 = a.v21*b.v13 + a.v22*b.v23 + a.v23*b.v33;
+	m.v31 = a.v31*b.v11 + a.v32*b.v21 + a.v33*b.v31;
+	m.v32 = a.v31*b.v12 + a.v32*b.v22 + a.v33*b.v32;
+	m.v33 = a.v31*b.v13 + a.v32*b.v23 + a.v33*b.v33;
+	m.v41 = a.v41*b.v11 + a.v42*b.v21 + a.v43*b.v31 + b.v41;
+	m.v42 = a.v41*b.v12 + a.v42*b.v22 + a.v43*b.v32 + b.v42;
+	m.v43 = a.v41*b.v13 + a.v42*b.v23 + a.v43*b.v33 + b.v43;
+	return m;
+}
+
+FXVec3f RSMMatrix::transform(const FXVec3f& p) const
+{
+	return FXVec3f(
+		p.x*v11 + p.y*v21 + p.z*v31 + v41,
+		p.x*v12 + p.y*v22 + p.z*v32 + v42,
+		p.x*v13 + p.y*v23 + p.z*v33 + v43);
+}
+
+void RSMMatrix::load(FXStream& store)
+{
+	store >> v11; store >> v12; store >> v13;
+	store >> v21; store >> v22; store >> v23;
+	store >> v31; store >> v32; store >> v33;
+	store >> v41; store >> v42; store >> v43;
+}
+
+void RSMMatrix::save(FXStream& store) const
+{
+	store << v11; store << v12; store << v13;
+	store << v21; store << v22; store << v23;
+	store << v31; store << v32; store << v33;
+	store << v41; store << v42; store << v43;
+}
+
+/// Grow a box by the 8 corners of another box transformed by a matrix
+void NRSM::RSMGrowBox(FXVec3f& min, FXVec3f& max, const FXVec3f& bmin, const FXVec3f& bmax, const RSMMatrix& m)
+{
+	for( FXint i = 0; i < 8; ++i )
+	{
+		const FXVec3f p = m.transform(FXVec3f((i&1) ? bmax.x : bmin.x, (i&2) ? bmax.y : bmin.y, (i&4) ? bmax.z : bmin.z));
+		if( p.x < min.x ) min.x = p.x;
+		if( p.y < min.y ) min.y = p.y;
+		if( p.z < min.z ) min.z = p.z;
+		if( p.x > max.x ) max.x = p.x;
+		if( p.y > max.y ) max.y = p.y;
+		if( p.z > max.z ) max.z = p.z;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Bounds
+
+/// If this RSM is compatible with the target version (version >= target)
+bool RSMBounds::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
+{
+	return ( ( this->major_ver == major_ver && this->minor_ver >= minor_ver ) || this->major_ver > major_ver );
+}
+
+/// The model is read whole, the bounds are those of RSM::computeTransforms
+bool RSMBounds::load(FXStream& store)
+{
+	RSM rsm;
+	rsm.load(store);
+	major_ver = rsm.major_ver;
+	minor_ver = rsm.minor_ver;
+	min = rsm.min;
+	max = rsm.max;
+	return rsm.valid() && store.status() == FXStreamOK;
+}
+
+//-----------------------------------------------------------------------------
+// Model
+
+/// Skip the records of a section of a node and add them to a total,
+/// false for a negative count or a seek past the end
+static bool RSMSkip(FXStream& store, FXlong& total, FXlong record, FXlong extra = 0)
+{
+	FXint n;
+	store >> n;
+	if( n < 0 || store.status() != FXStreamOK )
+		return false;
+	total += n;
+	return store.position((FXlong)n*record + extra, FXFromCurrent);
+}
+
+/// A count of the second pass that fits into the total of the first
+static bool RSMFits(FXint first, FXint count, FXlong total)
+{
+	return count >= 0 && (FXlong)first + count <= total;
+}
+
+RSM::RSM()
+: anim_length(0)
+, shade_type(2)
+, alpha(0xFF)
+, arena(NULL)
+, texture_count(0)
+, textures(NULL)
+, node_count(0)
+, nodes(NULL)
+, node_textures(NULL)
+, vertex_count(0)
+, vertices(NULL)
+, tvertex_count(0)
+, tvertices(NULL)
+, face_count(0)
+, faces(NULL)
+, poskey_count(0)
+, poskeys(NULL)
+, rotkey_count(0)
+, rotkeys(NULL)
+, volume_count(0)
+, volumes(NULL)
+, min(0.0f, 0.0f, 0.0f)
+, max(0.0f, 0.0f, 0.0f)
+{
+	memcpy(magic, "GRSM", 4);
+	major_ver = 1;
+	minor_ver = 5;
+	memset(reserved, 0, sizeof(reserved));
+	memset(main_node, 0, sizeof(main_node));
+}
+
+RSM::~RSM()
+{
+	clear();
+}
+
+/// Free the arrays, they have nothing to destroy so the block just goes
+void RSM::clear()
+{
+	if( arena )
+		fxfree((void**)&arena);
+	arena = NULL;
+	textures = NULL;
+	nodes = NULL;
+	node_textures = NULL;
+	vertices = NULL;
+	tvertices = NULL;
+	faces = NULL;
+	poskeys = NULL;
+	rotkeys = NULL;
+	volumes = NULL;
+	texture_count = 0;
+	node_count = 0;
+	vertex_count = 0;
+	tvertex_count = 0;
+	face_count = 0;
+	poskey_count = 0;
+	rotkey_count = 0;
+	volume_count = 0;
+}
+
+/// If this RSM is compatible with the target version (version >= target)
+bool RSM::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
+{
+	return ( ( this->major_ver == major_ver && this->minor_ver >= minor_ver ) || this->major_ver > major_ver );
+}
+
+/// Matrices in parent order, then the bounds of the vertices
+void RSM::computeTransforms()
+{
+	FXint i, k;
+	for( i = 0; i < node_count; ++i )
+	{
+		RSMNode& node = nodes[i];
+		RSMMatrix m;
+		// p * scale * rotation * translation
+		node.local.scaling(node.scale);
+		m.rotation(node.rotangle, node.rotaxis);
+		node.local = RSMMatrix::multiply(node.local, m);
+		m.translation(node.pos);
+		node.local = RSMMatrix::multiply(node.local, m);
+		if( node.parent >= 0 )
+			node.world = RSMMatrix::multiply(node.local, nodes[node.parent].world);
+		else
+			node.world = node.local;
+		node.mesh = RSMMatrix::multiply(node.offset, node.world);
+	}
+	bool first = true;
+	min = max = FXVec3f(0.0f, 0.0f, 0.0f);
+	for( i = 0; i < node_count; ++i )
+	{
+		const RSMNode& node = nodes[i];
+		for( k = 0; k < node.vertex_count; ++k )
+		{
+			const FXVec3f v = node.mesh.transform(vertices[node.vertex_first + k]);
+			if( first )
+			{
+				min = max = v;
+				first = false;
+			}
+			if( v.x < min.x ) min.x = v.x;
+			if( v.y < min.y ) min.y = v.y;
+			if( v.z < min.z ) min.z = v.z;
+			if( v.x > max.x ) max.x = v.x;
+			if( v.y > max.y ) max.y = v.y;
+			if( v.z > max.z ) max.z = v.z;
+		}
+	}
+}
+
+/// The indexes of a face are in the arrays of its node and the texture of
+/// the node is one of the model
+bool RSM::validFace(const RSMNode& node, const RSMFace& face) const
+{
+	for( FXint k = 0; k < 3; ++k )
+	{
+		if( face.vertex[k] >= node.vertex_count || face.tvertex[k] >= node.tvertex_count )
+			return false;
+	}
+	if( face.texture >= node.texture_count )
+		return false;
+	const FXint texture = node_textures[node.texture_first + face.texture];
+	return ( texture >= 0 && texture < texture_count );
+}
+
+/// Load RSM from a stream
+FXStream& operator>>(FXStream& store, RSM& rsm)
+{
+	rsm.load(store);
+	return store;
+}
+void RSM::load(FXStream& store)
+{
+	bool bigEndian = store.isBigEndian();
+	FXint i, k, n;
+
+	clear();
+	store.setBigEndian(false);// data is in little endian
+	store.load(magic, 4);
+	store >> major_ver;
+	store >> minor_ver;
+	if( memcmp(magic, "GRSM", 4) != 0 )
+	{
+		fxwarning("not a RSM file\n");
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	store >> anim_length;
+	store >> shade_type;
+	if( IsCompatibleWith(1,4) )
+		store >> alpha;
+	else
+		alpha = 0xFF;
+	store.load(reserved, 16);
+
+	// count everything first, the records have a fixed size for a version
+	const FXlong tvert_size = IsCompatibleWith(1,2) ? TexVertexRecordSize : TexVertexRecordSizeBase;
+	const FXlong face_size = IsCompatibleWith(1,2) ? FaceRecordSize : FaceRecordSizeBase;
+	const FXlong start = store.position();
+	FXlong total[6] = { 0, 0, 0, 0, 0, 0 };// textures, vertices, tvertices, faces, poskeys, rotkeys
+	store >> texture_count;
+	bool ok = ( texture_count >= 0 && store.position((FXlong)texture_count*NameSize + NameSize, FXFromCurrent) );
+	store >> node_count;
+	ok = ok && node_count > 0;
+	for( i = 0; i < node_count && ok && store.status() == FXStreamOK; ++i )
+	{
+		ok = store.position(2*NameSize, FXFromCurrent);
+		ok = ok && RSMSkip(store, total[0], 4, 48 + 12 + 4 + 12 + 12);// texture ids, then the transform
+		ok = ok && RSMSkip(store, total[1], 12);
+		ok = ok && RSMSkip(store, total[2], tvert_size);
+		ok = ok && RSMSkip(store, total[3], face_size);
+		if( IsCompatibleWith(1,5) )
+			ok = ok && RSMSkip(store, total[4], PosKeyRecordSize);
+		ok = ok && RSMSkip(store, total[5], RotKeyRecordSize);
+	}
+	if( ok && !IsCompatibleWith(1,5) )
+		ok = RSMSkip(store, total[4], PosKeyRecordSize);
+	store >> volume_count;
+	ok = ok && volume_count >= 0 && store.status() == FXStreamOK;
+	for( k = 0; k < 6; ++k )
+		ok = ok && total[k] < 0x1000000;
+	ok = ok && texture_count < 0x10000 && node_count < 0x10000 && volume_count < 0x10000;
+	if( !ok || !store.position(start) )
+	{
+		fxwarning("RSM is corrupt or truncated\n");
+		texture_count = node_count = volume_count = 0;
+		store.setBigEndian(bigEndian);
+		return;
+	}
+
+	// one block for all arrays, the structs first so everything is aligned
+	FXival size =	(FXival)2*node_count*sizeof(RSMNode) +// sorted, then file order
+					total[1]*sizeof(FXVec3f) +
+					total[2]*sizeof(RSMTexVertex) +
+					total[3]*sizeof(RSMFace) +
+					total[4]*sizeof(RSMPosKey) +
+					total[5]*sizeof(RSMRotKey) +
+					volume_count*sizeof(RSMVolume) +
+					total[0]*sizeof(FXint) +
+					(FXival)texture_count*NameSize;
+	if( !fxmalloc((void**)&arena, size + 1) )
+	{
+		fxwarning("RSM out of memory for %d nodes\n", node_count);
+		texture_count = node_count = volume_count = 0;
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	nodes = (RSMNode*)arena;
+	RSMNode* tmp = nodes + node_count;
+	vertices = (FXVec3f*)(tmp + node_count);
+	tvertices = (RSMTexVertex*)(vertices + total[1]);
+	faces = (RSMFace*)(tvertices + total[2]);
+	poskeys = (RSMPosKey*)(faces + total[3]);
+	rotkeys = (RSMRotKey*)(poskeys + total[4]);
+	volumes = (RSMVolume*)(rotkeys + total[5]);
+	node_textures = (FXint*)(volumes + volume_count);
+	textures = (FXchar*)(node_textures + total[0]);
+
+	// the counts are read again, they must fit into what was counted
+	const FXint textures_counted = texture_count;
+	const FXint nodes_counted = node_count;
+	const FXint volumes_counted = volume_count;
+	store >> texture_count;
+	ok = ( texture_count == textures_counted );
+	if( ok )
+		store.load(textures, texture_count*NameSize);
+	for( i = 0; i < texture_count; ++i )
+		textures[i*NameSize + NameSize - 1] = 0;
+	store.load(main_node, NameSize);
+	main_node[NameSize-1] = 0;
+	store >> node_count;
+	ok = ok && node_count == nodes_counted;
+	face_count = 0;
+	for( i = 0; i < node_count && ok; ++i )
+	{
+		RSMNode& node = tmp[i];
+		store.load(node.name, NameSize);
+		store.load(node.parent_name, NameSize);
+		node.name[NameSize-1] = 0;
+		node.parent_name[NameSize-1] = 0;
+		store >> node.texture_count;
+		node.texture_first = (FXint)(i ? tmp[i-1].texture_first + tmp[i-1].texture_count : 0);
+		if( !RSMFits(node.texture_first, node.texture_count, total[0]) )
+			break;
+		store.load(node_textures + node.texture_first, node.texture_count);
+		node.offset.load(store);
+		store >> node.pos;
+		store >> node.rotangle;
+		store >> node.rotaxis;
+		store >> node.scale;
+		store >> node.vertex_count;
+		node.vertex_first = (FXint)(i ? tmp[i-1].vertex_first + tmp[i-1].vertex_count : 0);
+		if( !RSMFits(node.vertex_first, node.vertex_count, total[1]) )
+			break;
+		store.load((FXfloat*)(vertices + node.vertex_first), 3*node.vertex_count);
+		store >> node.tvertex_count;
+		node.tvertex_first = (FXint)(i ? tmp[i-1].tvertex_first + tmp[i-1].tvertex_count : 0);
+		if( !RSMFits(node.tvertex_first, node.tvertex_count, total[2]) )
+			break;
+		if( IsCompatibleWith(1,2) )
+			store.load((FXuint*)(tvertices + node.tvertex_first), 3*node.tvertex_count);// color, u, v
+		else
+		{
+			for( k = 0; k < node.tvertex_count; ++k )
+			{
+				RSMTexVertex& tv = tvertices[node.tvertex_first + k];
+				tv.color = 0xFFFFFFFF;
+				store >> tv.u;
+				store >> tv.v;
+			}
+		}
+		store >> n;
+		node.face_first = (FXint)(i ? tmp[i-1].face_first + tmp[i-1].face_count : 0);
+		node.face_count = 0;
+		if( !RSMFits(node.face_first, n, total[3]) )
+			break;
+		for( k = 0; k < n; ++k )
+		{// faces with an index outside the arrays of the node are dropped
+			RSMFace& face = faces[node.face_first + node.face_count];
+			store.load(face.vertex, 3);
+			store.load(face.tvertex, 3);
+			store >> face.texture;
+			store >> face.padding;
+			store >> face.two_side;
+			if( IsCompatibleWith(1,2) )
+				store >> face.smooth_group;
+			else
+				face.smooth_group = 0;
+			if( validFace(node, face) )
+				++node.face_count;
+		}
+		if( node.face_count < n )
+			fxwarning("RSM node '%s' has %d faces with bad indexes, they are dropped\n", node.name, n - node.face_count);
+		face_count += node.face_count;
+		node.poskey_first = (FXint)(i ? tmp[i-1].poskey_first + tmp[i-1].poskey_count : 0);
+		node.poskey_count = 0;
+		if( IsCompatibleWith(1,5) )
+		{
+			store >> node.poskey_count;
+			if( !RSMFits(node.poskey_first, node.poskey_count, total[4]) )
+				break;
+			store.load((FXuint*)(poskeys + node.poskey_first), 4*node.poskey_count);// frame, x, y, z
+		}
+		store >> node.rotkey_count;
+		node.rotkey_first = (FXint)(i ? tmp[i-1].rotkey_first + tmp[i-1].rotkey_count : 0);
+		if( !RSMFits(node.rotkey_first, node.rotkey_count, total[5]) )
+			break;
+		store.load((FXuint*)(rotkeys + node.rotkey_first), 5*node.rotkey_count);// frame, qx, qy, qz, qw
+		ok = ( store.status() == FXStreamOK );
+	}
+	ok = ok && i == node_count;
+	if( ok && !IsCompatibleWith(1,5) )
+	{// global keyframes, they go to the main node
+		store >> n;
+		ok = RSMFits(0, n, total[4]);
+		if( ok )
+			store.load((FXuint*)poskeys, 4*n);
+	}
+	if( ok )
+	{
+		store >> volume_count;
+		ok = volume_count >= 0 && volume_count <= volumes_counted && store.status() == FXStreamOK;
+	}
+	if( !ok )
+	{
+		fxwarning("RSM is corrupt or truncated\n");
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	vertex_count = (FXint)total[1];
+	tvertex_count = (FXint)total[2];
+	poskey_count = (FXint)total[4];
+	rotkey_count = (FXint)total[5];
+	if( !IsCompatibleWith(1,5) )
+	{// the global keyframes go to the main node
+		for( i = 0; i < node_count; ++i )
+		{
+			if( strcmp(tmp[i].name, main_node) == 0 )
+			{
+				tmp[i].poskey_first = 0;
+				tmp[i].poskey_count = n;
+				break;
+			}
+		}
+	}
+	for( i = 0; i < volume_count; ++i )
+	{
+		RSMVolume& volume = volumes[i];
+		store >> volume.size;
+		store >> volume.pos;
+		store >> volume.rot;
+		if( IsCompatibleWith(1,3) )
+			store >> volume.flag;
+		else
+			volume.flag = 0;
+	}
+
+	// parents by name, the root has none or itself
+	for( i = 0; i < node_count; ++i )
+	{
+		tmp[i].parent = -1;
+		if( tmp[i].parent_name[0] == 0 || strcmp(tmp[i].parent_name, tmp[i].name) == 0 )
+			continue;
+		for( k = 0; k < node_count; ++k )
+		{
+			if( k != i && strcmp(tmp[k].name, tmp[i].parent_name) == 0 )
+			{
+				tmp[i].parent = k;
+				break;
+			}
+		}
+	}
+	// parents first: each pass places the nodes whose parent is placed,
+	// nodes left in a loop become roots
+	FXint* place;
+	FXint placed = 0;
+	if( !fxmalloc((void**)&place, node_count*sizeof(FXint)) )
+	{
+		fxwarning("RSM out of memory for %d nodes\n", node_count);
+		clear();
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	for( i = 0; i < node_count; ++i )
+		place[i] = -1;
+	while( placed < node_count )
+	{
+		const FXint before = placed;
+		for( i = 0; i < node_count; ++i )
+		{
+			if( place[i] < 0 && ( tmp[i].parent < 0 || place[tmp[i].parent] >= 0 ) )
+				place[i] = placed++;
+		}
+		if( placed == before )
+		{
+			for( i = 0; place[i] >= 0; ++i )
+				;
+			tmp[i].parent = -1;
+			fxwarning("RSM node '%s' is in a parent loop\n", tmp[i].name);
+		}
+	}
+	for( i = 0; i < node_count; ++i )
+	{
+		nodes[place[i]] = tmp[i];
+		if( tmp[i].parent >= 0 )
+			nodes[place[i]].parent = place[tmp[i].parent];
+	}
+	fxfree((void**)&place);
+	computeTransforms();
+	if( store.status() != FXStreamOK )
+		fxwarning("RSM is truncated\n");
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+}
+
+/// Save RSM to a stream
+FXStream& operator<<(FXStream& store, const RSM& rsm)
+{
+	rsm.save(store);
+	return store;
+}
+void RSM::save(FXStream& store) const
+{
+	bool bigEndian = store.isBigEndian();
+	FXint i, k;
+
+	store.setBigEndian(false);// data is in little endian
+	store.save(magic, 4);
+	store << major_ver;
+	store << minor_ver;
+	store << anim_length;
+	store << shade_type;
+	if( IsCompatibleWith(1,4) )
+		store << alpha;
+	store.save(reserved, 16);
+	store << texture_count;
+	store.save(textures, texture_count*NameSize);
+	store.save(main_node, NameSize);
+	store << node_count;
+	const RSMNode* main = NULL;
+	for( i = 0; i < node_count; ++i )
+	{
+		const RSMNode& node = nodes[i];
+		if( main == NULL && strcmp(node.name, main_node) == 0 )
+			main = &node;
+		store.save(node.name, NameSize);
+		store.save(node.parent_name, NameSize);
+		store << node.texture_count;
+		store.save(node_textures + node.texture_first, node.texture_count);
+		node.offset.save(store);
+		store << node.pos;
+		store << node.rotangle;
+		store << node.rotaxis;
+		store << node.scale;
+		store << node.vertex_count;
+		store.save((const FXfloat*)(vertices + node.vertex_first), 3*node.vertex_count);
+		store << node.tvertex_count;
+		for( k = 0; k < node.tvertex_count; ++k )
+		{
+			const RSMTexVertex& tv = tvertices[node.tvertex_first + k];
+			if( IsCompatibleWith(1,2) )
+				store << tv.color;
+			store << tv.u;
+			store << tv.v;
+		}
+		store << node.face_count;
+		for( k = 0; k < node.face_count; ++k )
+		{
+			const RSMFace& face = faces[node.face_first + k];
+			store.save(face.vertex, 3);
+			store.save(face.tvertex, 3);
+			store << face.texture;
+			store << face.padding;
+			store << face.two_side;
+			if( IsCompatibleWith(1,2) )
+				store << face.smooth_group;
+		}
+		if( IsCompatibleWith(1,5) )
+		{
+			store << node.poskey_count;
+			store.save((const FXuint*)(poskeys + node.poskey_first), 4*node.poskey_count);
+		}
+		store << node.rotkey_count;
+		store.save((const FXuint*)(rotkeys + node.rotkey_first), 5*node.rotkey_count);
+	}
+	if( !IsCompatibleWith(1,5) )
+	{// global keyframes of the main node
+		const FXint n = main ? main->poskey_count : 0;
+		store << n;
+		if( n )
+			store.save((const FXuint*)(poskeys + main->poskey_first), 4*n);
+	}
+	store << volume_count;
+	for( i = 0; i < volume_count; ++i )
+	{
+		const RSMVolume& volume = volumes[i];
+		store << volume.size;
+		store << volume.pos;
+		store << volume.rot;
+		if( IsCompatibleWith(1,3) )
+			store << volume.flag;
+	}
+	store.setBigEndian(bigEndian);// revert to the previous endianess
+}
+
+//-----------------------------------------------------------------------------
+// Cache
+
+RSMCache::RSMCache(const FXString& dir, const NGRF::GRF* grf)
+: dir(dir)
+, grf(grf)
+{
+}
+
+RSMCache::~RSMCache()
+{
+	clear();
+}
+
+void RSMCache::clear()
+{
+	FXMutexLock l(lock);
+	for( FXint pos = models.first(); pos < models.size(); pos = models.next(pos) )
+		delete (RSM*)models.data(pos);
+	models.clear();
+}
+
+/// The lock is not held while a model loads, when two threads load the
+/// same model the first one inserted is kept
+const RSM* RSMCache::get(const FXchar* filename)
+{
+	FXString key = filename;
+	key.substitute('\\', '/');
+	key.lower();
+	{
+		FXMutexLock l(lock);
+		const RSM* rsm = (const RSM*)models.find(key.text());
+		if( rsm )
+			return rsm->valid() ? rsm : NULL;
+	}
+
+	RSM* rsm = new RSM;
+	if( grf )
+	{
+		NGRF::GRFStream store;
+		if( store.open(*grf, (dir + "/" + key).text()) )
+		{
+			rsm->load(store);
+			store.close();
+		}
+	}
+	else
+	{
+		FXString path = dir + PATHSEPSTRING + filename;
+		path.substitute('\\', PATHSEP);
+		path.substitute('/', PATHSEP);
+		FXFileStream store;
+		if( store.open(path, FXStreamLoad) )
+		{
+			rsm->load(store);
+			store.close();
+		}
+	}
+	if( !rsm->valid() )
+		fxwarning("RSM model '%s' could not be loaded\n", filename);
+
+	FXMutexLock l(lock);
+	RSM* other = (RSM*)models.find(key.text());
+	if( other )
+	{
+		delete rsm;
+		rsm = other;
+	}
+	else
+		models.insert(key.text(), rsm);
+	return rsm->valid() ? rsm : NULL;
+}
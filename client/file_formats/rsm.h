@@ -0,0 +1,250 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Special thanks to:
+**    ximosoft and who he's thanking for info -> http://rolaboratory.ximosoft.com/file-format/rsm/
+**    Gravity
+**
+** $Id$
+*/
+#ifndef _RSM_H_
+#define _RSM_H_
+
+#include "fx.h"
+#include "FXVec3f.h"
+#include "grf.h"
+
+//-----------------------------------------------------------------------------
+namespace NRSM {
+//-----------------------------------------------------------------------------
+// 1.1 - base supported version
+// 1.2 - color added to texture vertices; smoothGroup added to faces
+// 1.3 - flag added to volume boxes
+// 1.4 - alpha added to header
+// 1.5 - position animation for each node instead of global(?)
+
+/// 4x3 matrix as stored in the files, points are row vectors (p' = p*m)
+struct RSMMatrix
+{
+	FXfloat v11, v12, v13;
+	FXfloat v21, v22, v23;
+	FXfloat v31, v32, v33;
+	FXfloat v41, v42, v43;// translation
+
+	void identity();
+	void translation(const FXVec3f& t);
+	void rotation(FXfloat angle, const FXVec3f& axis);// radians
+	void scaling(const FXVec3f& s);
+	/// a*b, a is applied first
+	static RSMMatrix multiply(const RSMMatrix& a, const RSMMatrix& b);
+	FXVec3f transform(const FXVec3f& p) const;
+
+	void load(FXStream& store);
+	void save(FXStream& store) const;
+};
+
+/// Grow a box by the 8 corners of another box transformed by a matrix
+void RSMGrowBox(FXVec3f& min, FXVec3f& max, const FXVec3f& bmin, const FXVec3f& bmax, const RSMMatrix& m);
+
+/// Bounding box of a model, the model is read with RSM::load and dropped.
+/// The box covers the vertices of all nodes in the rest position.
+struct RSMBounds
+{
+	FXchar major_ver;
+	FXchar minor_ver;
+	FXVec3f min;
+	FXVec3f max;
+
+	/// If this RSM is compatible with the target version (version >= target)
+	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
+
+	/// Read the model, false when it is not a RSM
+	bool load(FXStream& store);
+};
+
+enum RecordSize
+{
+	NameSize = 40,
+	TexVertexRecordSize = 12,
+	TexVertexRecordSizeBase = 8,// (version < 1.2)
+	FaceRecordSize = 24,
+	FaceRecordSizeBase = 20,// (version < 1.2)
+	PosKeyRecordSize = 16,
+	RotKeyRecordSize = 20,
+	VolumeRecordSize = 40,
+	VolumeRecordSizeBase = 36// (version < 1.3)
+};
+
+/// Texture vertex - 12 bytes (8 before 1.2)
+struct RSMTexVertex
+{
+	FXuint color;// (version >= 1.2) 0xFFFFFFFF before
+	FXfloat u;
+	FXfloat v;
+};
+
+/// Face - 24 bytes (20 before 1.2), the indexes are in the arrays of the node
+struct RSMFace
+{
+	FXushort vertex[3];
+	FXushort tvertex[3];
+	FXushort texture;// index in the textures of the node
+	FXushort padding;
+	FXint two_side;
+	FXint smooth_group;// (version >= 1.2) 0 before
+};
+
+/// Position keyframe - 16 bytes
+struct RSMPosKey
+{
+	FXint frame;
+	FXVec3f pos;
+};
+
+/// Rotation keyframe - 20 bytes
+struct RSMRotKey
+{
+	FXint frame;
+	FXfloat q[4];// x, y, z, w
+};
+
+/// Volume box - 40 bytes (36 before 1.3)
+struct RSMVolume
+{
+	FXVec3f size;
+	FXVec3f pos;
+	FXVec3f rot;
+	FXint flag;// (version >= 1.3) 0 before
+};
+
+/// Node, the data of all nodes is in the arrays of the model.
+/// each array has a [first, first+count) range for the node
+struct RSMNode
+{
+	FXchar name[NameSize];
+	FXchar parent_name[NameSize];
+	FXint parent;// index in the nodes, -1 for a root
+	RSMMatrix offset;// offsetMT
+	FXVec3f pos;
+	FXfloat rotangle;// radians
+	FXVec3f rotaxis;
+	FXVec3f scale;
+	FXint texture_first, texture_count;// in node_textures
+	FXint vertex_first, vertex_count;
+	FXint tvertex_first, tvertex_count;
+	FXint face_first, face_count;
+	FXint poskey_first, poskey_count;// (version >= 1.5, the main node before)
+	FXint rotkey_first, rotkey_count;
+
+	// computed when the model is loaded, in the rest position
+	RSMMatrix local;// scale, rotation and translation of the node
+	RSMMatrix world;// local of the node, then of its parents
+	RSMMatrix mesh;// offset then world, vertices of the node to model space
+};
+
+/// Resource Model.
+/// the nodes are sorted so every parent comes before its children and all
+/// arrays are in one block
+struct RSM
+{
+	FXchar magic[4];// "GRSM"
+	FXchar major_ver;
+	FXchar minor_ver;
+	FXint anim_length;
+	FXint shade_type;
+	FXuchar alpha;// (version >= 1.4) 0xFF before
+	FXchar reserved[16];
+	FXchar main_node[NameSize];
+
+	FXuchar* arena;
+	FXint texture_count;
+	FXchar* textures;// NameSize bytes each
+	FXint node_count;
+	RSMNode* nodes;
+	FXint* node_textures;
+	FXint vertex_count;
+	FXVec3f* vertices;
+	FXint tvertex_count;
+	RSMTexVertex* tvertices;
+	FXint face_count;
+	RSMFace* faces;
+	FXint poskey_count;
+	RSMPosKey* poskeys;
+	FXint rotkey_count;
+	RSMRotKey* rotkeys;
+	FXint volume_count;
+	RSMVolume* volumes;
+
+	FXVec3f min;// vertices of all nodes in model space
+	FXVec3f max;
+
+	RSM();
+	~RSM();
+
+	/// Free the arrays
+	void clear();
+
+	/// If this RSM is compatible with the target version (version >= target)
+	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
+	/// If a model was loaded
+	bool valid() const	{ return arena != NULL && node_count > 0; }
+
+	const FXchar* texture(FXint i) const	{ return textures + i*NameSize; }
+
+	/// Recompute the matrices and bounds of the nodes, after changing them
+	void computeTransforms();
+	/// If the indexes of a face are in the arrays of the node
+	bool validFace(const RSMNode& node, const RSMFace& face) const;
+
+	void load(FXStream& store);
+	void save(FXStream& store) const;
+
+	friend FXStream& operator>>(FXStream& store,RSM& rsm);
+	friend FXStream& operator<<(FXStream& store,const RSM& rsm);
+
+private:
+	RSM(const RSM&);
+	RSM& operator=(const RSM&);
+};
+
+/// Models by path, each is loaded once.
+/// the paths are as in the RSW (relative to the model folder, any case and separator)
+class RSMCache
+{
+	FXString dir;// model folder
+	const NGRF::GRF* grf;// archive with the model folder or NULL for the disk
+	FXDict models;// path -> RSM*, a model that could not be loaded stays with valid() false
+	FXMutex lock;
+
+	RSMCache(const RSMCache&);
+	RSMCache& operator=(const RSMCache&);
+public:
+	RSMCache(const FXString& dir, const NGRF::GRF* grf = NULL);
+	~RSMCache();
+
+	/// Model of a path, loaded on the first use. NULL when it can not be loaded.
+	/// can be called from several threads
+	const RSM* get(const FXchar* filename);
+
+	/// Number of paths seen
+	FXint size() const	{ return models.no(); }
+
+	/// Free all models
+	void clear();
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NRSM
+//-----------------------------------------------------------------------------
+
+#endif // _RSM_H_
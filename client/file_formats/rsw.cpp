@@ -20,6 +20,7 @@
 ** $Id$
 */
 #include "rsw.h"
+#include <new>
 
 using namespace NRSW;
 // 1.2 - base supported version
@@ -36,12 +37,316 @@ using namespace NRSW;
 //-----------------------------------------------------------------------------
 // RSW
 
+RSW::RSW()
+: object_count(0)
+, arena(NULL)
+, models(NULL)
+, model_count(0)
+, lights(NULL)
+, light_count(0)
+, sounds(NULL)
+, sound_count(0)
+, effects(NULL)
+, effect_count(0)
+, order(NULL)
+, quadtree(NULL)
+, leaf_start(NULL)
+, leaf_objects(NULL)
+{
+}
+
+RSW::~RSW()
+{
+	clear();
+}
+
+/// Free the objects, they have nothing to destroy so the block just goes
+void RSW::clear()
+{
+	if( arena )
+		fxfree((void**)&arena);
+	arena = NULL;
+	models = NULL;
+	lights = NULL;
+	sounds = NULL;
+	effects = NULL;
+	order = NULL;
+	object_count = 0;
+	model_count = 0;
+	light_count = 0;
+	sound_count = 0;
+	effect_count = 0;
+	if( quadtree )
+		fxfree((void**)&quadtree);
+	if( leaf_start )
+		fxfree((void**)&leaf_start);
+	quadtree = NULL;
+	leaf_start = NULL;
+	leaf_objects = NULL;
+}
+
 /// If this RSW is compatible with the target version (version >= target)
 bool RSW::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
 {
 	return ( ( this->major_ver == major_ver && this->minor_ver >= minor_ver ) || this->major_ver > major_ver );
 }
 
+//-----------------------------------------------------------------------------
+// Quadtree
+
+/// The file has the nodes depth-first, memory breadth-first
+static void loadQuadTree(FXStream& store, QuadTreeNode* nodes, FXint level, FXint index)
+{
+	QuadTreeNode& node = nodes[index];
+	store >> node.max;
+	store >> node.min;
+	store >> node.halfsize;
+	store >> node.center;
+	if( level + 1 < RSW::QuadTreeLevels )
+	{
+		for( FXint i = 0; i < 4; ++i )
+			loadQuadTree(store, nodes, level + 1, 4*index + 1 + i);
+	}
+}
+
+static void saveQuadTree(FXStream& store, const QuadTreeNode* nodes, FXint level, FXint index)
+{
+	const QuadTreeNode& node = nodes[index];
+	store << node.max;
+	store << node.min;
+	store << node.halfsize;
+	store << node.center;
+	if( level + 1 < RSW::QuadTreeLevels )
+	{
+		for( FXint i = 0; i < 4; ++i )
+			saveQuadTree(store, nodes, level + 1, 4*index + 1 + i);
+	}
+}
+
+static inline bool containsXZ(const QuadTreeNode& node, const FXVec3f& p)
+{
+	return p.x >= node.min.x && p.x <= node.max.x && p.z >= node.min.z && p.z <= node.max.z;
+}
+
+/// Leaf holding a position, QuadTreeLeafCount when it is outside the tree
+static FXint findLeaf(const QuadTreeNode* nodes, const FXVec3f& p)
+{
+	FXint index = 0;
+	if( !containsXZ(nodes[0], p) )
+		return RSW::QuadTreeLeafCount;
+	for( FXint level = 1; level < RSW::QuadTreeLevels; ++level )
+	{
+		FXint i;
+		for( i = 0; i < 4; ++i )
+		{
+			if( containsXZ(nodes[4*index + 1 + i], p) )
+				break;
+		}
+		if( i == 4 )
+			return RSW::QuadTreeLeafCount;
+		index = 4*index + 1 + i;
+	}
+	return index - RSW::QuadTreeLeafStart;
+}
+
+/// Range of leaves below a node
+static void leafRange(FXint index, FXint& first, FXint& last)
+{
+	first = last = index;
+	while( first < RSW::QuadTreeLeafStart )
+	{
+		first = 4*first + 1;
+		last = 4*last + 4;
+	}
+	first -= RSW::QuadTreeLeafStart;
+	last -= RSW::QuadTreeLeafStart;
+}
+
+/// Position of the i-th object in file order
+FXVec3f RSW::objectPosition(FXint i) const
+{
+	const FXint k = objectIndex(i);
+	switch( objectType(i) )
+	{
+	case ModelObjectType:	return FXVec3f(models[k].pos_x, models[k].pos_y, models[k].pos_z);
+	case LightObjectType:	return FXVec3f(lights[k].pos_x, lights[k].pos_y, lights[k].pos_z);
+	case SoundObjectType:	return FXVec3f(sounds[k].todo1, sounds[k].todo2, sounds[k].todo3);
+	case EffectObjectType:	return FXVec3f(effects[k].pos_x, effects[k].pos_y, effects[k].pos_z);
+	default:				return FXVec3f(0.0f, 0.0f, 0.0f);
+	}
+}
+
+/// Counting sort of the objects into the leaves
+void RSW::buildIndex()
+{
+	FXint i;
+	if( leaf_start )
+		fxfree((void**)&leaf_start);
+	leaf_objects = NULL;
+	// one block, the bucket starts and then the objects
+	if( !fxmalloc((void**)&leaf_start, (QuadTreeLeafCount + 2 + object_count)*sizeof(FXint)) )
+	{
+		fxwarning("RSW out of memory for the object index\n");
+		return;
+	}
+	leaf_objects = leaf_start + QuadTreeLeafCount + 2;
+	memset(leaf_start, 0, (QuadTreeLeafCount + 2)*sizeof(FXint));
+	FXint* leaf = leaf_objects;// the leaf of each object until it is sorted
+	for( i = 0; i < object_count; ++i )
+	{
+		leaf[i] = quadtree ? findLeaf(quadtree, objectPosition(i)) : QuadTreeLeafCount;
+		++leaf_start[leaf[i] + 1];
+	}
+	for( i = 0; i <= QuadTreeLeafCount; ++i )
+		leaf_start[i + 1] += leaf_start[i];
+	FXint next[QuadTreeLeafCount + 1];
+	for( i = 0; i <= QuadTreeLeafCount; ++i )
+		next[i] = leaf_start[i + 1];
+	FXint* tmp;
+	if( !fxmalloc((void**)&tmp, object_count*sizeof(FXint) + 1) )
+	{
+		fxwarning("RSW out of memory for the object index\n");
+		fxfree((void**)&leaf_start);
+		leaf_objects = NULL;
+		return;
+	}
+	memcpy(tmp, leaf, object_count*sizeof(FXint));
+	for( i = object_count - 1; i >= 0; --i )
+		leaf_objects[--next[tmp[i]]] = i;
+	fxfree((void**)&tmp);
+}
+
+/// Objects with an x/z position inside the rectangle
+FXint RSW::queryRect(FXfloat x0, FXfloat z0, FXfloat x1, FXfloat z1, FXArray<FXint>& result, FXint types) const
+{
+	FXint found = 0, i, k;
+	if( !leaf_start )
+		return 0;
+	if( x0 > x1 ) { FXfloat t = x0; x0 = x1; x1 = t; }
+	if( z0 > z1 ) { FXfloat t = z0; z0 = z1; z1 = t; }
+	// nodes to visit, at most 3 per level wait while one is opened
+	FXint stack[4*QuadTreeLevels];
+	FXint top = 0;
+	if( quadtree )
+		stack[top++] = 0;
+	while( top > 0 )
+	{
+		const FXint index = stack[--top];
+		const QuadTreeNode& node = quadtree[index];
+		if( node.max.x < x0 || node.min.x > x1 || node.max.z < z0 || node.min.z > z1 )
+			continue;
+		const bool inside = ( node.min.x >= x0 && node.max.x <= x1 && node.min.z >= z0 && node.max.z <= z1 );
+		if( !inside && index < QuadTreeLeafStart )
+		{
+			for( i = 4; i > 0; --i )
+				stack[top++] = 4*index + i;
+			continue;
+		}
+		FXint first, last;
+		leafRange(index, first, last);
+		for( k = leaf_start[first]; k < leaf_start[last + 1]; ++k )
+		{
+			const FXint obj = leaf_objects[k];
+			if( !(types & (1<<objectType(obj))) )
+				continue;
+			if( !inside )
+			{
+				const FXVec3f p = objectPosition(obj);
+				if( p.x < x0 || p.x > x1 || p.z < z0 || p.z > z1 )
+					continue;
+			}
+			result.append(obj);
+			++found;
+		}
+	}
+	// the objects outside the tree are always checked
+	for( k = leaf_start[QuadTreeLeafCount]; k < leaf_start[QuadTreeLeafCount + 1]; ++k )
+	{
+		const FXint obj = leaf_objects[k];
+		if( !(types & (1<<objectType(obj))) )
+			continue;
+		const FXVec3f p = objectPosition(obj);
+		if( p.x < x0 || p.x > x1 || p.z < z0 || p.z > z1 )
+			continue;
+		result.append(obj);
+		++found;
+	}
+	return found;
+}
+
+static inline bool insidePlanes(const FXVec4f* planes, FXint num_planes, const FXVec3f& p)
+{
+	for( FXint i = 0; i < num_planes; ++i )
+	{
+		if( planes[i].x*p.x + planes[i].y*p.y + planes[i].z*p.z + planes[i].w < 0.0f )
+			return false;
+	}
+	return true;
+}
+
+/// Objects with a position inside all planes
+FXint RSW::queryFrustum(const FXVec4f* planes, FXint num_planes, FXArray<FXint>& result, FXint types) const
+{
+	FXint found = 0, i, k;
+	if( !leaf_start )
+		return 0;
+	FXint stack[4*QuadTreeLevels];
+	FXint top = 0;
+	if( quadtree )
+		stack[top++] = 0;
+	while( top > 0 )
+	{
+		const FXint index = stack[--top];
+		const QuadTreeNode& node = quadtree[index];
+		// the box corner furthest along the normal decides if the box is out,
+		// the nearest one if it is completely in
+		bool inside = true, outside = false;
+		for( i = 0; i < num_planes && !outside; ++i )
+		{
+			const FXVec4f& pl = planes[i];
+			const FXfloat far_ = pl.x*(pl.x >= 0 ? node.max.x : node.min.x) + pl.y*(pl.y >= 0 ? node.max.y : node.min.y) + pl.z*(pl.z >= 0 ? node.max.z : node.min.z) + pl.w;
+			const FXfloat near_ = pl.x*(pl.x >= 0 ? node.min.x : node.max.x) + pl.y*(pl.y >= 0 ? node.min.y : node.max.y) + pl.z*(pl.z >= 0 ? node.min.z : node.max.z) + pl.w;
+			if( far_ < 0.0f )
+				outside = true;
+			else if( near_ < 0.0f )
+				inside = false;
+		}
+		if( outside )
+			continue;
+		if( !inside && index < QuadTreeLeafStart )
+		{
+			for( i = 4; i > 0; --i )
+				stack[top++] = 4*index + i;
+			continue;
+		}
+		// the boxes only bound the x/z sort, the objects are always checked
+		FXint first, last;
+		leafRange(index, first, last);
+		for( k = leaf_start[first]; k < leaf_start[last + 1]; ++k )
+		{
+			const FXint obj = leaf_objects[k];
+			if( (types & (1<<objectType(obj))) && insidePlanes(planes, num_planes, objectPosition(obj)) )
+			{
+				result.append(obj);
+				++found;
+			}
+		}
+	}
+	for( k = leaf_start[QuadTreeLeafCount]; k < leaf_start[QuadTreeLeafCount + 1]; ++k )
+	{
+		const FXint obj = leaf_objects[k];
+		if( (types & (1<<objectType(obj))) && insidePlanes(planes, num_planes, objectPosition(obj)) )
+		{
+			result.append(obj);
+			++found;
+		}
+	}
+	return found;
+}
+
+//-----------------------------------------------------------------------------
+// RSW stream
+
 /// Load RSW from a stream
 FXStream& operator>>(FXStream& store, RSW& rsw)
 {
@@ -61,6 +366,7 @@ void RSW::load(FX::FXStream &store)
 		store.load(gat_file, 40);
 	else
 		memset(gat_file, 0, 40);
+	store.load(scr_file, 40);
 	if( IsCompatibleWith(1,3) )
 		store >> water_height;
 	else
@@ -83,7 +389,7 @@ void RSW::load(FX::FXStream &store)
 		store >> texture_cycling;
 	else
 		texture_cycling = 3;
-	if( IsCompatibleWith(1,4) )
+	if( IsCompatibleWith(1,5) )
 	{
 		store >> unk1;
 		store >> unk2;
@@ -101,6 +407,8 @@ void RSW::load(FX::FXStream &store)
 	}
 	if( IsCompatibleWith(1,7) )
 		store >> unk3;// ignored
+	else
+		unk3 = 0.0f;
 	if( IsCompatibleWith(1,6) )
 	{
 		store >> unk4;
@@ -117,63 +425,107 @@ void RSW::load(FX::FXStream &store)
 	}
 	store >> object_count;
 	// objects
-	fxcalloc((void**)&objects, object_count*sizeof(RSWObject*));
-	models.clear();
-	lights.clear();
-	sounds.clear();
-	effects.clear();
-	for( FXint i = 0; i < object_count; ++i )
+	clear();
+	if( object_count < 0 )
+		object_count = 0;
+	// count the types first, the records have a fixed size for a version
+	const FXlong model_size = IsCompatibleWith(1,3) ? ModelRecordSize : ModelRecordSizeBase;
+	const FXlong sound_size = IsCompatibleWith(2,0) ? SoundRecordSize : SoundRecordSizeBase;
+	FXlong start = store.position();
+	FXint i;
+	for( i = 0; i < object_count; ++i )
 	{
 		FXint type;
 		store >> type;
 		switch( type )
 		{
+		case ModelObjectType:	++model_count;	store.position(model_size, FXFromCurrent);	break;
+		case LightObjectType:	++light_count;	store.position(LightRecordSize, FXFromCurrent);	break;
+		case SoundObjectType:	++sound_count;	store.position(sound_size, FXFromCurrent);	break;
+		case EffectObjectType:	++effect_count;	store.position(EffectRecordSize, FXFromCurrent);	break;
+		default:
+			// the size of the record is unknown, nothing after it can be read
+			fxerror("unknown type %d for RSW object %d/%d at offset %lld\n", type, (i+1), object_count, store.position());
+			object_count = i;
+		}
+	}
+	if( store.status() != FXStreamOK || !store.position(start) )
+	{
+		fxwarning("RSW objects could not be counted\n");
+		model_count = light_count = sound_count = effect_count = object_count = 0;
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	// one block for all arrays
+	FXival size =	model_count*sizeof(ModelObject) +
+					light_count*sizeof(LightObject) +
+					sound_count*sizeof(SoundObject) +
+					effect_count*sizeof(EffectObject) +
+					object_count*sizeof(FXuint);
+	if( !fxmalloc((void**)&arena, size + 1) )
+	{
+		fxwarning("RSW out of memory for %d objects\n", object_count);
+		model_count = light_count = sound_count = effect_count = object_count = 0;
+		store.setBigEndian(bigEndian);
+		return;
+	}
+	models = (ModelObject*)arena;
+	lights = (LightObject*)(models + model_count);
+	sounds = (SoundObject*)(lights + light_count);
+	effects = (EffectObject*)(sounds + sound_count);
+	order = (FXuint*)(effects + effect_count);
+	FXint next[EffectObjectType+1] = { 0, 0, 0, 0, 0 };
+	for( i = 0; i < object_count; ++i )
+	{
+		FXint type;
+		store >> type;
+		order[i] = ((FXuint)type<<OrderTypeShift) | (FXuint)next[type];
+		switch( type )
+		{
 		case ModelObjectType:
 			{
-				ModelObject* model = new ModelObject(store.position());
+				ModelObject* model = new (models + next[type]++) ModelObject(store.position());
 				if( IsCompatibleWith(1,3) )
 					model->load(store, ModelObject::Version0103);
 				else
 					model->load(store, ModelObject::VersionBase);
-				models.push_back(model);
-				objects[i] = model;
 				break;
 			}
 		case LightObjectType:
 			{
-				LightObject* light = new LightObject(store.position());
+				LightObject* light = new (lights + next[type]++) LightObject(store.position());
 				light->load(store);
-				lights.push_back(light);
-				objects[i] = light;
 				break;
 			}
 		case SoundObjectType:
 			{
-				SoundObject* sound = new SoundObject(store.position());
+				SoundObject* sound = new (sounds + next[type]++) SoundObject(store.position());
 				if( IsCompatibleWith(2,0) )
 					sound->load(store, SoundObject::Version0200);
 				else
 					sound->load(store, SoundObject::VersionBase);
-				sounds.push_back(sound);
-				objects[i] = sound;
 				break;
 			}
 		case EffectObjectType:
 			{
-				EffectObject* effect = new EffectObject(store.position());
+				EffectObject* effect = new (effects + next[type]++) EffectObject(store.position());
 				effect->load(store);
-				effects.push_back(effect);
-				objects[i] = effect;
 				break;
 			}
-		default:
-			{
-				fxerror("unknown type %d for RSW object %d/%d at offset %lld\n", type, (i+1), object_count, store.position());
-				objects[i] = new RSWObject(store.position());
-			}
 		}
 	}
-	// TODO quadtree
+	// quadtree
+	if( IsCompatibleWith(2,1) )
+	{
+		if( fxmalloc((void**)&quadtree, QuadTreeNodeCount*sizeof(QuadTreeNode)) )
+			loadQuadTree(store, quadtree, 0, 0);
+		else
+		{
+			fxwarning("RSW out of memory for the quadtree\n");
+			store.position(QuadTreeNodeCount*QuadTreeNodeSize, FXFromCurrent);
+		}
+	}
+	buildIndex();
 	store.setBigEndian(bigEndian);// revert to the previous endianess
 }
 
@@ -186,6 +538,7 @@ FXStream& operator<<(FXStream& store, const RSW& rsw)
 void RSW::save(FX::FXStream &store) const
 {
 	bool bigEndian = store.isBigEndian();
+	store.setBigEndian(false);// data is in little endian
 	store.save(magic, 4);
 	store << major_ver;
 	store << minor_ver;
@@ -193,6 +546,7 @@ void RSW::save(FX::FXStream &store) const
 	store.save(gnd_file, 40);
 	if( IsCompatibleWith(1,4) )
 		store.save(gat_file, 40);
+	store.save(scr_file, 40);
 	if( IsCompatibleWith(1,3) )
 		store << water_height;
 	if( IsCompatibleWith(1,8) )
@@ -204,7 +558,7 @@ void RSW::save(FX::FXStream &store) const
 	}
 	if( IsCompatibleWith(1,9) )
 		store << texture_cycling;
-	if( IsCompatibleWith(1,4) )
+	if( IsCompatibleWith(1,5) )
 	{
 		store << unk1;
 		store << unk2;
@@ -221,8 +575,39 @@ void RSW::save(FX::FXStream &store) const
 		store << unk7;
 	}
 	store << object_count;
-	// TODO objects
-	// TODO quadtree
+	// objects in their original order
+	for( FXint i = 0; i < object_count; ++i )
+	{
+		const FXint type = objectType(i);
+		store << type;
+		switch( type )
+		{
+		case ModelObjectType:
+			models[objectIndex(i)].save(store, IsCompatibleWith(1,3) ? ModelObject::Version0103 : ModelObject::VersionBase);
+			break;
+		case LightObjectType:
+			lights[objectIndex(i)].save(store);
+			break;
+		case SoundObjectType:
+			sounds[objectIndex(i)].save(store, IsCompatibleWith(2,0) ? SoundObject::Version0200 : SoundObject::VersionBase);
+			break;
+		case EffectObjectType:
+			effects[objectIndex(i)].save(store);
+			break;
+		}
+	}
+	// quadtree
+	if( IsCompatibleWith(2,1) )
+	{
+		if( quadtree )
+			saveQuadTree(store, quadtree, 0, 0);
+		else
+		{	// an empty tree keeps the file readable
+			QuadTreeNode empty[QuadTreeNodeCount];
+			memset(empty, 0, sizeof(empty));
+			saveQuadTree(store, empty, 0, 0);
+		}
+	}
 	store.setBigEndian(bigEndian);
 }
 
@@ -239,8 +624,8 @@ void ModelObject::load(FXStream& store, ModelObject::Version v)
 		store >> unk3;
 	}
 	else
-	{
-		name[0] = 0;
+	{// saved as 1.3 or newer the whole name is written
+		memset(name, 0, 40);
 		unk1 = 0;
 		unk2 = 1.0f;
 		unk3 = 0;
@@ -291,28 +676,26 @@ void ModelObject::save(FXStream& store, ModelObject::Version v) const
 
 void LightObject::load(FXStream& store)
 {
-	store.load(name, 40);
+	store.load(name, 80);
 	store >> pos_x;
 	store >> pos_y;
 	store >> pos_z;
-	store.load(todo1, 40);
 	store >> color_r;
 	store >> color_g;
 	store >> color_b;
-	store >> todo2;
+	store >> range;
 }
 
 void LightObject::save(FXStream& store) const
 {
-	store.save(name, 40);
+	store.save(name, 80);
 	store << pos_x;
 	store << pos_y;
 	store << pos_z;
-	store.save(todo1, 40);
 	store << color_r;
 	store << color_g;
 	store << color_b;
-	store << todo2;
+	store << range;
 }
 
 //-----------------------------------------------------------------------------
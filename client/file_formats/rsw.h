@@ -25,8 +25,8 @@
 #include "fx.h"
 #include "FXVec2f.h"
 #include "FXVec3f.h"
+#include "FXVec4f.h"
 #include "FXArray.h"
-#include <vector>
 
 //-----------------------------------------------------------------------------
 namespace NRSW {
@@ -53,6 +53,19 @@ enum ObjectType
 	EffectObjectType = 4
 };
 
+/// Size of the object records in the file (without the type int)
+enum RecordSize
+{
+	ModelRecordSize = 248,
+	ModelRecordSizeBase = 196,// version < 1.3
+	LightRecordSize = 108,
+	SoundRecordSize = 192,
+	SoundRecordSizeBase = 188,// version < 2.0
+	EffectRecordSize = 116,
+	QuadTreeNodeSize = 48,
+	QuadTreeNodeCount = 1365// 4^0 + 4^1 + 4^2 + 4^3 + 4^4 + 4^5
+};
+
 struct RSWObject
 {
 	FXlong position;
@@ -101,15 +114,14 @@ struct ModelObject : public RSWObject
 /// Light object - 108 bytes
 struct LightObject : public RSWObject
 {
-	FXchar name[40];
+	FXchar name[80];
 	FXfloat pos_x;
 	FXfloat pos_y;
 	FXfloat pos_z;
-	FXchar todo1[40];
 	FXfloat color_r;
 	FXfloat color_g;
 	FXfloat color_b;
-	FXfloat todo2;
+	FXfloat range;
 
 	void load(FXStream& store);
 	void save(FXStream& store) const;
@@ -175,6 +187,15 @@ struct EffectObject : public RSWObject
 	EffectObject(FXlong position):RSWObject(EffectObjectType,position){}
 };
 
+/// Scene quadtree node - 48 bytes (version >= 2.1)
+struct QuadTreeNode
+{
+	FXVec3f max;
+	FXVec3f min;
+	FXVec3f halfsize;
+	FXVec3f center;
+};
+
 /// Resource World
 struct RSW
 {
@@ -202,21 +223,70 @@ struct RSW
 	FXint unk7;// (version >= 1.6)
 	FXint object_count;
 
-	// objects
-	RSWObject** objects;
-	std::vector< ModelObject* > models;
-	std::vector< LightObject* > lights;
-	std::vector< SoundObject* > sounds;
-	std::vector< EffectObject* > effects;
+	// objects, one contiguous array per type inside a single arena block.
+	// order has an entry per object in file order, the type in the top
+	// bits and the index in the array of that type in the rest
+	enum { OrderTypeShift = 28, OrderIndexMask = (1<<28)-1 };
+	FXuchar* arena;
+	ModelObject* models;
+	FXint model_count;
+	LightObject* lights;
+	FXint light_count;
+	SoundObject* sounds;
+	FXint sound_count;
+	EffectObject* effects;
+	FXint effect_count;
+	FXuint* order;
+
+	// scene quadtree (version >= 2.1), QuadTreeNodeCount nodes in breadth-first
+	// order, the children of node n are 4n+1 to 4n+4 and the leaves come last.
+	// the file has them depth-first
+	enum { QuadTreeLevels = 6, QuadTreeLeafStart = 341, QuadTreeLeafCount = 1024 };
+	QuadTreeNode* quadtree;
+	// objects by leaf, the leaf holding the x/z position of an object.
+	// leaf_objects[leaf_start[k]..leaf_start[k+1]-1] are the objects (file order
+	// index) of leaf k, bucket QuadTreeLeafCount has the objects outside the tree
+	FXint* leaf_start;
+	FXint* leaf_objects;
+
+	/// Object type bits for the queries
+	enum { QueryModels = 1<<ModelObjectType, QueryLights = 1<<LightObjectType, QuerySounds = 1<<SoundObjectType, QueryEffects = 1<<EffectObjectType, QueryAll = 0x1E };
+
+	RSW();
+	~RSW();
+
+	/// Free the objects
+	void clear();
+
+	/// Type and object of the i-th object in file order
+	ObjectType objectType(FXint i) const	{ return (ObjectType)(order[i]>>OrderTypeShift); }
+	FXint objectIndex(FXint i) const		{ return (FXint)(order[i]&OrderIndexMask); }
 
 	/// If this RSW is compatible with the target version (version >= target)
 	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
 
+	/// Position of the i-th object in file order
+	FXVec3f objectPosition(FXint i) const;
+
+	/// Sort the objects into the quadtree leaves, call after moving objects.
+	/// without a quadtree all objects are in the outside bucket
+	void buildIndex();
+	/// Objects with an x/z position inside the rectangle, appended as file order indexes.
+	/// returns the number of objects found
+	FXint queryRect(FXfloat x0, FXfloat z0, FXfloat x1, FXfloat z1, FXArray<FXint>& result, FXint types = QueryAll) const;
+	/// Objects with a position inside all planes (a*x+b*y+c*z+d >= 0), appended as file order indexes.
+	/// returns the number of objects found
+	FXint queryFrustum(const FXVec4f* planes, FXint num_planes, FXArray<FXint>& result, FXint types = QueryAll) const;
+
 	void load(FXStream& store);
 	void save(FXStream& store) const;
 
 	friend FXStream& operator>>(FXStream& store,RSW& rsw);
 	friend FXStream& operator<<(FXStream& store,const RSW& rsw);
+
+private:
+	RSW(const RSW&);
+	RSW& operator=(const RSW&);
 };
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,383 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#include "rswmap.h"
+
+using namespace NRSW;
+
+//-----------------------------------------------------------------------------
+// Views
+
+void ModelView::get(ModelObject& obj) const
+{
+	FXVec3f v;
+	obj.object_type = ModelObjectType;
+	obj.position = 0;
+	memset(obj.name, 0, 40);
+	if( data )
+		memcpy(obj.name, data, 40);
+	obj.unk1 = anim_type();
+	obj.unk2 = anim_speed();
+	obj.unk3 = data ? RSWReadFloat(data+48) : 0.0f;// read as float like RSW::load
+	memcpy(obj.filename, base, 40);
+	memcpy(obj.reserved, base+40, 40);
+	memcpy(obj.type, base+80, 20);
+	memcpy(obj.sound, base+100, 20);
+	memcpy(obj.todo1, base+120, 40);
+	v = pos();		obj.pos_x = v.x;	obj.pos_y = v.y;	obj.pos_z = v.z;
+	v = rot();		obj.rot_x = v.x;	obj.rot_y = v.y;	obj.rot_z = v.z;
+	v = scale();	obj.scale_x = v.x;	obj.scale_y = v.y;	obj.scale_z = v.z;
+}
+
+void LightView::get(LightObject& obj) const
+{
+	FXVec3f v;
+	obj.object_type = LightObjectType;
+	obj.position = 0;
+	memcpy(obj.name, data, 80);
+	v = pos();		obj.pos_x = v.x;	obj.pos_y = v.y;	obj.pos_z = v.z;
+	v = color();	obj.color_r = v.x;	obj.color_g = v.y;	obj.color_b = v.z;
+	obj.range = range();
+}
+
+void SoundView::get(SoundObject& obj) const
+{
+	obj.object_type = SoundObjectType;
+	obj.position = 0;
+	memcpy(obj.name, data, 80);
+	memcpy(obj.filename, data+80, 80);
+	obj.todo1 = RSWReadFloat(data+160);
+	obj.todo2 = RSWReadFloat(data+164);
+	obj.todo3 = RSWReadFloat(data+168);
+	obj.todo4 = RSWReadFloat(data+172);
+	obj.todo5 = RSWReadFloat(data+176);
+	obj.todo6 = RSWReadFloat(data+180);
+	obj.todo7 = RSWReadFloat(data+184);
+	obj.todo8 = cycle();
+}
+
+void EffectView::get(EffectObject& obj) const
+{
+	obj.object_type = EffectObjectType;
+	obj.position = 0;
+	memcpy(obj.name, data, 40);
+	obj.todo1 = RSWReadFloat(data+40);
+	obj.todo2 = RSWReadFloat(data+44);
+	obj.todo3 = RSWReadFloat(data+48);
+	obj.todo4 = RSWReadFloat(data+52);
+	obj.todo5 = RSWReadFloat(data+56);
+	obj.todo6 = RSWReadFloat(data+60);
+	obj.todo7 = RSWReadFloat(data+64);
+	obj.todo8 = RSWReadFloat(data+68);
+	obj.todo9 = RSWReadFloat(data+72);
+	obj.category = category();
+	obj.pos_x = RSWReadFloat(data+80);
+	obj.pos_y = RSWReadFloat(data+84);
+	obj.pos_z = RSWReadFloat(data+88);
+	obj.type = type();
+	obj.loop = loop();
+	obj.todo10 = RSWReadFloat(data+100);
+	obj.todo11 = RSWReadFloat(data+104);
+	obj.todo12 = RSWReadInt(data+108);
+	obj.todo13 = RSWReadInt(data+112);
+}
+
+//-----------------------------------------------------------------------------
+// RSWMap
+
+RSWMap::RSWMap() : data(NULL), size(0), object_count(0), offsets(NULL), quadtree_data(NULL)
+{
+	memset(&head, 0, sizeof(head));
+	memset(type_start, 0, sizeof(type_start));
+}
+
+RSWMap::~RSWMap()
+{
+	close();
+}
+
+bool RSWMap::open(const FXString& filename)
+{
+	close();
+	data = (const FXuchar*)file.map(filename);
+	if( data == NULL )
+	{
+		error.format("%s: can not be mapped", filename.text());
+		return false;
+	}
+	size = file.length();
+	if( !parse() )
+	{
+		error.prepend(filename + ": ");
+		close();
+		return false;
+	}
+	return true;
+}
+
+void RSWMap::close()
+{
+	if( data )
+		file.unmap();
+	data = NULL;
+	size = 0;
+	object_count = 0;
+	if( offsets )
+		fxfree((void**)&offsets);
+	memset(type_start, 0, sizeof(type_start));
+	quadtree_data = NULL;
+}
+
+/// If this RSW is compatible with the target version (version >= target)
+bool RSWMap::IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const
+{
+	return ( ( head.major_ver == major_ver && head.minor_ver >= minor_ver ) || head.major_ver > major_ver );
+}
+
+/// Check the whole file once and index the objects.
+/// Field sizes are taken from rsw.txt
+bool RSWMap::parse()
+{
+	FXival pos = 0;
+	FXint i, count[EffectObjectType+1];
+
+	if( size < 6 || memcmp(data, "GRSW", 4) != 0 )
+	{
+		error = "not a RSW file";
+		return false;
+	}
+	head.major_ver = (FXchar)data[4];
+	head.minor_ver = (FXchar)data[5];
+	if( IsCompatibleWith(2,2) || !IsCompatibleWith(1,2) )
+	{
+		error.format("unsupported version %d.%d", head.major_ver, head.minor_ver);
+		return false;
+	}
+
+	// the header has a known size for each version
+	FXival need = 6 + 40 + 40 + 40 + 4;
+	if( IsCompatibleWith(1,4) ) need += 40;
+	if( IsCompatibleWith(1,3) ) need += 4;
+	if( IsCompatibleWith(1,8) ) need += 16;
+	if( IsCompatibleWith(1,9) ) need += 4;
+	if( IsCompatibleWith(1,5) ) need += 32;
+	if( IsCompatibleWith(1,7) ) need += 4;
+	if( IsCompatibleWith(1,6) ) need += 16;
+	if( size < need )
+	{
+		error = "truncated header";
+		return false;
+	}
+
+	pos = 6;
+	head.ini_file = (const FXchar*)data+pos;	pos += 40;
+	head.gnd_file = (const FXchar*)data+pos;	pos += 40;
+	if( IsCompatibleWith(1,4) )
+	{
+		head.gat_file = (const FXchar*)data+pos;
+		pos += 40;
+	}
+	else
+		head.gat_file = "";
+	head.scr_file = (const FXchar*)data+pos;	pos += 40;
+	if( IsCompatibleWith(1,3) )
+	{
+		head.water_height = RSWReadFloat(data+pos);
+		pos += 4;
+	}
+	else
+		head.water_height = 0.0f;
+	if( IsCompatibleWith(1,8) )
+	{
+		head.water_type = RSWReadInt(data+pos);
+		head.water_amplitude = RSWReadFloat(data+pos+4);
+		head.water_phase = RSWReadFloat(data+pos+8);
+		head.surface_curve_level = RSWReadFloat(data+pos+12);
+		pos += 16;
+	}
+	else
+	{
+		head.water_type = 0;
+		head.water_amplitude = 1.0f;
+		head.water_phase = 2.0f;
+		head.surface_curve_level = 0.5f;
+	}
+	if( IsCompatibleWith(1,9) )
+	{
+		head.texture_cycling = RSWReadInt(data+pos);
+		pos += 4;
+	}
+	else
+		head.texture_cycling = 3;
+	if( IsCompatibleWith(1,5) )
+	{
+		head.light_longitude = RSWReadInt(data+pos);
+		head.light_latitude = RSWReadInt(data+pos+4);
+		head.diffuse = RSWReadVec3f(data+pos+8);
+		head.ambient = RSWReadVec3f(data+pos+20);
+		pos += 32;
+	}
+	else
+	{
+		head.light_longitude = 45;
+		head.light_latitude = 45;
+		head.diffuse = FXVec3f(1.0f, 1.0f, 1.0f);
+		head.ambient = FXVec3f(0.3f, 0.3f, 0.3f);
+	}
+	if( IsCompatibleWith(1,7) )
+		pos += 4;// ignored
+	if( IsCompatibleWith(1,6) )
+	{
+		head.ground_top = RSWReadInt(data+pos);
+		head.ground_bottom = RSWReadInt(data+pos+4);
+		head.ground_left = RSWReadInt(data+pos+8);
+		head.ground_right = RSWReadInt(data+pos+12);
+		pos += 16;
+	}
+	else
+	{
+		head.ground_top = -500;
+		head.ground_bottom = 500;
+		head.ground_left = -500;
+		head.ground_right = 500;
+	}
+	object_count = RSWReadInt(data+pos);
+	pos += 4;
+	// the smallest record has 4+108 bytes
+	if( object_count < 0 || object_count > (size - pos) / (4 + LightRecordSize) )
+	{
+		error.format("bad object count %d", object_count);
+		object_count = 0;
+		return false;
+	}
+
+	// objects, one offset table for all of them
+	const FXival model_size = IsCompatibleWith(1,3) ? ModelRecordSize : ModelRecordSizeBase;
+	const FXival sound_size = IsCompatibleWith(2,0) ? SoundRecordSize : SoundRecordSizeBase;
+	if( !fxmalloc((void**)&offsets, 2*object_count*sizeof(FXuint) + 1) )
+	{
+		error = "out of memory";
+		return false;
+	}
+	memset(count, 0, sizeof(count));
+	for( i = 0; i < object_count; ++i )
+	{
+		if( pos + 4 > size )
+		{
+			error.format("truncated at object %d/%d", (i+1), object_count);
+			return false;
+		}
+		FXint type = RSWReadInt(data+pos);
+		FXival len;
+		pos += 4;
+		switch( type )
+		{
+		case ModelObjectType:	len = model_size; break;
+		case LightObjectType:	len = LightRecordSize; break;
+		case SoundObjectType:	len = sound_size; break;
+		case EffectObjectType:	len = EffectRecordSize; break;
+		default:
+			error.format("unknown type %d for RSW object %d/%d at offset %lld", type, (i+1), object_count, (FXlong)pos);
+			return false;
+		}
+		if( pos + len > size )
+		{
+			error.format("truncated at object %d/%d", (i+1), object_count);
+			return false;
+		}
+		offsets[i] = (FXuint)pos;
+		++count[type];
+		pos += len;
+	}
+
+	// group by type, keeping the file order inside a type
+	FXint next[EffectObjectType+1];
+	type_start[0] = type_start[1] = 0;
+	for( i = ModelObjectType; i <= EffectObjectType; ++i )
+		type_start[i+1] = type_start[i] + count[i];
+	for( i = ModelObjectType; i <= EffectObjectType; ++i )
+		next[i] = type_start[i];
+	for( i = 0; i < object_count; ++i )
+		offsets[object_count + next[typeAt(offsets[i])]++] = offsets[i];
+
+	// quadtree
+	if( IsCompatibleWith(2,1) )
+	{
+		if( pos + QuadTreeNodeCount*QuadTreeNodeSize > size )
+		{
+			error = "truncated quadtree";
+			return false;
+		}
+		quadtree_data = data + pos;
+		pos += QuadTreeNodeCount*QuadTreeNodeSize;
+	}
+	if( pos < size )
+		fxwarning("RSW: %lld extra bytes\n", (FXlong)(size - pos));
+	return true;
+}
+
+FXint RSWMap::typeIndex(FXint i) const
+{	// the grouped part is sorted by offset inside a type
+	const ObjectType t = objectType(i);
+	FXint a = type_start[t], b = type_start[t+1];
+	while( a < b )
+	{
+		const FXint m = (a+b)/2;
+		if( offsets[object_count+m] < offsets[i] )
+			a = m+1;
+		else
+			b = m;
+	}
+	return a - type_start[t];
+}
+
+ModelView RSWMap::model(FXint i) const
+{
+	ModelView v;
+	const FXuchar* p = data + offsets[object_count + type_start[ModelObjectType] + i];
+	if( IsCompatibleWith(1,3) )
+	{
+		v.data = p;
+		v.base = p + (ModelRecordSize - ModelRecordSizeBase);
+	}
+	else
+	{
+		v.data = NULL;
+		v.base = p;
+	}
+	return v;
+}
+
+LightView RSWMap::light(FXint i) const
+{
+	LightView v;
+	v.data = data + offsets[object_count + type_start[LightObjectType] + i];
+	return v;
+}
+
+SoundView RSWMap::sound(FXint i) const
+{
+	SoundView v;
+	v.data = data + offsets[object_count + type_start[SoundObjectType] + i];
+	v.has_cycle = IsCompatibleWith(2,0);
+	return v;
+}
+
+EffectView RSWMap::effect(FXint i) const
+{
+	EffectView v;
+	v.data = data + offsets[object_count + type_start[EffectObjectType] + i];
+	return v;
+}
@@ -0,0 +1,201 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Read-only RSW loader over a memory mapped file.
+** The file is checked once when it is opened, after that the objects are
+** read in place. Nothing is allocated per object, only one offset table
+** for all of them.
+**
+** $Id$
+*/
+#ifndef _RSWMAP_H_
+#define _RSWMAP_H_
+
+#include "fx.h"
+#include "FXVec3f.h"
+#include "rsw.h"
+
+//-----------------------------------------------------------------------------
+namespace NRSW {
+//-----------------------------------------------------------------------------
+
+/// little endian field readers, the records are not aligned
+inline FXint RSWReadInt(const FXuchar* p)
+{
+	return (FXint)( (FXuint)p[0] | ((FXuint)p[1]<<8) | ((FXuint)p[2]<<16) | ((FXuint)p[3]<<24) );
+}
+inline FXfloat RSWReadFloat(const FXuchar* p)
+{
+	FXuint u = (FXuint)RSWReadInt(p);
+	FXfloat f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+inline FXVec3f RSWReadVec3f(const FXuchar* p)
+{
+	return FXVec3f(RSWReadFloat(p), RSWReadFloat(p+4), RSWReadFloat(p+8));
+}
+
+/// Model record view, the fields of version 1.3 have their defaults in older files
+/// The strings are not nul terminated when they fill the whole field.
+struct ModelView
+{
+	const FXuchar* data;// start of the 1.3 fields or NULL for older files
+	const FXuchar* base;// start of the fields every version has
+
+	const FXchar* name() const			{ return data ? (const FXchar*)data : ""; }// 40
+	FXint anim_type() const				{ return data ? RSWReadInt(data+40) : 0; }
+	FXfloat anim_speed() const			{ return data ? RSWReadFloat(data+44) : 1.0f; }
+	FXint block_type() const			{ return data ? RSWReadInt(data+48) : 0; }
+	const FXchar* filename() const		{ return (const FXchar*)base; }// 80
+	const FXchar* node_name() const		{ return (const FXchar*)base+80; }// 80
+	FXVec3f pos() const					{ return RSWReadVec3f(base+160); }
+	FXVec3f rot() const					{ return RSWReadVec3f(base+172); }
+	FXVec3f scale() const				{ return RSWReadVec3f(base+184); }
+
+	/// Copy into the stream based object
+	void get(ModelObject& obj) const;
+};
+
+/// Light record view
+struct LightView
+{
+	const FXuchar* data;
+
+	const FXchar* name() const			{ return (const FXchar*)data; }// 80
+	FXVec3f pos() const					{ return RSWReadVec3f(data+80); }
+	FXVec3f color() const				{ return RSWReadVec3f(data+92); }
+	FXfloat range() const				{ return RSWReadFloat(data+104); }
+
+	/// Copy into the stream based object
+	void get(LightObject& obj) const;
+};
+
+/// Sound record view, the cycle of version 2.0 has its default in older files
+struct SoundView
+{
+	const FXuchar* data;
+	bool has_cycle;
+
+	const FXchar* name() const			{ return (const FXchar*)data; }// 80
+	const FXchar* filename() const		{ return (const FXchar*)data+80; }// 80
+	FXVec3f pos() const					{ return RSWReadVec3f(data+160); }
+	FXfloat volume() const				{ return RSWReadFloat(data+172); }
+	FXint width() const					{ return RSWReadInt(data+176); }
+	FXint height() const				{ return RSWReadInt(data+180); }
+	FXfloat range() const				{ return RSWReadFloat(data+184); }
+	FXfloat cycle() const				{ return has_cycle ? RSWReadFloat(data+188) : 4.0f; }
+
+	/// Copy into the stream based object
+	void get(SoundObject& obj) const;
+};
+
+/// Effect record view
+struct EffectView
+{
+	const FXuchar* data;
+
+	const FXchar* name() const			{ return (const FXchar*)data; }// 40
+	FXint category() const				{ return RSWReadInt(data+76); }
+	FXVec3f pos() const					{ return RSWReadVec3f(data+80); }
+	FXint type() const					{ return RSWReadInt(data+92); }
+	FXfloat loop() const				{ return RSWReadFloat(data+96); }
+
+	/// Copy into the stream based object
+	void get(EffectObject& obj) const;
+};
+
+/// Resource World mapped into memory
+class RSWMap
+{
+public:
+	/// Header, the fields that depend on the version are copied with their defaults
+	struct Header
+	{
+		FXchar major_ver;
+		FXchar minor_ver;
+		const FXchar* ini_file;// 40
+		const FXchar* gnd_file;// 40
+		const FXchar* gat_file;// 40, "" before 1.4
+		const FXchar* scr_file;// 40
+		FXfloat water_height;
+		FXint water_type;
+		FXfloat water_amplitude;
+		FXfloat water_phase;
+		FXfloat surface_curve_level;
+		FXint texture_cycling;
+		FXint light_longitude;
+		FXint light_latitude;
+		FXVec3f diffuse;
+		FXVec3f ambient;
+		FXint ground_top;
+		FXint ground_bottom;
+		FXint ground_left;
+		FXint ground_right;
+	};
+
+private:
+	FXMemMap file;
+	const FXuchar* data;
+	FXival size;
+	Header head;
+	FXint object_count;
+	FXuint* offsets;// record offset of each object in file order, then grouped by type
+	FXint type_start[EffectObjectType+2];// start of each type in the grouped part
+	const FXuchar* quadtree_data;
+	FXString error;
+
+	bool parse();
+	ObjectType typeAt(FXuint off) const	{ return (ObjectType)RSWReadInt(data+off-4); }
+
+	RSWMap(const RSWMap&);
+	RSWMap& operator=(const RSWMap&);
+public:
+	RSWMap();
+	~RSWMap();
+
+	/// Map and check a file, false with error() set when it is not a valid RSW
+	bool open(const FXString& filename);
+	/// Unmap the file, all views become invalid
+	void close();
+
+	const FXString& getError() const	{ return error; }
+	const Header& header() const		{ return head; }
+	/// If this RSW is compatible with the target version (version >= target)
+	bool IsCompatibleWith(FXchar major_ver, FXchar minor_ver) const;
+
+	/// Objects in file order
+	FXint objectCount() const			{ return object_count; }
+	ObjectType objectType(FXint i) const	{ return typeAt(offsets[i]); }
+	/// Index of an object in the list of its type
+	FXint typeIndex(FXint i) const;
+
+	/// Objects by type
+	FXint modelCount() const			{ return type_start[ModelObjectType+1] - type_start[ModelObjectType]; }
+	FXint lightCount() const			{ return type_start[LightObjectType+1] - type_start[LightObjectType]; }
+	FXint soundCount() const			{ return type_start[SoundObjectType+1] - type_start[SoundObjectType]; }
+	FXint effectCount() const			{ return type_start[EffectObjectType+1] - type_start[EffectObjectType]; }
+	ModelView model(FXint i) const;
+	LightView light(FXint i) const;
+	SoundView sound(FXint i) const;
+	EffectView effect(FXint i) const;
+
+	/// Raw quadtree nodes (version >= 2.1) or NULL, QuadTreeNodeCount nodes in depth-first order
+	const FXuchar* quadtree() const		{ return quadtree_data; }
+};
+
+//-----------------------------------------------------------------------------
+}// namespace NRSW
+//-----------------------------------------------------------------------------
+
+#endif // _RSWMAP_H_
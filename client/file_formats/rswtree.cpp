@@ -0,0 +1,224 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** $Id$
+*/
+#include "rswtree.h"
+#include <string.h>
+
+using namespace NRSW;
+using namespace NRSM;
+
+//-----------------------------------------------------------------------------
+// Builder
+
+/// Models that touch a node, per level, in the scratch of the thread
+struct QuadTreeBuild
+{
+	QuadTreeNode* nodes;
+	const FXVec3f* bmin;// world box of each model
+	const FXVec3f* bmax;
+	FXint stride;// model count, the scratch has a list of that size per level
+};
+
+static inline bool overlapsXZ(const QuadTreeNode& node, const FXVec3f& bmin, const FXVec3f& bmax)
+{
+	return ( bmin.x <= node.max.x && bmax.x >= node.min.x && bmin.z <= node.max.z && bmax.z >= node.min.z );
+}
+
+/// Fill a node with its x/z already set, then its children
+static void buildNode(const QuadTreeBuild& b, FXint level, FXint index, const FXint* list, FXint count, FXint* scratch)
+{
+	QuadTreeNode& node = b.nodes[index];
+	FXint i, n = 0;
+	for( i = 0; i < count; ++i )
+	{
+		const FXint m = list[i];
+		if( !overlapsXZ(node, b.bmin[m], b.bmax[m]) )
+			continue;
+		if( n == 0 || b.bmin[m].y < node.min.y ) node.min.y = b.bmin[m].y;
+		if( n == 0 || b.bmax[m].y > node.max.y ) node.max.y = b.bmax[m].y;
+		scratch[n++] = m;
+	}
+	if( n == 0 && index > 0 )
+	{// empty area, same height as the parent
+		node.min.y = b.nodes[(index - 1)/4].min.y;
+		node.max.y = b.nodes[(index - 1)/4].max.y;
+	}
+	node.halfsize = (node.max - node.min)*0.5f;
+	node.center = (node.max + node.min)*0.5f;
+	if( level + 1 >= RSW::QuadTreeLevels )
+		return;
+	for( i = 0; i < 4; ++i )
+	{
+		QuadTreeNode& child = b.nodes[4*index + 1 + i];
+		child.min.x = (i&1) ? node.center.x : node.min.x;
+		child.max.x = (i&1) ? node.max.x : node.center.x;
+		child.min.z = (i&2) ? node.center.z : node.min.z;
+		child.max.z = (i&2) ? node.max.z : node.center.z;
+		buildNode(b, level + 1, 4*index + 1 + i, scratch, n, scratch + b.stride);
+	}
+}
+
+/// One level 1 subtree, the subtrees write disjoint nodes
+class QuadTreeWorker : public FXThread
+{
+public:
+	const QuadTreeBuild* build;
+	FXint index;
+	const FXint* list;
+	FXint count;
+	FXint* scratch;
+
+	virtual FXint run()
+	{
+		buildNode(*build, 1, index, list, count, scratch);
+		return 0;
+	}
+};
+
+/// Box of a model instance: scale, rotation y, x, z (degrees) then position
+static void instanceBounds(const ModelObject& obj, const FXVec3f& min, const FXVec3f& max, FXVec3f& bmin, FXVec3f& bmax)
+{
+	const FXfloat rad = 3.14159265358979f/180.0f;
+	RSMMatrix m, r;
+	m.scaling(FXVec3f(obj.scale_x, obj.scale_y, obj.scale_z));
+	r.rotation(obj.rot_y*rad, FXVec3f(0.0f, 1.0f, 0.0f));
+	m = RSMMatrix::multiply(m, r);
+	r.rotation(obj.rot_x*rad, FXVec3f(1.0f, 0.0f, 0.0f));
+	m = RSMMatrix::multiply(m, r);
+	r.rotation(obj.rot_z*rad, FXVec3f(0.0f, 0.0f, 1.0f));
+	m = RSMMatrix::multiply(m, r);
+	r.translation(FXVec3f(obj.pos_x, obj.pos_y, obj.pos_z));
+	m = RSMMatrix::multiply(m, r);
+	bmin = bmax = m.transform(min);
+	RSMGrowBox(bmin, bmax, min, max, m);
+}
+
+bool NRSW::RSWBuildQuadTree(RSW& rsw, RSMCache& models)
+{
+	const FXint count = rsw.model_count;
+	FXint i;
+
+	// model boxes, read in this thread before the workers start
+	FXVec3f* bmin;
+	FXint* list;
+	if( !fxmalloc((void**)&bmin, 2*count*sizeof(FXVec3f) + 1) )
+	{
+		fxwarning("RSW out of memory for the quadtree\n");
+		return false;
+	}
+	FXVec3f* bmax = bmin + count;
+	// the root list, then 4 threads with a list per level below the root
+	const FXint lists = 1 + 4*(RSW::QuadTreeLevels - 1);
+	if( !fxmalloc((void**)&list, lists*count*sizeof(FXint) + 1) )
+	{
+		fxfree((void**)&bmin);
+		fxwarning("RSW out of memory for the quadtree\n");
+		return false;
+	}
+	for( i = 0; i < count; ++i )
+	{
+		const ModelObject& obj = rsw.models[i];
+		FXchar filename[sizeof(obj.filename) + 1];
+		FXVec3f min, max;
+		memcpy(filename, obj.filename, sizeof(obj.filename));
+		filename[sizeof(obj.filename)] = 0;
+		const RSM* rsm = models.get(filename);
+		if( rsm )
+		{
+			min = rsm->min;
+			max = rsm->max;
+		}
+		else// the cache warns once per model, the box is the position
+			min = max = FXVec3f(0.0f, 0.0f, 0.0f);
+		instanceBounds(obj, min, max, bmin[i], bmax[i]);
+		list[i] = i;
+	}
+
+	if( rsw.quadtree == NULL && !fxmalloc((void**)&rsw.quadtree, RSW::QuadTreeNodeCount*sizeof(QuadTreeNode)) )
+	{
+		fxfree((void**)&list);
+		fxfree((void**)&bmin);
+		fxwarning("RSW out of memory for the quadtree\n");
+		return false;
+	}
+
+	// root, the ground area grown by the models
+	QuadTreeNode& root = rsw.quadtree[0];
+	root.min = FXVec3f((FXfloat)rsw.unk6, 0.0f, (FXfloat)rsw.unk4);// left, top
+	root.max = FXVec3f((FXfloat)rsw.unk7, 0.0f, (FXfloat)rsw.unk5);// right, bottom
+	for( i = 0; i < count; ++i )
+	{
+		if( bmin[i].x < root.min.x ) root.min.x = bmin[i].x;
+		if( bmin[i].z < root.min.z ) root.min.z = bmin[i].z;
+		if( bmax[i].x > root.max.x ) root.max.x = bmax[i].x;
+		if( bmax[i].z > root.max.z ) root.max.z = bmax[i].z;
+	}
+	QuadTreeBuild b;
+	b.nodes = rsw.quadtree;
+	b.bmin = bmin;
+	b.bmax = bmax;
+	b.stride = count;
+	// the root alone first, so the subtrees can inherit its height
+	for( i = 0; i < count; ++i )
+	{
+		if( i == 0 || bmin[i].y < root.min.y ) root.min.y = bmin[i].y;
+		if( i == 0 || bmax[i].y > root.max.y ) root.max.y = bmax[i].y;
+	}
+	root.halfsize = (root.max - root.min)*0.5f;
+	root.center = (root.max + root.min)*0.5f;
+
+	// the 4 level 1 subtrees in parallel
+	QuadTreeWorker workers[4];
+	bool started[4];
+	for( i = 0; i < 4; ++i )
+	{
+		QuadTreeNode& child = rsw.quadtree[1 + i];
+		child.min.x = (i&1) ? root.center.x : root.min.x;
+		child.max.x = (i&1) ? root.max.x : root.center.x;
+		child.min.z = (i&2) ? root.center.z : root.min.z;
+		child.max.z = (i&2) ? root.max.z : root.center.z;
+		workers[i].build = &b;
+		workers[i].index = 1 + i;
+		workers[i].list = list;
+		workers[i].count = count;
+		workers[i].scratch = list + (1 + i*(RSW::QuadTreeLevels - 1))*count;
+		started[i] = workers[i].start();
+		if( !started[i] )
+			workers[i].run();
+	}
+	for( i = 0; i < 4; ++i )
+	{
+		if( started[i] )
+			workers[i].join();
+	}
+
+	fxfree((void**)&list);
+	fxfree((void**)&bmin);
+	rsw.buildIndex();
+	return true;
+}
+
+bool NRSW::RSWUpgradeQuadTree(RSW& rsw, RSMCache& models)
+{
+	if( !RSWBuildQuadTree(rsw, models) )
+		return false;
+	if( !rsw.IsCompatibleWith(2,1) )
+	{// RSW::load and the object loaders set the defaults of the fields
+	 // the old version does not have, they are written as they are
+		rsw.major_ver = 2;
+		rsw.minor_ver = 1;
+	}
+	return true;
+}
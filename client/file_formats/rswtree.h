@@ -0,0 +1,46 @@
+/*
+** 2003 March 25
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+** This file uses the fox toolkit library.
+**
+** Scene quadtree builder for RSW maps without one (version < 2.1) or with
+** a quadtree that no longer matches the models.
+** The nodes split x/z in 4 down to 6 levels, the y range of a node covers
+** the models that touch it. Models are boxed from their RSM in the rest
+** position and the instance scale, rotation and position, the models come
+** from the RSMCache of the caller.
+**
+** $Id$
+*/
+#ifndef _RSWTREE_H_
+#define _RSWTREE_H_
+
+#include "fx.h"
+#include "FXVec3f.h"
+#include "rsw.h"
+#include "rsm.h"
+
+//-----------------------------------------------------------------------------
+namespace NRSW {
+//-----------------------------------------------------------------------------
+
+/// Compute the quadtree of a RSW from its models and rebuild the object index.
+/// child i of a node has the upper half of x when bit 0 is set and of z when bit 1 is set
+bool RSWBuildQuadTree(RSW& rsw, NRSM::RSMCache& models);
+
+/// Compute the quadtree and raise the version to 2.1 so RSW::save writes it
+bool RSWUpgradeQuadTree(RSW& rsw, NRSM::RSMCache& models);
+
+//-----------------------------------------------------------------------------
+}// namespace NRSW
+//-----------------------------------------------------------------------------
+
+#endif // _RSWTREE_H_
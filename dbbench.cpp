@@ -0,0 +1,462 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// dbbench - replays synthetic server workloads against a database backend
+// and reports throughput and latency percentiles.
+//
+// usage: dbbench [-e mem|kvmem|kv|sql] [-c configfile] [-a accounts] [-n ops]
+//                [-w workload[,workload...]] [-s seed]
+//
+// workloads:
+//   login      account lookup by name and save, like a login storm
+//   charselect char server account with all its chars
+//   autosave   save of every char, like the periodic save wave
+//   guildwar   guild lookup and save with castle updates
+//   mail       broadcast to all chars followed by inbox reads
+//
+// engines:
+//   mem        plain in-memory tables (basemem.h), the baseline
+//   kvmem      embedded databases on a store without file, the encoding
+//              cost without the disk
+//   kv         embedded databases
+//   sql        mysql databases
+//
+// the databases are filled with <accounts> accounts with 3 chars each and
+// one guild per 20 accounts. for kv and sql use a separate config with an
+// empty test database, the data is left behind.
+
+#include "basesq.h"
+#include "basekv.h"
+#include "basemem.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// helpers
+
+/// microsecond clock
+static uint64 bench_clock()
+{
+#ifdef WIN32
+	static LARGE_INTEGER freq = {{0,0}};
+	LARGE_INTEGER now;
+	if( !freq.QuadPart )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec*1000000 + tv.tv_usec;
+#endif
+}
+
+/// reproducible random numbers
+static uint32 bench_seed = 1;
+static uint32 bench_rand(uint32 range)
+{
+	bench_seed = bench_seed*1103515245 + 12345;
+	return range ? (bench_seed>>8) % range : 0;
+}
+
+static int bench_cmp(const void* a, const void* b)
+{
+	const uint32 x = *(const uint32*)a, y = *(const uint32*)b;
+	return (x<y) ? -1 : (x>y);
+}
+
+/// latencies of one workload
+class CBenchResult
+{
+	uint32*	lat;
+	size_t	cnt;
+	size_t	cap;
+	size_t	failed;
+	uint64	start;
+	uint64	total;
+
+	CBenchResult(const CBenchResult&);
+	const CBenchResult& operator=(const CBenchResult&);
+public:
+	CBenchResult() : lat(NULL), cnt(0), cap(0), failed(0), start(0), total(0)
+	{}
+	~CBenchResult()
+	{
+		if(lat) delete[] lat;
+	}
+	/// start of the timed section
+	void begin()	{ this->start = bench_clock(); }
+	/// takes untimed work of us microseconds out of the total
+	void exclude(uint64 us)	{ this->start += us; }
+	/// end of the timed section, for work after the last operation
+	void finish()	{ this->total = bench_clock() - this->start; }
+	/// end of one operation started at t
+	void done(uint64 t, bool ok)
+	{
+		const uint64 now = bench_clock();
+		if( this->cnt >= this->cap )
+		{
+			this->cap = this->cap ? this->cap*2 : 4096;
+			uint32* tmp = new uint32[this->cap];
+			if( this->lat )
+			{
+				memcpy(tmp, this->lat, this->cnt*sizeof(uint32));
+				delete[] this->lat;
+			}
+			this->lat = tmp;
+		}
+		this->lat[this->cnt++] = (uint32)(now-t);
+		if( !ok )
+			++this->failed;
+		this->total = now - this->start;
+	}
+	uint32 percentile(double p) const
+	{
+		if( !this->cnt )
+			return 0;
+		size_t i = (size_t)(p*this->cnt);
+		return this->lat[(i<this->cnt)?i:this->cnt-1];
+	}
+	void report(const char* name)
+	{
+		qsort(this->lat, this->cnt, sizeof(uint32), bench_cmp);
+		const double sec = this->total ? this->total/1000000.0 : 1e-6;
+		printf("%-10s %8lu ops %10.0f ops/s   p50 %6lu  p90 %6lu  p99 %6lu  max %7lu us%s",
+			name, (ulong)this->cnt, this->cnt/sec,
+			(ulong)this->percentile(0.50), (ulong)this->percentile(0.90),
+			(ulong)this->percentile(0.99), (ulong)this->percentile(1.0),
+			this->failed ? "" : "\n");
+		if( this->failed )
+			printf("  (%lu failed)\n", (ulong)this->failed);
+	}
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// backend
+struct bench_db
+{
+	CAccountDBInterface*	account;
+	CCharDBInterface*		chars;
+	CGuildDBInterface*		guild;
+#if defined(WITH_MYSQL)
+	CCharDB_sql*			chars_sql;	///< set with the sql engine, for flushing the queued saves
+#endif
+
+	bench_db() : account(NULL), chars(NULL), guild(NULL)
+#if defined(WITH_MYSQL)
+		, chars_sql(NULL)
+#endif
+	{}
+	~bench_db()
+	{
+		if(account) delete account;
+		if(chars) delete chars;
+		if(guild) delete guild;
+	}
+	bool create(const char* engine, const char* configfile)
+	{
+		if( 0==strcmp(engine, "mem") )
+		{
+			this->account = new CAccountDB_mem(configfile);
+			this->chars   = new CCharDB_mem(configfile);
+			this->guild   = new CGuildDB_mem(configfile);
+		}
+		else if( 0==strcmp(engine, "kvmem") )
+		{
+			this->account = new CAccountDB_kv(configfile, true);
+			this->chars   = new CCharDB_kv(configfile, true);
+			this->guild   = new CGuildDB_kv(configfile, true);
+		}
+		else if( 0==strcmp(engine, "kv") )
+		{
+			this->account = new CAccountDB_kv(configfile);
+			this->chars   = new CCharDB_kv(configfile);
+			this->guild   = new CGuildDB_kv(configfile);
+		}
+#if defined(WITH_MYSQL)
+		else if( 0==strcmp(engine, "sql") )
+		{
+			this->account = new CAccountDB_sql(configfile);
+			this->chars   = this->chars_sql = new CCharDB_sql(configfile);
+			this->guild   = new CGuildDB_sql(configfile);
+		}
+#endif
+		else
+		{
+			ShowError("unknown database engine '%s'\n", engine);
+			return false;
+		}
+		return true;
+	}
+};
+
+/// ids of the test data
+static uint32* bench_acc = NULL;
+static uint32* bench_char = NULL;
+static uint32* bench_guild = NULL;
+static size_t bench_acc_cnt = 0, bench_char_cnt = 0, bench_guild_cnt = 0;
+
+static bool bench_fill(bench_db& db, size_t accounts)
+{
+	size_t i, k;
+	char name[32];
+	const uint64 t = bench_clock();
+
+	bench_acc = new uint32[accounts];
+	bench_char = new uint32[accounts*3];
+	bench_guild = new uint32[accounts/20+1];
+
+	for(i=0; i<accounts; ++i)
+	{
+		CLoginAccount account;
+		snprintf(name, sizeof(name), "bench%lu", (ulong)i);
+		if( !db.account->searchAccount(name, account) &&
+			!db.account->insertAccount(name, "bench", (i&1)?'M':'F', "a@a.com", account) )
+			return false;
+		bench_acc[bench_acc_cnt++] = account.account_id;
+
+		CCharCharAccount ca;
+		ca.account_id = account.account_id;
+		ca.sex = account.sex;
+		db.chars->saveAccount(ca);
+		for(k=0; k<3; ++k)
+		{
+			CCharCharacter p;
+			snprintf(name, sizeof(name), "bench%lu_%lu", (ulong)i, (ulong)k);
+			if( !db.chars->searchChar(name, p) &&
+				!db.chars->insertChar(ca, name, 5,5,5,5,5,5, k, 1, 1, p) )
+				return false;
+			bench_char[bench_char_cnt++] = p.char_id;
+		}
+		if( 0==i%20 )
+		{
+			CGuild g;
+			guild_member m;
+			memset(&m, 0, sizeof(m));
+			m.account_id = account.account_id;
+			m.char_id = bench_char[bench_char_cnt-3];
+			m.lv = 1;
+			snprintf(m.name, sizeof(m.name), "bench%lu_0", (ulong)i);
+			snprintf(name, sizeof(name), "benchguild%lu", (ulong)i/20);
+			if( !db.guild->searchGuild(name, g) &&
+				!db.guild->insertGuild(m, name, g) )
+				return false;
+			bench_guild[bench_guild_cnt++] = g.guild_id;
+		}
+	}
+	ShowInfo("filled %lu accounts, %lu chars, %lu guilds in %lu ms\n",
+		(ulong)bench_acc_cnt, (ulong)bench_char_cnt, (ulong)bench_guild_cnt, (ulong)((bench_clock()-t)/1000));
+	return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// workloads
+static void bench_login(bench_db& db, size_t ops)
+{
+	CBenchResult res;
+	CLoginAccount account;
+	char name[32];
+	size_t i;
+	res.begin();
+	for(i=0; i<ops; ++i)
+	{
+		snprintf(name, sizeof(name), "bench%lu", (ulong)bench_rand(bench_acc_cnt));
+		const uint64 t = bench_clock();
+		bool ok = db.account->searchAccount(name, account);
+		if( ok )
+		{
+			++account.login_count;
+			ok = db.account->saveAccount(account);
+		}
+		res.done(t, ok);
+	}
+	res.report("login");
+}
+
+static void bench_charselect(bench_db& db, size_t ops)
+{
+	CBenchResult res;
+	CCharCharAccount ca;
+	CCharCharacter p;
+	size_t i, k;
+	res.begin();
+	for(i=0; i<ops; ++i)
+	{
+		const uint64 t = bench_clock();
+		bool ok = db.chars->searchAccount(bench_acc[bench_rand(bench_acc_cnt)], ca);
+		for(k=0; ok && k<9; ++k)
+		{
+			if( ca.charlist[k] )
+				ok = db.chars->searchChar(ca.charlist[k], p);
+		}
+		res.done(t, ok);
+	}
+	res.report("charselect");
+}
+
+static void bench_autosave(bench_db& db, size_t ops)
+{
+	CBenchResult res;
+	CCharCharacter p;
+	size_t i;
+	res.begin();
+	for(i=0; i<ops; ++i)
+	{
+		const uint32 char_id = bench_char[i%bench_char_cnt];
+		// only the save is timed
+		const uint64 s = bench_clock();
+		const bool found = db.chars->searchChar(char_id, p);
+		res.exclude(bench_clock()-s);
+		if( !found )
+			continue;
+		p.zeny += 1;
+		p.base_exp += 10;
+		p.inventory[i%MAX_INVENTORY].nameid = 501;
+		p.inventory[i%MAX_INVENTORY].amount = 1 + i%30;
+		const uint64 t = bench_clock();
+		res.done(t, db.chars->saveChar(p));
+	}
+#if defined(WITH_MYSQL)
+	if( db.chars_sql )
+	{	// sql only queues the saves, the latencies are the enqueue,
+		// the throughput includes writing out the queue
+		db.chars_sql->flushSaves(true);
+	}
+#endif
+	res.finish();
+	res.report("autosave");
+}
+
+static void bench_guildwar(bench_db& db, size_t ops)
+{
+	CBenchResult res;
+	CGuild g;
+	CCastle c;
+	size_t i;
+	res.begin();
+	for(i=0; i<ops; ++i)
+	{
+		const uint64 t = bench_clock();
+		bool ok = db.guild->searchGuild(bench_guild[bench_rand(bench_guild_cnt)], g);
+		if( ok )
+		{
+			g.exp += 100;
+			g.member[0].exp += 100;
+			g.save_flags |= GUILD_SAFE_GUILD|GUILD_SAFE_MEMBER;
+			ok = db.guild->saveGuild(g);
+		}
+		if( ok && 0==i%8 )
+		{	// castle changes hands
+			const ushort castle_id = bench_rand(MAX_GUILDCASTLE);
+			ok = db.guild->searchCastle(castle_id, c);
+			if( ok )
+			{
+				c.guild_id = g.guild_id;
+				c.defense += 1;
+				ok = db.guild->saveCastle(c);
+			}
+		}
+		res.done(t, ok);
+	}
+	res.report("guildwar");
+}
+
+static void bench_mail(bench_db& db, size_t ops)
+{
+	CBenchResult send, read;
+	struct item it;
+	uint32 msgid, tid, all, unread;
+	unsigned char *buffer = new unsigned char[64*1024];
+	size_t i;
+	memset(&it, 0, sizeof(it));
+
+	send.begin();
+	for(i=0; i<4; ++i)
+	{
+		const uint64 t = bench_clock();
+		send.done(t, db.chars->sendMail(bench_char[0], "bench0_0", "*", "broadcast", "benchmark mail", 0, it, msgid, tid));
+	}
+	send.report("mail send");
+
+	read.begin();
+	for(i=0; i<ops; ++i)
+	{
+		const uint32 char_id = bench_char[bench_rand(bench_char_cnt)];
+		const uint64 t = bench_clock();
+		const size_t cnt = db.chars->getMailCount(char_id, all, unread);
+		const size_t listed = db.chars->listMail(char_id, 0, buffer);
+		// every char but the sender got the broadcasts
+		read.done(t, cnt==all && unread<=all && listed==all && (char_id==bench_char[0] || all>=4));
+	}
+	read.report("mail read");
+	delete[] buffer;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	const char* engine = "mem";
+	const char* configfile = NULL;
+	const char* workloads = "login,charselect,autosave,guildwar,mail";
+	size_t accounts = 1000, ops = 10000;
+	int i;
+
+	for(i=1; i<argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* val = (i+1<argc) ? argv[i+1] : NULL;
+		if( arg[0]!='-' || !val )
+		{
+			printf("usage: %s [-e mem|kvmem|kv|sql] [-c configfile] [-a accounts] [-n ops] [-w workload,...] [-s seed]\n", argv[0]);
+			return 1;
+		}
+		switch( arg[1] )
+		{
+		case 'e': engine = val; break;
+		case 'c': configfile = val; break;
+		case 'a': accounts = strtoul(val, NULL, 10); break;
+		case 'n': ops = strtoul(val, NULL, 10); break;
+		case 'w': workloads = val; break;
+		case 's': bench_seed = strtoul(val, NULL, 10); break;
+		}
+		++i;
+	}
+	if( !accounts ) accounts = 1;
+
+	bench_db db;
+	if( !db.create(engine, configfile) || !bench_fill(db, accounts) )
+	{
+		ShowError("cannot set up the '%s' databases\n", engine);
+		return 1;
+	}
+	printf("engine %s, %lu accounts, %lu ops per workload\n", engine, (ulong)accounts, (ulong)ops);
+
+	const char* w = workloads;
+	while( *w )
+	{
+		const char* end = strchr(w, ',');
+		const size_t len = end ? (size_t)(end-w) : strlen(w);
+		if(      len==5  && 0==strncmp(w, "login", len) )		bench_login(db, ops);
+		else if( len==10 && 0==strncmp(w, "charselect", len) )	bench_charselect(db, ops);
+		else if( len==8  && 0==strncmp(w, "autosave", len) )	bench_autosave(db, ops);
+		else if( len==8  && 0==strncmp(w, "guildwar", len) )	bench_guildwar(db, ops);
+		else if( len==4  && 0==strncmp(w, "mail", len) )		bench_mail(db, ops);
+		else
+			ShowWarning("unknown workload '%.*s'\n", (int)len, w);
+		w += len;
+		if( *w ) ++w;
+	}
+
+	delete[] bench_acc;
+	delete[] bench_char;
+	delete[] bench_guild;
+	return 0;
+}